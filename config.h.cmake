@@ -40,6 +40,8 @@
 #cmakedefine HAVE_GTHREAD
 #cmakedefine HAVE_GTHREAD_H
 #cmakedefine HAVE_OPENSSL
+#cmakedefine HAVE_ZSTD
+#cmakedefine HAVE_LIBURING
 #define SIZEOF_RLIM_T @SIZEOF_RLIM_T@
 
 #cmakedefine SIMPLE_PARSER 1
@@ -0,0 +1,183 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#include "sql-arena.h"
+
+#include <string.h>
+
+#define SQL_ARENA_BLOCK_SIZE 8192
+#define SQL_ARENA_ALIGN 8
+
+typedef struct sql_arena_block_t {
+    struct sql_arena_block_t *next;
+    gsize size;
+    gsize used;
+    char data[];
+} sql_arena_block_t;
+
+struct sql_arena_t {
+    sql_arena_block_t *blocks;  /* newest first */
+    GHashTable *lists;          /* node lists taken while active, no free func */
+};
+
+/* every node is preceded by its owner, so that freeing needs no lookup */
+typedef union sql_node_header_t {
+    sql_arena_t *arena;         /* NULL for a heap node */
+    gint64 align;
+} sql_node_header_t;
+
+#define NODE_HEADER(p) ((sql_node_header_t *)(p) - 1)
+
+/* arena of the thread, admin and monitor threads parse too */
+static GPrivate active_arena = G_PRIVATE_INIT(NULL);
+
+static sql_arena_block_t *
+arena_block_new(gsize size)
+{
+    sql_arena_block_t *block = g_malloc(sizeof(sql_arena_block_t) + size);
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    return block;
+}
+
+sql_arena_t *
+sql_arena_new()
+{
+    sql_arena_t *arena = g_new0(sql_arena_t, 1);
+    arena->blocks = arena_block_new(SQL_ARENA_BLOCK_SIZE);
+    arena->lists = g_hash_table_new(g_direct_hash, g_direct_equal);
+    return arena;
+}
+
+void
+sql_arena_free(sql_arena_t *arena)
+{
+    if (!arena)
+        return;
+    if (g_private_get(&active_arena) == arena) {
+        g_private_set(&active_arena, NULL);
+    }
+    sql_arena_reset(arena);
+    g_free(arena->blocks);
+    g_hash_table_destroy(arena->lists);
+    g_free(arena);
+}
+
+/* keep the first block for the next query, it is enough for most of them */
+void
+sql_arena_reset(sql_arena_t *arena)
+{
+    GHashTableIter iter;
+    gpointer list;
+    g_hash_table_iter_init(&iter, arena->lists);
+    while (g_hash_table_iter_next(&iter, &list, NULL)) {
+        g_ptr_array_free(list, TRUE);
+    }
+    g_hash_table_remove_all(arena->lists);
+
+    sql_arena_block_t *block = arena->blocks;
+    while (block->next) {
+        sql_arena_block_t *next = block->next;
+        g_free(block);
+        block = next;
+    }
+    block->used = 0;
+    arena->blocks = block;
+}
+
+sql_arena_t *
+sql_arena_activate(sql_arena_t *arena)
+{
+    sql_arena_t *prev = g_private_get(&active_arena);
+    g_private_set(&active_arena, arena);
+    return prev;
+}
+
+gboolean
+sql_node_in_arena(const void *p)
+{
+    return p && NODE_HEADER(p)->arena != NULL;
+}
+
+static void *
+arena_alloc0(sql_arena_t *arena, gsize size)
+{
+    size = (size + SQL_ARENA_ALIGN - 1) & ~(gsize)(SQL_ARENA_ALIGN - 1);
+    sql_arena_block_t *block = arena->blocks;
+    if (block->used + size > block->size) {
+        /* pushed at head, the first block stays last to be kept on reset */
+        block = arena_block_new(MAX(size, SQL_ARENA_BLOCK_SIZE));
+        block->next = arena->blocks;
+        arena->blocks = block;
+    }
+    void *p = block->data + block->used;
+    block->used += size;
+    memset(p, 0, size);
+    return p;
+}
+
+void *
+sql_node_alloc0(gsize size)
+{
+    sql_arena_t *arena = g_private_get(&active_arena);
+    sql_node_header_t *header;
+    if (arena) {
+        header = arena_alloc0(arena, sizeof(sql_node_header_t) + size);
+    } else {
+        header = g_malloc0(sizeof(sql_node_header_t) + size);
+    }
+    header->arena = arena;
+    return header + 1;
+}
+
+void
+sql_node_free(void *p)
+{
+    if (!p)
+        return;
+    sql_node_header_t *header = NODE_HEADER(p);
+    if (header->arena)
+        return;
+    g_free(header);
+}
+
+GPtrArray *
+sql_node_list_new(GDestroyNotify free_func)
+{
+    sql_arena_t *arena = g_private_get(&active_arena);
+    if (arena) {
+        GPtrArray *list = g_ptr_array_new();
+        g_hash_table_add(arena->lists, list);
+        return list;
+    }
+    return g_ptr_array_new_with_free_func(free_func);
+}
+
+void
+sql_node_list_free(GPtrArray *list)
+{
+    if (!list)
+        return;
+    sql_arena_t *arena = g_private_get(&active_arena);
+    if (arena && g_hash_table_contains(arena->lists, list))
+        return;
+    g_ptr_array_free(list, TRUE);
+}
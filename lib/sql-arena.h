@@ -0,0 +1,62 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#ifndef SQL_ARENA_H
+#define SQL_ARENA_H
+
+#include <glib.h>
+
+/**
+ * Bump allocator for the AST of one query.
+ *
+ * While an arena is active, every AST node, token copy and node list is
+ * taken from it. Each node records the arena it came from, freeing an arena
+ * node is a no-op and doesn't walk its children; sql_arena_reset() then
+ * drops the whole tree at once.
+ *
+ * The arena is active per thread, sql_context_activate_arena() makes the
+ * arena of a context active around everything that builds or edits its AST
+ * (parse, sql rewriting). A node list of an arena must be freed while that
+ * arena is active, or not at all.
+ */
+typedef struct sql_arena_t sql_arena_t;
+
+sql_arena_t *sql_arena_new();
+
+void sql_arena_free(sql_arena_t *);
+
+void sql_arena_reset(sql_arena_t *);
+
+/* @return previously active arena of this thread, to be restored by caller */
+sql_arena_t *sql_arena_activate(sql_arena_t *);
+
+/* TRUE if the node is taken from an arena, it goes away with the arena */
+gboolean sql_node_in_arena(const void *p);
+
+/* allocators used by AST code, fall back to heap when no arena is active */
+void *sql_node_alloc0(gsize size);
+
+void sql_node_free(void *p);
+
+GPtrArray *sql_node_list_new(GDestroyNotify free_func);
+
+void sql_node_list_free(GPtrArray *list);
+
+#endif /* SQL_ARENA_H */
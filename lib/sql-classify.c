@@ -0,0 +1,303 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#include "sql-classify.h"
+
+#include <string.h>
+#include <strings.h>
+#include <glib.h>
+
+#include "sql-expression.h"
+#include "sql-operation.h"
+#include "sql-arena.h"
+#include "myparser.y.h"
+
+/* longest unsigned literal taken for SET, longer ones go to the parser */
+#define MAX_SET_DIGITS 18
+
+/* SQL keywords that make the parser do more than classifying */
+static const char *common_fallback_words[] = {
+    "LAST_INSERT_ID",           /* answered by proxy, or rejected in WHERE */
+    NULL
+};
+
+static const char *select_fallback_words[] = {
+    "LAST_INSERT_ID",
+    "CURRENT_DATE",             /* local query */
+    "CETUS_SEQUENCE",
+    "CETUS_VERSION",
+    "UPDATE",                   /* FOR UPDATE, a locking read goes to master */
+    "SHARE",                    /* LOCK IN SHARE MODE, FOR SHARE */
+    "LOCK",
+    "INTO",                     /* SELECT ... INTO @var */
+    NULL
+};
+
+static inline gboolean
+is_word_char(unsigned char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '$'
+        || c >= 0x80;
+}
+
+static inline gboolean
+is_space_char(unsigned char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v';
+}
+
+static const char *
+skip_space(const char *p, const char *end)
+{
+    while (p < end && is_space_char(*p)) {
+        ++p;
+    }
+    return p;
+}
+
+static int
+word_len(const char *p, const char *end)
+{
+    const char *s = p;
+    while (p < end && is_word_char(*p)) {
+        ++p;
+    }
+    return p - s;
+}
+
+static inline gboolean
+word_is(const char *p, int len, const char *word)
+{
+    return len == strlen(word) && strncasecmp(p, word, len) == 0;
+}
+
+static gboolean
+word_in(const char *p, int len, const char **words)
+{
+    int i;
+    for (i = 0; words[i]; ++i) {
+        if (word_is(p, len, words[i])) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/* nothing but blanks and an optional trailing semicolon */
+static gboolean
+is_stmt_end(const char *p, const char *end)
+{
+    p = skip_space(p, end);
+    if (p < end && *p == ';') {
+        p = skip_space(p + 1, end);
+    }
+    return p == end;
+}
+
+/* @return one char past the closing quote, NULL if not closed */
+static const char *
+skip_quoted(const char *p, const char *end)
+{
+    char quote = *p++;
+    while (p < end) {
+        if (*p == '\\' && quote != '`') {
+            p += 2;
+        } else if (*p == quote) {
+            if (p + 1 < end && p[1] == quote) { /* doubled quote */
+                p += 2;
+            } else {
+                return p + 1;
+            }
+        } else {
+            ++p;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Scan the statement body once, skipping literals.
+ * Gives up on comments (they may carry routing hints), multiple statements
+ * and the given keywords.
+ */
+static gboolean
+scan_body(const char *p, const char *end, const char **fallback_words, gboolean *calc_found_rows)
+{
+    while (p < end) {
+        unsigned char c = *p;
+        if (is_word_char(c)) {
+            int len = word_len(p, end);
+            if (word_in(p, len, fallback_words)) {
+                return FALSE;
+            }
+            if (calc_found_rows && word_is(p, len, "SQL_CALC_FOUND_ROWS")) {
+                *calc_found_rows = TRUE;
+            }
+            p += len;
+            continue;
+        }
+        switch (c) {
+        case '\'':
+        case '"':
+        case '`':
+            p = skip_quoted(p, end);
+            if (p == NULL) {
+                return FALSE;
+            }
+            break;
+        case '#':
+            return FALSE;
+        case '/':
+            if (p + 1 < end && p[1] == '*') {
+                return FALSE;
+            }
+            ++p;
+            break;
+        case '-':
+            if (p + 1 < end && p[1] == '-') {
+                return FALSE;
+            }
+            ++p;
+            break;
+        case ';':
+            return is_stmt_end(p, end);
+        default:
+            ++p;
+            break;
+        }
+    }
+    return TRUE;
+}
+
+/* SET autocommit = N */
+static gboolean
+classify_set(sql_context_t *context, const char *p, const char *end)
+{
+    p = skip_space(p, end);
+    int len = word_len(p, end);
+    if (!word_is(p, len, "AUTOCOMMIT")) {
+        return FALSE;
+    }
+    sql_token_t name = { p, len };
+    p = skip_space(p + len, end);
+    if (p == end || *p != '=') {
+        return FALSE;
+    }
+    p = skip_space(p + 1, end);
+    const char *digits = p;
+    while (p < end && *p >= '0' && *p <= '9') {
+        ++p;
+    }
+    if (p == digits || p - digits > MAX_SET_DIGITS || (p < end && is_word_char(*p)) || !is_stmt_end(p, end)) {
+        return FALSE;
+    }
+    sql_token_t value = { digits, p - digits };
+
+    sql_expr_t *left = sql_expr_new(TK_ID, &name);
+    left->var_scope = SCOPE_SESSION;
+    sql_expr_t *right = sql_expr_new(TK_INTEGER, &value);
+    sql_expr_t *eq = sql_expr_new(TK_EQ, NULL);
+    sql_expr_attach_subtrees(eq, left, right);
+    sql_set_variable(context, sql_expr_list_append(NULL, eq));
+    return TRUE;
+}
+
+static gboolean
+classify_stmt(sql_context_t *context, const char *word, int len, const char *p, const char *end)
+{
+    if (word_is(word, len, "SELECT")) {
+        gboolean calc_found_rows = FALSE;
+        if (!scan_body(p, end, select_fallback_words, &calc_found_rows)) {
+            return FALSE;
+        }
+        sql_select_t *select = sql_select_new();
+        if (calc_found_rows) {
+            select->flags |= SF_CALC_FOUND_ROWS;
+        }
+        sql_select(context, select);
+    } else if (word_is(word, len, "INSERT") || word_is(word, len, "REPLACE")) {
+        if (!scan_body(p, end, common_fallback_words, NULL)) {
+            return FALSE;
+        }
+        sql_insert(context, NULL);
+    } else if (word_is(word, len, "UPDATE")) {
+        if (!scan_body(p, end, common_fallback_words, NULL)) {
+            return FALSE;
+        }
+        sql_update(context, NULL);
+    } else if (word_is(word, len, "DELETE")) {
+        if (!scan_body(p, end, common_fallback_words, NULL)) {
+            return FALSE;
+        }
+        sql_delete(context, NULL);
+    } else if (word_is(word, len, "BEGIN")) {
+        if (!is_stmt_end(p, end)) {
+            return FALSE;
+        }
+        sql_start_transaction(context);
+    } else if (word_is(word, len, "START")) {
+        p = skip_space(p, end);
+        len = word_len(p, end);
+        if (!word_is(p, len, "TRANSACTION") || !is_stmt_end(p + len, end)) {
+            return FALSE;
+        }
+        sql_start_transaction(context);
+    } else if (word_is(word, len, "COMMIT")) {
+        if (!is_stmt_end(p, end)) {
+            return FALSE;
+        }
+        sql_commit_transaction(context);
+    } else if (word_is(word, len, "ROLLBACK")) {
+        if (!is_stmt_end(p, end)) {
+            return FALSE;
+        }
+        sql_rollback_transaction(context);
+    } else if (word_is(word, len, "SET")) {
+        if (!classify_set(context, p, end)) {
+            return FALSE;
+        }
+    } else {
+        return FALSE;
+    }
+    return TRUE;
+}
+
+gboolean
+sql_context_classify_len(sql_context_t *context, GString *sql)
+{
+    const char *p = sql->str;
+    const char *end = sql->str + strnlen(sql->str, sql->len);
+
+    p = skip_space(p, end);
+    int len = word_len(p, end);
+    if (len == 0) {
+        return FALSE;
+    }
+    const char *word = p;
+    p += len;
+
+    sql_context_reset(context);
+    context->stmt_count = 1;
+
+    sql_arena_t *prev_arena = sql_context_activate_arena(context);
+    gboolean classified = classify_stmt(context, word, len, p, end);
+    sql_arena_activate(prev_arena);
+    return classified;
+}
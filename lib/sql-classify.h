@@ -0,0 +1,40 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#ifndef SQL_CLASSIFY_H
+#define SQL_CLASSIFY_H
+
+#include "sql-context.h"
+
+/**
+ * Single pass classification of the most frequent statements, without
+ * building the full AST. Only meant for rw-split, where routing needs
+ * nothing but the statement class and a few keywords.
+ *
+ * On success the context is filled as the parser would do for routing:
+ * rc, stmt_type and rw_flag are set, SELECT gets an empty sql_select_t
+ * with only flags, INSERT/UPDATE/DELETE get no statement at all.
+ *
+ * @param sql same buffer as sql_context_parse_len()
+ * @return FALSE if not sure, the caller must do a full parse
+ */
+gboolean sql_context_classify_len(sql_context_t *, GString *sql);
+
+#endif /* SQL_CLASSIFY_H */
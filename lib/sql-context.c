@@ -22,6 +22,7 @@
 
 #include "mylexer.l.h"
 #include "sql-property.h"
+#include "sql-arena.h"
 
 void sqlParser(void *yyp, int yymajor, sql_token_t yyminor, sql_context_t *);
 void sqlParserFree(void *p, void (*freeProc) (void *));
@@ -35,22 +36,46 @@ sql_context_init(sql_context_t *p)
     memset(p, 0, sizeof(sql_context_t));
 }
 
-void
-sql_context_destroy(sql_context_t *p)
+static void
+sql_context_clear(sql_context_t *p)
 {
-    if (p->sql_statement)
+    /* a tree built in the arena goes away with it, freeing it is a no-op */
+    if (p->sql_statement) {
+        sql_arena_t *prev_arena = sql_arena_activate(p->arena);
         sql_statement_free(p->sql_statement, p->stmt_type);
+        sql_arena_activate(prev_arena);
+    }
+    if (p->arena)
+        sql_arena_reset(p->arena);
     if (p->message)
         g_free(p->message);
     if (p->property)
         sql_property_free(p->property);
 }
 
+void
+sql_context_destroy(sql_context_t *p)
+{
+    sql_context_clear(p);
+    if (p->arena)
+        sql_arena_free(p->arena);
+}
+
 void
 sql_context_reset(sql_context_t *p)
 {
-    sql_context_destroy(p);
+    sql_arena_t *arena = p->arena;
+    sql_context_clear(p);
     sql_context_init(p);
+    p->arena = arena;
+}
+
+sql_arena_t *
+sql_context_activate_arena(sql_context_t *p)
+{
+    if (p->arena == NULL)
+        p->arena = sql_arena_new();
+    return sql_arena_activate(p->arena);
 }
 
 void
@@ -155,8 +180,9 @@ sql_context_parse_len(sql_context_t *context, GString *sql)
 
     void *parser = sqlParserAlloc(malloc);
     sql_context_reset(context);
+    sql_arena_t *prev_arena = sql_context_activate_arena(context);
 
-    static sql_property_parser_t comment_parser;
+    sql_property_parser_t comment_parser;
     sql_property_parser_reset(&comment_parser);
 
     int code;
@@ -185,7 +211,8 @@ sql_context_parse_len(sql_context_t *context, GString *sql)
         }
         sqlParser(parser, 0, token, context);
     }
-    sqlParserFree(parser, free);
+    sqlParserFree(parser, free);  /* may run destructors on arena nodes */
+    sql_arena_activate(prev_arena);
     yy_delete_buffer(buf_state, scanner);
     yylex_destroy(scanner);
 }
@@ -41,6 +41,7 @@ enum sql_parsing_place_t {
 };
 
 struct sql_property_t;
+struct sql_arena_t;
 
 typedef struct sql_context_t {
     enum sql_parse_state_code_t rc;
@@ -57,12 +58,17 @@ typedef struct sql_context_t {
     enum sql_parsing_place_t parsing_place;
 
     struct sql_property_t *property;
+    struct sql_arena_t *arena;  /* AST of current query, kept across resets */
 } sql_context_t;
 
 void sql_context_init(sql_context_t *);
 
 void sql_context_reset(sql_context_t *);
 
+/* AST built or edited after this comes from the context's arena,
+ * @return previous arena, to be activated back when done */
+struct sql_arena_t *sql_context_activate_arena(sql_context_t *);
+
 void sql_context_destroy(sql_context_t *);
 
 void sql_context_append_msg(sql_context_t *, char *msg);
@@ -29,13 +29,14 @@
 #include <glib.h>
 
 #include "myparser.y.h"
+#include "sql-arena.h"
 
 char *
 sql_token_dup(sql_token_t token)
 {
     if (token.n == 0)
         return NULL;
-    char *s = g_malloc0(token.n + 1);
+    char *s = sql_node_alloc0(token.n + 1);
     memcpy(s, token.z, token.n);
     sql_string_dequote(s);
     return s;
@@ -109,7 +110,7 @@ sql_expr_new(int op, const sql_token_t *token)
     if (token && op != TK_INTEGER) {
         extra = token->n + 1;
     }
-    sql_expr_t *expr = g_malloc0(sizeof(sql_expr_t) + extra);
+    sql_expr_t *expr = sql_node_alloc0(sizeof(sql_expr_t) + extra);
     if (expr) {
         expr->op = op;
         if (token) {
@@ -145,7 +146,7 @@ sql_expr_dup(const sql_expr_t *p)
         extra = strlen(p->token_text) + 1;
     }
     int size = sizeof(sql_expr_t) + extra;
-    sql_expr_t *expr = g_malloc0(size);
+    sql_expr_t *expr = sql_node_alloc0(size);
     if (expr) {
         memcpy(expr, p, size);
         if (p->op == TK_DOT) {
@@ -200,22 +201,23 @@ sql_expr_attach_subtrees(sql_expr_t *root, sql_expr_t *left, sql_expr_t *right)
     }
 }
 
+/* a tree taken from an arena goes away with the arena, it is not walked */
 void
 sql_expr_free(void *p)
 {
-    if (p) {
+    if (p && !sql_node_in_arena(p)) {
         sql_expr_t *exp = (sql_expr_t *)p;
         if (exp->left)
             sql_expr_free(exp->left);
         if (exp->right)
             sql_expr_free(exp->right);
         if (exp->list)
-            g_ptr_array_free(exp->list, TRUE);
+            sql_node_list_free(exp->list);
         if (exp->select)
             sql_select_free(exp->select);
         if (exp->alias)
-            g_free(exp->alias);
-        g_free(exp);
+            sql_node_free(exp->alias);
+        sql_node_free(exp);
     }
 }
 
@@ -368,7 +370,7 @@ sql_expr_list_append(sql_expr_list_t *list, sql_expr_t *expr)
     if (expr == NULL)
         return list;
     if (list == NULL) {
-        list = g_ptr_array_new_with_free_func(sql_expr_free);
+        list = sql_node_list_new(sql_expr_free);
     }
     g_ptr_array_add(list, expr);
     return list;
@@ -447,7 +449,7 @@ void
 sql_expr_list_free(sql_expr_list_t *list)
 {
     if (list)
-        g_ptr_array_free(list, TRUE);
+        sql_node_list_free(list);
 }
 
 enum sql_func_type_t
@@ -470,22 +472,22 @@ sql_func_type(const char *s)
 sql_column_t *
 sql_column_new()
 {
-    return g_new0(struct sql_column_t, 1);
+    return sql_node_alloc0(sizeof(struct sql_column_t));
 }
 
 void
 sql_column_free(void *p)
 {
-    if (!p)
+    if (!p || sql_node_in_arena(p))
         return;
     sql_column_t *col = (sql_column_t *)p;
     if (col->expr)
         sql_expr_free(col->expr);
     if (col->alias)
-        g_free(col->alias);
+        sql_node_free(col->alias);
     if (col->type)
-        g_free(col->type);
-    g_free(col);
+        sql_node_free(col->type);
+    sql_node_free(col);
 }
 
 sql_column_list_t *
@@ -494,7 +496,7 @@ sql_column_list_append(sql_column_list_t *list, sql_column_t *col)
     if (col == NULL)
         return list;
     if (list == NULL) {
-        list = g_ptr_array_new_with_free_func(sql_column_free);
+        list = sql_node_list_new(sql_column_free);
     }
     g_ptr_array_add(list, col);
     return list;
@@ -504,20 +506,20 @@ void
 sql_column_list_free(sql_column_list_t *list)
 {
     if (list)
-        g_ptr_array_free(list, TRUE);
+        sql_node_list_free(list);
 }
 
 sql_select_t *
 sql_select_new()
 {
-    sql_select_t *p = g_new0(sql_select_t, 1);
+    sql_select_t *p = sql_node_alloc0(sizeof(sql_select_t));
     return p;
 }
 
 void
 sql_select_free(sql_select_t *p)
 {
-    if (!p)
+    if (!p || sql_node_in_arena(p))
         return;
     if (p->columns)             /* The fields of the result */
         sql_expr_list_free(p->columns);
@@ -538,20 +540,20 @@ sql_select_free(sql_select_t *p)
         sql_expr_free(p->limit);
     if (p->offset)              /* OFFSET expression. NULL means not used. */
         sql_expr_free(p->offset);
-    g_free(p);
+    sql_node_free(p);
 }
 
 sql_delete_t *
 sql_delete_new()
 {
-    sql_delete_t *p = g_new0(sql_delete_t, 1);
+    sql_delete_t *p = sql_node_alloc0(sizeof(sql_delete_t));
     return p;
 }
 
 void
 sql_delete_free(sql_delete_t *p)
 {
-    if (!p)
+    if (!p || sql_node_in_arena(p))
         return;
     if (p->from_src)            /* The FROM clause */
         sql_src_list_free(p->from_src);
@@ -563,20 +565,20 @@ sql_delete_free(sql_delete_t *p)
         sql_expr_free(p->limit);
     if (p->offset)              /* OFFSET expression. NULL means not used. */
         sql_expr_free(p->offset);
-    g_free(p);
+    sql_node_free(p);
 }
 
 sql_update_t *
 sql_update_new()
 {
-    sql_update_t *p = g_new0(sql_update_t, 1);
+    sql_update_t *p = sql_node_alloc0(sizeof(sql_update_t));
     return p;
 }
 
 void
 sql_update_free(sql_update_t *p)
 {
-    if (!p)
+    if (!p || sql_node_in_arena(p))
         return;
     if (p->table)
         sql_src_list_free(p->table);
@@ -590,20 +592,20 @@ sql_update_free(sql_update_t *p)
         sql_expr_free(p->limit);
     if (p->offset)              /* OFFSET expression. NULL means not used. */
         sql_expr_free(p->offset);
-    g_free(p);
+    sql_node_free(p);
 }
 
 sql_insert_t *
 sql_insert_new()
 {
-    sql_insert_t *p = g_new0(sql_insert_t, 1);
+    sql_insert_t *p = sql_node_alloc0(sizeof(sql_insert_t));
     return p;
 }
 
 void
 sql_insert_free(sql_insert_t *p)
 {
-    if (!p)
+    if (!p || sql_node_in_arena(p))
         return;
     if (p->table)
         sql_src_list_free(p->table);
@@ -611,21 +613,21 @@ sql_insert_free(sql_insert_t *p)
         sql_select_free(p->sel_val);
     if (p->columns)
         sql_id_list_free(p->columns);
-    g_free(p);
+    sql_node_free(p);
 }
 
 void
 sql_src_item_free(void *p)
 {
-    if (!p)
+    if (!p || sql_node_in_arena(p))
         return;
     struct sql_src_item_t *item = (struct sql_src_item_t *)p;
     if (item->table_name)
-        g_free(item->table_name);
+        sql_node_free(item->table_name);
     if (item->table_alias)
-        g_free(item->table_alias);
+        sql_node_free(item->table_alias);
     if (item->dbname)
-        g_free(item->dbname);
+        sql_node_free(item->dbname);
     if (item->select)
         sql_select_free(item->select);
     if (item->on_clause)
@@ -634,7 +636,7 @@ sql_src_item_free(void *p)
         sql_id_list_free(item->pUsing);
     if (item->func_arg)
         sql_expr_list_free(item->func_arg);
-    g_free(item);
+    sql_node_free(item);
 }
 
 sql_src_list_t *
@@ -642,7 +644,7 @@ sql_src_list_append(sql_src_list_t *p, sql_token_t *tname,
                     sql_token_t *dbname, sql_token_t *alias, sql_select_t *subquery,
                     sql_expr_t *on_clause, sql_id_list_t *using_clause)
 {
-    struct sql_src_item_t *item = g_new0(sql_src_item_t, 1);
+    struct sql_src_item_t *item = sql_node_alloc0(sizeof(sql_src_item_t));
     if (item) {
         item->table_name = tname ? sql_token_dup(*tname) : NULL;
         item->table_alias = alias ? sql_token_dup(*alias) : NULL;
@@ -652,7 +654,7 @@ sql_src_list_append(sql_src_list_t *p, sql_token_t *tname,
         item->pUsing = using_clause;
     }
     if (!p) {
-        p = g_ptr_array_new_with_free_func(sql_src_item_free);
+        p = sql_node_list_new(sql_src_item_free);
     }
     g_ptr_array_add(p, item);
     return p;
@@ -662,14 +664,14 @@ void
 sql_src_list_free(sql_src_list_t *p)
 {
     if (p)
-        g_ptr_array_free(p, TRUE);
+        sql_node_list_free(p);
 }
 
 sql_id_list_t *
 sql_id_list_append(sql_id_list_t *p, sql_token_t *id_name)
 {
     if (!p) {
-        p = g_ptr_array_new_with_free_func(g_free);
+        p = sql_node_list_new(sql_node_free);
     }
     if (id_name)
         g_ptr_array_add(p, sql_token_dup(*id_name));
@@ -680,7 +682,7 @@ void
 sql_id_list_free(sql_id_list_t *p)
 {
     if (p)
-        g_ptr_array_free(p, TRUE);
+        sql_node_list_free(p);
 }
 
 char *
@@ -889,7 +891,7 @@ sql_statement_free(void *clause, sql_stmt_type_t stmt_type)
     case STMT_SET_NAMES:
     case STMT_USE:
     case STMT_SAVEPOINT:
-        g_free(clause);
+        sql_node_free(clause);
         break;
     case STMT_START:
     case STMT_COMMIT:
@@ -941,7 +943,7 @@ sql_join_type(sql_token_t kw)
         }
         ++i;
     }
-    g_free(kw_str);
+    sql_node_free(kw_str);
     return ret;
 }
 
@@ -177,6 +177,8 @@ enum select_flag_t {
     SF_CALC_FOUND_ROWS = 0x04,
     SF_MULTI_VALUE = 0x08,
     SF_REWRITE_ORDERBY = 0x10,
+    SF_REWRITE_AVG = 0x20,      /* AVG(x) sent to shards as SUM(x) + hidden COUNT(x) */
+    SF_COUNT_DISTINCT = 0x40,   /* COUNT(DISTINCT x) sent to shards as SELECT DISTINCT x */
 };
 
 struct sql_select_t {
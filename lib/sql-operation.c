@@ -27,6 +27,7 @@
 
 #include "sql-expression.h"
 #include "sql-filter-variables.h"
+#include "sql-arena.h"
 #include "myparser.y.h"
 
 void
@@ -161,7 +162,7 @@ sql_set_names(sql_context_t *ps, char *val)
 {
     if (ps->property) {
         sql_context_set_error(ps, PARSE_NOT_SUPPORT, "Commanding comment is not allowed in SET clause");
-        g_free(val);
+        sql_node_free(val);
         return;
     }
     const char *charsets[] = { "latin1", "ascii", "gb2312", "gbk", "utf8", "utf8mb4", "big5" };
@@ -170,7 +171,7 @@ sql_set_names(sql_context_t *ps, char *val)
         char msg[64] = { 0 };
         snprintf(msg, 64, "Unknown character set: %s", val);
         sql_context_set_error(ps, PARSE_NOT_SUPPORT, msg);
-        g_free(val);
+        sql_node_free(val);
         return;
     }
     sql_context_add_stmt(ps, STMT_SET_NAMES, val);
@@ -187,7 +188,7 @@ sql_set_transaction(sql_context_t *ps, int scope, int rw_feature, int level)
         sql_context_set_error(ps, PARSE_NOT_SUPPORT, "GLOBAL scope SET TRANSACTION is not supported now");
         return;
     }
-    sql_set_transaction_t *set_tran = g_new0(sql_set_transaction_t, 1);
+    sql_set_transaction_t *set_tran = sql_node_alloc0(sizeof(sql_set_transaction_t));
     set_tran->scope = scope;
     set_tran->rw_feature = rw_feature;
     set_tran->level = level;
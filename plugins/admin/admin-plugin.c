@@ -41,6 +41,8 @@
 #include "network-mysqld-proto.h"
 #include "network-mysqld.h"
 #include "server-session.h"
+#include "sharding-config.h"
+#include "sharding-migration.h"
 #include "sys-pedantic.h"
 
 #ifndef PLUGIN_VERSION
@@ -664,6 +666,11 @@ admin_show_connectionlist(network_mysqld_con *admin_con, const char *sql)
     field->type = MYSQL_TYPE_STRING;
     g_ptr_array_add(fields, field);
 
+    field = network_mysqld_proto_fielddef_new();
+    field->name = g_strdup("Phases");
+    field->type = MYSQL_TYPE_STRING;
+    g_ptr_array_add(fields, field);
+
     field = network_mysqld_proto_fielddef_new();
     field->name = g_strdup("Info");
     field->type = MYSQL_TYPE_STRING;
@@ -673,6 +680,7 @@ admin_show_connectionlist(network_mysqld_con *admin_con, const char *sql)
 
     struct timeval now;
     gettimeofday(&(now), NULL);
+    gint64 now_us = g_get_monotonic_time();
 
     len = priv->cons->len;
     int count = 0;
@@ -705,13 +713,17 @@ admin_show_connectionlist(network_mysqld_con *admin_con, const char *sql)
             g_ptr_array_add(row, g_strdup("0"));
         } else {
             g_ptr_array_add(row, g_strdup("Query"));
-            int diff = now.tv_sec - con->req_recv_time.tv_sec;
-            if (diff > 7200) {
+            int diff;
+            if (con->query_start_us) {
+                diff = (now_us - con->query_start_us) / 1000;
+            } else {
+                diff = (now.tv_sec - con->req_recv_time.tv_sec) * 1000;
+                diff += (now.tv_usec - con->req_recv_time.tv_usec) / 1000;
+            }
+            if (diff > 7200 * 1000) {
                 g_critical("%s:too slow connection(%s) processing for con:%p",
                         G_STRLOC, con->client->src->name->str, con);
             }
-            diff = diff * 1000;
-            diff += (now.tv_usec - con->req_recv_time.tv_usec) / 1000;
             snprintf(buffer, sizeof(buffer), "%d", diff);
             g_ptr_array_add(row, g_strdup(buffer));
         }
@@ -764,6 +776,19 @@ admin_show_connectionlist(network_mysqld_con *admin_con, const char *sql)
             }
         }
 
+        if (con->state > ST_READ_QUERY && con->query_start_us) {
+            /* charged phases, then time in current state */
+            GString *phases = g_string_new(NULL);
+            network_mysqld_con_append_phases(con, phases);
+            if (con->state_since_us) {
+                g_string_append_printf(phases, "%s%s:%" G_GINT64_FORMAT, phases->len ? " " : "",
+                                       network_mysqld_con_st_name(con->state), now_us - con->state_since_us);
+            }
+            g_ptr_array_add(row, g_string_free(phases, FALSE));
+        } else {
+            g_ptr_array_add(row, NULL);
+        }
+
         if (con->orig_sql->len) {
             if (con->state == ST_READ_QUERY) {
                 g_ptr_array_add(row, NULL);
@@ -1729,12 +1754,68 @@ admin_supported_stats(network_mysqld_con *con)
     APPEND_ROW_1_COL(rows, "query_time_table");
     APPEND_ROW_1_COL(rows, "server_query_details");
     APPEND_ROW_1_COL(rows, "query_wait_table");
+    APPEND_ROW_1_COL(rows, "query_time");
+    APPEND_ROW_1_COL(rows, "phase_time");
+    APPEND_ROW_1_COL(rows, "backend_time");
     network_mysqld_con_send_resultset(con->client, fields, rows);
     network_mysqld_proto_fielddefs_free(fields);
     g_ptr_array_free(rows, TRUE);
     return PROXY_SEND_RESULT;
 }
 
+/* count and percentiles in microseconds, nothing if empty */
+static void
+append_histogram_rows(GPtrArray *rows, const char *name, const chassis_histogram_t *hist)
+{
+    static const struct {
+        const char *suffix;
+        double percentile;
+    } points[] = {
+        {"p50", 50}, {"p99", 99}, {"p999", 99.9},
+    };
+    if (hist == NULL || hist->total == 0) {
+        return;
+    }
+    GPtrArray *row = g_ptr_array_new_with_free_func(g_free);
+    g_ptr_array_add(row, g_strdup_printf("%s.count", name));
+    g_ptr_array_add(row, g_strdup_printf("%lu", hist->total));
+    g_ptr_array_add(rows, row);
+    int i;
+    for (i = 0; i < G_N_ELEMENTS(points); ++i) {
+        row = g_ptr_array_new_with_free_func(g_free);
+        g_ptr_array_add(row, g_strdup_printf("%s.%s", name, points[i].suffix));
+        g_ptr_array_add(row, g_strdup_printf("%lu", chassis_histogram_percentile(hist, points[i].percentile)));
+        g_ptr_array_add(rows, row);
+    }
+    row = g_ptr_array_new_with_free_func(g_free);
+    g_ptr_array_add(row, g_strdup_printf("%s.max", name));
+    g_ptr_array_add(row, g_strdup_printf("%lu", hist->max));
+    g_ptr_array_add(rows, row);
+}
+
+/* the old 1ms tables, rebuilt from the histograms */
+#define QUERY_TIME_TABLE_SIZE 1000
+#define QUERY_WAIT_TABLE_SIZE 1024
+
+static void
+append_table_rows(GPtrArray *rows, const char *name, chassis_histogram_t **hists, int nhists, int size)
+{
+    guint64 *table = g_new0(guint64, size);
+    int i;
+    for (i = 0; i < nhists; ++i) {
+        if (hists[i]) {
+            chassis_histogram_fill_table(hists[i], 1000, table, size);
+        }
+    }
+    for (i = 0; i < size && table[i]; ++i) {
+        GPtrArray *row = g_ptr_array_new_with_free_func(g_free);
+        g_ptr_array_add(row, g_strdup_printf("%s.%d", name, i + 1));
+        g_ptr_array_add(row, g_strdup_printf("%lu", table[i]));
+        g_ptr_array_add(rows, row);
+    }
+    g_free(table);
+}
+
 static int
 admin_get_stats(network_mysqld_con *con, const char *sql)
 {
@@ -1764,18 +1845,30 @@ admin_get_stats(network_mysqld_con *con, const char *sql)
         APPEND_ROW_2_COL(rows, "proxyed_query.ro", buf1);
         APPEND_ROW_2_COL(rows, "proxyed_query.rw", buf2);
     } else if (strcasecmp(p, "query_time_table") == 0) {
-        for (i = 0; i < MAX_QUERY_TIME && stats->query_time_table[i]; ++i) {
-            GPtrArray *row = g_ptr_array_new_with_free_func(g_free);
-            g_ptr_array_add(row, g_strdup_printf("query_time_table.%d", i + 1));
-            g_ptr_array_add(row, g_strdup_printf("%lu", stats->query_time_table[i]));
-            g_ptr_array_add(rows, row);
-        }
+        append_table_rows(rows, "query_time_table", stats->query_time, QUERY_CLASS_MAX, QUERY_TIME_TABLE_SIZE);
     } else if (strcasecmp(p, "query_wait_table") == 0) {
-        for (i = 0; i < MAX_QUERY_TIME && stats->query_wait_table[i]; ++i) {
-            GPtrArray *row = g_ptr_array_new_with_free_func(g_free);
-            g_ptr_array_add(row, g_strdup_printf("query_wait_table.%d", i + 1));
-            g_ptr_array_add(row, g_strdup_printf("%lu", stats->query_wait_table[i]));
-            g_ptr_array_add(rows, row);
+        append_table_rows(rows, "query_wait_table", &stats->phase_time[QUERY_PHASE_POOL_WAIT], 1,
+                          QUERY_WAIT_TABLE_SIZE);
+    } else if (strcasecmp(p, "query_time") == 0) {
+        static const char *class_names[QUERY_CLASS_MAX] = {
+            "other", "select", "insert", "update", "delete"
+        };
+        for (i = 0; i < QUERY_CLASS_MAX; ++i) {
+            char name[64];
+            snprintf(name, sizeof(name), "query_time.%s", class_names[i]);
+            append_histogram_rows(rows, name, stats->query_time[i]);
+        }
+    } else if (strcasecmp(p, "phase_time") == 0) {
+        for (i = 0; i < QUERY_PHASE_MAX; ++i) {
+            char name[64];
+            snprintf(name, sizeof(name), "phase_time.%s", query_phase_name(i));
+            append_histogram_rows(rows, name, stats->phase_time[i]);
+        }
+    } else if (strcasecmp(p, "backend_time") == 0) {
+        for (i = 0; i < MAX_SERVER_NUM && i < network_backends_count(chas->priv->backends); ++i) {
+            char name[64];
+            snprintf(name, sizeof(name), "backend_time.%d", i + 1);
+            append_histogram_rows(rows, name, stats->backend_time[i]);
         }
     } else if (strcasecmp(p, "server_query_details") == 0) {
         for (i = 0; i < MAX_SERVER_NUM && i < network_backends_count(chas->priv->backends); ++i) {
@@ -2029,6 +2122,109 @@ admin_send_group_info(network_mysqld_con *con, const char *sql)
 
 }
 
+static int
+admin_send_partitions_info(network_mysqld_con *con, const char *sql)
+{
+    GPtrArray *fields = network_mysqld_proto_fielddefs_new();
+    MAKE_FIELD_DEF_2_COL(fields, "vdb", "partition");
+    MAKE_FIELD_DEF_2_COL(fields, "range", "group");
+    MAKE_FIELD_DEF_1_COL(fields, "moving_to");
+
+    GPtrArray *rows = g_ptr_array_new_with_free_func((void *)network_mysqld_mysql_field_row_free);
+
+    GList *free_list = NULL;
+    GList *l;
+    for (l = shard_conf_get_vdbs(); l; l = l->next) {
+        sharding_vdb_t *vdb = l->data;
+        int i;
+        for (i = 0; i < vdb->partitions->len; ++i) {
+            sharding_partition_t *part = g_ptr_array_index(vdb->partitions, i);
+            char *vdb_id = g_strdup_printf("%d", vdb->id);
+            char *index = g_strdup_printf("%d", i);
+            GString *range = g_string_new(NULL);
+            sharding_partition_describe(part, range);
+            GPtrArray *row = g_ptr_array_new();
+            g_ptr_array_add(row, vdb_id);
+            g_ptr_array_add(row, index);
+            g_ptr_array_add(row, range->str);
+            g_ptr_array_add(row, part->group_name->str);
+            g_ptr_array_add(row, part->migrate_to ? part->migrate_to->str : "");
+            g_ptr_array_add(rows, row);
+            free_list = g_list_append(free_list, vdb_id);
+            free_list = g_list_append(free_list, index);
+            free_list = g_list_append(free_list, g_string_free(range, FALSE));
+        }
+    }
+    network_mysqld_con_send_resultset(con->client, fields, rows);
+
+    network_mysqld_proto_fielddefs_free(fields);
+    g_ptr_array_free(rows, TRUE);
+    g_list_free_full(free_list, g_free);
+    return PROXY_SEND_RESULT;
+}
+
+static int
+admin_reshard_partition(network_mysqld_con *con, const char *sql)
+{
+    int vdb_id, index;
+    char *partition = str_nth_token(sql, 2);
+    char *to = str_nth_token(sql, 3);
+    char *group = str_nth_token(sql, 4);
+    gboolean valid = partition && to && group && strcmp(to, "to") == 0
+        && sscanf(partition, "%d:%d", &vdb_id, &index) == 2;
+    g_free(partition);
+    g_free(to);
+    if (!valid) {
+        g_free(group);
+        return PROXY_NO_DECISION;
+    }
+    g_strdelimit(group, "'\"", ' ');
+    g_strstrip(group);
+
+    GString *errmsg = g_string_new(NULL);
+    if (shard_migration_start(con->srv, vdb_id, index, group, errmsg)) {
+        network_mysqld_con_send_ok(con->client);
+    } else {
+        network_mysqld_con_send_error(con->client, S(errmsg));
+    }
+    g_string_free(errmsg, TRUE);
+    g_free(group);
+    return PROXY_SEND_RESULT;
+}
+
+static int
+admin_reshard_cancel(network_mysqld_con *con, const char *sql)
+{
+    GString *errmsg = g_string_new(NULL);
+    if (shard_migration_cancel(errmsg)) {
+        network_mysqld_con_send_ok(con->client);
+    } else {
+        network_mysqld_con_send_error(con->client, S(errmsg));
+    }
+    g_string_free(errmsg, TRUE);
+    return PROXY_SEND_RESULT;
+}
+
+static int
+admin_reshard_status(network_mysqld_con *con, const char *sql)
+{
+    GPtrArray *fields = network_mysqld_proto_fielddefs_new();
+    MAKE_FIELD_DEF_1_COL(fields, "status");
+    GPtrArray *rows = g_ptr_array_new_with_free_func((void *)network_mysqld_mysql_field_row_free);
+
+    GString *status = g_string_new(NULL);
+    shard_migration_status(status);
+    if (status->len > 0) {
+        APPEND_ROW_1_COL(rows, status->str);
+    }
+    network_mysqld_con_send_resultset(con->client, fields, rows);
+
+    network_mysqld_proto_fielddefs_free(fields);
+    g_ptr_array_free(rows, TRUE);
+    g_string_free(status, TRUE);
+    return PROXY_SEND_RESULT;
+}
+
 static int admin_help(network_mysqld_con *con, const char *sql);
 
 typedef int (*sql_handler_func) (network_mysqld_con *, const char *);
@@ -2047,6 +2243,15 @@ static struct sql_handler_entry_t sql_handler_shard_map[] = {
      "select * from backends", "list the backends and their state"},
     {"select * from groups", admin_send_group_info,
      "select * from groups","list the backends and their groups"},
+    {"select * from partitions", admin_send_partitions_info,
+     "select * from partitions", "list the sharding partitions and their groups"},
+    {"reshard partition ", admin_reshard_partition,
+     "reshard partition <vdb_id>:<partition> to '<group>'",
+     "move a partition to a group not used by its vdb, online"},
+    {"reshard cancel", admin_reshard_cancel,
+     "reshard cancel", "stop moving the partition"},
+    {"reshard status", admin_reshard_status,
+     "reshard status", "show the progress of the last partition move"},
     {"show connectionlist", admin_show_connectionlist,
      "show connectionlist [<num>]", "show <num> connections"},
     {"show allow_ip ", admin_show_allow_ip,
@@ -2549,7 +2754,7 @@ network_mysqld_admin_plugin_apply_config(chassis *chas, chassis_plugin_config *c
 
     g_message("%s:admin-server listening on port", G_STRLOC);
     /* FIXME: network_socket_bind() */
-    if (0 != network_socket_bind(listen_sock)) {
+    if (0 != network_socket_bind(listen_sock, chas->listen_backlog)) {
         return -1;
     }
     g_message("admin-server listening on port %s", config->address);
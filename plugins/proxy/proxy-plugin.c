@@ -56,6 +56,7 @@ typedef int socklen_t;
 #include "network-injection.h"
 #include "network-backend.h"
 #include "sql-context.h"
+#include "sql-classify.h"
 #include "sql-filter-variables.h"
 #include "glib-ext.h"
 #include "chassis-timings.h"
@@ -65,6 +66,8 @@ typedef int socklen_t;
 #include "cetus-users.h"
 #include "plugin-common.h"
 #include "chassis-options.h"
+#include "network-compress-pool.h"
+#include "network-uring.h"
 
 #ifndef PLUGIN_VERSION
 #ifdef CHASSIS_BUILD_TAG
@@ -92,6 +95,8 @@ typedef enum {
     INJ_ID_CHANGE_SQL_MODE,
     INJ_ID_CHANGE_USER,
     INJ_ID_RESET_CONNECTION,
+    INJ_ID_TRACK_GTIDS,
+    INJ_ID_WAIT_GTID,
 } proxy_inj_id_t;
 
 struct chassis_plugin_config {
@@ -155,6 +160,10 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_timeout)
         break;
     case ST_READ_QUERY_RESULT:
         if (diff < 8 * HOURS) {
+            if (st->backend && con->server) {
+                network_backend_breaker_record(st->backend, con->server->breaker_epoch,
+                                               g_get_monotonic_time() - con->backend_send_us, TRUE);
+            }
             if (con->server && !con->client->is_server_conn_reserved) {
                 con->server_to_be_closed = 1;
                 g_critical("%s, con:%p read query result timeout, sql:%s", G_STRLOC, con, con->orig_sql->str);
@@ -169,6 +178,15 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_timeout)
             con->state = ST_SEND_ERROR;
         }
         break;
+    case ST_SEND_QUERY:
+        if (con->large_packet_relay == LARGE_PACKET_BODY) {
+            /* the client stalled in the middle of a long command */
+            g_message("%s, con:%p relaying a long command timeout", G_STRLOC, con);
+            con->prev_state = con->state;
+            con->state = ST_ERROR;
+            break;
+        }
+        /* fall through */
     default:
         if (diff >= 8 * HOURS) {
             con->prev_state = con->state;
@@ -200,6 +218,50 @@ store_server_ndx_in_prepared_resp(proxy_resultset_t *res, int index)
     return 0;
 }
 
+/* WAIT_FOR_EXECUTED_GTID_SET() returned 0 */
+static gboolean
+is_gtid_applied(proxy_resultset_t *res)
+{
+    if (res->qstat.query_status != MYSQLD_PACKET_OK || res->result_queue == NULL) {
+        return FALSE;
+    }
+
+    /* column count, column, EOF, the row */
+    GString *row = g_queue_peek_nth(res->result_queue, 3);
+    if (row == NULL) {
+        return FALSE;
+    }
+
+    return row->len == NET_HEADER_SIZE + 2 && row->str[NET_HEADER_SIZE] == 1 && row->str[NET_HEADER_SIZE + 1] == '0';
+}
+
+/*
+ * the slave timed out on the last write of the session: the read is taken
+ * again without reading the client, own_gtid_wait_failed routes it to the master
+ */
+static gboolean
+retry_read_on_master(network_mysqld_con *con)
+{
+    proxy_plugin_con_t *st = con->plugin_con_state;
+    injection *inj = g_queue_peek_head(st->injected.queries);
+
+    if (st->injected.queries->length != 1 || inj->id != INJ_ID_COM_QUERY
+        || con->is_in_transaction || con->client->is_server_conn_reserved) {
+        return FALSE;
+    }
+
+    GString *packet = g_string_sized_new(NET_HEADER_SIZE + inj->query->len);
+    network_mysqld_proto_append_packet_len(packet, inj->query->len);
+    network_mysqld_proto_append_packet_id(packet, 0);
+    g_string_append_len(packet, S(inj->query));
+
+    network_injection_queue_reset(st->injected.queries);
+    network_queue_clear(con->client->recv_queue);
+    network_queue_append(con->client->recv_queue, packet);
+    con->is_wait_server = 1;
+    return TRUE;
+}
+
 static network_mysqld_stmt_ret
 proxy_c_read_query_result(network_mysqld_con *con)
 {
@@ -241,6 +303,27 @@ proxy_c_read_query_result(network_mysqld_con *con)
     case INJ_ID_RESET_CONNECTION:
         ret = PROXY_IGNORE_RESULT;
         break;
+    case INJ_ID_WAIT_GTID:
+        if (st->backend_ndx >= 0 && st->backend_ndx < 64 && is_gtid_applied(res)) {
+            st->own_gtid_applied |= G_GUINT64_CONSTANT(1) << st->backend_ndx;
+        } else {
+            g_message("%s: slave %d is behind the last write of con:%p, gtid:%s",
+                      G_STRLOC, st->backend_ndx, con, st->own_gtid->str);
+            st->own_gtid_wait_failed = 1;
+            if (!retry_read_on_master(con)) {
+                /* the query can't move, don't answer it with stale data */
+                network_injection_queue_reset(st->injected.queries);
+                network_mysqld_con_send_error_full(con->client, C("(proxy) slave is behind the last write"),
+                                                   ER_LOCK_WAIT_TIMEOUT, "HY000");
+                network_queue_clear(recv_sock->recv_queue);
+                network_queue_clear(con->client->recv_queue);
+                network_mysqld_queue_reset(con->client);
+                ret = PROXY_NO_DECISION;
+                break;
+            }
+        }
+        ret = PROXY_IGNORE_RESULT;
+        break;
     case INJ_ID_CHANGE_USER:
         if (con->is_changed_user_failed) {
             g_warning("%s: change user failed for user '%s'@'%s'", G_STRLOC,
@@ -930,6 +1013,47 @@ adjust_user(network_mysqld_con *con)
     }
 }
 
+/* writes on the master report their GTID */
+static void
+adjust_track_gtids(network_mysqld_con *con)
+{
+    proxy_plugin_con_t *st = con->plugin_con_state;
+
+    if (con->srv->read_your_writes_wait == 0 || st->backend->type != BACKEND_TYPE_RW) {
+        return;
+    }
+    if (!con->server->is_session_tracked || con->server->is_gtid_tracked) {
+        return;
+    }
+
+    GString *packet = g_string_new(NULL);
+    g_string_append_c(packet, (char)COM_QUERY);
+    g_string_append(packet, "SET session_track_gtids = OWN_GTID");
+    proxy_inject_packet(con, PROXY_QUEUE_ADD_PREPEND, INJ_ID_TRACK_GTIDS, packet, TRUE);
+    con->server->is_gtid_tracked = 1;
+}
+
+/* reads on a slave wait for it to apply the last write of the session */
+static void
+adjust_wait_gtid(network_mysqld_con *con)
+{
+    proxy_plugin_con_t *st = con->plugin_con_state;
+    int wait = con->srv->read_your_writes_wait;
+
+    if (wait == 0 || st->own_gtid == NULL || st->own_gtid->len == 0 || st->backend->type != BACKEND_TYPE_RO) {
+        return;
+    }
+    if (st->backend_ndx >= 0 && st->backend_ndx < 64 && (st->own_gtid_applied & (G_GUINT64_CONSTANT(1) << st->backend_ndx))) {
+        return;
+    }
+
+    GString *packet = g_string_new(NULL);
+    g_string_append_c(packet, (char)COM_QUERY);
+    g_string_append_printf(packet, "SELECT WAIT_FOR_EXECUTED_GTID_SET('%s', %d.%03d)",
+                           st->own_gtid->str, wait / 1000, wait % 1000);
+    proxy_inject_packet(con, PROXY_QUEUE_ADD_PREPEND, INJ_ID_WAIT_GTID, packet, TRUE);
+}
+
 static int
 adjust_multi_stmt(network_mysqld_con *con, enum enum_server_command cmd)
 {
@@ -1121,7 +1245,13 @@ process_query_or_stmt_prepare(network_mysqld_con *con, proxy_plugin_con_t *st,
     g_string_append_c(con->orig_sql, '\0');
 
     sql_context_t *context = st->sql_context;
-    sql_context_parse_len(context, con->orig_sql);
+    chassis *srv = con->srv;
+    if (srv->disable_fast_classify || srv->query_cache_enabled
+        || !sql_context_classify_len(context, con->orig_sql)) {
+        sql_context_parse_len(context, con->orig_sql);
+    } else {
+        srv->query_stats.com_fast_classified++;
+    }
     if (context->rc == PARSE_SYNTAX_ERR) {
         char *msg = context->message;
         g_message("%s SQL syntax error: %s. while parsing: %s", G_STRLOC, msg, con->orig_sql->str);
@@ -1157,15 +1287,19 @@ process_query_or_stmt_prepare(network_mysqld_con *con, proxy_plugin_con_t *st,
     switch (context->stmt_type) {
     case STMT_SELECT:
         stats->com_select += 1;
+        con->query_class = QUERY_CLASS_SELECT;
         break;
     case STMT_UPDATE:
         stats->com_update += 1;
+        con->query_class = QUERY_CLASS_UPDATE;
         break;
     case STMT_INSERT:
         stats->com_insert += 1;
+        con->query_class = QUERY_CLASS_INSERT;
         break;
     case STMT_DELETE:
         stats->com_delete += 1;
+        con->query_class = QUERY_CLASS_DELETE;
         break;
     default:
         break;
@@ -1218,6 +1352,26 @@ process_query_or_stmt_prepare(network_mysqld_con *con, proxy_plugin_con_t *st,
     return 1;
 }
 
+/* a slow autocommit SELECT on a slave may be sent to another one too, see hedge-reads */
+static gboolean
+is_read_hedgeable(network_mysqld_con *con, int command)
+{
+    proxy_plugin_con_t *st = con->plugin_con_state;
+
+    if (!con->srv->hedge_reads || command != COM_QUERY || st->backend->type != BACKEND_TYPE_RO) {
+        return FALSE;
+    }
+    if (st->sql_context->stmt_type != STMT_SELECT || con->is_in_transaction || !con->is_auto_commit) {
+        return FALSE;
+    }
+    if (con->client->is_server_conn_reserved || con->is_calc_found_rows
+        || con->large_packet_relay != LARGE_PACKET_NONE) {
+        return FALSE;
+    }
+    /* nothing to adjust on the slave, a pooled connection alike will do */
+    return st->injected.queries->length == 1;
+}
+
 static network_mysqld_stmt_ret
 network_read_query(network_mysqld_con *con, proxy_plugin_con_t *st)
 {
@@ -1231,6 +1385,7 @@ network_read_query(network_mysqld_con *con, proxy_plugin_con_t *st)
     con->master_conn_shortaged = 0;
     con->slave_conn_shortaged = 0;
     con->use_slave_forced = 0;
+    con->is_read_hedgeable = 0;
 
     network_injection_queue_reset(st->injected.queries);
 
@@ -1375,6 +1530,10 @@ network_read_query(network_mysqld_con *con, proxy_plugin_con_t *st)
         g_debug("%s: set is_server_conn_reserved true:%p", G_STRLOC, con);
     }
 
+    adjust_track_gtids(con);
+
+    adjust_wait_gtid(con);
+
     adjust_sql_mode(con, &query_attr);
 
     adjust_charset(con, &query_attr);
@@ -1398,9 +1557,38 @@ network_read_query(network_mysqld_con *con, proxy_plugin_con_t *st)
         }
     }
 
+    con->is_read_hedgeable = is_read_hedgeable(con, command);
+
     return PROXY_SEND_INJECTION;
 }
 
+/**
+ * queue an injected query for the server
+ *
+ * a client command longer than one packet has only its first packet read,
+ * the rest is relayed from the client once the first one is sent
+ */
+static void
+proxy_queue_injection(network_mysqld_con *con, network_socket *send_sock, injection *inj)
+{
+    network_mysqld_queue_reset(send_sock);
+
+    if (con->large_packet_relay == LARGE_PACKET_PENDING && inj->query->len == PACKET_LEN_MAX) {
+        switch (inj->id) {
+        case INJ_ID_COM_DEFAULT:
+        case INJ_ID_COM_QUERY:
+        case INJ_ID_COM_STMT_PREPARE:
+            network_mysqld_queue_append_head(send_sock, send_sock->send_queue, inj->query->str);
+            con->large_packet_relay = LARGE_PACKET_HEAD;
+            return;
+        default:
+            break;
+        }
+    }
+
+    network_mysqld_queue_append(send_sock, send_sock->send_queue, S(inj->query));
+}
+
 /**
  * gets called after a query has been read
  *
@@ -1544,8 +1732,7 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_query)
 
         send_sock = con->server;
 
-        network_mysqld_queue_reset(send_sock);
-        network_mysqld_queue_append(send_sock, send_sock->send_queue, S(inj->query));
+        proxy_queue_injection(con, send_sock, inj);
 
         network_queue_clear(recv_sock->recv_queue);
         break;
@@ -1604,7 +1791,7 @@ proxy_get_backend_ndx(network_mysqld_con *con, int type, gboolean force_slave)
             idx = network_backends_get_ro_ndx(g->backends, BACKEND_ALGO_ROUND_ROBIN);
         } else {
             int x = g_random_int_range(0, 100);
-            if (x < con->config->read_master_percentage) {
+            if (x < con->config->read_master_percentage || st->own_gtid_wait_failed) {
                 idx = network_backends_get_rw_ndx(g->backends);
             } else {
                 idx = network_backends_get_ro_ndx(g->backends, BACKEND_ALGO_ROUND_ROBIN);
@@ -1629,17 +1816,17 @@ proxy_get_backend_ndx(network_mysqld_con *con, int type, gboolean force_slave)
             return FALSE;
         }
     } else {
-        if (idx == st->backend_ndx && con->server) {
+        if (idx != st->backend_ndx || !con->server) {
+            network_socket *send_sock = network_connection_pool_swap(con, idx);
+            if (!send_sock) {
+                return FALSE;
+            }
+            con->server = send_sock;
+            st->backend_ndx = idx;
+        } else {
             g_debug("%s: no need to change server:%d", G_STRLOC, st->backend_ndx);
-            return TRUE;
-        }
-
-        network_socket *send_sock = network_connection_pool_swap(con, idx);
-        if (!send_sock) {
-            return FALSE;
         }
-        con->server = send_sock;
-        st->backend_ndx = idx;
+        network_backend_breaker_claim(network_backends_get(g->backends, idx));
     }
     return TRUE;
 }
@@ -1738,8 +1925,7 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_send_query_result)
     g_assert(inj);
     g_assert(send_sock);
 
-    network_mysqld_queue_reset(send_sock);
-    network_mysqld_queue_append(send_sock, send_sock->send_queue, S(inj->query));
+    proxy_queue_injection(con, send_sock, inj);
 
     g_debug("%s: call reset_command_response_state for con:%p", G_STRLOC, con);
     network_mysqld_con_reset_command_response_state(con);
@@ -1749,6 +1935,56 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_send_query_result)
     return NETWORK_SOCKET_SUCCESS;
 }
 
+/* is the packet an OK packet ending a statement */
+static gboolean
+is_ok_packet(network_mysqld_con *con, GString *packet)
+{
+    if (packet->len <= NET_HEADER_SIZE || packet->str[NET_HEADER_SIZE] != MYSQLD_PACKET_OK) {
+        return FALSE;
+    }
+
+    switch (con->parse.command) {
+    case COM_QUERY:
+    case COM_PROCESS_INFO:
+    case COM_STMT_EXECUTE:{
+        network_mysqld_com_query_result_t *query = con->parse.data;
+        return query && (query->state == PARSE_COM_QUERY_INIT || query->state == PARSE_COM_QUERY_LOCAL_INFILE_RESULT);
+    }
+    case COM_INIT_DB:
+    case COM_PING:
+    case COM_REFRESH:
+    case COM_PROCESS_KILL:
+    case COM_STMT_RESET:
+    case COM_CHANGE_USER:
+    case COM_RESET_CONNECTION:
+        return TRUE;
+    default:
+        return FALSE;
+    }
+}
+
+/* strip the session state the client didn't ask for, keeping the GTID of a write */
+static void
+proxy_untrack_ok_packet(network_mysqld_con *con, GString *packet)
+{
+    proxy_plugin_con_t *st = con->plugin_con_state;
+    GString *gtid = g_string_new(NULL);
+
+    if (network_mysqld_proto_untrack_ok_packet(packet, gtid) != 0) {
+        g_warning("%s: malformed OK packet from %s for con:%p", G_STRLOC, con->server->dst->name->str, con);
+    } else if (gtid->len > 0) {
+        g_debug("%s: con:%p wrote gtid:%s", G_STRLOC, con, gtid->str);
+        if (st->own_gtid) {
+            g_string_free(st->own_gtid, TRUE);
+        }
+        st->own_gtid = gtid;
+        st->own_gtid_applied = 0;
+        st->own_gtid_wait_failed = 0;
+        return;
+    }
+    g_string_free(gtid, TRUE);
+}
+
 /**
  * handle the query-result we received from the server
  *
@@ -1777,6 +2013,10 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_query_result)
         inj = g_queue_peek_head(st->injected.queries);
     }
 
+    if (recv_sock->is_session_tracked && !con->resp_too_long && is_ok_packet(con, packet.data)) {
+        proxy_untrack_ok_packet(con, packet.data);
+    }
+
     g_debug("%s: here we visit network_mysqld_proto_get_query_result for con:%p", G_STRLOC, con);
 
     if (con->resp_too_long) {
@@ -1819,6 +2059,9 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_query_result)
         case COM_INIT_DB:
             break;
         case COM_CHANGE_USER:
+        case COM_RESET_CONNECTION:
+            /* the session variables are back to their defaults */
+            recv_sock->is_gtid_tracked = 0;
             break;
         default:
             break;
@@ -1839,6 +2082,7 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_query_result)
 
     if (is_finished) {
         g_debug("%s: resultset_is_finished finished: %p", G_STRLOC, con);
+        network_mysqld_con_backend_done(con, st->backend_ndx, recv_sock);
         network_mysqld_stmt_ret ret;
 
         /**
@@ -2034,7 +2278,7 @@ mysqld_con_reserved_connections_free(network_mysqld_con *con)
             network_socket *server = g_ptr_array_index(con->servers, index);
             network_backend_t *backend = network_backends_get(g->backends, i);
 
-            CHECK_PENDING_EVENT(&(server->event));
+            CHECK_PENDING_EVENT(&(server->event), &(server->timer));
 
             network_socket_free(server);
             backend->connected_clients--;
@@ -2080,6 +2324,10 @@ proxy_plugin_con_free(network_mysqld_con *con, proxy_plugin_con_t *st)
         g_warning("%s: st backend_ndx_array is not nill for con:%p", G_STRLOC, con);
     }
 
+    if (st->own_gtid) {
+        g_string_free(st->own_gtid, TRUE);
+    }
+
     g_free(st);
 }
 
@@ -2113,6 +2361,11 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_disconnect_client)
         break;
     }
 
+    if (con->large_packet_relay >= LARGE_PACKET_HEAD) {
+        /* the server is in the middle of a command */
+        con->server_to_be_closed = 1;
+    }
+
     if (con->server && !con->server_to_be_closed) {
         if (con->state == ST_CLOSE_CLIENT || con->prev_state <= ST_READ_QUERY) {
             /* move the connection to the connection pool
@@ -2328,7 +2581,7 @@ network_mysqld_proxy_plugin_apply_config(chassis *chas, chassis_plugin_config *c
         return -1;
     }
 
-    if (network_socket_bind(listen_sock)) {
+    if (network_socket_bind(listen_sock, chas->listen_backlog)) {
         return -1;
     }
     g_message("proxy listening on port %s, con:%p", config->address, con);
@@ -2344,6 +2597,14 @@ network_mysqld_proxy_plugin_apply_config(chassis *chas, chassis_plugin_config *c
     event_add(&(listen_sock->event), NULL);
     g_debug("%s:listen sock, ev:%p", G_STRLOC, (&listen_sock->event));
 
+    if (network_compress_pool_start(chas) != 0) {
+        return -1;
+    }
+
+    if (network_uring_start(chas) != 0) {
+        return -1;
+    }
+
     if (network_backends_load_config(g->backends, chas) != -1) {
         network_connection_pool_create_conns(chas);
     }
@@ -44,10 +44,15 @@
 #include "server-session.h"
 #include "shard-plugin-con.h"
 #include "sharding-config.h"
+#include "sharding-global-index.h"
+#include "sharding-load-data.h"
+#include "sharding-migration.h"
 #include "sharding-parser.h"
 #include "sharding-query-plan.h"
 #include "sql-filter-variables.h"
 #include "cetus-log.h"
+#include "network-compress-pool.h"
+#include "network-uring.h"
 
 #ifdef NETWORK_DEBUG_TRACE_STATE_CHANGES
 #include "cetus-query-queue.h"
@@ -108,6 +113,16 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_timeout)
     case ST_READ_M_QUERY_RESULT:
     case ST_READ_QUERY_RESULT:
         g_warning("%s:read query result timeout", G_STRLOC);
+        if (con->servers) {
+            int i;
+            for (i = 0; i < con->servers->len; i++) {
+                server_session_t *ss = g_ptr_array_index(con->servers, i);
+                if (ss->participated && ss->state != NET_RW_STATE_FINISHED && ss->backend && ss->server) {
+                    network_backend_breaker_record(ss->backend, ss->server->breaker_epoch,
+                                                   g_get_monotonic_time() - con->backend_send_us, TRUE);
+                }
+            }
+        }
         if (con->dist_tran) {
             if (con->dist_tran_state > NEXT_ST_XA_CANDIDATE_OVER) {
                 g_critical("%s:EV_TIMEOUT, phase two, not recv response:%p", G_STRLOC, con);
@@ -119,6 +134,12 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_timeout)
         }
         break;
     default:
+        if (con->load_data) {
+            g_message("%s: LOAD DATA file not sent in time, closing con:%p", G_STRLOC, con);
+            con->prev_state = con->state;
+            con->state = ST_ERROR;
+            break;
+        }
         diff = time(0) - con->client->create_or_update_time;
         if (diff < 8 * HOURS) {
             if (!con->client->is_server_conn_reserved) {
@@ -174,6 +195,7 @@ process_set_names(network_mysqld_con *con, char *s, mysqld_query_attr_t *query_a
 
 static int proxy_parse_query(network_mysqld_con *con);
 static int proxy_get_server_list(network_mysqld_con *con);
+static void remove_ro_servers(network_mysqld_con *con);
 
 static int
 check_backends_attr_changed(network_mysqld_con *con)
@@ -254,6 +276,11 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_query)
         break;
     }
 
+    if (con->load_data) {
+        con->state = ST_GET_SERVER_CONNECTION_LIST;
+        return NETWORK_SOCKET_SUCCESS;
+    }
+
     if (con->srv->query_cache_enabled) {
         shard_plugin_con_t *st = con->plugin_con_state;
         if (sql_context_is_cacheable(st->sql_context)) {
@@ -421,6 +448,7 @@ analysis_query(network_mysqld_con *con, mysqld_query_attr_t *query_attr)
             con->could_be_tcp_streamed = 1;
         }
         stats->com_select += 1;
+        con->query_class = QUERY_CLASS_SELECT;
         sql_select_t *select = (sql_select_t *)context->sql_statement;
 
         if (con->could_be_tcp_streamed) {
@@ -448,12 +476,15 @@ analysis_query(network_mysqld_con *con, mysqld_query_attr_t *query_attr)
     }
     case STMT_UPDATE:
         stats->com_update += 1;
+        con->query_class = QUERY_CLASS_UPDATE;
         break;
     case STMT_INSERT:
         stats->com_insert += 1;
+        con->query_class = QUERY_CLASS_INSERT;
         break;
     case STMT_DELETE:
         stats->com_delete += 1;
+        con->query_class = QUERY_CLASS_DELETE;
         break;
     case STMT_SET_NAMES:{
         char *charset_name = (char *)context->sql_statement;
@@ -552,6 +583,99 @@ shard_handle_local_query(network_mysqld_con *con, sql_context_t *context)
     return PROXY_SEND_RESULT;
 }
 
+/* LOAD DATA LOCAL INFILE goes straight to the groups of its table, see sharding-load-data.h */
+static int
+proxy_prepare_load_data(network_mysqld_con *con)
+{
+    if (con->is_in_transaction || !con->is_auto_commit || con->is_start_trans_buffered
+        || con->is_auto_commit_trans_buffered || con->dist_tran) {
+        network_mysqld_con_send_error_full(con->client, C("(proxy) LOAD DATA is not supported in a transaction"),
+                                           ER_CETUS_NOT_SUPPORTED, "HY000");
+        return PROXY_SEND_RESULT;
+    }
+
+    if (con->client->default_db->len == 0) {
+        g_string_assign(con->client->default_db, con->srv->default_db);
+    }
+
+    GString *err = g_string_new(NULL);
+    sharding_load_data_t *ld = sharding_load_data_new(con->orig_sql, con->client->default_db->str, err);
+    if (!ld) {
+        g_message("%s: %s, sql:%s", G_STRLOC, err->str, con->orig_sql->str);
+        network_mysqld_con_send_error_full(con->client, S(err), ER_CETUS_NOT_SUPPORTED, "HY000");
+        g_string_free(err, TRUE);
+        return PROXY_SEND_RESULT;
+    }
+
+    const char *db = sharding_load_data_db(ld);
+    const char *table = sharding_load_data_table(ld);
+    GPtrArray *groups = g_ptr_array_new();
+    sharding_table_t *info = shard_conf_get_info(db, table);
+    if (info) {
+        if (info->index_column) {
+            g_string_assign(err, "(proxy) LOAD DATA into a table with a global index is not supported");
+        } else if (sharding_load_data_set_key(ld, info, sharding_key_write_groups, err)) {
+            int i;
+            for (i = 0; i < info->partitions->len; ++i) {
+                sharding_partition_t *part = g_ptr_array_index(info->partitions, i);
+                g_ptr_array_add(groups, part->group_name);
+                if (part->migrate_to) {
+                    g_ptr_array_add(groups, part->migrate_to);
+                }
+            }
+        }
+    } else if (shard_conf_is_single_table(db, table)) {
+        shard_conf_get_single_table_distinct_group(groups, db, table);
+    } else {
+        shard_conf_get_all_groups(groups, db);  /* global table, every group keeps a copy */
+    }
+    if (err->len == 0 && groups->len == 0) {
+        g_string_assign(err, "(proxy) no group for LOAD DATA");
+    }
+    if (err->len > 0) {
+        g_message("%s: %s, sql:%s", G_STRLOC, err->str, con->orig_sql->str);
+        network_mysqld_con_send_error_full(con->client, S(err), ER_CETUS_NOT_SUPPORTED, "HY000");
+        g_ptr_array_free(groups, TRUE);
+        g_string_free(err, TRUE);
+        sharding_load_data_free(ld);
+        return PROXY_SEND_RESULT;
+    }
+    g_string_free(err, TRUE);
+
+    sharding_plan_t *plan = sharding_plan_new(con->orig_sql);
+    int i;
+    for (i = 0; i < groups->len; ++i) {
+        GString *group = g_ptr_array_index(groups, i);
+        if (!sharding_plan_has_group(plan, group)) {
+            GString *sql = sharding_load_data_sql(ld);
+            sharding_plan_add_group_sql(plan, group, g_string_new_len(sql->str, sql->len));
+        }
+    }
+    g_ptr_array_free(groups, TRUE);
+    network_mysqld_con_set_sharding_plan(con, plan);
+
+    con->dist_tran_decided = 0;
+    con->dist_tran_failed = 0;
+    con->buffer_and_send_fake_resp = 0;
+    con->server_to_be_closed = 0;
+    con->server_closed = 0;
+    con->resp_too_long = 0;
+    con->all_participate_num = 0;
+    con->could_be_tcp_streamed = 0;
+    con->use_all_prev_servers = 0;
+    con->last_warning_met = 0;
+    if (con->servers && !con->client->is_server_conn_reserved) {
+        remove_ro_servers(con);
+    }
+
+    query_stats_t *stats = &(con->srv->query_stats);
+    stats->client_query.rw++;
+    stats->proxyed_query.rw++;
+
+    con->load_data = ld;
+    return PROXY_NO_DECISION;
+}
+
 static int
 proxy_parse_query(network_mysqld_con *con)
 {
@@ -608,6 +732,9 @@ proxy_parse_query(network_mysqld_con *con)
             g_string_append_c(con->orig_sql, '\0');
 
             g_debug("%s: sql:%s", G_STRLOC, con->orig_sql->str);
+            if (sharding_load_data_is_statement(con->orig_sql)) {
+                return proxy_prepare_load_data(con);
+            }
             sql_context_t *context = st->sql_context;
             sql_context_parse_len(context, con->orig_sql);
 
@@ -735,7 +862,7 @@ remove_ro_servers(network_mysqld_con *con)
             network_connection_pool *pool = ss->backend->pool;
             network_socket *server = ss->server;
 
-            CHECK_PENDING_EVENT(&(server->event));
+            CHECK_PENDING_EVENT(&(server->event), &(server->timer));
 
             network_pool_add_idle_conn(pool, con->srv, server);
             ss->backend->connected_clients--;
@@ -1137,10 +1264,21 @@ proxy_get_server_list(network_mysqld_con *con)
         }
         break;
     default:
+        plan->global_index_stale = con->global_index_missed;
         rv = sharding_parse_groups(con->client->default_db, st->sql_context, stats, con->key, plan);
         break;
     }
 
+    if (plan->join_sides) {
+        con->could_be_tcp_streamed = 0; /* joined after all groups have answered */
+    }
+    if (plan->global_index_hint) {
+        /* routed again to all groups if the group of the hint returns no row */
+        GString *packet = g_queue_peek_head(con->client->recv_queue->chunks);
+        plan->global_index_query = g_string_new_len(S(packet));
+        con->could_be_tcp_streamed = 0;
+    }
+
     if (plan->groups->len > 1) {
         switch (st->sql_context->stmt_type) {
         case STMT_SELECT:
@@ -1240,7 +1378,8 @@ proxy_get_pooled_connection(network_mysqld_con *con,
 
     if (type == BACKEND_TYPE_RW) {
         backend = backend_group->master;    /* may be NULL if master down */
-        if (!backend || (backend->state != BACKEND_STATE_UP && backend->state != BACKEND_STATE_UNKNOWN)) {
+        if (!backend || (backend->state != BACKEND_STATE_UP && backend->state != BACKEND_STATE_UNKNOWN)
+            || !network_backend_breaker_check(backend)) {
             *server_unavailable = 1;
             return FALSE;
         }
@@ -1259,8 +1398,10 @@ proxy_get_pooled_connection(network_mysqld_con *con,
 
     (*sock)->is_read_only = (type == BACKEND_TYPE_RO) ? 1 : 0;
     st->backend = backend;
+    network_backend_breaker_claim(backend);
 
     st->backend->connected_clients++;
+    network_connection_pool_note_in_use(backend->pool, network_backend_borrowed_count(backend));
 
     g_debug("%s: connected_clients add, backend:%p, now:%d, con:%p, server:%p",
             G_STRLOC, backend, st->backend->connected_clients, con, *sock);
@@ -1319,6 +1460,7 @@ proxy_add_server_connection(network_mysqld_con *con, GString *group, int *server
 
         ss->con = con;
         ss->backend = st->backend;
+        ss->backend_ndx = network_backends_get_ndx(con->srv->priv->backends, st->backend);
         ss->server = server;
         server->group = group;
         ss->sql = sharding_plan_get_sql(con->sharding_plan, group);
@@ -1398,7 +1540,7 @@ proxy_add_server_connection_array(network_mysqld_con *con, int *server_unavailab
                     network_connection_pool *pool = ss->backend->pool;
                     network_socket *server = ss->server;
 
-                    CHECK_PENDING_EVENT(&(server->event));
+                    CHECK_PENDING_EVENT(&(server->event), &(server->timer));
 
                     network_pool_add_idle_conn(pool, con->srv, server);
                     ss->backend->connected_clients--;
@@ -1663,6 +1805,16 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_get_server_conn_list)
 
     con->is_new_server_added = 0;
 
+    shard_plugin_con_t *st = con->plugin_con_state;
+    if (!st->is_dual_writer && shard_migration_is_dual_write(con->sharding_plan)) {
+        if (!shard_migration_write_enter()) {
+            g_debug("%s: a batch of the partition is being copied, wait:%p", G_STRLOC, con);
+            shard_migration_wait_gate(con);
+            return NETWORK_SOCKET_WAIT_FOR_EVENT;
+        }
+        st->is_dual_writer = 1;
+    }
+
     if (!con->use_all_prev_servers) {
         int server_unavailable = 0;
         if (!proxy_add_server_connection_array(con, &server_unavailable)) {
@@ -1866,6 +2018,19 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_get_server_conn_list)
  */
 NETWORK_MYSQLD_PLUGIN_PROTO(proxy_send_query_result)
 {
+    shard_plugin_con_t *st = con->plugin_con_state;
+    if (st && st->is_dual_writer && !con->is_in_transaction && !con->dist_tran) {
+        shard_migration_write_leave();
+        st->is_dual_writer = 0;
+    }
+
+    if (con->load_data && !sharding_load_data_is_streaming(con->load_data)) {
+        /* failed before the file was asked for */
+        sharding_load_data_free(con->load_data);
+        con->load_data = NULL;
+        con->client->is_server_conn_reserved = 0;
+    }
+
     if (con->server_to_be_closed) {
         if (con->servers != NULL) {
             g_debug("%s:call proxy_put_shard_conn_to_pool for con:%p", G_STRLOC, con);
@@ -1890,7 +2055,7 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_send_query_result)
     con->state = ST_READ_QUERY;
 
     if (con->srv->maintain_close_mode) {
-        if (!con->is_in_transaction) {
+        if (!con->is_in_transaction && !con->load_data) {
             con->state = ST_CLOSE_CLIENT;
             g_debug("%s:client needs to closed for con:%p", G_STRLOC, con);
         }
@@ -1952,6 +2117,10 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_init)
 static int
 proxy_c_disconnect_shard_client(network_mysqld_con *con)
 {
+    if (con->load_data) {
+        con->server_to_be_closed = 1;   /* in the middle of the statement */
+    }
+
     if (con->is_in_transaction || con->is_auto_commit == 0) {
         if (con->is_in_transaction) {
             g_message("%s: con is still in trans for con:%p", G_STRLOC, con);
@@ -1988,6 +2157,12 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_disconnect_client)
     if (st == NULL)
         return NETWORK_SOCKET_SUCCESS;
 
+    if (st->is_dual_writer) {
+        shard_migration_write_leave();
+        st->is_dual_writer = 0;
+    }
+    shard_migration_wait_cancel(con);
+
     if (con->servers != NULL) {
         g_debug("%s: call proxy_c_disconnect_shard_client:%p", G_STRLOC, con);
         proxy_c_disconnect_shard_client(con);
@@ -2072,6 +2247,8 @@ network_mysqld_shard_plugin_free(chassis *chas, chassis_plugin_config *config)
         g_free(config->address);
     }
     sql_filter_vars_destroy();
+    shard_migration_destroy();
+    global_index_destroy();
     g_debug("%s: call shard_conf_destroy", G_STRLOC);
     shard_conf_destroy();
 
@@ -2131,6 +2308,8 @@ sharding_conf_reload_callback(int fd, short what, void *arg)
     }
     int num_groups = chas->priv->backends->groups->len;
     if (shard_conf_load(shard_json, num_groups)) {
+        shard_migration_conf_reloaded();
+        global_index_conf_reloaded(chas);
         g_message("sharding config is updated");
     } else {
         g_warning("sharding config update failed");
@@ -2204,7 +2383,7 @@ network_mysqld_shard_plugin_apply_config(chassis *chas, chassis_plugin_config *c
         return -1;
     }
 
-    if (network_socket_bind(listen_sock)) {
+    if (network_socket_bind(listen_sock, chas->listen_backlog)) {
         return -1;
     }
     g_message("shard module listening on port %s, con:%p", config->address, con);
@@ -2219,6 +2398,7 @@ network_mysqld_shard_plugin_apply_config(chassis *chas, chassis_plugin_config *c
         exit(0);
     }
     g_free(shard_json);
+    global_index_conf_reloaded(chas);
 
     g_assert(chas->priv->monitor);
     cetus_monitor_register_object(chas->priv->monitor, "sharding", sharding_conf_reload_callback, chas);
@@ -2232,6 +2412,14 @@ network_mysqld_shard_plugin_apply_config(chassis *chas, chassis_plugin_config *c
     event_add(&(listen_sock->event), NULL);
     g_debug("%s:listen sock, ev:%p", G_STRLOC, (&listen_sock->event));
 
+    if (network_compress_pool_start(chas) != 0) {
+        return -1;
+    }
+
+    if (network_uring_start(chas) != 0) {
+        return -1;
+    }
+
     if (network_backends_load_config(g->backends, chas) != -1) {
         network_connection_pool_create_conns(chas);
     }
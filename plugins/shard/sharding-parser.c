@@ -30,7 +30,9 @@
 #include "sql-expression.h"
 #include "sql-construction.h"
 #include "sql-property.h"
+#include "sql-arena.h"
 #include "sharding-config.h"
+#include "sharding-global-index.h"
 
 static gboolean
 is_compare_op(int op)
@@ -210,13 +212,170 @@ sql_modify_orderby(sql_select_t *select)
     }
 }
 
-GString *
-sharding_modify_sql(sql_context_t *context, having_condition_t *hav_condi)
+/* text between the outermost parentheses of a function call, "AVG( x+1 )" ==> " x+1 " */
+static GString *
+function_args_text(const sql_expr_t *func)
+{
+    const char *lp = memchr(func->start, '(', func->end - func->start);
+    if (lp == NULL) {
+        return NULL;
+    }
+    const char *rp = func->end - 1;
+    while (rp > lp && *rp != ')') {
+        --rp;
+    }
+    if (rp <= lp) {
+        return NULL;
+    }
+    return g_string_new_len(lp + 1, rp - lp - 1);
+}
+
+static void
+string_append_backquoted(GString *s, const char *p, int len)
+{
+    int i;
+    g_string_append_c(s, '`');
+    for (i = 0; i < len; ++i) {
+        if (p[i] == '`') {
+            g_string_append_c(s, '`');
+        }
+        g_string_append_c(s, p[i]);
+    }
+    g_string_append_c(s, '`');
+}
+
+/* a select column whose text is constructed by proxy, not from the original sql */
+static sql_expr_t *
+constructed_column_new(GString *text, GString *alias)
+{
+    sql_token_t token = { text->str, text->len };
+    sql_expr_t *expr = sql_expr_new(TK_FUNCTION, &token);
+    expr->start = expr->token_text;
+    expr->end = expr->token_text + text->len;
+    if (alias) {
+        expr->alias = sql_node_alloc0(alias->len + 1);
+        memcpy(expr->alias, alias->str, alias->len);
+    }
+    return expr;
+}
+
+/**
+ * AVG(x) AS a ==> SUM(x) AS a, ..., COUNT(x)
+ *   the COUNT(x) of every AVG column is appended in column order after the
+ *   original columns, resultset merge relies on this layout.
+ * @param constructed [out] the newly created columns, to be freed by caller
+ * @return column list used for the shard sql, shares untouched columns with the original
+ */
+static sql_expr_list_t *
+sql_rewrite_avg_columns(sql_expr_list_t *columns, GPtrArray *constructed)
+{
+    sql_expr_list_t *new_columns = g_ptr_array_new();
+    GPtrArray *counts = g_ptr_array_new();
+    int i;
+    for (i = 0; i < columns->len; ++i) {
+        sql_expr_t *col = g_ptr_array_index(columns, i);
+        GString *args = NULL;
+        if (col->op == TK_FUNCTION && sql_func_type(col->token_text) == FT_AVG) {
+            args = function_args_text(col);
+        }
+        if (args == NULL) {
+            g_ptr_array_add(new_columns, col);
+            continue;
+        }
+        GString *text = g_string_new(NULL);
+        GString *alias = g_string_new(NULL);
+        if (col->alias) {
+            string_append_backquoted(alias, col->alias, strlen(col->alias));
+        } else {
+            string_append_backquoted(alias, col->start, col->end - col->start);
+        }
+        g_string_printf(text, "SUM(%s)", args->str);
+        sql_expr_t *sum = constructed_column_new(text, alias);
+        g_string_printf(text, "COUNT(%s)", args->str);
+        sql_expr_t *count = constructed_column_new(text, NULL);
+
+        g_ptr_array_add(new_columns, sum);
+        g_ptr_array_add(counts, count);
+        g_ptr_array_add(constructed, sum);
+        g_ptr_array_add(constructed, count);
+        g_string_free(text, TRUE);
+        g_string_free(alias, TRUE);
+        g_string_free(args, TRUE);
+    }
+    for (i = 0; i < counts->len; ++i) {
+        g_ptr_array_add(new_columns, g_ptr_array_index(counts, i));
+    }
+    g_ptr_array_free(counts, TRUE);
+    return new_columns;
+}
+
+/**
+ * SELECT COUNT(DISTINCT a,b) FROM .. WHERE ..
+ *   ==> SELECT DISTINCT a,b,COLLATION(a),COLLATION(b) FROM .. WHERE ..
+ * the collations tell resultset merge how the keys of different shards compare
+ */
+static GString *
+sql_modify_count_distinct(sql_select_t *select)
+{
+    sql_expr_t *count = g_ptr_array_index(select->columns, 0);
+    GString *args = function_args_text(count);
+    if (args == NULL) {
+        return NULL;
+    }
+    /* strip the DISTINCT keyword, the args are pushed down as a DISTINCT key stream */
+    const char *p = args->str;
+    while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r') {
+        ++p;
+    }
+    if (strncasecmp(p, "distinct", 8) == 0) {
+        g_string_erase(args, 0, p + 8 - args->str);
+    }
+    int i;
+    for (i = 0; i < count->list->len; ++i) {
+        sql_expr_t *arg = g_ptr_array_index(count->list, i);
+        g_string_append_printf(args, ",COLLATION(%.*s)", (int)(arg->end - arg->start), arg->start);
+    }
+
+    GPtrArray *constructed = g_ptr_array_new_with_free_func(sql_expr_free);
+    sql_expr_list_t *orig_columns = select->columns;
+    sql_expr_t *limit = select->limit;
+    sql_expr_t *offset = select->offset;
+    uint32_t orig_flags = select->flags;
+
+    sql_expr_list_t *key_columns = g_ptr_array_new();
+    sql_expr_t *keys = constructed_column_new(args, NULL);
+    g_ptr_array_add(constructed, keys);
+    g_ptr_array_add(key_columns, keys);
+
+    /* LIMIT applies to the single aggregated row, not to the key stream */
+    select->columns = key_columns;
+    select->limit = NULL;
+    select->offset = NULL;
+    select->flags |= SF_DISTINCT;
+    GString *new_sql = sql_construct_select(select);
+    g_string_append_c(new_sql, ';');
+    select->columns = orig_columns;
+    select->limit = limit;
+    select->offset = offset;
+    select->flags = orig_flags;
+
+    g_ptr_array_free(key_columns, TRUE);
+    g_ptr_array_free(constructed, TRUE);
+    g_string_free(args, TRUE);
+    return new_sql;
+}
+
+static GString *
+sharding_modify_select(sql_context_t *context, having_condition_t *hav_condi)
 {
     /* TODO: sql rewrite priority */
     if (context->stmt_type == STMT_SELECT && context->sql_statement) {
         sql_select_t *select = context->sql_statement;
 
+        if (select->flags & SF_COUNT_DISTINCT) {
+            return sql_modify_count_distinct(select);
+        }
+
         sql_expr_t *having = select->having_clause;
         if (having) {
             if (is_compare_op(having->op)) {
@@ -241,6 +400,15 @@ sharding_modify_sql(sql_context_t *context, having_condition_t *hav_condi)
         gboolean has_function = FALSE;
         GString *modified_sql = NULL;
 
+        /* AVG(x) ==> SUM(x), COUNT(x), the columns are swapped back after construction */
+        sql_expr_list_t *orig_columns = NULL;
+        GPtrArray *constructed = NULL;
+        if (select->flags & SF_REWRITE_AVG) {
+            constructed = g_ptr_array_new_with_free_func(sql_expr_free);
+            orig_columns = select->columns;
+            select->columns = sql_rewrite_avg_columns(orig_columns, constructed);
+        }
+
         /* (LIMIT a, b) ==> (LIMIT 0, a+b) */
         if (modified_sql == NULL && !has_function) {
             modified_sql = sql_modify_limit(select);
@@ -251,16 +419,31 @@ sharding_modify_sql(sql_context_t *context, having_condition_t *hav_condi)
             modified_sql = sql_modify_orderby(select);
         }
 
-        if (modified_sql == NULL && having) {
+        if (modified_sql == NULL && (having || orig_columns)) {
             modified_sql = sql_construct_select(select);
         }
         select->having_clause = having; /* get HAVING back */
+        if (orig_columns) {
+            g_ptr_array_free(select->columns, TRUE);
+            select->columns = orig_columns;
+            g_ptr_array_free(constructed, TRUE);
+        }
 
         return modified_sql;
     }
     return NULL;
 }
 
+GString *
+sharding_modify_sql(sql_context_t *context, having_condition_t *hav_condi)
+{
+    /* nodes added by the rewrite live as long as the parsed tree */
+    sql_arena_t *prev_arena = sql_context_activate_arena(context);
+    GString *modified_sql = sharding_modify_select(context, hav_condi);
+    sql_arena_activate(prev_arena);
+    return modified_sql;
+}
+
 static gboolean
 sql_select_contains_sharding_table(sql_select_t *select, char **current_db /* in_out */ , char **table /* out */ )
 {
@@ -553,7 +736,7 @@ partitions_collect_IN_expr(GPtrArray *partitions, sql_expr_t *expr)
 
     struct condition_t cond = { 0 };
     if (expr->list && expr->list->len > 0) {
-        GPtrArray *partitions = g_ptr_array_new();
+        GPtrArray *collected = g_ptr_array_new();
 
         sql_expr_list_t *args = expr->list;
         int i;
@@ -562,21 +745,21 @@ partitions_collect_IN_expr(GPtrArray *partitions, sql_expr_t *expr)
             cond.op = TK_EQ;
             int rc = expr_parse_sharding_value(arg, conf->key_type, &cond);
             if (rc != PARSE_OK) {
-                g_ptr_array_free(partitions, TRUE);
+                g_ptr_array_free(collected, TRUE);
                 return rc;
             }
-            partitions_collect(partitions, cond, partitions);
+            partitions_collect(partitions, cond, collected);
         }
 
-        /* transfer partitions to partitions as output */
+        /* transfer collected to partitions as output */
         for (i = partitions->len - 1; i >= 0; --i) {
             g_ptr_array_remove_index(partitions, i);
         }
-        for (i = 0; i < partitions->len; ++i) {
-            gpointer *gp = g_ptr_array_index(partitions, i);
+        for (i = 0; i < collected->len; ++i) {
+            gpointer *gp = g_ptr_array_index(collected, i);
             g_ptr_array_add(partitions, gp);
         }
-        g_ptr_array_free(partitions, TRUE);
+        g_ptr_array_free(collected, TRUE);
         return PARSE_OK;
 
     } else {
@@ -731,6 +914,37 @@ partitions_get_group_names(GPtrArray *partitions, GPtrArray *groups)
     }
 }
 
+/* writes to a partition being moved go to both groups */
+static void
+partitions_get_write_group_names(GPtrArray *partitions, GPtrArray *groups)
+{
+    int i = 0;
+    for (i = 0; i < partitions->len; ++i) {
+        sharding_partition_t *gp = g_ptr_array_index(partitions, i);
+        g_ptr_array_add(groups, gp->group_name);
+        if (gp->migrate_to) {
+            g_ptr_array_add(groups, gp->migrate_to);
+        }
+    }
+}
+
+static void
+table_get_write_group_names(char *db, char *table, GPtrArray *groups)
+{
+    shard_conf_get_table_groups(groups, db, table);
+
+    GPtrArray *partitions = g_ptr_array_new();
+    shard_conf_table_partitions(partitions, db, table);
+    int i = 0;
+    for (i = 0; i < partitions->len; ++i) {
+        sharding_partition_t *gp = g_ptr_array_index(partitions, i);
+        if (gp->migrate_to) {
+            g_ptr_array_add(groups, gp->migrate_to);
+        }
+    }
+    g_ptr_array_free(partitions, TRUE);
+}
+
 /**
  * find out which 2 tables are connected by expression 'p', then
  * 1. record it in linkage array
@@ -852,9 +1066,708 @@ sql_select_get_single_tables(sql_select_t *select, char *current_db, GList **sin
     }
 }
 
+#define JOIN_SIDES 2
+
+/* the one of the joined tables a qualified column belongs to, -1 if none */
 static int
-routing_select(sql_context_t *context, const sql_select_t *select,
-               char *default_db, guint32 fixture, query_stats_t *stats, GPtrArray *groups /* out */ )
+join_column_side(const sql_expr_t *p, sql_src_item_t **tables, const char *default_db)
+{
+    if (!p || p->op != TK_DOT || !sql_expr_is_field_name(p)) {
+        return -1;
+    }
+    const char *db = NULL;
+    const sql_expr_t *dot = p;
+    if (p->right->op == TK_DOT) {   /* db.table.col */
+        db = p->left->token_text;
+        dot = p->right;
+    }
+    const char *prefix = dot->left->token_text;
+    int i;
+    for (i = 0; i < JOIN_SIDES; ++i) {
+        sql_src_item_t *src = tables[i];
+        if (db) {
+            const char *src_db = src->dbname ? src->dbname : default_db;
+            if (strcasecmp(db, src_db) == 0 && strcasecmp(prefix, src->table_name) == 0) {
+                return i;
+            }
+        } else if (src->table_alias) {
+            if (strcmp(prefix, src->table_alias) == 0) {
+                return i;
+            }
+        } else if (strcasecmp(prefix, src->table_name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* bitmask of the joined tables referenced by the expression, -1 if unknown */
+static int
+join_expr_sides(const sql_expr_t *p, sql_src_item_t **tables, const char *default_db)
+{
+    if (!p) {
+        return 0;
+    }
+    if (p->select || p->op == TK_ID) {  /* subquery, or column not qualified */
+        return -1;
+    }
+    if (p->op == TK_DOT) {
+        int side = join_column_side(p, tables, default_db);
+        return side < 0 ? -1 : 1 << side;
+    }
+    int mask = 0;
+    int sub = join_expr_sides(p->left, tables, default_db);
+    if (sub < 0) {
+        return -1;
+    }
+    mask |= sub;
+    sub = join_expr_sides(p->right, tables, default_db);
+    if (sub < 0) {
+        return -1;
+    }
+    mask |= sub;
+    int i;
+    for (i = 0; p->list && i < p->list->len; ++i) {
+        sub = join_expr_sides(g_ptr_array_index(p->list, i), tables, default_db);
+        if (sub < 0) {
+            return -1;
+        }
+        mask |= sub;
+    }
+    return mask;
+}
+
+static void
+join_collect_conjuncts(sql_expr_t *p, GPtrArray *conds)
+{
+    if (!p) {
+        return;
+    }
+    if (p->op == TK_AND) {
+        join_collect_conjuncts(p->left, conds);
+        join_collect_conjuncts(p->right, conds);
+    } else {
+        g_ptr_array_add(conds, p);
+    }
+}
+
+static void
+join_append_quoted(GString *s, const char *name)
+{
+    g_string_append_c(s, '`');
+    for (; *name; ++name) {
+        if (*name == '`') {
+            g_string_append_c(s, '`');
+        }
+        g_string_append_c(s, *name);
+    }
+    g_string_append_c(s, '`');
+}
+
+static void
+join_append_expr(GString *s, const sql_expr_t *p)
+{
+    g_string_append_len(s, p->start, p->end - p->start);
+}
+
+/**
+ * SELECT side, key0, key1, COLLATION(key), columns... FROM table WHERE filters
+ *   columns of the other table are NULL, so that all groups return the same layout
+ */
+static void
+join_append_side_select(GString *s, int side, sql_src_item_t *src, const sql_expr_t **keys,
+                        sql_expr_list_t *columns, const GByteArray *sides, GPtrArray *filters)
+{
+    g_string_append_printf(s, "SELECT %d", side);
+    int i;
+    for (i = 0; i < JOIN_SIDES; ++i) {
+        g_string_append_c(s, ',');
+        if (i == side) {
+            join_append_expr(s, keys[i]);
+        } else {
+            g_string_append(s, "NULL");
+        }
+    }
+    g_string_append(s, ",COLLATION(");
+    join_append_expr(s, keys[side]);
+    g_string_append_c(s, ')');
+    for (i = 0; i < columns->len; ++i) {
+        sql_expr_t *col = g_ptr_array_index(columns, i);
+        g_string_append_c(s, ',');
+        if (sides->data[i] == side) {
+            join_append_expr(s, col);
+        } else {
+            g_string_append(s, "NULL");
+        }
+        g_string_append(s, " AS ");
+        if (col->alias) {
+            join_append_quoted(s, col->alias);
+        } else {
+            const sql_expr_t *dot = col->right->op == TK_DOT ? col->right : col;
+            join_append_quoted(s, dot->right->token_text);
+        }
+    }
+    g_string_append(s, " FROM ");
+    if (src->dbname) {
+        join_append_quoted(s, src->dbname);
+        g_string_append_c(s, '.');
+    }
+    join_append_quoted(s, src->table_name);
+    if (src->table_alias) {
+        g_string_append(s, " AS ");
+        join_append_quoted(s, src->table_alias);
+    }
+    for (i = 0; i < filters->len; ++i) {
+        g_string_append(s, i == 0 ? " WHERE (" : " AND (");
+        join_append_expr(s, g_ptr_array_index(filters, i));
+        g_string_append_c(s, ')');
+    }
+}
+
+static gboolean
+join_groups_contain(GPtrArray *groups, GString *group)
+{
+    int i;
+    for (i = 0; i < groups->len; ++i) {
+        if (g_string_equal(g_ptr_array_index(groups, i), group)) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/* pick the pushed-down predicates and the join equation out of WHERE and ON */
+static const char *
+join_split_conditions(const sql_select_t *select, sql_src_item_t **tables, const char *default_db,
+                      gboolean keep_left, const sql_expr_t **keys, GPtrArray **filters)
+{
+    GPtrArray *conds = g_ptr_array_new();
+    join_collect_conjuncts(select->where_clause, conds);
+    guint where_len = conds->len;
+    join_collect_conjuncts(tables[1]->on_clause, conds);
+
+    const char *error = NULL;
+    int i;
+    for (i = 0; i < conds->len && !error; ++i) {
+        sql_expr_t *cond = g_ptr_array_index(conds, i);
+        gboolean in_on = i >= where_len;
+        int mask = join_expr_sides(cond, tables, default_db);
+        if (mask < 0) {
+            error = "(cetus) columns of JOIN across shards must be qualified by table";
+        } else if (mask == 3) {
+            int left = join_column_side(cond->left, tables, default_db);
+            int right = join_column_side(cond->right, tables, default_db);
+            if (cond->op != TK_EQ || keys[0] || left < 0 || right < 0 || left == right || (keep_left && !in_on)) {
+                error = "(cetus) JOIN across shards needs exactly one column equation between the tables";
+            } else {
+                keys[left] = cond->left;
+                keys[right] = cond->right;
+            }
+        } else if (keep_left && (in_on ? mask == 1 : mask == 2)) {
+            error = "(cetus) LEFT JOIN across shards can't filter the left table in ON or the right table in WHERE";
+        } else {
+            /* constants go to both sides, except ON of LEFT JOIN which keeps all left rows */
+            if ((mask & 1) || (mask == 0 && !(keep_left && in_on))) {
+                g_ptr_array_add(filters[0], cond);
+            }
+            if ((mask & 2) || mask == 0) {
+                g_ptr_array_add(filters[1], cond);
+            }
+        }
+    }
+    if (!error && !keys[0]) {
+        error = "(cetus) JOIN across shards needs exactly one column equation between the tables";
+    }
+    g_ptr_array_free(conds, TRUE);
+    return error;
+}
+
+/**
+ * Two tables the backends can't join (different VDBs, not on the sharding key,
+ * or single-table with sharding-table) are joined inside the proxy: each group
+ * returns the rows of the tables it holds, tagged by table and filtered by the
+ * predicates of that table only, then merge_for_hash_join() matches them.
+ */
+static int
+routing_hash_join(sql_context_t *context, const sql_select_t *select, char *default_db, sharding_plan_t *plan)
+{
+    if (select->prior || select->next || select->groupby_clause || select->having_clause
+        || select->orderby_clause || select->lock_read || (select->flags & SF_DISTINCT)
+        || (context->clause_flags & (CF_AGGREGATE | CF_SUBQUERY))) {
+        sql_context_append_msg(context, "(cetus) JOIN across shards only supports columns, WHERE and LIMIT");
+        return ERROR_UNPARSABLE;
+    }
+    sql_src_item_t *tables[JOIN_SIDES] = {
+        g_ptr_array_index(select->from_src, 0),
+        g_ptr_array_index(select->from_src, 1)
+    };
+    if (!tables[0]->table_name || !tables[1]->table_name || tables[1]->pUsing) {
+        sql_context_append_msg(context, "(cetus) JOIN across shards only supports tables joined ON columns");
+        return ERROR_UNPARSABLE;
+    }
+    int jointype = tables[0]->jointype;
+    gboolean keep_left = (jointype & JT_LEFT) && !(jointype & ~(JT_LEFT | JT_OUTER));
+    if (!keep_left && (jointype & ~(JT_INNER | JT_CROSS))) {
+        sql_context_append_msg(context, "(cetus) JOIN across shards only supports INNER and LEFT JOIN");
+        return ERROR_UNPARSABLE;
+    }
+
+    sql_expr_list_t *columns = select->columns;
+    GByteArray *sides = g_byte_array_sized_new(columns->len);
+    int i;
+    for (i = 0; i < columns->len; ++i) {
+        int side = join_column_side(g_ptr_array_index(columns, i), tables, default_db);
+        if (side < 0) {
+            g_byte_array_free(sides, TRUE);
+            sql_context_append_msg(context, "(cetus) columns of JOIN across shards must be qualified by table");
+            return ERROR_UNPARSABLE;
+        }
+        guint8 b = side;
+        g_byte_array_append(sides, &b, 1);
+    }
+
+    const sql_expr_t *keys[JOIN_SIDES] = { NULL, NULL };
+    GPtrArray *filters[JOIN_SIDES] = { g_ptr_array_new(), g_ptr_array_new() };
+    GPtrArray *side_groups[JOIN_SIDES] = { g_ptr_array_new(), g_ptr_array_new() };
+    const char *error = join_split_conditions(select, tables, default_db, keep_left, keys, filters);
+    for (i = 0; i < JOIN_SIDES && !error; ++i) {
+        char *db = tables[i]->dbname ? tables[i]->dbname : default_db;
+        if (shard_conf_is_shard_table(db, tables[i]->table_name)) {
+            shard_conf_get_table_groups(side_groups[i], db, tables[i]->table_name);
+        } else {
+            shard_conf_get_single_table_distinct_group(side_groups[i], db, tables[i]->table_name);
+        }
+        if (side_groups[i]->len == 0) {
+            error = "(proxy)JOIN must inside VDB and have explicit join-on condition";
+        }
+    }
+
+    int rc = ERROR_UNPARSABLE;
+    if (error) {
+        sql_context_append_msg(context, (char *)error);
+        g_byte_array_free(sides, TRUE);
+    } else {
+        GPtrArray *groups = g_ptr_array_new();
+        for (i = 0; i < JOIN_SIDES; ++i) {
+            int j;
+            for (j = 0; j < side_groups[i]->len; ++j) {
+                GString *group = g_ptr_array_index(side_groups[i], j);
+                if (!join_groups_contain(groups, group)) {
+                    g_ptr_array_add(groups, group);
+                }
+            }
+        }
+        if (groups->len == 1) {     /* both tables live in the same backend */
+            sharding_plan_add_group(plan, g_ptr_array_index(groups, 0));
+            g_byte_array_free(sides, TRUE);
+            rc = USE_SHARDING;
+        } else {
+            for (i = 0; i < groups->len; ++i) {
+                GString *group = g_ptr_array_index(groups, i);
+                GString *sql = g_string_new(NULL);
+                int side;
+                for (side = 0; side < JOIN_SIDES; ++side) {
+                    if (join_groups_contain(side_groups[side], group)) {
+                        if (sql->len > 0) {
+                            g_string_append(sql, " UNION ALL ");
+                        }
+                        join_append_side_select(sql, side, tables[side], keys, columns, sides, filters[side]);
+                    }
+                }
+                sharding_plan_add_group_sql(plan, group, sql);
+            }
+            plan->join_sides = sides;
+            plan->join_keep_left = keep_left;
+            rc = USE_ALL_SHARDINGS;
+        }
+        g_ptr_array_free(groups, TRUE);
+    }
+    for (i = 0; i < JOIN_SIDES; ++i) {
+        g_ptr_array_free(filters[i], TRUE);
+        g_ptr_array_free(side_groups[i], TRUE);
+    }
+    return rc;
+}
+
+static gboolean
+expr_is_literal(sql_expr_t *p)
+{
+    gint64 intval;
+    return p->op == TK_STRING || sql_expr_get_int(p, &intval);
+}
+
+/* the literal of a top-level "column = literal" condition, NULL if none */
+static sql_expr_t *
+where_column_value(sql_expr_t *where, const sql_src_item_t *src, const char *column)
+{
+    if (!where) {
+        return NULL;
+    }
+    if (where->op == TK_AND) {
+        sql_expr_t *value = where_column_value(where->left, src, column);
+        return value ? value : where_column_value(where->right, src, column);
+    }
+    if (where->op != TK_EQ || !where->left || !where->right) {
+        return NULL;
+    }
+    if (expr_is_sharding_key(where->left, src, column) && expr_is_literal(where->right)) {
+        return where->right;
+    }
+    if (expr_is_sharding_key(where->right, src, column) && expr_is_literal(where->left)) {
+        return where->left;
+    }
+    return NULL;
+}
+
+/* a literal as the index table stores it */
+static const char *
+global_index_value_text(sql_expr_t *value, char *buf, size_t size)
+{
+    gint64 intval;
+    if (value->op != TK_STRING && sql_expr_get_int(value, &intval)) {
+        snprintf(buf, size, "%" G_GINT64_FORMAT, intval);
+        return buf;
+    }
+    return value->token_text;
+}
+
+/* queries on a value being written go to all groups until its new pair is copied */
+static void
+global_index_evict_value(sharding_table_t *shard_info, sql_expr_t *value)
+{
+    if (value && value->op != TK_NULL && expr_is_literal(value)) {
+        char buf[32];
+        global_index_evict(shard_info->db->str, shard_info->name->str,
+                           global_index_value_text(value, buf, sizeof(buf)));
+    }
+}
+
+/**
+ * route by the global index of the table, see sharding-global-index.h
+ * @return FALSE if the value is not known to the index
+ */
+static gboolean
+routing_global_index(sql_expr_t *where, const sql_src_item_t *src, const char *db, GPtrArray *groups,
+                     sharding_plan_t *plan)
+{
+    sharding_table_t *shard_info = shard_conf_get_info(db, src->table_name);
+    if (!shard_info || !shard_info->index_column) {
+        return FALSE;
+    }
+    sql_expr_t *value = where_column_value(where, src, shard_info->index_column->str);
+    if (!value) {
+        return FALSE;
+    }
+    if (plan->global_index_stale) {
+        global_index_evict_value(shard_info, value);    /* its group returned no row */
+        return FALSE;
+    }
+    char buf[32];
+    const char *text = global_index_value_text(value, buf, sizeof(buf));
+    const char *key = global_index_lookup(shard_info->db->str, shard_info->name->str, text);
+    struct condition_t cond = { TK_EQ, {0} };
+    if (!key || string_to_sharding_value(key, shard_info->shard_key_type, &cond) != PARSE_OK) {
+        return FALSE;
+    }
+    GPtrArray *partitions = g_ptr_array_new();
+    shard_conf_table_partitions(partitions, db, src->table_name);
+    partitions_filter(partitions, cond);
+    partitions_get_group_names(partitions, groups);
+    g_ptr_array_free(partitions, TRUE);
+    plan->global_index_hint = groups->len > 0;
+    return plan->global_index_hint;
+}
+
+/* keep the partitions also in other */
+static void
+partitions_intersect(GPtrArray *partitions, GPtrArray *other)
+{
+    int i, j;
+    for (i = partitions->len - 1; i >= 0; --i) {
+        gpointer part = g_ptr_array_index(partitions, i);
+        for (j = 0; j < other->len && g_ptr_array_index(other, j) != part; ++j) ;
+        if (j == other->len) {
+            g_ptr_array_remove_index(partitions, i);
+        }
+    }
+}
+
+/**
+ * the only source of a select that reads a sharding table, directly or
+ * through a derived table
+ * @return FALSE if there is none or more than one
+ */
+static gboolean
+select_sharding_source(sql_select_t *select, char *default_db, sql_src_item_t **src_out, char **db_out)
+{
+    sql_src_list_t *sources = select->from_src;
+    *src_out = NULL;
+    int i;
+    for (i = 0; sources && i < sources->len; ++i) {
+        sql_src_item_t *src = g_ptr_array_index(sources, i);
+        char *db = src->dbname ? src->dbname : default_db;
+        char *table = NULL;
+        if ((src->table_name && shard_conf_is_shard_table(db, src->table_name))
+            || (src->select && sql_select_contains_sharding_table(src->select, &db, &table))) {
+            if (*src_out) {
+                return FALSE;
+            }
+            *src_out = src;
+            *db_out = src->dbname ? src->dbname : default_db;
+        }
+    }
+    return *src_out != NULL;
+}
+
+static GPtrArray *derived_key_partitions(sql_src_item_t *derived, char *default_db, sql_expr_t *outer_where);
+
+/**
+ * partitions holding all the sharding rows a select reads
+ * @return NULL if its WHERE doesn't narrow them down
+ */
+static GPtrArray *
+select_key_partitions(sql_select_t *select, char *default_db)
+{
+    sql_src_item_t *src;
+    char *db;
+    if (!select_sharding_source(select, default_db, &src, &db)) {
+        return NULL;
+    }
+    if (src->select) {
+        return derived_key_partitions(src, default_db, select->where_clause);
+    }
+    sharding_table_t *shard_info = shard_conf_get_info(db, src->table_name);
+    if (!optimize_sharding_condition(select->where_clause, src, shard_info->pkey->str)) {
+        return NULL;
+    }
+    GPtrArray *partitions = g_ptr_array_new();
+    shard_conf_table_partitions(partitions, db, src->table_name);
+    if (partitions_filter_expr(partitions, select->where_clause) != PARSE_OK) {
+        g_ptr_array_free(partitions, TRUE);
+        return NULL;
+    }
+    return partitions;
+}
+
+/* name of the sharding key among the columns of a derived table, NULL if not selected as is */
+static const char *
+derived_key_column(sql_select_t *select, const sql_src_item_t *src, const char *key)
+{
+    int i;
+    for (i = 0; select->columns && i < select->columns->len; ++i) {
+        sql_expr_t *col = g_ptr_array_index(select->columns, i);
+        if (col->op == TK_STAR) {
+            return key;
+        }
+        if (col->op == TK_DOT && col->right && col->right->op == TK_STAR
+            && (strcasecmp(col->left->token_text, src->table_name) == 0
+                || (src->table_alias && strcmp(col->left->token_text, src->table_alias) == 0))) {
+            return key;
+        }
+        if (expr_is_sharding_key(col, src, key)) {
+            return col->alias ? col->alias : key;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Partitions holding all the rows of a derived table.
+ * They are pinned by the WHERE of each member of the derived select, or by
+ * the outer WHERE on the sharding key column it selects:
+ *   SELECT * FROM (SELECT id, name FROM t) AS d WHERE d.id = 1
+ * @return NULL if not pinned
+ */
+static GPtrArray *
+derived_key_partitions(sql_src_item_t *derived, char *default_db, sql_expr_t *outer_where)
+{
+    sql_select_t *select = derived->select;
+    GPtrArray *pinned = NULL;
+    sql_select_t *member;
+    for (member = select; member; member = member->prior) {
+        GPtrArray *partitions = select_key_partitions(member, default_db);
+        if (!partitions) {
+            if (pinned) {
+                g_ptr_array_free(pinned, TRUE);
+                pinned = NULL;
+            }
+            break;
+        }
+        if (pinned) {
+            partitions_merge(pinned, partitions);
+            g_ptr_array_free(partitions, TRUE);
+        } else {
+            pinned = partitions;
+        }
+    }
+
+    sql_src_item_t *src;
+    char *db;
+    if (select->prior || !derived->table_alias || !outer_where
+        || !select_sharding_source(select, default_db, &src, &db) || src->select) {
+        return pinned;
+    }
+    sharding_table_t *shard_info = shard_conf_get_info(db, src->table_name);
+    const char *column = derived_key_column(select, src, shard_info->pkey->str);
+    sql_src_item_t outer = { 0 };
+    outer.table_name = derived->table_alias;
+    outer.table_alias = derived->table_alias;
+    if (!column || !optimize_sharding_condition(outer_where, &outer, column)) {
+        return pinned;
+    }
+    GPtrArray *partitions = g_ptr_array_new();
+    shard_conf_table_partitions(partitions, db, src->table_name);
+    if (partitions_filter_expr(partitions, outer_where) != PARSE_OK) {
+        g_ptr_array_free(partitions, TRUE);
+        return pinned;
+    }
+    if (pinned) {
+        partitions_intersect(pinned, partitions);
+        g_ptr_array_free(partitions, TRUE);
+        return pinned;
+    }
+    return partitions;
+}
+
+/* is p a column of the table, qualified so that it can't be a column of the subquery */
+static gboolean
+expr_is_outer_column(sql_expr_t *p, const sql_src_item_t *outer, const char *column, sql_select_t *subquery)
+{
+    if (p->op != TK_DOT || !expr_is_sharding_key(p, outer, column)) {
+        return FALSE;
+    }
+    int i;
+    for (i = 0; subquery->from_src && i < subquery->from_src->len; ++i) {
+        sql_src_item_t *src = g_ptr_array_index(subquery->from_src, i);
+        if (src->table_name && expr_is_sharding_key(p, src, column)) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+/**
+ * Partitions of an IN or EXISTS subquery on a table of the given vdb, when
+ * it only reads rows on the groups of the outer rows.
+ *   IN: the only column is the sharding key of the subquery table
+ *   EXISTS: its WHERE has "sharding key = outer.sharding key", which is
+ *     marked as a link so that it isn't taken as a value of the key
+ * @return NULL if not pinned
+ */
+static GPtrArray *
+subquery_key_partitions(sql_select_t *select, char *default_db, GPtrArray *vdb_partitions,
+                        const sql_src_item_t *outer, const char *outer_key)
+{
+    sql_src_item_t *src;
+    char *db;
+    if (select->prior || !select_sharding_source(select, default_db, &src, &db) || src->select) {
+        return NULL;
+    }
+    sharding_table_t *shard_info = shard_conf_get_info(db, src->table_name);
+    if (shard_info->partitions != vdb_partitions) {
+        return NULL;
+    }
+    const char *key = shard_info->pkey->str;
+    if (outer) {
+        GPtrArray *conds = g_ptr_array_new();
+        join_collect_conjuncts(select->where_clause, conds);
+        sql_expr_t *link = NULL;
+        int i;
+        for (i = 0; i < conds->len && !link; ++i) {
+            sql_expr_t *p = g_ptr_array_index(conds, i);
+            if (p->op != TK_EQ || !p->left || !p->right) {
+                continue;
+            }
+            if ((expr_is_sharding_key(p->left, src, key) && expr_is_outer_column(p->right, outer, outer_key, select))
+                || (expr_is_sharding_key(p->right, src, key)
+                    && expr_is_outer_column(p->left, outer, outer_key, select))) {
+                link = p;
+            }
+        }
+        g_ptr_array_free(conds, TRUE);
+        if (!link) {
+            return NULL;
+        }
+        link->flags |= EP_JOIN_LINK;
+    } else {
+        if (!select->columns || select->columns->len != 1
+            || !expr_is_sharding_key(g_ptr_array_index(select->columns, 0), src, key)) {
+            return NULL;
+        }
+    }
+    return select_key_partitions(select, default_db);
+}
+
+/**
+ * Partitions kept by the top-level IN and EXISTS subqueries co-located with
+ * the sharding table, e.g. for t and t2 in the same vdb:
+ *   WHERE t.id IN (SELECT t2.id FROM t2 WHERE t2.id = 1)
+ *   WHERE EXISTS (SELECT 1 FROM t2 WHERE t2.id = t.id AND t2.id = 1)
+ * @return NULL if none pins the sharding key
+ */
+static GPtrArray *
+where_subquery_partitions(sql_expr_t *where, const sql_src_item_t *table, char *default_db,
+                          sharding_table_t *shard_info)
+{
+    GPtrArray *conds = g_ptr_array_new();
+    join_collect_conjuncts(where, conds);
+    GPtrArray *pinned = NULL;
+    int i;
+    for (i = 0; i < conds->len; ++i) {
+        sql_expr_t *p = g_ptr_array_index(conds, i);
+        GPtrArray *partitions = NULL;
+        if (p->op == TK_IN && p->select && p->left && expr_is_sharding_key(p->left, table, shard_info->pkey->str)) {
+            partitions = subquery_key_partitions(p->select, default_db, shard_info->partitions, NULL, NULL);
+        } else if (p->op == TK_EXISTS && p->select) {
+            partitions = subquery_key_partitions(p->select, default_db, shard_info->partitions,
+                                                 table, shard_info->pkey->str);
+        }
+        if (!partitions) {
+            continue;
+        }
+        if (pinned) {
+            partitions_intersect(pinned, partitions);
+            g_ptr_array_free(partitions, TRUE);
+        } else {
+            pinned = partitions;
+        }
+    }
+    g_ptr_array_free(conds, TRUE);
+    return pinned;
+}
+
+/* IN (SELECT ...) is not a value of the key, the subquery is routed by itself */
+static int
+where_unmark_subquery_keys(sql_expr_t *p)
+{
+    if (!p) {
+        return 0;
+    }
+    if (is_logical_op(p->op)) {
+        return where_unmark_subquery_keys(p->left) + where_unmark_subquery_keys(p->right);
+    }
+    if (p->op == TK_IN && p->select && (p->flags & EP_SHARD_COND)) {
+        p->flags &= ~EP_SHARD_COND;
+        return 1;
+    }
+    return 0;
+}
+
+/* a sharding table inside a derived table, on all its groups */
+static int
+routing_derived_all(sql_context_t *context, char *db, char *table, GPtrArray *groups)
+{
+    sharding_filter_sql(context);   /* sharding table inside sub-query, should be filterd */
+    if (context->rc == PARSE_NOT_SUPPORT) {
+        return ERROR_UNPARSABLE;
+    }
+    shard_conf_get_table_groups(groups, db, table);
+    return USE_ALL_SHARDINGS;
+}
+
+static int
+routing_select(sql_context_t *context, const sql_select_t *select, char *default_db, guint32 fixture,
+               query_stats_t *stats, GPtrArray *groups /* out */ , sharding_plan_t *plan)
 {
     sql_src_list_t *sources = select->from_src;
     if (!sources) {
@@ -865,19 +1778,35 @@ routing_select(sql_context_t *context, const sql_select_t *select,
     char *db = default_db;
     GPtrArray *sharding_tables = g_ptr_array_new();
     GList *single_tables = NULL;
+    GPtrArray *derived = NULL;  /* partitions pinned by the only, derived, sharding source */
+    char *derived_db = NULL;
+    char *derived_table = NULL;
     int i;
     for (i = 0; i < sources->len; ++i) {
         sql_src_item_t *src = g_ptr_array_index(sources, i);
         char *table = NULL;
+        char *outer_db = db;
         if (src->select && sql_select_contains_sharding_table(src->select, &db, &table)) {
-            sharding_filter_sql(context);   /* sharding table inside sub-query, should be filterd */
-            if (context->rc == PARSE_NOT_SUPPORT) {
-                g_ptr_array_free(sharding_tables, TRUE);
-                return ERROR_UNPARSABLE;
+            sql_src_item_t *only_src;
+            char *only_db;
+            GPtrArray *partitions = NULL;
+            if (select_sharding_source((sql_select_t *)select, default_db, &only_src, &only_db)) {
+                partitions = derived_key_partitions(src, default_db, select->where_clause);
+            }
+            if (partitions && partitions->len > 0) {
+                /* routed once the other sources are known */
+                derived = partitions;
+                derived_db = db;
+                derived_table = table;
+                db = outer_db;
+                continue;
+            }
+            if (partitions) {
+                g_ptr_array_free(partitions, TRUE);
             }
-            shard_conf_get_table_groups(groups, db, table);
             g_ptr_array_free(sharding_tables, TRUE);
-            return USE_ALL_SHARDINGS;
+            g_list_free(single_tables);
+            return routing_derived_all(context, db, table, groups);
         }
         if (src->select) {      /* subquery not contain sharding table, try to find single table */
             sql_select_get_single_tables(src->select, db, &single_tables);
@@ -892,11 +1821,28 @@ routing_select(sql_context_t *context, const sql_select_t *select,
         }
     }
 
+    if (derived) {
+        /* it is the only sharding source, so sharding_tables is empty */
+        g_ptr_array_free(sharding_tables, TRUE);
+        if (single_tables) {
+            /* joined with a single table, the groups can't be narrowed */
+            g_list_free(single_tables);
+            g_ptr_array_free(derived, TRUE);
+            return routing_derived_all(context, derived_db, derived_table, groups);
+        }
+        partitions_get_group_names(derived, groups);
+        g_ptr_array_free(derived, TRUE);
+        return USE_SHARDING;
+    }
+
     /* handle single table */
     if (single_tables) {
         if (sharding_tables->len > 0) {
             g_ptr_array_free(sharding_tables, TRUE);
             g_list_free(single_tables);
+            if (sources->len == 2) {
+                return routing_hash_join(context, select, default_db, plan);
+            }
             sql_context_append_msg(context, "(cetus) JOIN single-table WITH sharding-table");
             return ERROR_UNPARSABLE;
         }
@@ -910,6 +1856,10 @@ routing_select(sql_context_t *context, const sql_select_t *select,
         if (groups->len > 1) {
             g_ptr_array_free(sharding_tables, TRUE);
             g_list_free(single_tables);
+            if (sources->len == 2) {
+                g_ptr_array_set_size(groups, 0);
+                return routing_hash_join(context, select, default_db, plan);
+            }
             sql_context_append_msg(context, "(cetus)JOIN multiple single-tables not allowed");
             return ERROR_UNPARSABLE;
         } else {
@@ -929,6 +1879,9 @@ routing_select(sql_context_t *context, const sql_select_t *select,
     if (sharding_tables->len >= 2) {
         if (!join_on_sharding_key(db, sharding_tables, select->where_clause)) {
             g_ptr_array_free(sharding_tables, TRUE);
+            if (sources->len == 2) {
+                return routing_hash_join(context, select, default_db, plan);
+            }
             sql_context_append_msg(context, "(proxy)JOIN must inside VDB and have explicit join-on condition");
             return ERROR_UNPARSABLE;
         }
@@ -943,41 +1896,72 @@ routing_select(sql_context_t *context, const sql_select_t *select,
 
         /* join tables have same sharding key, we are graunteed tableA.key = tableB.key
            so tableA.key = x also applies to tableB */
-        if (optimize_sharding_condition(select->where_clause, shard_table, shard_info->pkey->str)) {
+        int key_occur = optimize_sharding_condition(select->where_clause, shard_table, shard_info->pkey->str);
+        if (key_occur > where_unmark_subquery_keys(select->where_clause)) {
             has_sharding_key = TRUE;
         }
     }
 
-    if (has_sharding_key) {
+    /* subqueries on the same vdb narrow down the groups of a single sharding table */
+    GPtrArray *pinned = NULL;
+    if (sharding_tables->len == 1) {
+        sql_src_item_t *shard_table = g_ptr_array_index(sharding_tables, 0);
+        char *table_db = shard_table->dbname ? shard_table->dbname : db;
+        pinned = where_subquery_partitions(select->where_clause, shard_table, default_db,
+                                           shard_conf_get_info(table_db, shard_table->table_name));
+    }
+
+    if (has_sharding_key || pinned) {
         GPtrArray *partitions = g_ptr_array_new();  /* GPtrArray<sharding_partition_t *> */
         for (i = 0; i < sharding_tables->len; ++i) {
             sql_src_item_t *shard_table = g_ptr_array_index(sharding_tables, 0);
             db = shard_table->dbname ? shard_table->dbname : db;
 
             shard_conf_table_partitions(partitions, db, shard_table->table_name);
-            int rc = partitions_filter_expr(partitions, select->where_clause);
+            int rc = has_sharding_key ? partitions_filter_expr(partitions, select->where_clause) : PARSE_OK;
             if (rc == PARSE_ERROR) {
                 g_warning(G_STRLOC ":unrecognized key ranges");
                 g_ptr_array_free(partitions, TRUE);
                 g_ptr_array_free(sharding_tables, TRUE);
+                if (pinned) {
+                    g_ptr_array_free(pinned, TRUE);
+                }
                 sql_context_append_msg(context, "(proxy)sharding key parse error");
                 return ERROR_UNPARSABLE;
-            } else if (rc == PARSE_UNRECOGNIZED) {
+            } else if (rc == PARSE_UNRECOGNIZED && !pinned) {
                 g_ptr_array_free(partitions, TRUE);
                 g_ptr_array_free(sharding_tables, TRUE);
                 shard_conf_get_table_groups(groups, db, shard_table->table_name);
                 stats->com_select_bad_key += 1;
                 return USE_ALL_SHARDINGS;
+            } else if (rc == PARSE_UNRECOGNIZED) {
+                g_ptr_array_set_size(partitions, 0);
+                shard_conf_table_partitions(partitions, db, shard_table->table_name);
+            }
+            if (pinned) {
+                partitions_intersect(partitions, pinned);
             }
             partitions_get_group_names(partitions, groups);
         }
         g_ptr_array_free(partitions, TRUE);
+        if (pinned) {
+            g_ptr_array_free(pinned, TRUE);
+        }
     }
 
     if (groups->len > 0) {
         g_ptr_array_free(sharding_tables, TRUE);
         return USE_SHARDING;
     } else {
+        if (!has_sharding_key && sharding_tables->len == 1) {
+            sql_src_item_t *shard_table = g_ptr_array_index(sharding_tables, 0);
+            db = shard_table->dbname ? shard_table->dbname : db;
+            if (routing_global_index(select->where_clause, shard_table, db, groups, plan)) {
+                g_ptr_array_free(sharding_tables, TRUE);
+                stats->com_select_global_index += 1;
+                return USE_SHARDING;
+            }
+        }
         /* has sharding table, but no sharding key
            OR sharding key filter out all groups */
         for (i = 0; i < sharding_tables->len; ++i) {
@@ -1018,6 +2002,51 @@ expr_same_with_sharding_cond(sql_expr_t *equation, sql_expr_t *where)
     return is_same;
 }
 
+/* REPLACE INTO `db`.`index_table` (`column`,`key`) VALUES */
+static GString *
+global_index_sql_new(const char *db, sharding_table_t *shard_info)
+{
+    GString *sql = g_string_new("REPLACE INTO ");
+    string_append_backquoted(sql, L(db));
+    g_string_append_c(sql, '.');
+    string_append_backquoted(sql, S(shard_info->index_table));
+    g_string_append(sql, " (");
+    string_append_backquoted(sql, S(shard_info->index_column));
+    g_string_append_c(sql, ',');
+    string_append_backquoted(sql, S(shard_info->pkey));
+    g_string_append(sql, ") VALUES ");
+    return sql;
+}
+
+static void
+global_index_append_pair(GString *sql, const sql_expr_t *value, const sql_expr_t *key)
+{
+    g_string_append_c(sql, '(');
+    g_string_append_len(sql, value->start, value->end - value->start);
+    g_string_append_c(sql, ',');
+    g_string_append_len(sql, key->start, key->end - key->start);
+    g_string_append_c(sql, ')');
+}
+
+/* the new pair goes to the index group in the same distributed transaction as the row */
+static gboolean
+update_global_index(sql_context_t *context, const char *db, sharding_table_t *shard_info,
+                    const sql_src_item_t *table, sql_expr_t *where, sql_expr_t *value, sharding_plan_t *plan)
+{
+    if (value->op == TK_NULL) {
+        return TRUE;            /* NULL is not indexed, a stale pair only finds no row */
+    }
+    sql_expr_t *key = where_column_value(where, table, shard_info->pkey->str);
+    if (!key || !expr_is_literal(value)) {
+        sql_context_append_msg(context, "(proxy)update of global index column needs a constant and sharding key = constant");
+        return FALSE;
+    }
+    GString *sql = global_index_sql_new(db, shard_info);
+    global_index_append_pair(sql, value, key);
+    sharding_plan_add_group_sql(plan, shard_info->index_group, sql);
+    return TRUE;
+}
+
 static int
 routing_update(sql_context_t *context, sql_update_t *update,
                char *default_db, sharding_plan_t *plan, GPtrArray *groups, guint32 fixture)
@@ -1048,6 +2077,7 @@ routing_update(sql_context_t *context, sql_update_t *update,
     int key_occur = optimize_sharding_condition(update->where_clause,
                                                 table, shard_info->pkey->str);
     int i = 0;
+    sql_expr_t *index_value = NULL;
     /* update sharding key is not allowed */
     for (i = 0; update->set_list && i < update->set_list->len; ++i) {
         sql_expr_t *equation = g_ptr_array_index(update->set_list, i);
@@ -1055,6 +2085,9 @@ routing_update(sql_context_t *context, sql_update_t *update,
             sql_context_append_msg(context, "(proxy)syntax error");
             return ERROR_UNPARSABLE;
         }
+        if (shard_info->index_column && expr_is_sharding_key(equation->left, table, shard_info->index_column->str)) {
+            index_value = equation->right;
+        }
         if (expr_is_sharding_key(equation->left, table, shard_info->pkey->str)) {
             if (!(key_occur == 1    /* "update set k = 1 where k = 1" is legal */
                   && expr_same_with_sharding_cond(equation, update->where_clause))) {
@@ -1075,13 +2108,21 @@ routing_update(sql_context_t *context, sql_update_t *update,
             return ERROR_UNPARSABLE;
         }
     }
-    partitions_get_group_names(partitions, groups);
+    partitions_get_write_group_names(partitions, groups);
     g_ptr_array_free(partitions, TRUE);
 
+    if (index_value) {
+        /* the old value moves away, the new one may have been elsewhere */
+        global_index_evict_value(shard_info, where_column_value(update->where_clause, table,
+                                                                shard_info->index_column->str));
+        global_index_evict_value(shard_info, index_value);
+        return update_global_index(context, db, shard_info, table, update->where_clause, index_value, plan)
+            ? USE_DIS_TRAN : ERROR_UNPARSABLE;
+    }
     if (groups->len == 1) {
         return USE_SHARDING;
     } else if (groups->len == 0) {
-        shard_conf_get_table_groups(groups, db, table->table_name);
+        table_get_write_group_names(db, table->table_name, groups);
         return USE_DIS_TRAN;
     } else {
         return USE_DIS_TRAN;
@@ -1175,6 +2216,9 @@ insert_multi_value(sql_context_t *context, sql_insert_t *insert,
         insert->sel_val = values_list;
         sql_construct_insert(sql, insert);
         sharding_plan_add_group_sql(plan, part->group_name, sql);
+        if (part->migrate_to) {
+            sharding_plan_add_group_sql(plan, part->migrate_to, g_string_new_len(S(sql)));
+        }
     }
     rc = plan->groups->len > 1 ? USE_DIS_TRAN : USE_NON_SHARDING_TABLE;
 
@@ -1187,6 +2231,57 @@ insert_multi_value(sql_context_t *context, sql_insert_t *insert,
     return rc;
 }
 
+/* the pairs of the inserted rows go to the index group in the same distributed transaction */
+static gboolean
+insert_global_index(sql_context_t *context, sql_insert_t *insert, const char *db,
+                    sharding_table_t *shard_info, int shard_key_index, sharding_plan_t *plan)
+{
+    if (!shard_info->index_column) {
+        return TRUE;
+    }
+    sql_id_list_t *cols = insert->columns;
+    int index_col = -1;
+    int i;
+    for (i = 0; i < cols->len; ++i) {
+        if (strcasecmp(g_ptr_array_index(cols, i), shard_info->index_column->str) == 0) {
+            index_col = i;
+            break;
+        }
+    }
+    if (index_col == -1) {
+        return TRUE;            /* NULL is not indexed */
+    }
+    GString *sql = global_index_sql_new(db, shard_info);
+    gsize head_len = sql->len;
+    sql_select_t *values;
+    for (values = insert->sel_val; values; values = values->prior) {
+        if (values->columns->len <= MAX(index_col, shard_key_index)) {
+            continue;
+        }
+        sql_expr_t *value = g_ptr_array_index(values->columns, index_col);
+        sql_expr_t *key = g_ptr_array_index(values->columns, shard_key_index);
+        if (value->op == TK_NULL) {
+            continue;
+        }
+        if (!expr_is_literal(value) || !expr_is_literal(key)) {
+            g_string_free(sql, TRUE);
+            sql_context_append_msg(context, "(proxy)global index column must be given a constant");
+            return FALSE;
+        }
+        if (sql->len > head_len) {
+            g_string_append_c(sql, ',');
+        }
+        global_index_append_pair(sql, value, key);
+        global_index_evict_value(shard_info, value);
+    }
+    if (sql->len > head_len) {
+        sharding_plan_add_group_sql(plan, shard_info->index_group, sql);
+    } else {
+        g_string_free(sql, TRUE);
+    }
+    return TRUE;
+}
+
 static int
 routing_insert(sql_context_t *context, sql_insert_t *insert, char *default_db, sharding_plan_t *plan, guint32 fixture)
 {
@@ -1248,7 +2343,14 @@ routing_insert(sql_context_t *context, sql_insert_t *insert, char *default_db, s
         return ERROR_UNPARSABLE;
     }
     if (sel_val->flags & SF_MULTI_VALUE) {
-        return insert_multi_value(context, insert, db, table, shard_info, shard_key_index, plan);
+        int rc = insert_multi_value(context, insert, db, table, shard_info, shard_key_index, plan);
+        if (rc < 0) {
+            return rc;
+        }
+        if (!insert_global_index(context, insert, db, shard_info, shard_key_index, plan)) {
+            return ERROR_UNPARSABLE;
+        }
+        return plan->groups->len > 1 ? USE_DIS_TRAN : rc;
     }
 
     /* SINGLE VALUE */
@@ -1272,19 +2374,21 @@ routing_insert(sql_context_t *context, sql_insert_t *insert, char *default_db, s
     partitions_filter(partitions, cond);
 
     GPtrArray *groups = g_ptr_array_new();
-    partitions_get_group_names(partitions, groups);
+    partitions_get_write_group_names(partitions, groups);
     g_ptr_array_free(partitions, TRUE);
     sharding_plan_add_groups(plan, groups);
     g_ptr_array_free(groups, TRUE);
 
+    if (plan->groups->len > 0 && !insert_global_index(context, insert, db, shard_info, shard_key_index, plan)) {
+        return ERROR_UNPARSABLE;
+    }
     if (plan->groups->len == 0) {
         /* TODO: return code when pkey out of range; */
         return USE_NON_SHARDING_TABLE;
-    } else {
-        if (plan->groups->len != 1) {   /* can't happen */
-            return ERROR_UNPARSABLE;
-        }
+    } else if (plan->groups->len == 1) {
         return USE_SHARDING;
+    } else {
+        return USE_DIS_TRAN;    /* partition being moved, or global index */
     }
 }
 
@@ -1326,7 +2430,7 @@ routing_delete(sql_context_t *context, sql_delete_t *delete,
     }
     plan->table_type = SHARDED_TABLE;
     if (!delete->where_clause) {
-        shard_conf_get_table_groups(groups, db, table->table_name);
+        table_get_write_group_names(db, table->table_name, groups);
         if (groups->len == 1) {
             return USE_SHARDING;
         } else if (groups->len > 1) {
@@ -1335,6 +2439,10 @@ routing_delete(sql_context_t *context, sql_delete_t *delete,
     }
 
     sharding_table_t *shard_info = shard_conf_get_info(db, table->table_name);
+    if (shard_info->index_column) {
+        global_index_evict_value(shard_info, where_column_value(delete->where_clause, table,
+                                                                shard_info->index_column->str));
+    }
     GPtrArray *partitions = g_ptr_array_new();
     shard_conf_table_partitions(partitions, db, table->table_name);
     gboolean has_sharding_key = optimize_sharding_condition(delete->where_clause, table, shard_info->pkey->str);
@@ -1349,13 +2457,13 @@ routing_delete(sql_context_t *context, sql_delete_t *delete,
         sql_context_append_msg(context, "(proxy)sharding key parse error");
         return ERROR_UNPARSABLE;
     }
-    partitions_get_group_names(partitions, groups);
+    partitions_get_write_group_names(partitions, groups);
     g_ptr_array_free(partitions, TRUE);
 
     if (groups->len == 1) {
         return USE_SHARDING;
     } else if (groups->len == 0) {
-        shard_conf_get_table_groups(groups, db, table->table_name);
+        table_get_write_group_names(db, table->table_name, groups);
         return USE_DIS_TRAN;
     } else if (groups->len > 1) {
         return USE_DIS_TRAN;
@@ -1453,7 +2561,7 @@ sharding_parse_groups(GString *default_db, sql_context_t *context, query_stats_t
     case STMT_SELECT:{
         sql_select_t *select = context->sql_statement;
         while (select) {
-            rc = routing_select(context, select, db, fixture, stats, groups);
+            rc = routing_select(context, select, db, fixture, stats, groups, plan);
             if (rc < 0) {
                 break;
             }
@@ -1670,6 +2778,43 @@ select_has_AVG(sql_select_t *select)
     return FALSE;
 }
 
+/* every AVG takes one more aggregate slot in merge for its hidden COUNT */
+static gboolean
+select_avg_fits_aggr_limit(sql_select_t *select)
+{
+    int i, num_aggregate = 0;
+    for (i = 0; select->columns && i < select->columns->len; ++i) {
+        sql_expr_t *expr = g_ptr_array_index(select->columns, i);
+        if (expr->op == TK_FUNCTION) {
+            enum sql_func_type_t type = sql_func_type(expr->token_text);
+            if (type == FT_AVG) {
+                if (expr->flags & EP_DISTINCT) {
+                    return FALSE;
+                }
+                num_aggregate += 2;
+            } else if (type != FT_UNKNOWN) {
+                num_aggregate += 1;
+            }
+        }
+    }
+    return num_aggregate <= MAX_AGGR_FUNS;
+}
+
+/* only COUNT(DISTINCT ...) in column, no GROUP BY/HAVING/ORDER BY/UNION */
+static gboolean
+select_is_plain_count_distinct(sql_select_t *select)
+{
+    if (select->prior || select->groupby_clause || select->having_clause || select->orderby_clause) {
+        return FALSE;
+    }
+    if (select->flags & SF_DISTINCT || !select->columns || select->columns->len != 1) {
+        return FALSE;
+    }
+    sql_expr_t *col = g_ptr_array_index(select->columns, 0);
+    return col->op == TK_FUNCTION && (col->flags & EP_DISTINCT)
+        && strcasecmp(col->token_text, "count") == 0 && col->list && col->list->len > 0;
+}
+
 /* group by & order by have only 1 column, and they are same */
 static gboolean
 select_groupby_orderby_have_same_column(sql_select_t *select)
@@ -1726,9 +2871,13 @@ sharding_filter_sql(sql_context_t *context)
         }
         if (context->clause_flags & CF_AGGREGATE) {
             if (select_has_AVG(select)) {
-                sql_context_set_error(context, PARSE_NOT_SUPPORT,
-                                      "(cetus)this AVG would be routed to multiple shards, not allowed");
-                return;
+                /* rewritten as SUM + COUNT, see sql_rewrite_avg_columns() */
+                if (select->prior || (select->flags & SF_DISTINCT) || !select_avg_fits_aggr_limit(select)) {
+                    sql_context_set_error(context, PARSE_NOT_SUPPORT,
+                                          "(cetus)this AVG would be routed to multiple shards, not allowed");
+                    return;
+                }
+                select->flags |= SF_REWRITE_AVG;
             }
             /* if we can't find simple aggregates, it's inside complex expressions */
             if (sql_expr_list_find_aggregate(select->columns) == 0) {
@@ -1742,11 +2891,15 @@ sharding_filter_sql(sql_context_t *context)
                                   "(cetus) can't ORDER BY and GROUP BY different columns on sharded sql");
             return;
         }
-        /* reject SELECT COUNT(DISTINCT) / SUM(DISTINCT) / AVG(DISTINCT) */
+        /* reject SUM(DISTINCT) / AVG(DISTINCT), COUNT(DISTINCT) is merged as a distinct key stream */
         if (context->clause_flags & CF_DISTINCT_AGGR) {
             char *aggr_name = NULL;
             int subquery = context->clause_flags & CF_SUBQUERY;
             if (select_has_distincted_aggregate(select, subquery, &aggr_name)) {
+                if (!subquery && select_is_plain_count_distinct(select)) {
+                    select->flags |= SF_COUNT_DISTINCT;
+                    return;
+                }
                 char msg[100];
                 snprintf(msg, 100, "(proxy) %s(DISTINCT ...) not supported", aggr_name);
                 sql_context_set_error(context, PARSE_NOT_SUPPORT, msg);
@@ -1755,3 +2908,21 @@ sharding_filter_sql(sql_context_t *context)
         }
     }
 }
+
+int
+sharding_key_write_groups(sharding_table_t *table, const char *key, GPtrArray *groups)
+{
+    struct condition_t cond = { TK_EQ, {0} };
+    if (string_to_sharding_value(key, table->shard_key_type, &cond) != PARSE_OK) {
+        return -1;
+    }
+    sharding_partition_t *part = partitions_get(table->partitions, cond);
+    if (!part) {
+        return -1;
+    }
+    g_ptr_array_add(groups, part->group_name);
+    if (part->migrate_to) {
+        g_ptr_array_add(groups, part->migrate_to);
+    }
+    return 0;
+}
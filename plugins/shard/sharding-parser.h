@@ -22,6 +22,7 @@
 #define __SHARDING_PARSER_H__
 
 #include "network-mysqld.h"
+#include "sharding-config.h"
 #include "sharding-query-plan.h"
 #include "sql-context.h"
 
@@ -43,4 +44,7 @@ NETWORK_API GString *sharding_modify_sql(sql_context_t *, having_condition_t *);
 
 NETWORK_API void sharding_filter_sql(sql_context_t *);
 
+/* groups written by a row whose sharding key is given as text, see load_data_route_func */
+NETWORK_API int sharding_key_write_groups(sharding_table_t *, const char *key, GPtrArray *groups);
+
 #endif //__SHARDING_PARSER_H__
@@ -39,10 +39,14 @@
 #include "chassis-event.h"
 #include "glib-ext.h"
 #include "sharding-config.h"
+#include "sharding-global-index.h"
+#include "sharding-migration.h"
 
 #define CHECK_ALIVE_INTERVAL 3
 #define CHECK_ALIVE_TIMES 2
-#define CHECK_DELAY_INTERVAL 300 * 1000 /* 300ms */
+#define CHECK_DELAY_INTERVAL 100 * 1000 /* 100ms */
+#define HEARTBEAT_HISTORY 64
+#define NO_DATA_LOG_INTERVAL (10 * G_USEC_PER_SEC)
 
 /* Each backend should have db <proxy_heart_beat> and table <tb_heartbeat> */
 #define HEARTBEAT_DB "proxy_heart_beat"
@@ -56,12 +60,19 @@ struct cetus_monitor_t {
     struct event write_master_timer;
     struct event read_slave_timer;
     struct event check_config_timer;
+    struct event reshard_timer;
+    struct event global_index_timer;
 
     GString *db_passwd;
     GHashTable *backend_conns;
 
     GList *registered_objects;
     char *config_id;
+
+    /* the heartbeats written to all masters lately, oldest first */
+    double heartbeats[HEARTBEAT_HISTORY];
+    int heartbeat_start;
+    int heartbeat_count;
 };
 
 static void
@@ -73,19 +84,6 @@ mysql_conn_free(gpointer e)
     }
 }
 
-static char *
-get_current_sys_timestr(void)
-{
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-#define BUFSIZE 32
-    char *time_sec = g_malloc(BUFSIZE);
-    strftime(time_sec, BUFSIZE, "%Y-%m-%d %H:%M:%S", localtime(&tv.tv_sec));
-    char *time_micro = g_strdup_printf("%s.%06ld", time_sec, tv.tv_usec);
-    g_free(time_sec);
-    return time_micro;
-}
-
 static MYSQL *
 get_mysql_connection(cetus_monitor_t *monitor, char *addr)
 {
@@ -177,6 +175,62 @@ check_backend_alive(int fd, short what, void *arg)
 
 static void check_slave_timestamp(int fd, short what, void *arg);
 
+static void
+add_heartbeat(cetus_monitor_t *monitor, double ts)
+{
+    int pos = (monitor->heartbeat_start + monitor->heartbeat_count) % HEARTBEAT_HISTORY;
+    monitor->heartbeats[pos] = ts;
+    if (monitor->heartbeat_count < HEARTBEAT_HISTORY) {
+        monitor->heartbeat_count++;
+    } else {
+        monitor->heartbeat_start = (monitor->heartbeat_start + 1) % HEARTBEAT_HISTORY;
+    }
+}
+
+/**
+ * the slave is behind since the first heartbeat it hasn't seen was written,
+ * a slave having the latest heartbeat is not behind at all
+ */
+static int
+get_slave_delay_msec(cetus_monitor_t *monitor, double ts_slave, double ts_now)
+{
+    double since = ts_slave;
+    int i;
+    for (i = 0; i < monitor->heartbeat_count; i++) {
+        double ts = monitor->heartbeats[(monitor->heartbeat_start + i) % HEARTBEAT_HISTORY];
+        if (ts > ts_slave + 0.0005) {
+            since = ts;
+            break;
+        }
+    }
+    if (i == 0 && monitor->heartbeat_count == HEARTBEAT_HISTORY) {
+        /* older than the whole history, the first one missed is forgotten */
+        since = ts_slave;
+    }
+    if (i == monitor->heartbeat_count && monitor->heartbeat_count > 0) {
+        return 0;
+    }
+    return ts_now > since ? (int)((ts_now - since) * 1000) : 0;
+}
+
+/* smooth the delay and keep the worst of the window */
+static void
+record_slave_delay(network_backend_t *backend, int delay_msec)
+{
+    backend->slave_delay_samples[backend->slave_delay_sample_pos] = delay_msec;
+    backend->slave_delay_sample_pos = (backend->slave_delay_sample_pos + 1) % SLAVE_DELAY_WINDOW;
+
+    int diff = delay_msec - backend->slave_delay_msec;
+    backend->slave_delay_msec += ABS(diff) < 4 ? diff : diff / 4;
+
+    int i;
+    int max_msec = 0;
+    for (i = 0; i < SLAVE_DELAY_WINDOW; i++) {
+        max_msec = MAX(max_msec, backend->slave_delay_samples[i]);
+    }
+    backend->slave_delay_max_msec = max_msec;
+}
+
 static void
 update_master_timestamp(int fd, short what, void *arg)
 {
@@ -191,7 +245,17 @@ update_master_timestamp(int fd, short what, void *arg)
      *   `p_ts` timestamp(3) NOT NULL DEFAULT CURRENT_TIMESTAMP(3),
      *   PRIMARY KEY (`p_id`)
      * ) ENGINE = InnoDB DEFAULT CHARSET = utf8;
+     *
+     * The heartbeat has the precision of the column, so that it reads back
+     * from the slaves exactly as it was written.
      */
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    char time_sec[32];
+    strftime(time_sec, sizeof(time_sec), "%Y-%m-%d %H:%M:%S", localtime(&tv.tv_sec));
+    long msec = tv.tv_usec / 1000;
+    gboolean written = TRUE;
+
     for (i = 0; i < network_backends_count(bs); i++) {
         network_backend_t *backend = network_backends_get(bs, i);
         if (backend->state == BACKEND_STATE_DELETED || backend->state == BACKEND_STATE_MAINTAINING)
@@ -199,15 +263,15 @@ update_master_timestamp(int fd, short what, void *arg)
 
         if (backend->type == BACKEND_TYPE_RW) {
             static char sql[1024];
-            char *cur_time_str = get_current_sys_timestr();
             snprintf(sql, sizeof(sql), "INSERT INTO %s.tb_heartbeat (p_id, p_ts)"
-                     " VALUES ('%s', '%s') ON DUPLICATE KEY UPDATE p_ts='%s'",
-                     HEARTBEAT_DB, monitor->config_id, cur_time_str, cur_time_str);
+                     " VALUES ('%s', '%s.%03ld') ON DUPLICATE KEY UPDATE p_ts=VALUES(p_ts)",
+                     HEARTBEAT_DB, monitor->config_id, time_sec, msec);
 
             char *backend_addr = backend->addr->name->str;
             MYSQL *conn = get_mysql_connection(monitor, backend_addr);
             if (conn == NULL) {
                 g_critical("Could not connect to Backend %s.", backend_addr);
+                written = FALSE;
             } else {
                 if (backend->state != BACKEND_STATE_UP) {
                     network_backends_modify(bs, i, backend->type, BACKEND_STATE_UP);
@@ -222,14 +286,20 @@ update_master_timestamp(int fd, short what, void *arg)
                     g_message("Update heartbeat success. backend: %s", backend_addr);
                 }
                 previous_result[i] = result;
+                if (result != 0) {
+                    written = FALSE;
+                }
             }
-            g_free(cur_time_str);
         }
     }
+    /* a heartbeat missing on some master would be taken for delay */
+    if (written) {
+        add_heartbeat(monitor, tv.tv_sec + ((double)msec) / 1000);
+    }
 
-    /* Wait 50ms for RO write data */
+    /* Give RO one interval to apply it */
     struct timeval timeout = { 0 };
-    timeout.tv_usec = 50 * 1000;
+    timeout.tv_usec = CHECK_DELAY_INTERVAL;
     ADD_MONITOR_TIMER(read_slave_timer, check_slave_timestamp, timeout);
 }
 
@@ -240,8 +310,10 @@ check_slave_timestamp(int fd, short what, void *arg)
     chassis *chas = monitor->chas;
     int i;
     network_backends_t *bs = chas->priv->backends;
+    int down_msec = (int)(chas->slave_delay_down_threshold_sec * 1000);
+    int recover_msec = (int)(chas->slave_delay_recover_threshold_sec * 1000);
 
-    /* Read delay sec and set slave UP/DOWN according to delay_secs */
+    /* Read delay and set slave UP/DOWN according to it */
     for (i = 0; i < network_backends_count(bs); i++) {
         network_backend_t *backend = network_backends_get(bs, i);
         if (backend->type == BACKEND_TYPE_RW || backend->state == BACKEND_STATE_DELETED ||
@@ -263,6 +335,8 @@ check_slave_timestamp(int fd, short what, void *arg)
         snprintf(sql, sizeof(sql), "select p_ts from %s.tb_heartbeat where p_id='%s'",
                  HEARTBEAT_DB, monitor->config_id);
         static int previous_result[256] = { 0 };    /* for each backend group */
+        static int no_data_count[256] = { 0 };
+        static gint64 no_data_logged[256] = { 0 };
         int result = mysql_real_query(conn, L(sql));
         if (result != previous_result[i] && result != 0) {
             g_critical("Select heartbeat error: %d, text: %s, backend: %s",
@@ -276,6 +350,7 @@ check_slave_timestamp(int fd, short what, void *arg)
             MYSQL_ROW row = mysql_fetch_row(rs_set);
             double ts_slave;
             if (row != NULL) {
+                no_data_count[i] = 0;
                 if (strstr(row[0], ".") != NULL) {
                     char **tms = g_strsplit(row[0], ".", -1);
                     glong ts_slave_sec = chassis_epoch_from_string(tms[0], NULL);
@@ -286,28 +361,36 @@ check_slave_timestamp(int fd, short what, void *arg)
                     ts_slave = chassis_epoch_from_string(row[0], NULL);
                 }
             } else {
-                g_critical("Check slave delay no data:%s", sql);
-                ts_slave = (double)G_MAXINT32;
+                /* at the start of an incident, then every few seconds rather than every heartbeat */
+                gint64 now = g_get_monotonic_time();
+                if (no_data_count[i]++ == 0 || now - no_data_logged[i] >= NO_DATA_LOG_INTERVAL) {
+                    g_critical("Check slave delay no data:%s, backend: %s, %d times",
+                               sql, backend_addr, no_data_count[i]);
+                    no_data_logged[i] = now;
+                }
+                ts_slave = 0;
             }
             if (ts_slave != 0) {
                 struct timeval tv;
                 gettimeofday(&tv, NULL);
                 double ts_now = tv.tv_sec + ((double)tv.tv_usec) / 1000000;
-                double delay_secs = ts_now - ts_slave;
-                backend->slave_delay_msec = (int)delay_secs *1000;
-                if (delay_secs > chas->slave_delay_down_threshold_sec && backend->state != BACKEND_STATE_DOWN) {
+                int delay_msec = get_slave_delay_msec(monitor, ts_slave, ts_now);
+                record_slave_delay(backend, delay_msec);
+                /* shed at once, take it back only when the whole window is good */
+                if (delay_msec > down_msec && backend->state != BACKEND_STATE_DOWN) {
                     network_backends_modify(bs, i, backend->type, BACKEND_STATE_DOWN);
-                    g_critical("Slave delay %.3f seconds. Set slave to DOWN.", delay_secs);
-                } else if (delay_secs <= chas->slave_delay_recover_threshold_sec && backend->state != BACKEND_STATE_UP) {
+                    g_critical("Slave delay %d ms (avg %d ms). Set slave to DOWN.",
+                               delay_msec, backend->slave_delay_msec);
+                } else if (backend->slave_delay_max_msec <= recover_msec && backend->state != BACKEND_STATE_UP) {
                     network_backends_modify(bs, i, backend->type, BACKEND_STATE_UP);
-                    g_message("Slave delay %.3f seconds. Recovered. Set slave to UP.", delay_secs);
+                    g_message("Slave delay %d ms (max %d ms). Recovered. Set slave to UP.",
+                              delay_msec, backend->slave_delay_max_msec);
                 }
             }
             mysql_free_result(rs_set);
         }
     }
     struct timeval timeout = { 0 };
-    timeout.tv_usec = CHECK_DELAY_INTERVAL;
     ADD_MONITOR_TIMER(write_master_timer, update_master_timestamp, timeout);
 }
 
@@ -351,6 +434,48 @@ check_config_worker(int fd, short what, void *arg)
     ADD_MONITOR_TIMER(check_config_timer, check_config_worker, timeout);
 }
 
+/* copies the rows of a moving partition, see sharding-migration.h */
+static void
+reshard_worker(int fd, short what, void *arg)
+{
+    cetus_monitor_t *monitor = arg;
+    struct timeval timeout = { 0 };
+    int delay_ms = 1000;
+
+    shard_migration_t *job = shard_migration_get_active();
+    if (job) {
+        MYSQL *from = get_mysql_connection(monitor, (char *)shard_migration_from_addr(job));
+        MYSQL *to = get_mysql_connection(monitor, (char *)shard_migration_to_addr(job));
+        delay_ms = shard_migration_step(job, from, to);
+    }
+
+    timeout.tv_sec = delay_ms / 1000;
+    timeout.tv_usec = (delay_ms % 1000) * 1000;
+    ADD_MONITOR_TIMER(reshard_timer, reshard_worker, timeout);
+}
+
+/* copies new global index pairs, see sharding-global-index.h */
+static void
+global_index_worker(int fd, short what, void *arg)
+{
+    cetus_monitor_t *monitor = arg;
+    struct timeval timeout = { 0 };
+    int delay_ms = monitor->chas->global_index_interval;
+
+    GPtrArray *indexes = global_index_get_all();
+    int i;
+    for (i = 0; indexes && i < indexes->len; ++i) {
+        global_index_t *index = g_ptr_array_index(indexes, i);
+        const char *addr = global_index_master_addr(index);
+        MYSQL *conn = addr ? get_mysql_connection(monitor, (char *)addr) : NULL;
+        delay_ms = MIN(delay_ms, global_index_poll(index, conn));
+    }
+
+    timeout.tv_sec = delay_ms / 1000;
+    timeout.tv_usec = (delay_ms % 1000) * 1000;
+    ADD_MONITOR_TIMER(global_index_timer, global_index_worker, timeout);
+}
+
 void
 cetus_monitor_open(cetus_monitor_t *monitor, monitor_type_t monitor_type)
 {
@@ -374,6 +499,18 @@ cetus_monitor_open(cetus_monitor_t *monitor, monitor_type_t monitor_type)
         ADD_MONITOR_TIMER(check_config_timer, check_config_worker, timeout);
         g_message("check_config monitor open.");
         break;
+    case MONITOR_TYPE_RESHARD:
+        timeout.tv_sec = 1;
+        timeout.tv_usec = 0;
+        ADD_MONITOR_TIMER(reshard_timer, reshard_worker, timeout);
+        g_message("reshard monitor open.");
+        break;
+    case MONITOR_TYPE_GLOBAL_INDEX:
+        timeout.tv_sec = 1;
+        timeout.tv_usec = 0;
+        ADD_MONITOR_TIMER(global_index_timer, global_index_worker, timeout);
+        g_message("global index monitor open.");
+        break;
     default:
         break;
     }
@@ -404,6 +541,18 @@ cetus_monitor_close(cetus_monitor_t *monitor, monitor_type_t monitor_type)
         }
         g_message("check_config monitor close.");
         break;
+    case MONITOR_TYPE_RESHARD:
+        if (monitor->reshard_timer.ev_base) {
+            evtimer_del(&monitor->reshard_timer);
+        }
+        g_message("reshard monitor close.");
+        break;
+    case MONITOR_TYPE_GLOBAL_INDEX:
+        if (monitor->global_index_timer.ev_base) {
+            evtimer_del(&monitor->global_index_timer);
+        }
+        g_message("global index monitor close.");
+        break;
     default:
         break;
     }
@@ -437,6 +586,8 @@ cetus_monitor_mainloop(void *data)
     if (chas->check_slave_delay) {
         cetus_monitor_open(monitor, MONITOR_TYPE_CHECK_DELAY);
     }
+    cetus_monitor_open(monitor, MONITOR_TYPE_RESHARD);
+    cetus_monitor_open(monitor, MONITOR_TYPE_GLOBAL_INDEX);
 #if 0
     cetus_monitor_open(monitor, MONITOR_TYPE_CHECK_CONFIG);
 #endif
@@ -29,7 +29,9 @@ typedef struct cetus_monitor_t cetus_monitor_t;
 typedef enum {
     MONITOR_TYPE_CHECK_ALIVE,
     MONITOR_TYPE_CHECK_DELAY,
-    MONITOR_TYPE_CHECK_CONFIG
+    MONITOR_TYPE_CHECK_CONFIG,
+    MONITOR_TYPE_RESHARD,
+    MONITOR_TYPE_GLOBAL_INDEX
 } monitor_type_t;
 
 typedef void (*monitor_callback_fn) (int, short, void *);
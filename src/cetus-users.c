@@ -26,17 +26,54 @@
 #include "cetus-util.h"
 #include "chassis-config.h"
 
+#define SHA1_LEN 20
+#define SHA256_LEN 32
+#define SCRAMBLE_NONCE_LEN 20
+
+/* hashes are computed when a password is set, logins only scramble */
 struct pwd_pair_t {
     char *client;
     char *server;
+    guint8 client_sha1[SHA1_LEN];           /* SHA1(pwd) */
+    guint8 client_sha1_sha1[SHA1_LEN];      /* SHA1(SHA1(pwd)) */
+    guint8 client_sha256[SHA256_LEN];       /* SHA256(pwd) */
+    guint8 client_sha256_sha256[SHA256_LEN];    /* SHA256(SHA256(pwd)), the caching_sha2 cache entry */
+    guint8 server_sha1[SHA1_LEN];
 };
 
+static void
+digest_of(GChecksumType type, const guint8 *data, gsize len, guint8 *digest)
+{
+    GChecksum *cs = g_checksum_new(type);
+    gsize digest_len = g_checksum_type_get_length(type);
+    g_checksum_update(cs, data, len);
+    g_checksum_get_digest(cs, digest, &digest_len);
+    g_checksum_free(cs);
+}
+
+static void
+pwd_pair_hash_client(struct pwd_pair_t *pwd)
+{
+    digest_of(G_CHECKSUM_SHA1, (const guint8 *)pwd->client, strlen(pwd->client), pwd->client_sha1);
+    digest_of(G_CHECKSUM_SHA1, pwd->client_sha1, SHA1_LEN, pwd->client_sha1_sha1);
+    digest_of(G_CHECKSUM_SHA256, (const guint8 *)pwd->client, strlen(pwd->client), pwd->client_sha256);
+    digest_of(G_CHECKSUM_SHA256, pwd->client_sha256, SHA256_LEN, pwd->client_sha256_sha256);
+}
+
+static void
+pwd_pair_hash_server(struct pwd_pair_t *pwd)
+{
+    digest_of(G_CHECKSUM_SHA1, (const guint8 *)pwd->server, strlen(pwd->server), pwd->server_sha1);
+}
+
 static struct pwd_pair_t *
 pwd_pair_new(const char *c, const char *s)
 {
     struct pwd_pair_t *pwd = g_new0(struct pwd_pair_t, 1);
     pwd->client = g_strdup(c);
     pwd->server = g_strdup(s);
+    pwd_pair_hash_client(pwd);
+    pwd_pair_hash_server(pwd);
     return pwd;
 }
 
@@ -47,10 +84,12 @@ pwd_pair_set_pwd(struct pwd_pair_t *pwd, const char *new_pass, enum cetus_pwd_ty
     case CETUS_CLIENT_PWD:
         g_free(pwd->client);
         pwd->client = g_strdup(new_pass);
+        pwd_pair_hash_client(pwd);
         break;
     case CETUS_SERVER_PWD:
         g_free(pwd->server);
         pwd->server = g_strdup(new_pass);
+        pwd_pair_hash_server(pwd);
         break;
     default:
         g_assert(0);
@@ -85,6 +124,8 @@ cetus_users_new()
 {
     cetus_users_t *users = g_new0(cetus_users_t, 1);
     users->records = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify) pwd_pair_free);
+    users->sha1 = g_checksum_new(G_CHECKSUM_SHA1);
+    users->sha256 = g_checksum_new(G_CHECKSUM_SHA256);
     return users;
 }
 
@@ -94,6 +135,8 @@ cetus_users_free(cetus_users_t *users)
     if (users) {
         if (users->records)
             g_hash_table_destroy(users->records);
+        g_checksum_free(users->sha1);
+        g_checksum_free(users->sha256);
         g_free(users);
     }
 }
@@ -228,6 +271,45 @@ cetus_users_write_json(cetus_users_t *users)
     return TRUE;
 }
 
+/**
+ * compare the client scramble with XOR(hash, DIGEST(first + second))
+ *
+ * mysql_native_password: XOR(SHA1(pwd), SHA1(nonce + SHA1(SHA1(pwd))))
+ * caching_sha2_password: XOR(SHA256(pwd), SHA256(SHA256(SHA256(pwd)) + nonce))
+ */
+static gboolean
+scramble_matches(GChecksum *cs, const guint8 *first, gsize first_len, const guint8 *second, gsize second_len,
+                 const guint8 *hash, gsize hash_len, const GString *scramble)
+{
+    guint8 digest[SHA256_LEN];
+    gsize digest_len = sizeof(digest);
+    guint8 diff = 0;
+    int i;
+
+    if (scramble->len != hash_len) {
+        return FALSE;
+    }
+
+    g_checksum_reset(cs);
+    g_checksum_update(cs, first, first_len);
+    g_checksum_update(cs, second, second_len);
+    g_checksum_get_digest(cs, digest, &digest_len);
+
+    for (i = 0; i < hash_len; i++) {
+        diff |= (digest[i] ^ hash[i]) ^ (guint8)scramble->str[i];
+    }
+    return diff == 0;
+}
+
+static gboolean
+is_caching_sha2(const network_mysqld_auth_response *response)
+{
+    if (response->auth_plugin_name->len > 0) {
+        return strcmp(response->auth_plugin_name->str, "caching_sha2_password") == 0;
+    }
+    return response->auth_plugin_data->len == SHA256_LEN;
+}
+
 gboolean
 cetus_users_authenticate_client(cetus_users_t *users,
                                 network_mysqld_auth_challenge *challenge, network_mysqld_auth_response *response)
@@ -235,26 +317,38 @@ cetus_users_authenticate_client(cetus_users_t *users,
     char *user_name = response->username->str;
 
     struct pwd_pair_t *pwd = g_hash_table_lookup(users->records, user_name);
-    if (pwd == NULL) {
+    if (pwd == NULL || pwd->client == NULL) {
         return FALSE;
     }
 
-    /* term 2: user_name and password must in frontend users/passwords */
-    if (pwd->client) {
-        GString *sha1_pwd = g_string_new(NULL);
-        network_mysqld_proto_password_hash(sha1_pwd, pwd->client, strlen(pwd->client));
-        GString *expected_response = g_string_new(NULL);
-        network_mysqld_proto_password_scramble(expected_response, S(challenge->auth_plugin_data), S(sha1_pwd));
-
-        if (g_string_equal(response->auth_plugin_data, expected_response)) {
-            g_string_free(expected_response, TRUE);
-            g_string_free(sha1_pwd, TRUE);
-            return TRUE;
-        }
-        g_string_free(expected_response, TRUE);
-        g_string_free(sha1_pwd, TRUE);
+    /* clients send nothing for an empty password */
+    if (pwd->client[0] == '\0') {
+        return response->auth_plugin_data->len == 0;
+    }
+
+    /* may carry a trailing \0 */
+    if (challenge->auth_plugin_data->len < SCRAMBLE_NONCE_LEN) {
+        return FALSE;
+    }
+    const guint8 *nonce = (const guint8 *)challenge->auth_plugin_data->str;
+
+    if (is_caching_sha2(response)) {
+        /*
+         * the SHA256(SHA256(pwd)) of every user is at hand, so fast auth
+         * always hits and full auth (RSA or TLS) is never asked for
+         */
+        return scramble_matches(users->sha256, pwd->client_sha256_sha256, SHA256_LEN, nonce, SCRAMBLE_NONCE_LEN,
+                                pwd->client_sha256, SHA256_LEN, response->auth_plugin_data);
     }
-    return FALSE;
+
+    return scramble_matches(users->sha1, nonce, SCRAMBLE_NONCE_LEN, pwd->client_sha1_sha1, SHA1_LEN,
+                            pwd->client_sha1, SHA1_LEN, response->auth_plugin_data);
+}
+
+gboolean
+cetus_users_is_fast_auth(network_mysqld_auth_response *response)
+{
+    return response->auth_plugin_data->len > 0 && is_caching_sha2(response);
 }
 
 void
@@ -275,7 +369,7 @@ cetus_users_get_hashed_client_pwd(cetus_users_t *users, const char *user_name, G
         return;
     }
     if (pwd->client) {
-        network_mysqld_proto_password_hash(sha1_pwd, pwd->client, strlen(pwd->client));
+        g_string_assign_len(sha1_pwd, (const char *)pwd->client_sha1, SHA1_LEN);
     }
 }
 
@@ -287,7 +381,7 @@ cetus_users_get_hashed_server_pwd(cetus_users_t *users, const char *user_name, G
         return;
     }
     if (pwd->server) {
-        network_mysqld_proto_password_hash(sha1_pwd, pwd->server, strlen(pwd->server));
+        g_string_assign_len(sha1_pwd, (const char *)pwd->server_sha1, SHA1_LEN);
     }
 }
 
@@ -27,6 +27,8 @@
 typedef struct cetus_users_t {
     chassis_config_t *conf_manager;
     GHashTable *records;        /* <char *, pwd_pair_t *> */
+    GChecksum *sha1;            /* reused by every login */
+    GChecksum *sha256;
 } cetus_users_t;
 
 enum cetus_pwd_type {
@@ -48,9 +50,13 @@ gboolean cetus_users_delete_record(cetus_users_t *users, const char *user);
 /* write current users to disk */
 gboolean cetus_users_write_json(cetus_users_t *users);
 
+/* mysql_native_password or caching_sha2_password */
 gboolean cetus_users_authenticate_client(cetus_users_t *users, network_mysqld_auth_challenge *,
                                          network_mysqld_auth_response *);
 
+/* caching_sha2_password fast auth, to be answered with fast_auth_success */
+gboolean cetus_users_is_fast_auth(network_mysqld_auth_response *);
+
 void cetus_users_get_hashed_pwd(cetus_users_t *, const char *user, enum cetus_pwd_type, GString *sha1pwd);
 
 void cetus_users_get_hashed_client_pwd(cetus_users_t *, const char *user, GString *sha1pwd);
@@ -20,6 +20,10 @@ cetus_variables_init_stats(cetus_variable_t **vars, chassis *chas)
         {"Com_delete_shard", &stats->com_delete_shard, VAR_INT64},
         {"Com_select_global", &stats->com_select_global, VAR_INT64},
         {"Com_select_bad_key", &stats->com_select_bad_key, VAR_INT64},
+        {"Com_select_global_index", &stats->com_select_global_index, VAR_INT64},
+        {"Com_fast_classified", &stats->com_fast_classified, VAR_INT64},
+        {"Hedged_reads", &stats->hedged_reads, VAR_INT64},
+        {"Hedged_read_wins", &stats->hedged_read_wins, VAR_INT64},
         {NULL, NULL, 0}
     };
     int length = sizeof(stats_variables);
@@ -66,3 +66,116 @@ charset_get_name(int number)
     };
     return charset[number];
 }
+
+enum collation_fold_kind {
+    FOLD_BINARY,                /* bytes as they are */
+    FOLD_PAD_BINARY,            /* *_bin, bytes without the trailing spaces */
+    FOLD_ASCII_CI,              /* ascii_general_ci */
+    FOLD_GENERAL_CI,            /* utf8_general_ci and utf8mb4_general_ci */
+};
+
+/* collations the proxy can compare like the backend does, others compare as binary */
+static const struct collation_fold_t {
+    const char *name;
+    int kind;
+} collation_folds[] = {
+    {"binary", FOLD_BINARY},
+    {"utf8mb4_0900_bin", FOLD_BINARY},
+    {"ascii_bin", FOLD_PAD_BINARY},
+    {"latin1_bin", FOLD_PAD_BINARY},
+    {"gbk_bin", FOLD_PAD_BINARY},
+    {"utf8_bin", FOLD_PAD_BINARY},
+    {"utf8mb3_bin", FOLD_PAD_BINARY},
+    {"utf8mb4_bin", FOLD_PAD_BINARY},
+    {"ascii_general_ci", FOLD_ASCII_CI},
+    {"utf8_general_ci", FOLD_GENERAL_CI},
+    {"utf8mb3_general_ci", FOLD_GENERAL_CI},
+    {"utf8mb4_general_ci", FOLD_GENERAL_CI},
+};
+
+/* weights of U+00C0..U+00FF in *_general_ci, the rest of Latin-1 weighs itself but U+00B5 */
+static const guint16 general_ci_latin1[64] = {
+    0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0xC6, 0x43, 0x45, 0x45, 0x45, 0x45, 0x49, 0x49, 0x49, 0x49,
+    0xD0, 0x4E, 0x4F, 0x4F, 0x4F, 0x4F, 0x4F, 0xD7, 0x4F, 0x55, 0x55, 0x55, 0x55, 0x59, 0xDE, 0x53,
+    0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0xC6, 0x43, 0x45, 0x45, 0x45, 0x45, 0x49, 0x49, 0x49, 0x49,
+    0xD0, 0x4E, 0x4F, 0x4F, 0x4F, 0x4F, 0x4F, 0xF7, 0x4F, 0x55, 0x55, 0x55, 0x55, 0x59, 0xDE, 0x59
+};
+
+static int
+collation_fold_kind(const char *collation)
+{
+    int i;
+    for (i = 0; collation && i < sizeof(collation_folds) / sizeof(collation_folds[0]); i++) {
+        if (g_ascii_strcasecmp(collation, collation_folds[i].name) == 0) {
+            return collation_folds[i].kind;
+        }
+    }
+    return -1;
+}
+
+/* whether a result is sent as UTF-8, by its collation number */
+static gboolean
+collation_is_utf8(int number)
+{
+    return number == 33 || number == 45 || number == 46 || number == 76 || number == 83
+        || (number >= 192 && number <= 247) || (number >= 255 && number <= 323);
+}
+
+/* FALSE if a character has no weight known here */
+static gboolean
+fold_general_ci(const char *s, gsize len, GString *key)
+{
+    const char *p = s;
+    const char *end = s + len;
+    while (p < end) {
+        gunichar c = g_utf8_get_char(p);
+        if (c < 0x80) {
+            c = g_ascii_toupper(c);
+        } else if (c == 0xB5) {
+            c = 0x39C;
+        } else if (c >= 0xC0 && c <= 0xFF) {
+            c = general_ci_latin1[c - 0xC0];
+        } else if (c > 0xFFFF) {
+            c = 0xFFFD;         /* supplementary characters all weigh the same */
+        } else if (c > 0xFF) {
+            return FALSE;
+        }
+        g_string_append_unichar(key, c);
+        p = g_utf8_next_char(p);
+    }
+    return TRUE;
+}
+
+gboolean
+collation_fold(const char *collation, int result_charsetnr, const char *s, gsize len, GString *key)
+{
+    int kind = collation_fold_kind(collation);
+    if (kind != FOLD_BINARY && kind != -1) {
+        while (len > 0 && s[len - 1] == ' ') {  /* PAD SPACE */
+            len--;
+        }
+    }
+    gsize orig_len = key->len;
+    gboolean folded = TRUE;
+    gsize i;
+    switch (kind) {
+    case FOLD_ASCII_CI:
+        for (i = 0; i < len && folded; i++) {
+            folded = !(s[i] & 0x80);
+            g_string_append_c(key, g_ascii_toupper(s[i]));
+        }
+        break;
+    case FOLD_GENERAL_CI:
+        folded = collation_is_utf8(result_charsetnr) && g_utf8_validate(s, len, NULL)
+            && fold_general_ci(s, len, key);
+        break;
+    default:
+        g_string_append_len(key, s, len);
+        return kind != -1;
+    }
+    if (!folded) {
+        g_string_truncate(key, orig_len);
+        g_string_append_len(key, s, len);
+    }
+    return folded;
+}
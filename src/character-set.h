@@ -21,9 +21,21 @@
 #ifndef CHARACTER_SET_H
 #define CHARACTER_SET_H
 
+#include <glib.h>
+
 #include "network-exports.h"
 
 NETWORK_API int charset_get_number(const char *name);
 NETWORK_API const char *charset_get_name(int number);
 
+/**
+ * append the string s to key the way the collation compares it, so that equal
+ * strings give equal keys; collation is a name as COLLATION() returns it and
+ * result_charsetnr the collation s was sent in
+ *   only binary, the common *_bin, ascii_general_ci and utf8(mb4)_general_ci
+ *   are known, FALSE if s is appended as it is (other collations or characters)
+ */
+NETWORK_API gboolean collation_fold(const char *collation, int result_charsetnr, const char *s, gsize len,
+                                    GString *key);
+
 #endif // CHARACTER_SET_H
@@ -52,17 +52,241 @@
 #define E_NET_WOULDBLOCK EWOULDBLOCK
 #endif
 
+/*
+ * Hierarchical timing wheel for the long read/write/idle timeouts of
+ * sockets, which are re-armed on every wait. libevent only watches the fd
+ * of such events, arming is O(1) instead of a min-heap insert.
+ *
+ * 4 levels of 64 slots with 100ms ticks cover 6.4s, 6.8min, 7.3h and 19d.
+ * Each loop has its own wheel, it ticks only while timers are armed.
+ */
+#define WHEEL_TICK_MS 100
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS 4
+#define WHEEL_MAX_TICKS ((G_GUINT64_CONSTANT(1) << (WHEEL_BITS * WHEEL_LEVELS)) - 1)
+
+/* shorter timeouts need the precision of libevent */
+#define WHEEL_MIN_TIMEOUT_SEC 1
+
+struct chassis_timer_wheel_t {
+    chassis_timer_t slots[WHEEL_LEVELS][WHEEL_SLOTS]; /* list heads */
+    guint64 now;                /* last tick run */
+    int armed;                  /* timers linked */
+    struct event_base *base;
+    struct event tick_event;
+};
+
+/* the wheel of the loop created by this thread */
+static GPrivate thread_wheel = G_PRIVATE_INIT(NULL);
+
+static inline guint64
+wheel_clock(void)
+{
+    return g_get_monotonic_time() / (WHEEL_TICK_MS * 1000);
+}
+
+static void
+wheel_link(chassis_timer_wheel_t *wheel, chassis_timer_t *t)
+{
+    guint64 delta = t->expires - wheel->now;
+    int level = 0;
+
+    if (delta > WHEEL_MAX_TICKS) {
+        t->expires = wheel->now + WHEEL_MAX_TICKS;
+        delta = WHEEL_MAX_TICKS;
+    }
+    while (level < WHEEL_LEVELS - 1 && delta >= (G_GUINT64_CONSTANT(1) << (WHEEL_BITS * (level + 1)))) {
+        level++;
+    }
+
+    chassis_timer_t *head = &wheel->slots[level][(t->expires >> (WHEEL_BITS * level)) & WHEEL_MASK];
+    t->next = head;
+    t->prev = head->prev;
+    head->prev->next = t;
+    head->prev = t;
+}
+
+static void
+wheel_unlink(chassis_timer_t *t)
+{
+    t->prev->next = t->next;
+    t->next->prev = t->prev;
+    t->prev = t->next = NULL;
+}
+
+static void
+wheel_disarm(chassis_timer_t *t)
+{
+    chassis_timer_wheel_t *wheel = t->wheel;
+
+    wheel_unlink(t);
+    t->wheel = NULL;
+    if (--wheel->armed == 0) {
+        event_del(&wheel->tick_event);
+    }
+}
+
+/* move the timers of a slot to the lower levels */
+static void
+wheel_cascade(chassis_timer_wheel_t *wheel, int level, int index)
+{
+    chassis_timer_t *head = &wheel->slots[level][index];
+    while (head->next != head) {
+        chassis_timer_t *t = head->next;
+        wheel_unlink(t);
+        wheel_link(wheel, t);
+    }
+}
+
+static void
+wheel_expire(chassis_timer_t *t)
+{
+    struct event *ev = t->ev;
+
+    wheel_disarm(t);
+
+    /* not pending: it fired meanwhile and was not re-armed */
+    if (event_pending(ev, EV_READ | EV_WRITE, NULL)) {
+        event_del(ev);
+        event_active(ev, EV_TIMEOUT, 1);
+    }
+}
+
+static void
+wheel_advance(chassis_timer_wheel_t *wheel)
+{
+    wheel->now++;
+
+    int index = wheel->now & WHEEL_MASK;
+    int level;
+    for (level = 1; index == 0 && level < WHEEL_LEVELS; level++) {
+        index = (wheel->now >> (WHEEL_BITS * level)) & WHEEL_MASK;
+        wheel_cascade(wheel, level, index);
+    }
+
+    chassis_timer_t *head = &wheel->slots[0][wheel->now & WHEEL_MASK];
+    while (head->next != head) {
+        wheel_expire(head->next);
+    }
+}
+
+static void
+wheel_tick_handler(int G_GNUC_UNUSED fd, short G_GNUC_UNUSED events, void *arg)
+{
+    chassis_timer_wheel_t *wheel = arg;
+    guint64 target = wheel_clock();
+    while (wheel->armed > 0 && wheel->now < target) {
+        wheel_advance(wheel);
+    }
+}
+
+static chassis_timer_wheel_t *
+wheel_new(struct event_base *base)
+{
+    int i, j;
+
+    chassis_timer_wheel_t *wheel = g_new0(chassis_timer_wheel_t, 1);
+    for (i = 0; i < WHEEL_LEVELS; i++) {
+        for (j = 0; j < WHEEL_SLOTS; j++) {
+            wheel->slots[i][j].prev = wheel->slots[i][j].next = &wheel->slots[i][j];
+        }
+    }
+    wheel->now = wheel_clock();
+    wheel->base = base;
+
+    event_set(&wheel->tick_event, -1, EV_PERSIST, wheel_tick_handler, wheel);
+    event_base_set(base, &wheel->tick_event);
+    return wheel;
+}
+
+static void
+wheel_free(chassis_timer_wheel_t *wheel)
+{
+    int i, j;
+
+    /* the events are gone with the loop, their owners may still disarm */
+    for (i = 0; i < WHEEL_LEVELS; i++) {
+        for (j = 0; j < WHEEL_SLOTS; j++) {
+            chassis_timer_t *head = &wheel->slots[i][j];
+            while (head->next != head) {
+                chassis_timer_t *t = head->next;
+                wheel_unlink(t);
+                t->wheel = NULL;
+            }
+        }
+    }
+    event_del(&wheel->tick_event);
+    g_free(wheel);
+}
+
+static gboolean
+wheel_arm(chassis_timer_t *t, struct event *ev, struct timeval *tv)
+{
+    chassis_timer_wheel_t *wheel = g_private_get(&thread_wheel);
+
+    if (!wheel || ev->ev_base != wheel->base || tv->tv_sec < WHEEL_MIN_TIMEOUT_SEC || ev->ev_fd < 0
+        || (ev->ev_events & EV_PERSIST)) {
+        return FALSE;
+    }
+
+    if (t->wheel) {
+        wheel_disarm(t);
+    }
+    if (wheel->armed++ == 0) {
+        /* nothing was linked, the clock can jump */
+        struct timeval tick = { 0, WHEEL_TICK_MS * 1000 };
+        wheel->now = wheel_clock();
+        event_add(&wheel->tick_event, &tick);
+    }
+
+    guint64 ticks = ((guint64)tv->tv_sec * 1000 + tv->tv_usec / 1000 + WHEEL_TICK_MS - 1) / WHEEL_TICK_MS;
+    t->ev = ev;
+    t->wheel = wheel;
+    t->expires = wheel->now + MAX(ticks, 1);
+    wheel_link(wheel, t);
+    return TRUE;
+}
+
 void
 chassis_event_add_with_timeout(chassis *chas, struct event *ev, struct timeval *tv)
 {
     event_base_set(chas->event_base, ev);
 #if NETWORK_DEBUG_TRACE_EVENT
-    CHECK_PENDING_EVENT(ev);
+    CHECK_PENDING_EVENT(ev, NULL);
 #endif
     event_add(ev, tv);
     g_debug("%s:event add ev:%p", G_STRLOC, ev);
 }
 
+void
+chassis_event_add_with_timer(chassis *chas, struct event *ev, chassis_timer_t *timer, struct timeval *tv)
+{
+    event_base_set(chas->event_base, ev);
+#if NETWORK_DEBUG_TRACE_EVENT
+    CHECK_PENDING_EVENT(ev, timer);
+#endif
+    if (tv && wheel_arm(timer, ev, tv)) {
+        event_add(ev, NULL);
+    } else {
+        if (timer->wheel) {
+            wheel_disarm(timer);
+        }
+        event_add(ev, tv);
+    }
+    g_debug("%s:event add ev:%p", G_STRLOC, ev);
+}
+
+void
+chassis_event_del(struct event *ev, chassis_timer_t *timer)
+{
+    if (timer && timer->wheel) {
+        wheel_disarm(timer);
+    }
+    event_del(ev);
+}
+
 /**
  * add a event asynchronously
  *
@@ -77,12 +301,21 @@ chassis_event_add(chassis *chas, struct event *ev)
 chassis_event_loop_t *
 chassis_event_loop_new()
 {
-    return event_base_new();
+    struct event_base *base = event_base_new();
+    if (base && !g_private_get(&thread_wheel)) {
+        g_private_set(&thread_wheel, wheel_new(base));
+    }
+    return base;
 }
 
 void
 chassis_event_loop_free(chassis_event_loop_t *event)
 {
+    chassis_timer_wheel_t *wheel = g_private_get(&thread_wheel);
+    if (wheel && wheel->base == event) {
+        wheel_free(wheel);
+        g_private_set(&thread_wheel, NULL);
+    }
     event_base_free(event);
 }
 
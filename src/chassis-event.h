@@ -26,14 +26,34 @@
 #include "chassis-exports.h"
 #include "chassis-mainloop.h"
 
-#define CHECK_PENDING_EVENT(ev) \
+/* timer may be NULL if ev never waits with chassis_event_add_with_timer() */
+#define CHECK_PENDING_EVENT(ev, timer) \
     if (event_pending((ev), EV_READ|EV_WRITE|EV_TIMEOUT, NULL)) {       \
         g_warning(G_STRLOC ": pending ev:%p, flags:%d", (ev), (ev)->ev_flags); \
-        event_del(ev);  \
+        chassis_event_del((ev), (timer));  \
     }
 
+typedef struct chassis_timer_wheel_t chassis_timer_wheel_t;
+
+/**
+ * timing wheel entry of an event, embedded next to the event and zeroed
+ * with it; it must not be freed while armed, see chassis_event_del()
+ */
+typedef struct chassis_timer_t {
+    struct chassis_timer_t *prev;
+    struct chassis_timer_t *next;
+    struct event *ev;
+    chassis_timer_wheel_t *wheel;   /* NULL if not armed */
+    guint64 expires;            /* in ticks */
+} chassis_timer_t;
+
 CHASSIS_API void chassis_event_add(chassis *chas, struct event *ev);
 CHASSIS_API void chassis_event_add_with_timeout(chassis *chas, struct event *ev, struct timeval *tv);
+/* timeouts from 1s on go to the timing wheel of the loop, libevent only watches the fd */
+CHASSIS_API void chassis_event_add_with_timer(chassis *chas, struct event *ev, chassis_timer_t *timer,
+                                              struct timeval *tv);
+/* event_del() that also disarms timer, which may be NULL */
+CHASSIS_API void chassis_event_del(struct event *ev, chassis_timer_t *timer);
 
 typedef struct event_base chassis_event_loop_t;
 
@@ -0,0 +1,123 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#include "chassis-histogram.h"
+
+#define HALF_SUB_COUNT (HISTOGRAM_SUB_COUNT / 2)
+
+static int
+bucket_index(guint64 value)
+{
+    if (value < HISTOGRAM_SUB_COUNT) {
+        return value;
+    }
+    if (value >> HISTOGRAM_MAX_BITS) {
+        return HISTOGRAM_BUCKETS - 1;
+    }
+    int magnitude = g_bit_storage(value) - 1 - HISTOGRAM_SUB_BITS;
+    int sub = value >> (magnitude + 1); /* in [HALF_SUB_COUNT, HISTOGRAM_SUB_COUNT) */
+    return HISTOGRAM_SUB_COUNT + magnitude * HALF_SUB_COUNT + sub - HALF_SUB_COUNT;
+}
+
+/* highest value counted in bucket i */
+static guint64
+bucket_value(int i)
+{
+    if (i < HISTOGRAM_SUB_COUNT) {
+        return i;
+    }
+    int magnitude = (i - HISTOGRAM_SUB_COUNT) / HALF_SUB_COUNT;
+    guint64 sub = (i - HISTOGRAM_SUB_COUNT) % HALF_SUB_COUNT + HALF_SUB_COUNT;
+    return ((sub + 1) << (magnitude + 1)) - 1;
+}
+
+void
+chassis_histogram_record(chassis_histogram_t *hist, guint64 value)
+{
+    hist->counts[bucket_index(value)]++;
+    hist->total++;
+    if (value > hist->max) {
+        hist->max = value;
+    }
+}
+
+void
+chassis_histogram_record_lazy(chassis_histogram_t **hist, guint64 value)
+{
+    if (*hist == NULL) {
+        *hist = g_new0(chassis_histogram_t, 1);
+    }
+    chassis_histogram_record(*hist, value);
+}
+
+void
+chassis_histogram_fill_table(const chassis_histogram_t *hist, guint64 unit, guint64 *table, int size)
+{
+    int i;
+    for (i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+        if (hist->counts[i]) {
+            guint64 slot = MIN(bucket_value(i), hist->max) / unit;
+            table[MIN(slot, size - 1)] += hist->counts[i];
+        }
+    }
+}
+
+guint64
+chassis_histogram_percentile(const chassis_histogram_t *hist, double percentile)
+{
+    if (hist->total == 0) {
+        return 0;
+    }
+    guint64 rank = (guint64)(hist->total * percentile / 100.0 + 0.5);
+    rank = CLAMP(rank, 1, hist->total);
+
+    guint64 seen = 0;
+    int i;
+    for (i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+        seen += hist->counts[i];
+        if (seen >= rank) {
+            return MIN(bucket_value(i), hist->max);
+        }
+    }
+    return hist->max;
+}
+
+guint64
+chassis_histogram_percentile_since(const chassis_histogram_t *hist, const chassis_histogram_t *base, double percentile)
+{
+    if (hist->total <= base->total) {
+        return 0;
+    }
+    guint64 total = hist->total - base->total;
+    guint64 rank = (guint64)(total * percentile / 100.0 + 0.5);
+    rank = CLAMP(rank, 1, total);
+
+    guint64 seen = 0;
+    int i;
+    for (i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+        if (hist->counts[i] > base->counts[i]) {
+            seen += hist->counts[i] - base->counts[i];
+        }
+        if (seen >= rank) {
+            return MIN(bucket_value(i), hist->max);
+        }
+    }
+    return hist->max;
+}
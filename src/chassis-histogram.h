@@ -0,0 +1,64 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#ifndef __CHASSIS_HISTOGRAM_H__
+#define __CHASSIS_HISTOGRAM_H__
+
+#include <glib.h>
+#include "chassis-exports.h"
+
+/**
+ * Log-linear latency histogram, in microseconds.
+ *
+ * Values below 2^HISTOGRAM_SUB_BITS are counted exactly, above that every
+ * power of two is split into 2^(HISTOGRAM_SUB_BITS-1) linear buckets, so
+ * any value is within 1/128 (< 1%) of its bucket. Values from 2^32 us
+ * (about 71 minutes) on go to the last bucket.
+ *
+ * About 26KB each, so query_stats_t only keeps pointers and allocates a
+ * histogram the first time a value is recorded in it.
+ */
+#define HISTOGRAM_SUB_BITS 8
+#define HISTOGRAM_MAX_BITS 32
+#define HISTOGRAM_SUB_COUNT (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_BUCKETS (HISTOGRAM_SUB_COUNT + (HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BITS) * HISTOGRAM_SUB_COUNT / 2)
+
+typedef struct chassis_histogram_t {
+    guint64 total;
+    guint64 max;
+    guint64 counts[HISTOGRAM_BUCKETS];
+} chassis_histogram_t;
+
+CHASSIS_API void chassis_histogram_record(chassis_histogram_t *, guint64 value);
+
+/* allocates *hist on the first value */
+CHASSIS_API void chassis_histogram_record_lazy(chassis_histogram_t **hist, guint64 value);
+
+/* adds the counts to table[value / unit], the last slot takes the rest */
+CHASSIS_API void chassis_histogram_fill_table(const chassis_histogram_t *, guint64 unit, guint64 *table, int size);
+
+/* @param percentile in (0, 100], e.g. 99.9 */
+CHASSIS_API guint64 chassis_histogram_percentile(const chassis_histogram_t *, double percentile);
+
+/* percentile of the values recorded since hist looked like base */
+CHASSIS_API guint64 chassis_histogram_percentile_since(const chassis_histogram_t *hist,
+                                                       const chassis_histogram_t *base, double percentile);
+
+#endif /* __CHASSIS_HISTOGRAM_H__ */
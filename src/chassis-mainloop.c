@@ -202,13 +202,20 @@ chassis_free(chassis *chas)
      */
     if (version && (strcmp(version, "1.3e") >= 0)) {
         if (chas->event_base) {
-            event_base_free(chas->event_base);
+            chassis_event_loop_free(chas->event_base);
         }
     }
 #endif
     if (chas->config_manager)
         chassis_config_free(chas->config_manager);
 
+    for (i = 0; i < QUERY_CLASS_MAX; i++)
+        g_free(chas->query_stats.query_time[i]);
+    for (i = 0; i < QUERY_PHASE_MAX; i++)
+        g_free(chas->query_stats.phase_time[i]);
+    for (i = 0; i < MAX_SERVER_NUM; i++)
+        g_free(chas->query_stats.backend_time[i]);
+
     g_free(chas);
 }
 
@@ -41,6 +41,7 @@
 #include "chassis-shutdown-hooks.h"
 #include "cetus-util.h"
 #include "chassis-config.h"
+#include "chassis-histogram.h"
 
 /** @defgroup chassis Chassis
  *
@@ -52,8 +53,6 @@ typedef struct chassis_private chassis_private;
 typedef struct chassis chassis;
 
 #define MAX_SERVER_NUM 64
-#define MAX_QUERY_TIME 1000
-#define MAX_WAIT_TIME 1024
 #define MAX_DIST_TRAN_PREFIX 32
 
 #define MAX_ALLOWED_PACKET_CEIL    (1 * GB)
@@ -65,11 +64,35 @@ typedef struct rw_op_t {
     uint64_t rw;
 } rw_op_t;
 
+/* statement classes of query_stats_t.query_time */
+typedef enum {
+    QUERY_CLASS_OTHER,
+    QUERY_CLASS_SELECT,
+    QUERY_CLASS_INSERT,
+    QUERY_CLASS_UPDATE,
+    QUERY_CLASS_DELETE,
+    QUERY_CLASS_MAX
+} query_class_t;
+
+/* where the time of one query goes, see network_mysqld_con_phase_end() */
+typedef enum {
+    QUERY_PHASE_CLIENT_READ,
+    QUERY_PHASE_PARSE_ROUTE,
+    QUERY_PHASE_POOL_WAIT,
+    QUERY_PHASE_BACKEND,
+    QUERY_PHASE_MERGE,
+    QUERY_PHASE_CLIENT_SEND,
+    QUERY_PHASE_XA,             /* XA END/PREPARE/COMMIT round trips */
+    QUERY_PHASE_MAX
+} query_phase_t;
+
 typedef struct query_stats_t {
     rw_op_t client_query;
     rw_op_t proxyed_query;
-    uint64_t query_time_table[MAX_QUERY_TIME];
-    uint64_t query_wait_table[MAX_WAIT_TIME];
+    /* NULL until the first value, see chassis_histogram_record_lazy() */
+    chassis_histogram_t *query_time[QUERY_CLASS_MAX];   /* whole query, by statement class */
+    chassis_histogram_t *phase_time[QUERY_PHASE_MAX];
+    chassis_histogram_t *backend_time[MAX_SERVER_NUM];  /* one round trip, by backend index */
     rw_op_t server_query_details[MAX_SERVER_NUM];
     uint64_t com_select;
     uint64_t com_insert;
@@ -81,6 +104,10 @@ typedef struct query_stats_t {
     uint64_t com_delete_shard;
     uint64_t com_select_global;
     uint64_t com_select_bad_key;
+    uint64_t com_select_global_index;   /* routed by a global index instead of all groups */
+    uint64_t com_fast_classified; /* rw-split queries routed without full parse */
+    uint64_t hedged_reads;      /* reads sent to a second slave */
+    uint64_t hedged_read_wins;  /* of them, answered by the second slave first */
     uint64_t xa_count;
 } query_stats_t;
 
@@ -126,6 +153,12 @@ struct chassis {
     unsigned int query_cache_enabled;
     unsigned int is_back_compressed;
     unsigned int compress_support;
+    int zstd_client_level;      /* 0: zstd not offered */
+    int zstd_back_level;
+    int compress_threads;       /* 0: compress on the event loop */
+    int compress_offload_size;
+    int listen_backlog;
+    unsigned int enable_io_uring;
     unsigned int client_found_rows;
     unsigned int master_preferred;
     unsigned int is_manual_down;
@@ -134,6 +167,10 @@ struct chassis {
     unsigned int sharding_reload;
     unsigned int check_slave_delay;
     int complement_conn_cnt;
+    int pool_connect_rate;      /* new backend connections per second, 0: unlimited */
+    int reshard_batch_size;     /* rows per batch when moving a partition */
+    int global_index_interval;  /* ms between copies of new global index pairs */
+    int global_index_cache_size;    /* pairs of a global index kept in memory */
     int default_query_cache_timeout;
     double slave_delay_down_threshold_sec;
     double slave_delay_recover_threshold_sec;
@@ -141,12 +178,20 @@ struct chassis {
     unsigned int min_req_time_for_cache;
     int cetus_max_allowed_packet;
     int disable_dns_cache;
+    int disable_fast_classify;
 
     int max_alive_time;
     int max_resp_len;
     int merged_output_size;
     int max_header_size;
     int compressed_merged_output_size;
+    int count_distinct_approx_threshold;
+    int join_buffer_size;       /* max bytes hashed by a JOIN across shards */
+    int read_your_writes_wait;  /* ms a slave may take to catch up with the session, 0: no GTID tracking */
+    int hedge_reads;            /* slow reads go to a second slave too */
+    int circuit_breaker;        /* keep queries off backends failing or slow, see network-backend.h */
+    int circuit_breaker_latency;    /* ms the p90 of a backend may take */
+    int circuit_breaker_error_rate; /* percent of queries a backend may fail */
 
     /* Conn-pool initialize settings */
     int max_idle_connections;
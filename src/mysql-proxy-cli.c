@@ -63,6 +63,7 @@
 #include "glib-ext.h"
 #include "network-mysqld.h"
 #include "network-mysqld-proto.h"
+#include "network-compress.h"
 #include "sys-pedantic.h"
 
 #include "cetus-log.h"
@@ -101,6 +102,16 @@ struct chassis_frontend_t {
     int is_tcp_stream_enabled;
     int is_back_compressed;
     int is_client_compress_support;
+    int zstd_client_level;
+    int zstd_back_level;
+    int compress_threads;
+    int compress_offload_size;
+    int listen_backlog;
+    int enable_io_uring;
+    int pool_connect_rate;
+    int reshard_batch_size;
+    int global_index_interval;
+    int global_index_cache_size;
     int check_slave_delay;
     int is_reduce_conns;
     int long_query_time;
@@ -109,6 +120,14 @@ struct chassis_frontend_t {
     int default_query_cache_timeout;
     int query_cache_enabled;
     int disable_dns_cache;
+    int disable_fast_classify;
+    int count_distinct_approx_threshold;
+    int join_buffer_size;
+    int read_your_writes_wait;
+    int hedge_reads;
+    int circuit_breaker;
+    int circuit_breaker_latency;
+    int circuit_breaker_error_rate;
     double slave_delay_down_threshold_sec;
     double slave_delay_recover_threshold_sec;
 
@@ -156,10 +175,17 @@ chassis_frontend_new(void)
     frontend->disable_threads = 0;
     frontend->is_back_compressed = 0;
     frontend->is_client_compress_support = 0;
+    frontend->compress_offload_size = 65536;
+    frontend->listen_backlog = 1024;
+    frontend->pool_connect_rate = 100;
+    frontend->reshard_batch_size = 1000;
+    frontend->global_index_interval = 500;
+    frontend->global_index_cache_size = 1000000;
     frontend->xa_log_detailed = 0;
 
     frontend->default_pool_size = 100;
     frontend->max_resp_len = 10 * 1024 * 1024;  /* 10M */
+    frontend->join_buffer_size = 16 * 1024 * 1024;  /* 16M */
     frontend->max_alive_time = 7200;
     frontend->merged_output_size = 8192;
     frontend->max_header_size = 65536;
@@ -167,9 +193,11 @@ chassis_frontend_new(void)
 
     frontend->slave_delay_down_threshold_sec = 60.0;
     frontend->default_query_cache_timeout = 100;
-    frontend->long_query_time = MAX_QUERY_TIME;
+    frontend->long_query_time = 1000;
     frontend->cetus_max_allowed_packet = MAX_ALLOWED_PACKET_DEFAULT;
     frontend->disable_dns_cache = 0;
+    frontend->circuit_breaker_latency = 1000;
+    frontend->circuit_breaker_error_rate = 50;
     return frontend;
 }
 
@@ -337,6 +365,57 @@ chassis_frontend_set_chassis_options(struct chassis_frontend_t *frontend, chassi
                         0, 0, OPTION_ARG_NONE, &(frontend->is_client_compress_support),
                         "enable compression for client interactions", NULL);
 
+    chassis_options_add(opts,
+                        "zstd-client-level",
+                        0, 0, OPTION_ARG_INT, &(frontend->zstd_client_level),
+                        "offer zstd compression to clients with this max level, 0 for zlib only", "<integer>");
+
+    chassis_options_add(opts,
+                        "zstd-back-level",
+                        0, 0, OPTION_ARG_INT, &(frontend->zstd_back_level),
+                        "use zstd compression of this level for backends supporting it", "<integer>");
+
+    chassis_options_add(opts,
+                        "listen-backlog",
+                        0, 0, OPTION_ARG_INT, &(frontend->listen_backlog),
+                        "Backlog of the listening sockets (default: 1024)", "<integer>");
+
+    chassis_options_add(opts,
+                        "pool-connect-rate",
+                        0, 0, OPTION_ARG_INT, &(frontend->pool_connect_rate),
+                        "Max new backend connections per second opened ahead of demand, 0 for no limit",
+                        "<integer>");
+
+    chassis_options_add(opts,
+                        "reshard-batch-size",
+                        0, 0, OPTION_ARG_INT, &(frontend->reshard_batch_size),
+                        "Rows copied per batch when moving a partition online (default: 1000)", "<integer>");
+
+    chassis_options_add(opts,
+                        "global-index-interval",
+                        0, 0, OPTION_ARG_INT, &(frontend->global_index_interval),
+                        "Milliseconds between copies of new global index entries (default: 500)", "<integer>");
+
+    chassis_options_add(opts,
+                        "global-index-cache-size",
+                        0, 0, OPTION_ARG_INT, &(frontend->global_index_cache_size),
+                        "Global index entries kept in memory per index (default: 1000000)", "<integer>");
+
+    chassis_options_add(opts,
+                        "enable-io-uring",
+                        0, 0, OPTION_ARG_NONE, &(frontend->enable_io_uring),
+                        "Submit client writes and accepts through io_uring", NULL);
+
+    chassis_options_add(opts,
+                        "compress-threads",
+                        0, 0, OPTION_ARG_INT, &(frontend->compress_threads),
+                        "Number of threads compressing large results for clients, 0 for none", "<integer>");
+
+    chassis_options_add(opts,
+                        "compress-offload-size",
+                        0, 0, OPTION_ARG_INT, &(frontend->compress_offload_size),
+                        "Results from this size in bytes are compressed by compress threads", "<integer>");
+
     chassis_options_add(opts,
                         "check-slave-delay",
                         0, 0, OPTION_ARG_NONE, &(frontend->check_slave_delay),
@@ -383,13 +462,50 @@ chassis_frontend_set_chassis_options(struct chassis_frontend_t *frontend, chassi
                         0, 0, OPTION_ARG_NONE, &(frontend->disable_dns_cache),
                         "Every new connection to backends will resolve domain name", NULL);
 
+    chassis_options_add(opts,
+                        "disable-fast-classify",
+                        0, 0, OPTION_ARG_NONE, &(frontend->disable_fast_classify),
+                        "Always do a full SQL parse in rw-split mode", NULL);
+
     chassis_options_add(opts,
                         "master-preferred",
                         0, 0, OPTION_ARG_NONE, &(frontend->master_preferred), "Access to master preferentially", NULL);
+    chassis_options_add(opts,
+                        "read-your-writes-wait",
+                        0, 0, OPTION_ARG_INT, &(frontend->read_your_writes_wait),
+                        "Ms a slave may take to apply the last write of the session before reads of it go to master, 0 disables",
+                        "<int>");
+    chassis_options_add(opts,
+                        "hedge-reads",
+                        0, 0, OPTION_ARG_NONE, &(frontend->hedge_reads),
+                        "Send a read slower than the slave's recent p95 to a second slave too", NULL);
+    chassis_options_add(opts,
+                        "circuit-breaker",
+                        0, 0, OPTION_ARG_NONE, &(frontend->circuit_breaker),
+                        "Stop sending queries to a backend failing or slow for a while", NULL);
+    chassis_options_add(opts,
+                        "circuit-breaker-latency",
+                        0, 0, OPTION_ARG_INT, &(frontend->circuit_breaker_latency),
+                        "Ms the p90 of the queries to a backend may take before its circuit opens, 0 disables",
+                        "<int>");
+    chassis_options_add(opts,
+                        "circuit-breaker-error-rate",
+                        0, 0, OPTION_ARG_INT, &(frontend->circuit_breaker_error_rate),
+                        "Percent of the queries to a backend that may fail before its circuit opens, 0 disables",
+                        "<int>");
     chassis_options_add(opts,
                         "max-allowed-packet",
                         0, 0, OPTION_ARG_INT, &(frontend->cetus_max_allowed_packet),
                         "Max allowed packet as in mysql", "<int>");
+    chassis_options_add(opts,
+                        "count-distinct-approx-threshold",
+                        0, 0, OPTION_ARG_INT, &(frontend->count_distinct_approx_threshold),
+                        "Sharded COUNT(DISTINCT) switches to HyperLogLog above this many keys, 0 means always exact",
+                        "<int>");
+    chassis_options_add(opts,
+                        "join-buffer-size",
+                        0, 0, OPTION_ARG_INT, &(frontend->join_buffer_size),
+                        "Max bytes of the hashed table when joining tables of different shards", "<int>");
     chassis_options_add(opts,
                         "remote-conf-url",
                         0, 0, OPTION_ARG_STRING, &(frontend->remote_config_url),
@@ -495,6 +611,14 @@ init_parameters(struct chassis_frontend_t *frontend, chassis *srv)
     srv->max_header_size = frontend->max_header_size;
     g_message("%s:set max header size:%d", G_STRLOC, srv->max_header_size);
 
+    srv->count_distinct_approx_threshold = MAX(frontend->count_distinct_approx_threshold, 0);
+    srv->join_buffer_size = frontend->join_buffer_size > 0 ? frontend->join_buffer_size : 16 * 1024 * 1024;
+    srv->read_your_writes_wait = MAX(frontend->read_your_writes_wait, 0);
+    srv->hedge_reads = frontend->hedge_reads;
+    srv->circuit_breaker = frontend->circuit_breaker;
+    srv->circuit_breaker_latency = MAX(frontend->circuit_breaker_latency, 0);
+    srv->circuit_breaker_error_rate = CLAMP(frontend->circuit_breaker_error_rate, 0, 100);
+
     if (frontend->worker_id > 0) {
         srv->guid_state.worker_id = frontend->worker_id & 0x3f;
     }
@@ -521,10 +645,28 @@ init_parameters(struct chassis_frontend_t *frontend, chassis *srv)
     srv->disable_threads = frontend->disable_threads;
     srv->is_back_compressed = frontend->is_back_compressed;
     srv->compress_support = frontend->is_client_compress_support;
+    srv->zstd_client_level = CLAMP(frontend->zstd_client_level, 0, ZSTD_LEVEL_MAX);
+    srv->zstd_back_level = CLAMP(frontend->zstd_back_level, 0, ZSTD_LEVEL_MAX);
+    srv->compress_threads = frontend->compress_threads;
+    srv->listen_backlog = frontend->listen_backlog > 0 ? frontend->listen_backlog : 1024;
+    srv->enable_io_uring = frontend->enable_io_uring;
+    srv->pool_connect_rate = MAX(frontend->pool_connect_rate, 0);
+    srv->reshard_batch_size = frontend->reshard_batch_size > 0 ? frontend->reshard_batch_size : 1000;
+    srv->global_index_interval = frontend->global_index_interval > 0 ? frontend->global_index_interval : 500;
+    srv->global_index_cache_size = frontend->global_index_cache_size > 0 ? frontend->global_index_cache_size : 1000000;
+    srv->compress_offload_size = frontend->compress_offload_size;
+#ifndef HAVE_ZSTD
+    if (srv->zstd_client_level > 0 || srv->zstd_back_level > 0) {
+        g_warning("%s:zstd compression not built in, use zlib", G_STRLOC);
+        srv->zstd_client_level = 0;
+        srv->zstd_back_level = 0;
+    }
+#endif
     srv->check_slave_delay = frontend->check_slave_delay;
     srv->slave_delay_down_threshold_sec = frontend->slave_delay_down_threshold_sec;
     srv->master_preferred = frontend->master_preferred;
     srv->disable_dns_cache = frontend->disable_dns_cache;
+    srv->disable_fast_classify = frontend->disable_fast_classify;
     if (frontend->slave_delay_recover_threshold_sec > 0) {
         srv->slave_delay_recover_threshold_sec = frontend->slave_delay_recover_threshold_sec;
         if (frontend->slave_delay_recover_threshold_sec > srv->slave_delay_down_threshold_sec) {
@@ -537,7 +679,7 @@ init_parameters(struct chassis_frontend_t *frontend, chassis *srv)
     }
 
     srv->default_query_cache_timeout = MAX(frontend->default_query_cache_timeout, 1);
-    srv->long_query_time = MIN(frontend->long_query_time, MAX_QUERY_TIME);
+    srv->long_query_time = frontend->long_query_time;
     srv->cetus_max_allowed_packet = CLAMP(frontend->cetus_max_allowed_packet,
                                           MAX_ALLOWED_PACKET_FLOOR, MAX_ALLOWED_PACKET_CEIL);
 }
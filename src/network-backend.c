@@ -110,6 +110,125 @@ network_backend_init_extra(network_backend_t *b, chassis *chas)
     return 0;
 }
 
+#define BREAKER_MIN_REQUESTS 20
+#define BREAKER_SLOW_PERCENT 10 /* p90 over the latency limit */
+#define BREAKER_OPEN_US (5 * G_USEC_PER_SEC)
+#define BREAKER_PROBE_INTERVAL_US (200 * 1000)
+#define BREAKER_PROBES 5
+
+static const char *breaker_state_str[] = {
+    "closed",
+    "open",
+    "half-open"
+};
+
+static void
+breaker_set_state(network_backend_t *b, breaker_state_t state, gint64 now)
+{
+    g_message("circuit breaker of backend %s: %s -> %s", b->addr->name->str,
+              breaker_state_str[b->breaker_state], breaker_state_str[state]);
+    b->breaker_state = state;
+    b->breaker_epoch++;
+    b->breaker_since_us = now;
+    b->breaker_probes_ok = 0;
+    if (state == BREAKER_CLOSED) {
+        memset(b->breaker_slots, 0, sizeof(b->breaker_slots));
+    }
+}
+
+gboolean
+network_backend_breaker_check(network_backend_t *b)
+{
+    chassis *srv = b->pool->srv;
+    if (srv == NULL || !srv->circuit_breaker || b->breaker_state == BREAKER_CLOSED) {
+        return TRUE;
+    }
+
+    gint64 now = g_get_monotonic_time();
+    if (b->breaker_state == BREAKER_OPEN) {
+        return now - b->breaker_since_us >= BREAKER_OPEN_US;
+    }
+    /* half-open: a trickle of probes */
+    return now - b->breaker_probe_us >= BREAKER_PROBE_INTERVAL_US;
+}
+
+void
+network_backend_breaker_claim(network_backend_t *b)
+{
+    chassis *srv = b->pool->srv;
+    if (srv == NULL || !srv->circuit_breaker || b->breaker_state == BREAKER_CLOSED) {
+        return;
+    }
+
+    gint64 now = g_get_monotonic_time();
+    if (b->breaker_state == BREAKER_OPEN) {
+        breaker_set_state(b, BREAKER_HALF_OPEN, now);
+    }
+    b->breaker_probe_us = now;
+}
+
+void
+network_backend_breaker_record(network_backend_t *b, guint32 epoch, gint64 latency_us, gboolean failed)
+{
+    chassis *srv = b->pool->srv;
+    if (srv == NULL || !srv->circuit_breaker) {
+        return;
+    }
+    if (epoch != b->breaker_epoch) {
+        /* e.g. a late answer to a query sent before it opened isn't a probe */
+        return;
+    }
+
+    gint64 now = g_get_monotonic_time();
+    gint64 sec = now / G_USEC_PER_SEC;
+    gboolean slow = srv->circuit_breaker_latency > 0 && latency_us >= (gint64)srv->circuit_breaker_latency * 1000;
+
+    breaker_slot_t *slot = &b->breaker_slots[sec % BREAKER_WINDOW];
+    if (slot->sec != sec) {
+        memset(slot, 0, sizeof(*slot));
+        slot->sec = sec;
+    }
+    slot->requests++;
+    slot->errors += failed ? 1 : 0;
+    slot->slow += slow ? 1 : 0;
+
+    switch (b->breaker_state) {
+    case BREAKER_HALF_OPEN:
+        if (failed || slow) {
+            breaker_set_state(b, BREAKER_OPEN, now);
+        } else if (++b->breaker_probes_ok >= BREAKER_PROBES) {
+            breaker_set_state(b, BREAKER_CLOSED, now);
+        }
+        break;
+    case BREAKER_CLOSED:{
+        guint64 requests = 0, errors = 0, slow_count = 0;
+        int i;
+        for (i = 0; i < BREAKER_WINDOW; i++) {
+            breaker_slot_t *s = &b->breaker_slots[i];
+            if (s->sec > sec - BREAKER_WINDOW) {
+                requests += s->requests;
+                errors += s->errors;
+                slow_count += s->slow;
+            }
+        }
+        if (requests < BREAKER_MIN_REQUESTS) {
+            break;
+        }
+        if (srv->circuit_breaker_error_rate > 0 && errors * 100 >= srv->circuit_breaker_error_rate * requests) {
+            g_warning("backend %s: %" G_GUINT64_FORMAT " of %" G_GUINT64_FORMAT " queries failed", b->addr->name->str, errors, requests);
+            breaker_set_state(b, BREAKER_OPEN, now);
+        } else if (slow_count * 100 > BREAKER_SLOW_PERCENT * requests) {
+            g_warning("backend %s: %" G_GUINT64_FORMAT " of %" G_GUINT64_FORMAT " queries took %dms or more",
+                      b->addr->name->str, slow_count, requests, srv->circuit_breaker_latency);
+            breaker_set_state(b, BREAKER_OPEN, now);
+        }
+        break;
+    }
+    default:
+        break;
+    }
+}
+
 int
 network_backend_conns_count(network_backend_t *b)
 {
@@ -118,6 +237,13 @@ network_backend_conns_count(network_backend_t *b)
     return in_use + pooled;
 }
 
+/* connections serving clients, without the ones still being opened */
+int
+network_backend_borrowed_count(network_backend_t *b)
+{
+    return b->connected_clients - b->connecting;
+}
+
 /*
  * save challenges from backend, will be used to authenticate front user
  */
@@ -130,7 +256,12 @@ network_backend_save_challenge(network_backend_t *b, const network_mysqld_auth_c
         network_mysqld_auth_challenge_free(challenge);
     }
 
+#ifdef SIMPLE_PARSER
     static const guint32 not_supported = CLIENT_SSL | CLIENT_LOCAL_FILES | CLIENT_DEPRECATE_EOF;
+#else
+    /* LOAD DATA LOCAL INFILE is relayed by the shard plugin */
+    static const guint32 not_supported = CLIENT_SSL | CLIENT_DEPRECATE_EOF;
+#endif
 
     network_mysqld_auth_challenge *challenge = network_mysqld_auth_challenge_copy(chal);
 
@@ -545,7 +676,10 @@ backends_get_ro_ndx_round_robin(network_backends_t *bs)
         if ((backend->type == BACKEND_TYPE_RO)
             && (backend->state == BACKEND_STATE_UP || backend->state == BACKEND_STATE_UNKNOWN)) {
             if (ro_index == remainder) {
-                break;
+                if (network_backend_breaker_check(backend)) {
+                    break;
+                }
+                remainder++;    /* on to the next one */
             }
             ro_index++;
         }
@@ -561,7 +695,8 @@ backends_get_ro_ndx_first(network_backends_t *bs)
     for (i = 0; i < count; i++) {
         network_backend_t *backend = network_backends_get(bs, i);
         if ((backend->type == BACKEND_TYPE_RO)
-            && (backend->state == BACKEND_STATE_UP || backend->state == BACKEND_STATE_UNKNOWN)) {
+            && (backend->state == BACKEND_STATE_UP || backend->state == BACKEND_STATE_UNKNOWN)
+            && network_backend_breaker_check(backend)) {
             return i;
         }
     }
@@ -575,19 +710,22 @@ backends_get_ro_ndx_random(network_backends_t *bs)
     int ndx = g_random_int_range(0, count);
     network_backend_t *backend = network_backends_get(bs, ndx);
     if (backend->type == BACKEND_TYPE_RO) { /* luckily run into a RO */
-        if (backend->state == BACKEND_STATE_UP || backend->state == BACKEND_STATE_UNKNOWN) {
+        if ((backend->state == BACKEND_STATE_UP || backend->state == BACKEND_STATE_UNKNOWN)
+            && network_backend_breaker_check(backend)) {
             return ndx;
         }
     } else {                    /* if we run into a RW, try it's neighbours */
         if (ndx - 1 >= 0) {
             backend = network_backends_get(bs, ndx - 1);
             if ((backend->type == BACKEND_TYPE_RO)
-                && (backend->state == BACKEND_STATE_UP || backend->state == BACKEND_STATE_UNKNOWN)) {
+                && (backend->state == BACKEND_STATE_UP || backend->state == BACKEND_STATE_UNKNOWN)
+                && network_backend_breaker_check(backend)) {
                 return ndx - 1;
             }
         } else if (ndx + 1 < count) {
             if ((backend->type == BACKEND_TYPE_RO)
-                && (backend->state == BACKEND_STATE_UP || backend->state == BACKEND_STATE_UNKNOWN)) {
+                && (backend->state == BACKEND_STATE_UP || backend->state == BACKEND_STATE_UNKNOWN)
+                && network_backend_breaker_check(backend)) {
                 return ndx + 1;
             }
         }
@@ -600,8 +738,11 @@ int
 network_backends_get_ro_ndx(network_backends_t *bs, backend_algo_t algo)
 {
     switch (algo) {
-    case BACKEND_ALGO_ROUND_ROBIN:
-        return backends_get_ro_ndx_round_robin(bs);
+    case BACKEND_ALGO_ROUND_ROBIN:{
+        /* the turn may fall on a slave the breaker keeps out */
+        int ndx = backends_get_ro_ndx_round_robin(bs);
+        return ndx != -1 ? ndx : backends_get_ro_ndx_first(bs);
+    }
     case BACKEND_ALGO_RANDOM:
         return backends_get_ro_ndx_random(bs);
     case BACKEND_ALGO_FIRST:
@@ -623,6 +764,9 @@ network_backends_get_rw_ndx(network_backends_t *bs)
             break;
         }
     }
+    if (i < count && !network_backend_breaker_check(network_backends_get(bs, i))) {
+        return -1;              /* fail fast */
+    }
     return i < count ? i : -1;
 }
 
@@ -640,6 +784,18 @@ network_backends_find_address(network_backends_t *bs, const char *ipport)
     return -1;
 }
 
+int
+network_backends_get_ndx(network_backends_t *bs, const network_backend_t *backend)
+{
+    int i;
+    for (i = 0; i < bs->backends->len; i++) {
+        if (g_ptr_array_index(bs->backends, i) == backend) {
+            return i;
+        }
+    }
+    return -1;
+}
+
 network_mysqld_auth_challenge *
 network_backends_get_challenge(network_backends_t *bs, int back_ndx)
 {
@@ -672,7 +828,7 @@ network_group_pick_slave_backend(network_group_t *group)
         g_debug("%s, slave:%d, total:%d, connected:%d, idle:%d, max:%d",
                 G_STRLOC, (int)i, total, connected_clts, cur_idle, max_idle_conns);
 
-        if (cur_idle || total <= max_idle_conns) {
+        if ((cur_idle || total <= max_idle_conns) && network_backend_breaker_check(backend)) {
             break;
         }
     }
@@ -63,6 +63,32 @@ typedef struct backend_config {
 
 } backend_config;
 
+/* number of heartbeat samples the worst slave delay is taken over */
+#define SLAVE_DELAY_WINDOW 10
+
+/**
+ * circuit breaker, see circuit-breaker
+ *
+ * the outcomes of the round trips of the last BREAKER_WINDOW seconds are
+ * counted per second, too many errors or a p90 over the latency limit
+ * open the circuit: no query goes to the backend for a while, then a few
+ * probes are let through (half-open) and decide whether it closes again
+ */
+#define BREAKER_WINDOW 10
+
+typedef enum {
+    BREAKER_CLOSED,
+    BREAKER_OPEN,
+    BREAKER_HALF_OPEN,
+} breaker_state_t;
+
+typedef struct {
+    gint64 sec;
+    guint32 requests;
+    guint32 errors;
+    guint32 slow;
+} breaker_slot_t;
+
 typedef struct {
     network_address *addr;
     GString *server_group;
@@ -77,6 +103,8 @@ typedef struct {
 
     /**< number of open connections to this backend for SQF */
     int connected_clients;
+    /**< of connected_clients, the ones the proxy is still opening for the pool */
+    int connecting;
 
     /**< the UUID of the backend */
     GString *uuid;
@@ -84,14 +112,39 @@ typedef struct {
     backend_config *config;
     GPtrArray *challenges;
     time_t last_check_time;
-    int slave_delay_msec;       /* valid if this is a ReadOnly slave */
+    int slave_delay_msec;       /* valid if this is a ReadOnly slave, smoothed */
+    int slave_delay_max_msec;   /* the largest of the recent samples */
+    int slave_delay_samples[SLAVE_DELAY_WINDOW];
+    int slave_delay_sample_pos;
+
+    breaker_state_t breaker_state;
+    guint32 breaker_epoch;      /* bumped on each state change */
+    gint64 breaker_since_us;    /* when breaker_state was entered */
+    gint64 breaker_probe_us;    /* when the last probe was let through */
+    int breaker_probes_ok;      /* probes answered in time since half-open */
+    breaker_slot_t breaker_slots[BREAKER_WINDOW];
 } network_backend_t;
 
 NETWORK_API network_backend_t *network_backend_new();
 NETWORK_API void network_backend_free(network_backend_t *b);
 NETWORK_API int network_backend_conns_count(network_backend_t *b);
+NETWORK_API int network_backend_borrowed_count(network_backend_t *b);
 NETWORK_API int network_backend_init_extra(network_backend_t *b, chassis *chas);
 void network_backend_save_challenge(network_backend_t *b, const network_mysqld_auth_challenge *);
+
+/* may a query go to the backend now */
+NETWORK_API gboolean network_backend_breaker_check(network_backend_t *b);
+
+/* a query picked the backend, half-open it is the next probe */
+NETWORK_API void network_backend_breaker_claim(network_backend_t *b);
+
+/**
+ * the outcome of one round trip to the backend
+ * @param epoch breaker_epoch when the query was sent, answers to queries
+ *        sent in another state are not counted
+ */
+NETWORK_API void network_backend_breaker_record(network_backend_t *b, guint32 epoch,
+                                                gint64 latency_us, gboolean failed);
 network_mysqld_auth_challenge *network_backend_get_challenge(network_backend_t *b);
 
 typedef struct {
@@ -121,6 +174,9 @@ NETWORK_API gboolean network_backends_load_config(network_backends_t *, chassis
 /* get backend index by ip:port string */
 int network_backends_find_address(network_backends_t *bs, const char *);
 
+/* get backend index by pointer, -1 if not found */
+int network_backends_get_ndx(network_backends_t *bs, const network_backend_t *);
+
 network_mysqld_auth_challenge *network_backends_get_challenge(network_backends_t *b, int back_ndx);
 
 #define MAX_GROUP_SLAVES 4
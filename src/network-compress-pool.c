@@ -0,0 +1,223 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include <event.h>
+
+#include "network-compress-pool.h"
+#include "network-mysqld-proto.h"
+
+struct compress_job_t {
+    compress_ctx_t *ctx;
+    GPtrArray *chunks;
+    guint8 packet_id;
+    GString *frame;
+    compress_job_done_fn done;
+    void *user_data;
+    gboolean cancelled;         /* only touched by the event loop */
+};
+
+typedef struct {
+    GThreadPool *workers;
+    GAsyncQueue *done_queue;
+    int efd;
+    struct event done_event;
+    gsize min_len;
+} compress_pool_t;
+
+static compress_pool_t *pool = NULL;
+
+static void
+compress_job_free(compress_job_t *job)
+{
+    if (job->cancelled) {
+        cetus_compress_ctx_free(job->ctx);
+    }
+    if (job->frame) {
+        g_string_free(job->frame, TRUE);
+    }
+    g_free(job);
+}
+
+/* runs in a worker thread */
+static void
+compress_job_run(gpointer data, gpointer user_data)
+{
+    compress_job_t *job = data;
+    GString *frame = g_string_sized_new(16384);
+    int uncompressed_len = 0;
+    int i;
+
+    /* 3 bytes compressed length, packet id, 3 bytes uncompressed length */
+    g_string_set_size(frame, NET_HEADER_SIZE + COMP_HEADER_SIZE);
+    frame->str[3] = job->packet_id;
+
+    int ret = cetus_compress_begin(job->ctx);
+    for (i = 0; i < job->chunks->len; i++) {
+        GString *s = g_ptr_array_index(job->chunks, i);
+        if (ret == Z_OK) {
+            ret = cetus_compress(job->ctx, frame, s->str, s->len, i + 1 == job->chunks->len);
+        }
+        uncompressed_len += s->len;
+        g_string_free(s, TRUE);
+    }
+    g_ptr_array_free(job->chunks, TRUE);
+    job->chunks = NULL;
+
+    int compressed_len = frame->len - NET_HEADER_SIZE - COMP_HEADER_SIZE;
+    if (ret != Z_OK) {
+        g_warning("%s:compression failed: %d", G_STRLOC, ret);
+        g_string_free(frame, TRUE);
+        frame = NULL;
+    } else if (compressed_len > PACKET_LEN_MAX) {
+        g_warning("%s:too large for compression:%d, compressed len:%d", G_STRLOC, uncompressed_len, compressed_len);
+        g_string_free(frame, TRUE);
+        frame = NULL;
+    } else {
+        for (i = 0; i < 3; i++) {
+            frame->str[i] = (compressed_len >> (i * 8)) & 0xff;
+            frame->str[NET_HEADER_SIZE + i] = (uncompressed_len >> (i * 8)) & 0xff;
+        }
+    }
+    job->frame = frame;
+
+    g_async_queue_push(pool->done_queue, job);
+    uint64_t one = 1;
+    if (write(pool->efd, &one, sizeof(one)) != sizeof(one)) {
+        g_critical("%s:write eventfd failed: %s", G_STRLOC, g_strerror(errno));
+    }
+}
+
+static void
+compress_pool_done_handler(int fd, short events, void *arg)
+{
+    uint64_t n;
+    if (read(fd, &n, sizeof(n)) != sizeof(n) && errno != EAGAIN) {
+        g_critical("%s:read eventfd failed: %s", G_STRLOC, g_strerror(errno));
+    }
+
+    compress_job_t *job;
+    while ((job = g_async_queue_try_pop(pool->done_queue))) {
+        if (!job->cancelled) {
+            GString *frame = job->frame;
+            job->frame = NULL;
+            job->done(job, frame, job->user_data);
+        }
+        compress_job_free(job);
+    }
+}
+
+int
+network_compress_pool_start(chassis *chas)
+{
+    if (pool || chas->compress_threads <= 0) {
+        return 0;
+    }
+    if (chas->disable_threads) {
+        g_message("%s:threads disabled, compress inline", G_STRLOC);
+        return 0;
+    }
+
+    int efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (efd == -1) {
+        g_critical("%s:eventfd failed: %s", G_STRLOC, g_strerror(errno));
+        return -1;
+    }
+
+    GError *error = NULL;
+    GThreadPool *workers = g_thread_pool_new(compress_job_run, NULL, chas->compress_threads, FALSE, &error);
+    if (!workers) {
+        g_critical("%s:create compress threads failed: %s", G_STRLOC, error ? error->message : "");
+        g_clear_error(&error);
+        close(efd);
+        return -1;
+    }
+
+    pool = g_new0(compress_pool_t, 1);
+    pool->workers = workers;
+    pool->done_queue = g_async_queue_new();
+    pool->efd = efd;
+    pool->min_len = chas->compress_offload_size;
+
+    event_set(&pool->done_event, efd, EV_READ | EV_PERSIST, compress_pool_done_handler, NULL);
+    event_base_set(chas->event_base, &pool->done_event);
+    event_add(&pool->done_event, NULL);
+
+    g_message("%s:%d compress threads for batches from %d bytes", G_STRLOC,
+              chas->compress_threads, (int)pool->min_len);
+    return 0;
+}
+
+void
+network_compress_pool_stop(void)
+{
+    if (!pool) {
+        return;
+    }
+
+    /* let the queued jobs finish, their owners are all gone by now */
+    g_thread_pool_free(pool->workers, FALSE, TRUE);
+    event_del(&pool->done_event);
+    close(pool->efd);
+
+    compress_job_t *job;
+    while ((job = g_async_queue_try_pop(pool->done_queue))) {
+        compress_job_free(job);
+    }
+    g_async_queue_unref(pool->done_queue);
+    g_free(pool);
+    pool = NULL;
+}
+
+gboolean
+network_compress_pool_accepts(gsize len)
+{
+    return pool && len >= pool->min_len;
+}
+
+compress_job_t *
+network_compress_job_submit(compress_ctx_t *ctx, GPtrArray *chunks, guint8 packet_id,
+                            compress_job_done_fn done, void *user_data)
+{
+    compress_job_t *job = g_new0(compress_job_t, 1);
+    job->ctx = ctx;
+    job->chunks = chunks;
+    job->packet_id = packet_id;
+    job->done = done;
+    job->user_data = user_data;
+
+    g_thread_pool_push(pool->workers, job, NULL);
+    return job;
+}
+
+void
+network_compress_job_cancel(compress_job_t *job)
+{
+    job->cancelled = TRUE;
+}
@@ -0,0 +1,57 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#ifndef _NETWORK_COMPRESS_POOL_H_
+#define _NETWORK_COMPRESS_POOL_H_
+
+#include <glib.h>
+
+#include "chassis-mainloop.h"
+#include "network-compress.h"
+#include "network-exports.h"
+
+/**
+ * Compression of large send batches off the event loop.
+ *
+ * A batch of whole packets is compressed into one frame by a worker thread,
+ * the frame comes back to the event loop through an eventfd.
+ */
+typedef struct compress_job_t compress_job_t;
+
+/* @param frame the compressed packet with its header, NULL on failure */
+typedef void (*compress_job_done_fn) (compress_job_t *, GString *frame, void *user_data);
+
+NETWORK_API int network_compress_pool_start(chassis *);
+NETWORK_API void network_compress_pool_stop(void);
+
+/* TRUE if a batch of @len bytes should be compressed by the pool */
+NETWORK_API gboolean network_compress_pool_accepts(gsize len);
+
+/**
+ * @param ctx    not to be used until the job is done
+ * @param chunks GStrings of the batch, freed by the job
+ */
+NETWORK_API compress_job_t *network_compress_job_submit(compress_ctx_t *ctx, GPtrArray *chunks, guint8 packet_id,
+                                                        compress_job_done_fn done, void *user_data);
+
+/* the owner is gone, the job frees @ctx instead of calling back */
+NETWORK_API void network_compress_job_cancel(compress_job_t *);
+
+#endif
@@ -27,33 +27,154 @@
 #include <zlib.h>
 #include "network-compress.h"
 
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
 #define CHUNK 16384
 
-int
-cetus_compress_init(z_stream *strm)
+struct compress_ctx_t {
+    compress_algo_t algo;
+    int level;
+    /* not bitfields, deflate may run in a compress thread while inflating */
+    gboolean deflate_ready;
+    gboolean inflate_ready;
+    z_stream deflate_strm;
+    z_stream inflate_strm;
+#ifdef HAVE_ZSTD
+    ZSTD_CCtx *cctx;
+    ZSTD_DCtx *dctx;
+#endif
+};
+
+compress_ctx_t *
+cetus_compress_ctx_new(compress_algo_t algo, int level)
 {
-    /* allocate deflate state */
-    strm->zalloc = Z_NULL;
-    strm->zfree = Z_NULL;
-    strm->opaque = Z_NULL;
+    compress_ctx_t *ctx = g_new0(compress_ctx_t, 1);
+#ifdef HAVE_ZSTD
+    ctx->algo = algo;
+#else
+    ctx->algo = COMPRESS_ALGO_ZLIB;
+#endif
+    ctx->level = level;
+    return ctx;
+}
 
-    int level = Z_DEFAULT_COMPRESSION;
+void
+cetus_compress_ctx_free(compress_ctx_t *ctx)
+{
+    if (!ctx)
+        return;
+    if (ctx->deflate_ready) {
+        (void)deflateEnd(&ctx->deflate_strm);
+    }
+    if (ctx->inflate_ready) {
+        (void)inflateEnd(&ctx->inflate_strm);
+    }
+#ifdef HAVE_ZSTD
+    ZSTD_freeCCtx(ctx->cctx);
+    ZSTD_freeDCtx(ctx->dctx);
+#endif
+    g_free(ctx);
+}
 
-    return deflateInit(strm, level);
+#ifdef HAVE_ZSTD
+static int
+zstd_compress(compress_ctx_t *ctx, GString *dst, char *src, int src_len, int end)
+{
+    unsigned char out[CHUNK];
+    ZSTD_inBuffer input = { src, src_len, 0 };
+    ZSTD_EndDirective mode = end ? ZSTD_e_end : ZSTD_e_continue;
+    size_t remaining;
+
+    do {
+        ZSTD_outBuffer output = { out, CHUNK, 0 };
+        remaining = ZSTD_compressStream2(ctx->cctx, &output, &input, mode);
+        if (ZSTD_isError(remaining)) {
+            g_warning("%s: zstd compress failed: %s", G_STRLOC, ZSTD_getErrorName(remaining));
+            return Z_STREAM_ERROR;
+        }
+        if (output.pos > 0) {
+            g_string_append_len(dst, (const gchar *)out, output.pos);
+        }
+    } while (end ? remaining != 0 : input.pos < input.size);
+
+    return Z_OK;
 }
 
-void
-cetus_compress_end(z_stream *strm)
+static int
+zstd_uncompress(compress_ctx_t *ctx, GString *dst, unsigned char *src, int len, int uncompressed_len)
+{
+    if (!ctx->dctx) {
+        ctx->dctx = ZSTD_createDCtx();
+    }
+    gsize offset = dst->len;
+    g_string_set_size(dst, offset + uncompressed_len);
+    size_t ret = ZSTD_decompressDCtx(ctx->dctx, dst->str + offset, uncompressed_len, src, len);
+    if (ZSTD_isError(ret) || ret != uncompressed_len) {
+        g_string_truncate(dst, offset);
+        return Z_DATA_ERROR;
+    }
+    return Z_OK;
+}
+#endif
+
+int
+cetus_compress_begin(compress_ctx_t *ctx)
 {
-    (void)deflateEnd(strm);
+#ifdef HAVE_ZSTD
+    if (ctx->algo == COMPRESS_ALGO_ZSTD) {
+        if (!ctx->cctx) {
+            ctx->cctx = ZSTD_createCCtx();
+            if (!ctx->cctx) {
+                return Z_MEM_ERROR;
+            }
+            size_t ret = ZSTD_CCtx_setParameter(ctx->cctx, ZSTD_c_compressionLevel, ctx->level);
+            if (ZSTD_isError(ret)) {
+                g_warning("%s: zstd level %d: %s", G_STRLOC, ctx->level, ZSTD_getErrorName(ret));
+                ZSTD_freeCCtx(ctx->cctx);
+                ctx->cctx = NULL;
+                return Z_STREAM_ERROR;
+            }
+        } else {
+            ZSTD_CCtx_reset(ctx->cctx, ZSTD_reset_session_only);
+        }
+        return Z_OK;
+    }
+#endif
+    if (ctx->deflate_ready) {
+        return deflateReset(&ctx->deflate_strm);
+    }
+
+    /* allocate deflate state */
+    ctx->deflate_strm.zalloc = Z_NULL;
+    ctx->deflate_strm.zfree = Z_NULL;
+    ctx->deflate_strm.opaque = Z_NULL;
+
+    int ret = deflateInit(&ctx->deflate_strm, ctx->level);
+    if (ret != Z_OK) {
+        g_warning("%s: deflateInit failed: %d", G_STRLOC, ret);
+    }
+    ctx->deflate_ready = (ret == Z_OK);
+    return ret;
 }
 
 int
-cetus_compress(z_stream *strm, GString *dst, char *src, int src_len, int end)
+cetus_compress(compress_ctx_t *ctx, GString *dst, char *src, int src_len, int end)
 {
+#ifdef HAVE_ZSTD
+    if (ctx->algo == COMPRESS_ALGO_ZSTD) {
+        return zstd_compress(ctx, dst, src, src_len, end);
+    }
+#endif
+    z_stream *strm = &ctx->deflate_strm;
     int flush;
     unsigned char out[CHUNK];
 
+    if (!ctx->deflate_ready) {
+        return Z_STREAM_ERROR;
+    }
+
     strm->avail_in = src_len;
     flush = end ? Z_FINISH : Z_NO_FLUSH;
     strm->next_in = (Bytef *) src;
@@ -74,58 +195,55 @@ cetus_compress(z_stream *strm, GString *dst, char *src, int src_len, int end)
     return Z_OK;
 }
 
-static int
-cetus_uncompress_init(z_stream *strm)
-{
-    /* allocate inflate state */
-    strm->zalloc = Z_NULL;
-    strm->zfree = Z_NULL;
-    strm->opaque = Z_NULL;
-    strm->avail_in = 0;
-    strm->next_in = Z_NULL;
-
-    return inflateInit(strm);
-}
-
-static void
-cetus_uncompress_end(z_stream *strm)
-{
-    (void)inflateEnd(strm);
-}
-
 int
-cetus_uncompress(GString *uncompressed_packet, unsigned char *src, int len)
+cetus_uncompress(compress_ctx_t *ctx, GString *uncompressed_packet, unsigned char *src, int len, int uncompressed_len)
 {
+#ifdef HAVE_ZSTD
+    if (ctx->algo == COMPRESS_ALGO_ZSTD) {
+        return zstd_uncompress(ctx, uncompressed_packet, src, len, uncompressed_len);
+    }
+#endif
     int ret;
-    z_stream strm;
+    z_stream *strm = &ctx->inflate_strm;
     unsigned char out[CHUNK];
 
-    cetus_uncompress_init(&strm);
+    if (ctx->inflate_ready) {
+        inflateReset(strm);
+    } else {
+        /* allocate inflate state */
+        strm->zalloc = Z_NULL;
+        strm->zfree = Z_NULL;
+        strm->opaque = Z_NULL;
+        strm->avail_in = 0;
+        strm->next_in = Z_NULL;
+        ret = inflateInit(strm);
+        if (ret != Z_OK) {
+            return ret;
+        }
+        ctx->inflate_ready = 1;
+    }
 
     /* decompress until deflate stream ends or end of file */
-    strm.avail_in = len;
-    strm.next_in = src;
+    strm->avail_in = len;
+    strm->next_in = src;
 
     /* run inflate() on input until output buffer not full */
     do {
-        strm.avail_out = CHUNK;
-        strm.next_out = out;
-        ret = inflate(&strm, Z_NO_FLUSH);
+        strm->avail_out = CHUNK;
+        strm->next_out = out;
+        ret = inflate(strm, Z_NO_FLUSH);
         switch (ret) {
         case Z_NEED_DICT:
             ret = Z_DATA_ERROR; /* and fall through */
         case Z_DATA_ERROR:
         case Z_MEM_ERROR:
-            (void)inflateEnd(&strm);
             return ret;
         }
-        unsigned int have = CHUNK - strm.avail_out;
+        unsigned int have = CHUNK - strm->avail_out;
 
         g_string_append_len(uncompressed_packet, (const gchar *)out, have);
 
-    } while (strm.avail_out == 0);
-
-    cetus_uncompress_end(&strm);
+    } while (strm->avail_out == 0);
 
     return ret == Z_STREAM_END ? Z_OK : Z_DATA_ERROR;
 }
@@ -34,9 +34,35 @@
 
 #define MIN_COMPRESS_LENGTH  50
 
-NETWORK_API int cetus_uncompress(GString *uncompressed_packet, unsigned char *src, int len);
-NETWORK_API int cetus_compress(z_stream *strm, GString *dst, char *src, int src_len, int end);
-NETWORK_API void cetus_compress_end(z_stream *strm);
-NETWORK_API int cetus_compress_init(z_stream *strm);
+/* the zstd level is one byte in the handshake, MySQL takes 1 to 22 */
+#define ZSTD_LEVEL_MAX 22
+
+#ifndef CLIENT_ZSTD_COMPRESSION_ALGORITHM
+#define CLIENT_ZSTD_COMPRESSION_ALGORITHM (1UL << 26)
+#endif
+
+typedef enum {
+    COMPRESS_ALGO_ZLIB,
+    COMPRESS_ALGO_ZSTD,         /* MySQL 8.0.18+ */
+} compress_algo_t;
+
+/**
+ * Compression state of one socket, kept for the life of the connection.
+ *
+ * Every compressed payload of the protocol is a complete stream/frame, so
+ * the contexts are only reset between payloads instead of being set up
+ * again (deflateInit allocates about 256KB).
+ */
+typedef struct compress_ctx_t compress_ctx_t;
+
+NETWORK_API compress_ctx_t *cetus_compress_ctx_new(compress_algo_t algo, int level);
+NETWORK_API void cetus_compress_ctx_free(compress_ctx_t *);
+
+/* start a new compressed payload, nothing can be compressed unless it returns Z_OK */
+NETWORK_API int cetus_compress_begin(compress_ctx_t *);
+NETWORK_API int cetus_compress(compress_ctx_t *, GString *dst, char *src, int src_len, int end);
+
+/* @param uncompressed_len from the compressed packet header */
+NETWORK_API int cetus_uncompress(compress_ctx_t *, GString *dst, unsigned char *src, int len, int uncompressed_len);
 
 #endif
@@ -109,7 +109,7 @@ network_pool_add_idle_conn(network_connection_pool *pool, chassis *srv, network_
     timeout.tv_sec = surplus_time;
     timeout.tv_usec = 0;
 
-    chassis_event_add_with_timeout(srv, &(server->event), &timeout);
+    chassis_event_add_with_timer(srv, &(server->event), &(server->timer), &timeout);
 
     return 0;
 }
@@ -162,7 +162,8 @@ network_pool_add_conn(network_mysqld_con *con, int is_swap)
 
     if (!is_swap && con->servers == NULL) {
         if (con->srv->is_reduce_conns) {
-            if (network_conn_pool_do_reduce_conns_verdict(st->backend->pool, st->backend->connected_clients)) {
+            if (network_conn_pool_do_reduce_conns_verdict(st->backend->pool,
+                                                          network_backend_borrowed_count(st->backend))) {
                 to_be_put_to_pool = FALSE;
             }
         }
@@ -209,7 +210,7 @@ network_pool_add_conn(network_mysqld_con *con, int is_swap)
                 int index = st->backend_ndx_array[i] - 1;
                 server = g_ptr_array_index(con->servers, index);
                 backend = network_backends_get(g->backends, i);
-                CHECK_PENDING_EVENT(&(server->event));
+                CHECK_PENDING_EVENT(&(server->event), &(server->timer));
 
                 g_debug("%s: add conn fd:%d to pool:%p ", G_STRLOC, server->fd, backend->pool);
                 server->is_multi_stmt_set = con->client->is_multi_stmt_set;
@@ -236,7 +237,7 @@ network_pool_add_conn(network_mysqld_con *con, int is_swap)
         con->is_prepared = 0;
         con->prepare_stmt_count = 0;
         g_debug("%s: con:%p, set prepare_stmt_count 0", G_STRLOC, con);
-        CHECK_PENDING_EVENT(&(con->server->event));
+        CHECK_PENDING_EVENT(&(con->server->event), &(con->server->timer));
 
         g_debug("%s: add conn fd:%d to pool:%p", G_STRLOC, con->server->fd, st->backend->pool);
         con->server->is_multi_stmt_set = con->client->is_multi_stmt_set;
@@ -375,6 +376,7 @@ network_connection_pool_swap(network_mysqld_con *con, int backend_ndx)
     /* connect to the new backend */
     st->backend = backend;
     st->backend->connected_clients++;
+    network_connection_pool_note_in_use(backend->pool, network_backend_borrowed_count(backend));
     st->backend_ndx = backend_ndx;
 
     g_debug("%s, con:%p, backend ndx:%d:connected_clients add, clients:%d, sock:%p",
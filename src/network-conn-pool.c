@@ -18,11 +18,13 @@
 
  $%ENDLICENSE%$ */
 
+#include <math.h>
 #include <glib.h>
 
 #include "network-conn-pool.h"
 #include "network-mysqld-packet.h"
 #include "glib-ext.h"
+#include "chassis-event.h"
 #include "sys-pedantic.h"
 
 /** @file
@@ -66,7 +68,7 @@ network_connection_pool_entry_free(network_connection_pool_entry *e, gboolean fr
         network_socket *sock = e->sock;
 
         g_debug("%s:event del, ev:%p", G_STRLOC, &(sock->event));
-        event_del(&(sock->event));
+        chassis_event_del(&(sock->event), &(sock->timer));
         network_socket_free(sock);
     }
 
@@ -210,7 +212,9 @@ network_connection_pool_get(network_connection_pool *pool, GString *username, in
         g_message("%s: conns is null for user '%s'", G_STRLOC, username ? username->str : "");
     }
 
+    pool->gets++;
     if (!entry) {
+        pool->misses++;
         g_debug("%s: (get) no entry for user '%s' -> %p", G_STRLOC, username ? username->str : "", conns);
         return NULL;
     }
@@ -226,7 +230,7 @@ network_connection_pool_get(network_connection_pool *pool, GString *username, in
 
     g_debug("%s:event del, ev:%p", G_STRLOC, &(sock->event));
     /* remove the idle handler from the socket */
-    event_del(&(sock->event));
+    chassis_event_del(&(sock->event), &(sock->timer));
 
     g_debug("%s: (get) got socket for user '%s' -> %p, charset:%s", G_STRLOC,
             username ? username->str : "", sock, sock->charset->str);
@@ -292,14 +296,80 @@ network_connection_pool_remove(network_connection_pool *pool, network_connection
     pool->cur_idle_connections--;
 }
 
-gboolean
-network_conn_pool_do_reduce_conns_verdict(network_connection_pool *pool, int connected_clients)
+/* weights of a new sample: demand follows a rise at once, a fall over ~20 intervals */
+#define DEMAND_ALPHA_UP 0.5
+#define DEMAND_ALPHA_DOWN 0.05
+#define MISS_RATE_ALPHA 0.3
+
+/* spare connections over the demand, grows with the miss rate */
+#define POOL_HEADROOM 0.2
+
+void
+network_connection_pool_note_in_use(network_connection_pool *pool, int in_use)
+{
+    if (in_use > pool->peak_in_use) {
+        pool->peak_in_use = in_use;
+    }
+}
+
+void
+network_connection_pool_update_demand(network_connection_pool *pool, int in_use)
+{
+    double peak = MAX(pool->peak_in_use, in_use);
+    double alpha = peak > pool->demand ? DEMAND_ALPHA_UP : DEMAND_ALPHA_DOWN;
+    pool->demand += alpha * (peak - pool->demand);
+
+    if (pool->gets > 0) {
+        double rate = (double)pool->misses / pool->gets;
+        pool->miss_rate += MISS_RATE_ALPHA * (rate - pool->miss_rate);
+    }
+
+    pool->gets = 0;
+    pool->misses = 0;
+    pool->peak_in_use = in_use;
+    /* give back one surplus connection per interval */
+    pool->shrink_budget = 1;
+}
+
+int
+network_connection_pool_target(network_connection_pool *pool, int max)
 {
-    if (pool->cur_idle_connections > pool->mid_idle_connections) {
-        if (connected_clients < pool->cur_idle_connections) {
-            return TRUE;
+    int target = (int)ceil(pool->demand * (1 + POOL_HEADROOM + pool->miss_rate));
+    return CLAMP(target, (int)pool->mid_idle_connections, max);
+}
+
+int
+network_connection_pool_shrink(network_connection_pool *pool, int in_use, int target, int n)
+{
+    int closed = 0;
+    GHashTableIter iter;
+    GQueue *conns;
+
+    g_hash_table_iter_init(&iter, pool->users);
+    while (closed < n && in_use + pool->cur_idle_connections > target
+           && g_hash_table_iter_next(&iter, NULL, (void **)&conns)) {
+        /* added at the head, the tail is idle the longest */
+        while (closed < n && in_use + pool->cur_idle_connections > target && conns->length > 0) {
+            network_connection_pool_entry *entry = g_queue_peek_tail(conns);
+            network_connection_pool_remove(pool, entry);
+            closed++;
         }
     }
+    return closed;
+}
+
+gboolean
+network_conn_pool_do_reduce_conns_verdict(network_connection_pool *pool, int borrowed)
+{
+    if (pool->shrink_budget <= 0) {
+        return FALSE;
+    }
+    /* the returning connection is still counted as borrowed */
+    int target = network_connection_pool_target(pool, G_MAXINT);
+    if (borrowed + pool->cur_idle_connections > target) {
+        pool->shrink_budget--;
+        return TRUE;
+    }
 
     return FALSE;
 }
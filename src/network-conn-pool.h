@@ -37,6 +37,15 @@ typedef struct {
     guint mid_idle_connections;
     guint min_idle_connections;
 
+    /* demand since the last network_connection_pool_update_demand() */
+    guint gets;
+    guint misses;               /* gets finding no idle connection */
+    int peak_in_use;
+
+    double demand;              /* EWMA of peak_in_use, rises fast, decays slowly */
+    double miss_rate;           /* EWMA of misses / gets */
+    int shrink_budget;          /* idle connections to close until the next update */
+
 } network_connection_pool;
 
 typedef struct {
@@ -56,5 +65,15 @@ NETWORK_API network_connection_pool *network_connection_pool_new(void);
 NETWORK_API void network_connection_pool_free(network_connection_pool *pool);
 NETWORK_API int network_connection_pool_total_conns_count(network_connection_pool *pool);
 
+/* after a connection is borrowed, @in_use counting it */
+NETWORK_API void network_connection_pool_note_in_use(network_connection_pool *, int in_use);
+/* once per controller interval */
+NETWORK_API void network_connection_pool_update_demand(network_connection_pool *, int in_use);
+/* connections (idle and in use) wanted for the demand, in [mid_idle_connections, @max] */
+NETWORK_API int network_connection_pool_target(network_connection_pool *, int max);
+/* close up to @n idle connections beyond @target, the longest idle first */
+NETWORK_API int network_connection_pool_shrink(network_connection_pool *, int in_use, int target, int n);
+
+/* TRUE if a connection given back is surplus to the demand and to be closed */
 NETWORK_API gboolean network_conn_pool_do_reduce_conns_verdict(network_connection_pool *, int);
 #endif
@@ -28,6 +28,7 @@
 
 #include "network-mysqld-packet.h"
 #include "glib-ext.h"
+#include "network-compress.h"
 
 network_mysqld_com_query_result_t *
 network_mysqld_com_query_result_new()
@@ -947,6 +948,89 @@ network_mysqld_proto_append_ok_packet(GString *packet, network_mysqld_ok_packet_
     return 0;
 }
 
+/* the type of the GTID entries in the session state of an OK packet */
+#define SESSION_STATE_GTIDS 3
+
+/**
+ * turn an OK packet of a server with CLIENT_SESSION_TRACK into the format
+ * of one without it, which is what the clients of the proxy agreed on
+ *
+ * @param packet  the packet with its network header, rewritten in place
+ * @param gtid    set to the GTID of the transaction if it was tracked
+ * @return 0 on success, -1 if it isn't a valid OK packet
+ */
+int
+network_mysqld_proto_untrack_ok_packet(GString *packet, GString *gtid)
+{
+    network_packet p = { packet, NET_HEADER_SIZE };
+    guint8 field_count;
+    guint64 affected, insert_id, info_len = 0;
+    guint16 server_status, warning_count;
+    gsize info_offset = 0;
+    int err = 0;
+
+    err = err || network_mysqld_proto_get_int8(&p, &field_count);
+    err = err || field_count != 0;
+    err = err || network_mysqld_proto_get_lenenc_int(&p, &affected);
+    err = err || network_mysqld_proto_get_lenenc_int(&p, &insert_id);
+    err = err || network_mysqld_proto_get_int16(&p, &server_status);
+    err = err || network_mysqld_proto_get_int16(&p, &warning_count);
+    if (!err && p.offset < packet->len) {
+        err = err || network_mysqld_proto_get_lenenc_int(&p, &info_len);
+        info_offset = p.offset;
+        err = err || network_mysqld_proto_skip(&p, info_len);
+    }
+    if (!err && (server_status & SERVER_SESSION_STATE_CHANGED)) {
+        guint64 state_len;
+        err = err || network_mysqld_proto_get_lenenc_int(&p, &state_len);
+        err = err || p.offset + state_len > packet->len;
+
+        gsize state_end = p.offset + state_len;
+        while (!err && p.offset < state_end) {
+            guint8 type, spec;
+            guint64 len, gtid_len;
+
+            err = err || network_mysqld_proto_get_int8(&p, &type);
+            err = err || network_mysqld_proto_get_lenenc_int(&p, &len);
+            err = err || p.offset + len > state_end;
+            if (err) {
+                break;
+            }
+
+            gsize entry_end = p.offset + len;
+            if (type == SESSION_STATE_GTIDS && gtid) {
+                err = err || network_mysqld_proto_get_int8(&p, &spec);
+                err = err || network_mysqld_proto_get_lenenc_int(&p, &gtid_len);
+                err = err || p.offset + gtid_len > entry_end;
+                if (!err) {
+                    g_string_assign_len(gtid, packet->str + p.offset, gtid_len);
+                }
+            }
+            p.offset = entry_end;
+        }
+    }
+    if (err) {
+        return -1;
+    }
+
+    GString *plain = g_string_sized_new(packet->len);
+    network_mysqld_proto_append_packet_len(plain, 0);
+    network_mysqld_proto_append_packet_id(plain, network_mysqld_proto_get_packet_id(packet));
+    network_mysqld_proto_append_int8(plain, 0);
+    network_mysqld_proto_append_lenenc_int(plain, affected);
+    network_mysqld_proto_append_lenenc_int(plain, insert_id);
+    network_mysqld_proto_append_int16(plain, server_status & ~SERVER_SESSION_STATE_CHANGED);
+    network_mysqld_proto_append_int16(plain, warning_count);
+    g_string_append_len(plain, packet->str + info_offset, info_len);
+    network_mysqld_proto_set_packet_len(plain, plain->len - NET_HEADER_SIZE);
+
+    g_string_truncate(packet, 0);
+    g_string_append_len(packet, S(plain));
+    g_string_free(plain, TRUE);
+
+    return 0;
+}
+
 static network_mysqld_err_packet_t *
 network_mysqld_err_packet_new_full(network_mysqld_protocol_t version)
 {
@@ -1479,6 +1563,12 @@ network_mysqld_proto_get_auth_response(network_packet *packet, network_mysqld_au
         if ((auth->server_capabilities & CLIENT_PLUGIN_AUTH) && (auth->client_capabilities & CLIENT_PLUGIN_AUTH)) {
             err = err || network_mysqld_proto_get_gstr(packet, auth->auth_plugin_name);
         }
+
+        /* the zstd level is the last byte, after the connect attrs */
+        if (!err && (auth->client_capabilities & CLIENT_ZSTD_COMPRESSION_ALGORITHM)
+            && packet->data->len > packet->offset) {
+            auth->zstd_level = packet->data->str[packet->data->len - 1];
+        }
     } else {
         err = err || network_mysqld_proto_get_int16(packet, &l_cap);
         err = err || network_mysqld_proto_get_int24(packet, &auth->max_packet_size);
@@ -1546,6 +1636,12 @@ network_mysqld_proto_get_and_change_auth_response(network_packet *packet, networ
         cap[2] &= ~(8 | 16);
         err = err || network_mysqld_proto_get_int32(packet, &auth->client_capabilities);
 
+        /* the zstd level is the last byte and is cut off below with the attrs */
+        if (!err && (auth->client_capabilities & CLIENT_ZSTD_COMPRESSION_ALGORITHM)) {
+            auth->zstd_level = packet->data->str[mysql_packet_len - 1];
+            cap[3] &= ~(CLIENT_ZSTD_COMPRESSION_ALGORITHM >> 24);
+        }
+
         err = err || network_mysqld_proto_get_int32(packet, &auth->max_packet_size);
         err = err || network_mysqld_proto_get_int8(packet, &auth->charset);
 
@@ -1564,14 +1660,18 @@ network_mysqld_proto_get_and_change_auth_response(network_packet *packet, networ
             err = err || network_mysqld_proto_get_gstr(packet, auth->database);
         }
 
-        if (mysql_packet_len != packet->offset) {
-            network_mysqld_proto_set_packet_len(packet->data, packet->offset - NET_HEADER_SIZE);
-            packet->data->len = packet->offset;
+        guint db_end = packet->offset;
+
+        /* the plugin tells how the password was scrambled */
+        if ((auth->server_capabilities & CLIENT_PLUGIN_AUTH) &&
+            (auth->client_capabilities & CLIENT_PLUGIN_AUTH) && packet->offset < mysql_packet_len) {
+            err = err || network_mysqld_proto_get_gstr(packet, auth->auth_plugin_name);
+        }
+
+        if (mysql_packet_len != db_end) {
+            network_mysqld_proto_set_packet_len(packet->data, db_end - NET_HEADER_SIZE);
+            packet->data->len = db_end;
         }
-        /* if ((auth->server_capabilities & CLIENT_PLUGIN_AUTH) &&
-           (auth->client_capabilities & CLIENT_PLUGIN_AUTH)) {
-           err = err || network_mysqld_proto_get_gstr(packet, auth->auth_plugin_name);
-           } */
     } else {
         err = err || network_mysqld_proto_get_int16(packet, &l_cap);
         err = err || network_mysqld_proto_get_int24(packet, &auth->max_packet_size);
@@ -1641,6 +1741,10 @@ network_mysqld_proto_append_auth_response(GString *packet, network_mysqld_auth_r
             g_string_append_len(packet, S(auth->auth_plugin_name));
             network_mysqld_proto_append_int8(packet, 0x00); /* trailing \0 */
         }
+
+        if (auth->client_capabilities & CLIENT_ZSTD_COMPRESSION_ALGORITHM) {
+            network_mysqld_proto_append_int8(packet, auth->zstd_level);
+        }
     }
 
     return 0;
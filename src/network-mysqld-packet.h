@@ -91,6 +91,9 @@ typedef struct {
 #ifndef CLIENT_DEPRECATE_EOF
 #define CLIENT_DEPRECATE_EOF (1UL << 24)
 #endif
+#ifndef SERVER_SESSION_STATE_CHANGED
+#define SERVER_SESSION_STATE_CHANGED (1UL << 14)
+#endif
 #ifndef CLIENT_PLUGIN_AUTH
 #define CLIENT_PLUGIN_AUTH (1UL << 19)
 #endif
@@ -162,6 +165,7 @@ NETWORK_API void network_mysqld_ok_packet_free(network_mysqld_ok_packet_t *udata
 
 NETWORK_API int network_mysqld_proto_get_ok_packet(network_packet *, network_mysqld_ok_packet_t *);
 NETWORK_API int network_mysqld_proto_append_ok_packet(GString *, network_mysqld_ok_packet_t *);
+NETWORK_API int network_mysqld_proto_untrack_ok_packet(GString *packet, GString *gtid);
 
 typedef struct {
     GString *errmsg;
@@ -216,6 +220,7 @@ struct network_mysqld_auth_response {
     GString *auth_plugin_data;
     GString *database;
     GString *auth_plugin_name;
+    guint8 zstd_level;          /* with CLIENT_ZSTD_COMPRESSION_ALGORITHM */
 };
 
 NETWORK_API network_mysqld_auth_response *network_mysqld_auth_response_new(guint server_capabilities);
@@ -72,11 +72,14 @@
 #include "cetus-monitor.h"
 #include "cetus-variable.h"
 #include "plugin-common.h"
+#include "sharding-load-data.h"
 #ifdef NETWORK_DEBUG_TRACE_STATE_CHANGES
 #include "cetus-query-queue.h"
 #endif
 
 #include "network-compress.h"
+#include "network-compress-pool.h"
+#include "network-uring.h"
 
 #ifdef HAVE_WRITEV
 #define USE_BUFFERED_NETIO
@@ -86,6 +89,7 @@
 
 #define XA_BUF_LEN 2048
 #define XA_CMD_BUF_LEN 64
+#define MAX_ACCEPTS_PER_EVENT 64
 #define E_NET_CONNRESET ECONNRESET
 #define E_NET_CONNABORTED ECONNABORTED
 #define E_NET_INPROGRESS EINPROGRESS
@@ -165,6 +169,27 @@ plugin_call_timeout(chassis *srv, network_mysqld_con *con)
     return retval;
 }
 
+/* pending output larger than this is written at once */
+#define DEFERRED_FLUSH_MAX (256 * 1024)
+
+/* unwritten responses larger than this stop pipelined commands from being handled */
+#define PIPELINE_HELD_OUTPUT_MAX (4 * 1024 * 1024)
+
+/* how often output written off the event loop is looked at again */
+#define DRAIN_POLL_USEC 1000
+
+static GQueue *deferred_flush_cons = NULL;
+static struct event deferred_flush_event;
+
+static struct event pool_ctl_event;
+
+static void hedge_cancel(chassis *srv, network_socket *loser, network_backend_t *backend,
+                         gboolean poolable, const struct timeval *timeout);
+#ifdef SIMPLE_PARSER
+static void hedge_windows_free(void);
+#endif
+static void hedge_cancels_free(void);
+
 chassis_private *
 network_mysqld_priv_init(void)
 {
@@ -222,10 +247,24 @@ network_mysqld_priv_free(chassis G_GNUC_UNUSED *chas, chassis_private *priv)
 
     g_ptr_array_free(priv->cons, TRUE);
 
+    hedge_cancels_free();
     network_backends_free(priv->backends);
     cetus_users_free(priv->users);
     g_free(priv->stats_variables);
     cetus_monitor_free(priv->monitor);
+#ifdef SIMPLE_PARSER
+    hedge_windows_free();
+#endif
+    if (pool_ctl_event.ev_base) {
+        event_del(&pool_ctl_event);
+    }
+    network_compress_pool_stop();
+    network_uring_stop();
+    if (deferred_flush_cons) {
+        event_del(&deferred_flush_event);
+        g_queue_free(deferred_flush_cons);
+        deferred_flush_cons = NULL;
+    }
     g_free(priv);
 }
 
@@ -318,6 +357,19 @@ cetus_clean_conn_data(network_mysqld_con *con)
     con->data = NULL;
 }
 
+/* cancel the read hedged to another slave, see hedge_read() */
+static void
+drop_hedge(network_mysqld_con *con)
+{
+    if (con->hedge == NULL) {
+        return;
+    }
+    hedge_cancel(con->srv, con->hedge, con->hedge_backend, TRUE, &con->read_timeout);
+    con->hedge = NULL;
+    con->hedge_backend = NULL;
+    con->hedge_backend_ndx = -1;
+}
+
 /**
  * free a connection 
  *
@@ -341,10 +393,18 @@ network_mysqld_con_free(network_mysqld_con *con)
         g_warning("%s: servers are not null for con:%p", G_STRLOC, con);
     }
 
+    if (con->is_flush_deferred) {
+        g_queue_remove(deferred_flush_cons, con);
+    }
+    if (con->drain_event.ev_base) {
+        chassis_event_del(&con->drain_event, &con->drain_timer);
+    }
+
     if (con->server)
         network_socket_free(con->server);
     if (con->client)
         network_socket_free(con->client);
+    drop_hedge(con);
 
     if (con->hav_condi.condition_value) {
         g_free(con->hav_condi.condition_value);
@@ -367,6 +427,13 @@ network_mysqld_con_free(network_mysqld_con *con)
     g_string_free(con->auth_switch_to_method, TRUE);
     g_string_free(con->auth_switch_to_data, TRUE);
 
+    if (con->load_data) {
+        sharding_load_data_free(con->load_data);
+    }
+
+    if (con->held_output) {
+        network_queue_free(con->held_output);
+    }
     /* we are still in the conns-array */
 
     g_ptr_array_remove_fast(con->srv->priv->cons, con);
@@ -511,6 +578,31 @@ network_mysqld_queue_append(network_socket *sock, network_queue *queue, const ch
     return 0;
 }
 
+/**
+ * appends the first packet of a command longer than PACKET_LEN_MAX
+ *
+ * the rest of the command follows as it is read from the client,
+ * so unlike network_mysqld_queue_append() no empty packet is added
+ */
+int
+network_mysqld_queue_append_head(network_socket *sock, network_queue *queue, const char *data)
+{
+    GString *s = g_string_sized_new(PACKET_LEN_MAX + NET_HEADER_SIZE);
+
+    if (sock->packet_id_is_reset) {
+        sock->packet_id_is_reset = FALSE;
+        sock->last_packet_id = 0xff;
+    }
+
+    network_mysqld_proto_append_packet_len(s, PACKET_LEN_MAX);
+    network_mysqld_proto_append_packet_id(s, ++sock->last_packet_id);
+    g_string_append_len(s, data, PACKET_LEN_MAX);
+
+    network_queue_append(queue, s);
+
+    return 0;
+}
+
 /**
  * create a OK packet and append it to the send-queue
  *
@@ -750,7 +842,8 @@ network_mysqld_con_get_uncompressed_packet(chassis *chas, network_socket *con)
             g_string_append_len(uncompressed_packet, (char *)(info + COMP_HEADER_SIZE), uncompressed_len);
         } else {
             uncompressed_packet = g_string_sized_new(uncompressed_len);
-            cetus_uncompress(uncompressed_packet, (unsigned char *)packet->str + header_length, packet_len);
+            cetus_uncompress(network_socket_compress_ctx(con), uncompressed_packet,
+                             (unsigned char *)packet->str + header_length, packet_len, uncompressed_len);
             g_debug("%s:call cetus_uncompress for con:%p", G_STRLOC, con);
         }
 
@@ -895,6 +988,7 @@ network_mysqld_read_mul_packets(chassis G_GNUC_UNUSED *chas,
 
         con->server = server;
         *is_finished = network_mysqld_proto_get_query_result(&packet, con);
+        hash_join_read_row(con, packet.data);
         if (*is_finished == 1) {
             g_debug("%s:packets read finished:%d, default db:%s, server db:%s",
                     G_STRLOC, count, con->client->default_db->str, server->default_db->str);
@@ -1059,6 +1153,7 @@ plugin_call(chassis *srv, network_mysqld_con *con, int state)
                     con->state = ST_READ_QUERY;
                     if (con->is_client_compressed) {
                         con->client->do_compress = 1;
+                        con->client->compress_async = 1;
                         network_socket_set_send_buffer_size(con->client, COMPRESS_BUF_SIZE);
                     }
                 }
@@ -2009,7 +2104,9 @@ normal_result_merge(network_mysqld_con *con)
     result.status = RM_SUCCESS;
     result.detail = NULL;
 
+    network_mysqld_con_phase_end(con, QUERY_PHASE_BACKEND);
     resultset_merge(con->client->send_queue, recv_queues, con, &uniq_id, &result);
+    network_mysqld_con_phase_end(con, QUERY_PHASE_MERGE);
 
     switch (result.status) {
     case RM_FAIL:
@@ -2044,10 +2141,16 @@ normal_result_merge(network_mysqld_con *con)
 
 #define DISP_STOP 1
 #define DISP_CONTINUE 2
+/* a write waiting for the compress pool is woken up by the pool, not by the fd */
 #define WAIT_FOR_EVENT(ev_struct, ev_type, timeout) \
-    event_set(&(ev_struct->event), ev_struct->fd, ev_type, network_mysqld_con_handle, con); \
+    ev_struct->write_wait = ((ev_type) == EV_WRITE && network_socket_write_pending(ev_struct)); \
+    if (ev_struct->write_wait) { \
+        event_set(&(ev_struct->event), -1, 0, network_mysqld_con_handle, con); \
+    } else { \
+        event_set(&(ev_struct->event), ev_struct->fd, ev_type, network_mysqld_con_handle, con); \
+    } \
     g_debug("%s:call WAIT_FOR_EVENT, ev:%p", G_STRLOC, &(ev_struct->event)); \
-    chassis_event_add_with_timeout(con->srv, &(ev_struct->event), timeout);
+    chassis_event_add_with_timer(con->srv, &(ev_struct->event), &(ev_struct->timer), timeout);
 
 static void
 disp_query_after_consistant_attr(network_mysqld_con *con)
@@ -2115,37 +2218,257 @@ disp_query_after_consistant_attr(network_mysqld_con *con)
     }
 }
 
+static const char *query_phase_names[QUERY_PHASE_MAX] = {
+    "client_read", "parse_route", "pool_wait", "backend", "merge", "client_send", "xa"
+};
+
+const char *
+query_phase_name(query_phase_t phase)
+{
+    return query_phase_names[phase];
+}
+
+void
+network_mysqld_con_append_phases(network_mysqld_con *con, GString *out)
+{
+    int i;
+    for (i = 0; i < QUERY_PHASE_MAX; ++i) {
+        if (con->phases_seen & (1 << i)) {
+            g_string_append_printf(out, "%s%s:%" G_GINT64_FORMAT, out->len ? " " : "",
+                                   query_phase_names[i], con->phase_us[i]);
+        }
+    }
+}
+
+void
+network_mysqld_con_phase_end(network_mysqld_con *con, query_phase_t phase)
+{
+    gint64 now = g_get_monotonic_time();
+    if (con->phase_start_us) {
+        con->phase_us[phase] += now - con->phase_start_us;
+        con->phases_seen |= 1 << phase;
+    }
+    con->phase_start_us = now;
+}
+
+void
+network_mysqld_con_backend_done(network_mysqld_con *con, int backend_ndx, network_socket *server)
+{
+    if (backend_ndx < 0 || backend_ndx >= MAX_SERVER_NUM || !con->backend_send_us) {
+        return;
+    }
+    gint64 latency = g_get_monotonic_time() - con->backend_send_us;
+    chassis_histogram_record_lazy(&con->srv->query_stats.backend_time[backend_ndx], latency);
+
+    network_backend_t *backend = network_backends_get(con->srv->priv->backends, backend_ndx);
+    if (backend && server) {
+        network_backend_breaker_record(backend, server->breaker_epoch, latency, FALSE);
+    }
+}
+
+static void
+query_latency_begin(network_mysqld_con *con)
+{
+    con->query_start_us = con->phase_start_us = g_get_monotonic_time();
+    con->backend_send_us = 0;
+    memset(con->phase_us, 0, sizeof(con->phase_us));
+    con->phases_seen = 0;
+    con->query_class = QUERY_CLASS_OTHER;
+}
+
 static void
 handle_query_time_stats(network_mysqld_con *con)
 {
-    int diff = (con->resp_send_time.tv_sec - con->req_recv_time.tv_sec) * 1000;
-    diff += (con->resp_send_time.tv_usec - con->req_recv_time.tv_usec) / 1000;
+    if (!con->query_start_us) {
+        return;
+    }
+    query_stats_t *stats = &con->srv->query_stats;
+    gint64 total = g_get_monotonic_time() - con->query_start_us;
+    con->query_start_us = 0;
 
-    diff = MAX(0, diff);
+    int diff = total / 1000;
     if (diff >= con->srv->long_query_time) {
+        GString *phases = g_string_new(NULL);
+        network_mysqld_con_append_phases(con, phases);
         g_log("slowquery", G_LOG_LEVEL_MESSAGE,
-              "time: %dms, client: %s, user: %s, sql: %s",
-              diff, con->client->src->name->str, con->client->response->username->str, con->orig_sql->str);
-        diff = con->srv->long_query_time - 1;
+              "time: %dms, phases(us): %s, client: %s, user: %s, sql: %s",
+              diff, phases->str, con->client->src->name->str, con->client->response->username->str,
+              con->orig_sql->str);
+        g_string_free(phases, TRUE);
+    }
+    chassis_histogram_record_lazy(&stats->query_time[con->query_class], total);
+
+    int i;
+    for (i = 0; i < QUERY_PHASE_MAX; ++i) {
+        if (con->phases_seen & (1 << i)) {
+            chassis_histogram_record_lazy(&stats->phase_time[i], con->phase_us[i]);
+        }
     }
-    con->srv->query_stats.query_time_table[diff]++;
 }
 
+/* put the responses set aside back in front of the output */
 static void
-handle_query_wait_stats(network_mysqld_con *con)
+restore_held_output(network_mysqld_con *con)
+{
+    network_queue *held = con->held_output;
+    network_queue *queue = con->client->send_queue;
+    GString *chunk;
+
+    if (held == NULL) {
+        return;
+    }
+
+    while ((chunk = g_queue_pop_head(queue->chunks))) {
+        g_queue_push_tail(held->chunks, chunk);
+    }
+    held->len += queue->len;
+
+    network_queue_free(queue);
+    con->client->send_queue = held;
+    con->held_output = NULL;
+    con->is_held_output_queued = 1;
+}
+
+/* read what the client has sent of a long command */
+static network_socket_retval_t
+large_packet_read(network_mysqld_con *con)
+{
+    network_socket *client = con->client;
+    network_socket_retval_t ret = network_socket_read(client);
+
+    if (ret != NETWORK_SOCKET_SUCCESS || !client->do_compress) {
+        return ret;
+    }
+
+    while ((ret = network_mysqld_con_get_uncompressed_packet(con->srv, client)) == NETWORK_SOCKET_SUCCESS) ;
+
+    return ret == NETWORK_SOCKET_ERROR ? ret : NETWORK_SOCKET_SUCCESS;
+}
+
+/**
+ * move the packets of a long command read so far to dest, or drop them
+ * if dest is NULL, packets are passed on as they are, in pieces
+ * @return TRUE once the last packet of the command is taken
+ */
+static gboolean
+large_packet_take(network_mysqld_con *con, network_queue *dest)
+{
+    network_socket *client = con->client;
+    network_queue *raw = client->do_compress ? client->recv_queue_uncompress_raw : client->recv_queue_raw;
+
+    for (;;) {
+        if (con->large_packet_left == 0) {
+            if (con->large_packet_last) {
+                con->large_packet_relay = LARGE_PACKET_NONE;
+                con->large_packet_last = 0;
+                return TRUE;
+            }
+            if (raw->len < NET_HEADER_SIZE) {
+                return FALSE;
+            }
+
+            GString *header = network_queue_pop_str(raw, NET_HEADER_SIZE, NULL);
+            con->large_packet_left = network_mysqld_proto_get_packet_len(header);
+            con->large_packet_last = con->large_packet_left < PACKET_LEN_MAX;
+            client->last_packet_id = network_mysqld_proto_get_packet_id(header);
+            if (dest) {
+                con->server->last_packet_id = client->last_packet_id;
+                network_queue_append(dest, header);
+            } else {
+                g_string_free(header, TRUE);
+            }
+            continue;
+        }
+
+        gsize len = MIN(raw->len, con->large_packet_left);
+        if (len == 0) {
+            return FALSE;
+        }
+
+        GString *chunk = network_queue_pop_str(raw, len, NULL);
+        con->large_packet_left -= len;
+        if (dest) {
+            network_queue_append(dest, chunk);
+        } else {
+            g_string_free(chunk, TRUE);
+        }
+    }
+}
+
+/**
+ * pass the rest of a long command to the server while the client sends it,
+ * the client is not read while the server has data to be written
+ * @return 1 once the whole command is written
+ */
+static int
+relay_large_packet(network_mysqld_con *con, int *disp_flag)
 {
-    struct timeval cur;
-    gettimeofday(&cur, NULL);
+    network_socket *server = con->server;
+
+    for (;;) {
+        if (server->send_queue->len > 0) {
+            switch (network_mysqld_write(con->srv, server)) {
+            case NETWORK_SOCKET_SUCCESS:
+                break;
+            case NETWORK_SOCKET_WAIT_FOR_EVENT:
+                WAIT_FOR_EVENT(server, EV_WRITE, &con->write_timeout);
+                *disp_flag = DISP_STOP;
+                return 0;
+            default:
+                g_message("%s: write error while relaying a long command, con:%p", G_STRLOC, con);
+                con->prev_state = con->state;
+                con->state = ST_ERROR;
+                *disp_flag = DISP_CONTINUE;
+                return 0;
+            }
+        }
+
+        if (con->large_packet_relay == LARGE_PACKET_NONE) {
+            return 1;
+        }
+
+        if (large_packet_read(con) == NETWORK_SOCKET_ERROR) {
+            g_message("%s: read error while relaying a long command, con:%p", G_STRLOC, con);
+            con->prev_state = con->state;
+            con->state = ST_ERROR;
+            *disp_flag = DISP_CONTINUE;
+            return 0;
+        }
 
-    int diff = (cur.tv_sec - con->req_recv_time.tv_sec) * 1000;
-    diff += (cur.tv_usec - con->req_recv_time.tv_usec) / 1000;
+        if (!large_packet_take(con, server->send_queue) && server->send_queue->len == 0) {
+            WAIT_FOR_EVENT(con->client, EV_READ, &con->read_timeout);
+            *disp_flag = DISP_STOP;
+            return 0;
+        }
+    }
+}
 
-    if (diff < 0 || diff >= MAX_WAIT_TIME) {
-        g_message("%s: query waits too long:%d for con:%p", G_STRLOC, diff, con);
-        diff = MAX_WAIT_TIME - 1;
+/* the client is sending the file of LOAD DATA LOCAL INFILE */
+static int
+handle_read_load_data(network_mysqld_con *con)
+{
+    for (;;) {
+        switch (network_mysqld_read(con->srv, con->client)) {
+        case NETWORK_SOCKET_SUCCESS:
+            continue;
+        case NETWORK_SOCKET_WAIT_FOR_EVENT:
+            break;
+        default:
+            g_critical("%s: network_mysqld_read error during LOAD DATA", G_STRLOC);
+            con->prev_state = con->state;
+            con->state = ST_ERROR;
+            return DISP_CONTINUE;
+        }
+        break;
     }
 
-    con->srv->query_stats.query_wait_table[diff]++;
+    sharding_load_data_read(con);
+
+    if (con->state == ST_READ_QUERY) {
+        WAIT_FOR_EVENT(con->client, EV_READ, &con->read_timeout);
+        return DISP_STOP;
+    }
+    return DISP_CONTINUE;
 }
 
 static int
@@ -2155,6 +2478,25 @@ handle_read_query(network_mysqld_con *con, network_mysqld_con_state_t ostate)
     network_socket *recv_sock;
     network_packet last_packet;
 
+    if (con->load_data) {
+        return handle_read_load_data(con);
+    }
+
+#ifdef SIMPLE_PARSER
+    if (con->large_packet_relay == LARGE_PACKET_PENDING && !con->is_wait_server) {
+        /* the long command was answered without the server, drop the rest of it */
+        if (large_packet_read(con) == NETWORK_SOCKET_ERROR) {
+            con->prev_state = con->state;
+            con->state = ST_ERROR;
+            return DISP_CONTINUE;
+        }
+        if (!large_packet_take(con, NULL)) {
+            WAIT_FOR_EVENT(con->client, EV_READ, &con->read_timeout);
+            return DISP_STOP;
+        }
+    }
+#endif
+
     chassis *srv = con->srv;
     recv_sock = con->client;
 
@@ -2171,11 +2513,18 @@ handle_read_query(network_mysqld_con *con, network_mysqld_con_state_t ostate)
     gettimeofday(&(con->req_recv_time), NULL);
 
     if (!con->is_wait_server) {
+        con->global_index_missed = 0;
+        if (!con->query_start_us) {
+            query_latency_begin(con);
+        }
         do {
             switch (network_mysqld_read(srv, recv_sock)) {
             case NETWORK_SOCKET_SUCCESS:
                 break;
             case NETWORK_SOCKET_WAIT_FOR_EVENT:
+                if (recv_sock->recv_queue_raw->len == 0 && recv_sock->recv_queue->len == 0) {
+                    con->query_start_us = 0;    /* client idle, not reading yet */
+                }
                 if (con->is_commit_or_rollback) {
                     if (con->is_start_tran_command) {   /* is prev sql START */
                         con->is_start_tran_command = 0;
@@ -2186,6 +2535,23 @@ handle_read_query(network_mysqld_con *con, network_mysqld_con_state_t ostate)
                         g_debug("%s: set is_need_q_peek_exec true", G_STRLOC);
                     }
                 }
+#ifdef SIMPLE_PARSER
+                if (con->held_output || recv_sock->send_queue->len > 0) {
+                    /* the pipelined commands are done, their responses are not */
+                    restore_held_output(con);
+                    switch (network_mysqld_write(srv, recv_sock)) {
+                    case NETWORK_SOCKET_SUCCESS:
+                        break;
+                    case NETWORK_SOCKET_WAIT_FOR_EVENT:
+                        WAIT_FOR_EVENT(recv_sock, EV_WRITE, &con->write_timeout);
+                        return DISP_STOP;
+                    default:
+                        con->prev_state = con->state;
+                        con->state = ST_ERROR;
+                        return DISP_CONTINUE;
+                    }
+                }
+#endif
                 if (con->client->is_need_q_peek_exec) {
                     timeout = con->wait_clt_next_sql;
                     con->client->is_need_q_peek_exec = 0;
@@ -2211,18 +2577,30 @@ handle_read_query(network_mysqld_con *con, network_mysqld_con_state_t ostate)
 
             GQueue *chunks = recv_sock->recv_queue->chunks;
             last_packet.data = g_queue_peek_tail(chunks);
+#ifdef SIMPLE_PARSER
+            if (last_packet.data->len == (PACKET_LEN_MAX + NET_HEADER_SIZE)) {
+                /* routing needs the first packet only, the rest is relayed as it comes */
+                con->large_packet_relay = LARGE_PACKET_PENDING;
+                con->large_packet_left = 0;
+                con->large_packet_last = 0;
+                break;
+            }
+#endif
         } while (last_packet.data->len == (PACKET_LEN_MAX + NET_HEADER_SIZE));
+        network_mysqld_con_phase_end(con, QUERY_PHASE_CLIENT_READ);
     } else {
         g_debug("%s:wait server.", G_STRLOC);
+        network_mysqld_con_phase_end(con, QUERY_PHASE_POOL_WAIT);
     }
 
     con->resp_too_long = 0;
     g_debug("%s:call read query", G_STRLOC);
-    switch (plugin_call(srv, con, con->state)) {
+    network_socket_retval_t ret = plugin_call(srv, con, con->state);
+    network_mysqld_con_phase_end(con, QUERY_PHASE_PARSE_ROUTE);
+    switch (ret) {
     case NETWORK_SOCKET_SUCCESS:
         if (con->retry_serv_cnt > 0 && con->is_wait_server) {
             g_message("%s: wait successful:%d, con:%p", G_STRLOC, con->retry_serv_cnt, con);
-            handle_query_wait_stats(con);
         }
         con->is_wait_server = 0;
         con->retry_serv_cnt = 0;
@@ -2244,7 +2622,6 @@ handle_read_query(network_mysqld_con *con, network_mysqld_con_state_t ostate)
     default:
         g_critical("%s: wait failed and no server backend for user:%s", G_STRLOC, con->client->response->username->str);
 
-        handle_query_wait_stats(con);
         con->state = ST_SEND_QUERY_RESULT;
         network_mysqld_con_send_error_full(con->client, C("service unavailable"), ER_SERVER_SHUTDOWN, "08S01");
         con->is_wait_server = 0;
@@ -2307,6 +2684,11 @@ process_write_to_server(network_mysqld_con *con, server_session_t *ss, int *writ
     default:
     {
         char *msg = "write error";
+        if (con->load_data && sharding_load_data_is_streaming(con->load_data)) {
+            con->num_write_pending--;
+            sharding_load_data_write_failed(con, ss);
+            break;
+        }
         con->state = ST_SEND_QUERY_RESULT;
         con->server_to_be_closed = 1;
         g_warning("%s:write error for con:%p, ret:%d", G_STRLOC, con, ret);
@@ -2331,17 +2713,25 @@ process_shard_write(network_mysqld_con *con, int *disp_flag)
         break;
     }
 
+    if (con->load_data && sharding_load_data_is_streaming(con->load_data)) {
+        /* file data, the groups answer only at its end */
+        con->state = ST_READ_QUERY;
+    }
+
     con->num_read_pending = 0;
     con->num_pending_servers = 0;
     con->num_servers_visited = 0;
     con->num_write_pending = 0;
+    con->backend_send_us = g_get_monotonic_time();
 
     int i, write_wait = 0;
     for (i = 0; i < con->servers->len; i++) {
         server_session_t *ss = g_ptr_array_index(con->servers, i);
         ss->index = i;
         ss->fresh = 0;
-        ss->server->compressed_packet_id = 0;
+        if (!con->load_data || !sharding_load_data_is_started(con->load_data)) {
+            ss->server->compressed_packet_id = 0;
+        }
         ss->server->resp_len = 0;
         ss->server->is_read_finished = 0;
         ss->server->is_waiting = 0;
@@ -2360,12 +2750,22 @@ process_shard_write(network_mysqld_con *con, int *disp_flag)
         ss->server->parse.command = con->parse.command;
         ss->state = NET_RW_STATE_NONE;
         ss->server->resp_len = 0;
+        if (ss->backend) {
+            ss->server->breaker_epoch = ss->backend->breaker_epoch;
+        }
 
         if (!g_queue_is_empty(ss->server->send_queue->chunks)) {
             process_write_to_server(con, ss, &write_wait);
         }
     }                           /* for each server */
 
+    if (con->state == ST_READ_QUERY && con->load_data && write_wait) {
+        /* stop reading the client until the groups take the data */
+        con->state = ST_SEND_QUERY;
+        *disp_flag = DISP_STOP;
+        return 0;
+    }
+
     if (con->state == ST_READ_M_QUERY_RESULT) {
         if (write_wait) {
             *disp_flag = DISP_STOP;
@@ -2380,9 +2780,56 @@ process_shard_write(network_mysqld_con *con, int *disp_flag)
     return 1;
 }
 
+static int
+process_rw_write_done(network_mysqld_con *con)
+{
+    /* some statements don't have a server response */
+    switch (con->parse.command) {
+    case COM_STMT_SEND_LONG_DATA:  /* not acked */
+    case COM_STMT_CLOSE:
+        if (!con->server_to_be_closed) {
+            g_message("%s: set ST_READ_QUERY for con:%p", G_STRLOC, con);
+            con->state = ST_READ_QUERY;
+        } else {
+            g_message("%s: set ST_CLOSE_SERVER for con:%p", G_STRLOC, con);
+            con->state = ST_CLOSE_SERVER;
+        }
+        if (con->client) {
+            network_mysqld_queue_reset(con->client);
+        }
+        if (con->server) {
+            network_mysqld_queue_reset(con->server);
+        }
+
+        con->prepare_stmt_count--;
+        g_debug("%s: conn:%p, sub, now prepare_stmt_count:%d", G_STRLOC, con, con->prepare_stmt_count);
+
+        if (con->prepare_stmt_count == 0) {
+            if (!con->is_in_transaction) {
+                if (network_pool_add_conn(con, 0)) {
+                    g_message("%s,con:%p:->pool failed", G_STRLOC, con);
+                }
+            }
+        }
+        break;
+    default:
+        con->state = ST_READ_QUERY_RESULT;
+        break;
+    }
+
+    return 1;
+}
+
 static int
 process_rw_write(network_mysqld_con *con, network_mysqld_con_state_t ostate, int *disp_flag)
 {
+    if (con->large_packet_relay == LARGE_PACKET_BODY) {
+        if (!relay_large_packet(con, disp_flag)) {
+            return 0;
+        }
+        return process_rw_write_done(con);
+    }
+
     if (con->server->send_queue->offset == 0) {
         /* only parse the packets once */
         network_packet packet;
@@ -2397,6 +2844,14 @@ process_rw_write(network_mysqld_con *con, network_mysqld_con_state_t ostate, int
 
             return DISP_CONTINUE;
         }
+        con->backend_send_us = g_get_monotonic_time();
+#ifdef SIMPLE_PARSER
+        proxy_plugin_con_t *st = con->plugin_con_state;
+        network_backend_t *backend = network_backends_get(con->srv->priv->backends, st->backend_ndx);
+        if (backend) {
+            con->server->breaker_epoch = backend->breaker_epoch;
+        }
+#endif
     }
 
     con->server->resp_len = 0;
@@ -2427,42 +2882,15 @@ process_rw_write(network_mysqld_con *con, network_mysqld_con_state_t ostate, int
         return 0;
     }
 
-    /* some statements don't have a server response */
-    switch (con->parse.command) {
-    case COM_STMT_SEND_LONG_DATA:  /* not acked */
-    case COM_STMT_CLOSE:
-        if (!con->server_to_be_closed) {
-            g_message("%s: set ST_READ_QUERY for con:%p", G_STRLOC, con);
-            con->state = ST_READ_QUERY;
-        } else {
-            g_message("%s: set ST_CLOSE_SERVER for con:%p", G_STRLOC, con);
-            con->state = ST_CLOSE_SERVER;
-        }
-        if (con->client) {
-            network_mysqld_queue_reset(con->client);
-        }
-        if (con->server) {
-            network_mysqld_queue_reset(con->server);
+    if (con->large_packet_relay == LARGE_PACKET_HEAD) {
+        con->large_packet_relay = LARGE_PACKET_BODY;
+        if (!relay_large_packet(con, disp_flag)) {
+            return 0;
         }
+    }
 
-        con->prepare_stmt_count--;
-        g_debug("%s: conn:%p, sub, now prepare_stmt_count:%d", G_STRLOC, con, con->prepare_stmt_count);
-
-        if (con->prepare_stmt_count == 0) {
-            if (!con->is_in_transaction) {
-                if (network_pool_add_conn(con, 0)) {
-                    g_message("%s,con:%p:->pool failed", G_STRLOC, con);
-                }
-            }
-        }
-        break;
-    default:
-        con->state = ST_READ_QUERY_RESULT;
-        break;
-    }
-
-    return 1;
-}
+    return process_rw_write_done(con);
+}
 
 static int
 handle_send_query_to_servers(network_mysqld_con *con, network_mysqld_con_state_t ostate)
@@ -2528,6 +2956,7 @@ shard_read_response(network_mysqld_con *con, server_session_t *ss)
             }
 
             set_conn_attr(con, ss->server);
+            network_mysqld_con_backend_done(con, ss->backend_ndx, ss->server);
             ss->state = NET_RW_STATE_FINISHED;
             ss->server->is_read_finished = 1;
             ss->server->is_waiting = 0;
@@ -3034,6 +3463,53 @@ disp_attr(network_mysqld_con *con, int srv_down_count, int *disp_flag)
     return 1;
 }
 
+/* a resultset without rows: field count, field defs, EOF, EOF */
+static gboolean
+resultset_has_no_row(GQueue *chunks)
+{
+    GString *first = g_queue_peek_head(chunks);
+    if (!first || first->len <= NET_HEADER_SIZE) {
+        return FALSE;
+    }
+    guchar type = first->str[NET_HEADER_SIZE];
+    if (type == MYSQLD_PACKET_OK || type == MYSQLD_PACKET_ERR) {
+        return FALSE;
+    }
+    network_packet packet = { first, NET_HEADER_SIZE };
+    guint64 field_count = 0;
+    if (network_mysqld_proto_get_lenenc_int(&packet, &field_count) == -1 || chunks->length != field_count + 3) {
+        return FALSE;
+    }
+    GString *last = g_queue_peek_tail(chunks);
+    return last->len > NET_HEADER_SIZE && (guchar)last->str[NET_HEADER_SIZE] == MYSQLD_PACKET_EOF;
+}
+
+/**
+ * the group of a global index hint returned no row, the pair may be stale
+ * or a newer one not copied yet: the query is routed again without hints
+ */
+static gboolean
+retry_global_index_hint(network_mysqld_con *con)
+{
+    sharding_plan_t *plan = con->sharding_plan;
+    if (!plan || !plan->global_index_query || con->dist_tran || con->is_in_transaction || con->servers->len != 1) {
+        return FALSE;
+    }
+    server_session_t *ss = g_ptr_array_index(con->servers, 0);
+    if (!resultset_has_no_row(ss->server->recv_queue->chunks)) {
+        return FALSE;
+    }
+    g_debug("%s: global index hint found no row, route again:%s", G_STRLOC, con->orig_sql->str);
+    remove_mul_server_recv_packets(con);
+    network_queue_clear(con->client->recv_queue);
+    network_queue_append(con->client->recv_queue, plan->global_index_query);
+    plan->global_index_query = NULL;
+    con->global_index_missed = 1;
+    con->is_wait_server = 1;    /* the query is taken again without reading the client */
+    con->state = ST_READ_QUERY;
+    return TRUE;
+}
+
 static int
 disp_after_resp(network_mysqld_con *con, int srv_down_count, int srv_response_count, int *disp_flag)
 {
@@ -3061,6 +3537,10 @@ disp_after_resp(network_mysqld_con *con, int srv_down_count, int srv_response_co
     }
 
     if (single_response) {
+        if (retry_global_index_hint(con)) {
+            *disp_flag = DISP_CONTINUE;
+            return 0;
+        }
         disp_single_resp(con);
     }
 
@@ -3103,6 +3583,14 @@ handle_read_mul_servers_resp(network_mysqld_con *con)
         return DISP_CONTINUE;
     }
 
+    if (con->load_data && con->attr_adj_state == ATTR_START) {
+        if (srv_response_count + srv_down_count < con->resp_expected_num) {
+            return DISP_STOP;
+        }
+        sharding_load_data_dispatch_resp(con);
+        return DISP_CONTINUE;
+    }
+
     if (con->state == ST_READ_QUERY) {
         return DISP_CONTINUE;
     } else if (srv_response_count != workers) {
@@ -3127,12 +3615,158 @@ handle_read_mul_servers_resp(network_mysqld_con *con)
     return DISP_CONTINUE;
 }
 
+/**
+ * write the output produced so far, while the resultset is still being
+ * produced the last write of it pushes the rest
+ */
+static network_socket_retval_t
+write_part_content(network_mysqld_con *con)
+{
+    network_socket *client = con->client;
+    network_socket_retval_t ret;
+
+    restore_held_output(con);
+
+    /* a finished response must not stay corked behind the next one */
+    client->more_data = !con->resultset_is_finished && !con->is_held_output_queued;
+    ret = network_mysqld_write(con->srv, client);
+    client->more_data = 0;
+    if (client->send_queue->len == 0) {
+        con->is_held_output_queued = 0;
+    }
+    return ret;
+}
+
+static void drain_client_output(network_mysqld_con *con);
+
+static void
+drain_handler(int G_GNUC_UNUSED fd, short events, void *arg)
+{
+    network_mysqld_con *con = arg;
+    if (events == EV_TIMEOUT && !network_socket_write_pending(con->client)) {
+        /* the client reads nothing, the final write of the state machine times out */
+        g_debug("%s: output of con:%p not drained", G_STRLOC, con);
+        return;
+    }
+    drain_client_output(con);
+}
+
+/**
+ * keep writing the output of a connection waiting for its backend,
+ * the responses written ahead of a pipelined command don't wait for it
+ */
+static void
+drain_client_output(network_mysqld_con *con)
+{
+    network_socket *client = con->client;
+    struct timeval timeout;
+
+    if (event_pending(&con->drain_event, EV_WRITE | EV_TIMEOUT, NULL)
+        || event_pending(&client->event, EV_WRITE, NULL) || client->write_wait) {
+        return;
+    }
+    if (client->send_queue->len == 0 && con->held_output == NULL) {
+        return;
+    }
+    switch (write_part_content(con)) {
+    case NETWORK_SOCKET_WAIT_FOR_EVENT:
+        if (network_socket_write_pending(client)) {
+            /* written off the event loop, nothing to wait for on the fd */
+            event_set(&con->drain_event, -1, 0, drain_handler, con);
+            timeout.tv_sec = 0;
+            timeout.tv_usec = DRAIN_POLL_USEC;
+        } else {
+            event_set(&con->drain_event, client->fd, EV_WRITE, drain_handler, con);
+            timeout = con->write_timeout;
+        }
+        chassis_event_add_with_timer(con->srv, &con->drain_event, &con->drain_timer, &timeout);
+        break;
+    case NETWORK_SOCKET_SUCCESS:
+        break;
+    default:
+        /* a broken client fails again on the final write of the state machine */
+        g_debug("%s: deferred write failed for con:%p", G_STRLOC, con);
+        break;
+    }
+}
+
+static void
+deferred_flush_handler(int G_GNUC_UNUSED fd, short G_GNUC_UNUSED events, void G_GNUC_UNUSED *arg)
+{
+    network_mysqld_con *con;
+    while ((con = g_queue_pop_head(deferred_flush_cons))) {
+        con->is_flush_deferred = 0;
+        drain_client_output(con);
+    }
+}
+
+/* write the output of the connection once the ready events of this loop iteration are handled */
+static void
+defer_flush(network_mysqld_con *con)
+{
+    if (con->is_flush_deferred) {
+        return;
+    }
+    if (!deferred_flush_cons) {
+        deferred_flush_cons = g_queue_new();
+        event_set(&deferred_flush_event, -1, 0, deferred_flush_handler, NULL);
+        event_base_set(con->srv->event_base, &deferred_flush_event);
+    }
+    if (g_queue_is_empty(deferred_flush_cons)) {
+        event_active(&deferred_flush_event, EV_TIMEOUT, 1);
+    }
+    g_queue_push_tail(deferred_flush_cons, con);
+    con->is_flush_deferred = 1;
+}
+
+#ifdef SIMPLE_PARSER
+/**
+ * the client has sent its next command without waiting for this response
+ *
+ * The unwritten part of the response is set aside and the next command is
+ * handled meanwhile, the response is written ahead of any later output.
+ */
+static gboolean
+hold_output_for_pipeline(network_mysqld_con *con)
+{
+    network_socket *client = con->client;
+
+    if (!con->resultset_is_finished || con->held_output || con->large_packet_relay != LARGE_PACKET_NONE) {
+        return FALSE;
+    }
+    if (client->send_queue->len > PIPELINE_HELD_OUTPUT_MAX || network_socket_write_pending(client)) {
+        return FALSE;
+    }
+    if (client->recv_queue_raw->len == 0 && client->recv_queue_uncompress_raw->len == 0) {
+        return FALSE;
+    }
+
+    con->held_output = client->send_queue;
+    client->send_queue = network_queue_new();
+    defer_flush(con);
+
+    return TRUE;
+}
+#endif
+
+/**
+ * queue partial output of a resultset for the client
+ *
+ * The output of all connections is written once the ready events of this
+ * loop iteration are handled, so the slices produced meanwhile go together.
+ */
 void
 send_part_content_to_client(network_mysqld_con *con)
 {
     g_debug("%s: call send_part_content_to_client, and queue len:%llu, con client:%p",
             G_STRLOC, (unsigned long long)con->client->send_queue->chunks->length, con->client);
-    switch (network_mysqld_write(con->srv, con->client)) {
+
+    if (con->client->send_queue->len < DEFERRED_FLUSH_MAX) {
+        defer_flush(con);
+        return;
+    }
+
+    switch (write_part_content(con)) {
     case NETWORK_SOCKET_SUCCESS:
         break;
     case NETWORK_SOCKET_WAIT_FOR_EVENT:
@@ -3202,13 +3836,21 @@ send_result_to_client(network_mysqld_con *con, network_mysqld_con_state_t ostate
     }
 
     g_debug("%s: send server result to client", G_STRLOC);
+    restore_held_output(con);
     /**
      * send the query result-set to the client 
      */
     switch (network_mysqld_write(srv, con->client)) {
     case NETWORK_SOCKET_SUCCESS:
+        con->is_held_output_queued = 0;
         break;
     case NETWORK_SOCKET_WAIT_FOR_EVENT:
+#ifdef SIMPLE_PARSER
+        if (hold_output_for_pipeline(con)) {
+            g_debug("%s: go on with the next command of con:%p", G_STRLOC, con);
+            break;
+        }
+#endif
         g_debug("%s: write wait and add event", G_STRLOC);
         timeout = con->write_timeout;
 
@@ -3228,6 +3870,8 @@ send_result_to_client(network_mysqld_con *con, network_mysqld_con_state_t ostate
         break;
     }
 
+    network_mysqld_con_phase_end(con, QUERY_PHASE_CLIENT_SEND);
+
     /* if the write failed, don't call the plugin handlers */
     if (con->state != ostate) {
         return DISP_CONTINUE;
@@ -3322,6 +3966,411 @@ send_result_to_client(network_mysqld_con *con, network_mysqld_con_state_t ostate
     return DISP_CONTINUE;
 }
 
+/**
+ * the slower of two hedged reads
+ *
+ * KILL QUERY is sent on another pooled connection of the same user, and the
+ * answer of the slower read is read and dropped. Both connections then go
+ * back to the pool, the slower one only once the kill is answered so that it
+ * can't hit the next query the connection is given.
+ */
+typedef struct hedge_cancel_t {
+    chassis *srv;
+    network_backend_t *backend;
+    network_socket *loser;
+    network_socket *killer;     /* NULL once the kill is answered */
+    network_mysqld_com_query_result_t *loser_result;
+    network_mysqld_com_query_result_t *killer_result;
+    int loser_over;             /* 1 answered, -1 failed, 0 not yet */
+    gboolean kill_unknown;      /* the kill may still come */
+    struct timeval timeout;
+} hedge_cancel_t;
+
+static GQueue hedge_cancels = G_QUEUE_INIT;
+
+static void hedge_cancel_handle(int fd, short events, void *arg);
+
+static void
+hedge_cancel_wait(hedge_cancel_t *hc, network_socket *sock)
+{
+    struct timeval timeout = hc->timeout;
+    event_set(&(sock->event), sock->fd, EV_READ, hedge_cancel_handle, hc);
+    chassis_event_add_with_timer(hc->srv, &(sock->event), &(sock->timer), &timeout);
+}
+
+/* back to the pool if its answer is over, else closed */
+static void
+hedge_cancel_release(hedge_cancel_t *hc, network_socket *sock, gboolean clean)
+{
+    if (sock->event.ev_base) {
+        chassis_event_del(&(sock->event), &(sock->timer));
+    }
+    hc->backend->connected_clients--;
+    if (clean) {
+        network_pool_add_idle_conn(hc->backend->pool, hc->srv, sock);
+    } else {
+        network_socket_free(sock);
+    }
+}
+
+/* @return 1 when the answer is over, 0 to wait for more, -1 on error */
+static int
+hedge_cancel_read(chassis *srv, network_socket *sock, network_mysqld_com_query_result_t *result)
+{
+    int b = -1;
+    if (ioctl(sock->fd, FIONREAD, &b) || b == 0) {
+        return -1;
+    }
+    sock->to_read = b;
+    switch (network_socket_read(sock)) {
+    case NETWORK_SOCKET_SUCCESS:
+        break;
+    case NETWORK_SOCKET_WAIT_FOR_EVENT:
+        return 0;
+    default:
+        return -1;
+    }
+
+    network_socket_retval_t ret = NETWORK_SOCKET_SUCCESS;
+    if (sock->do_compress) {
+        ret = network_mysqld_con_get_uncompressed_packet(srv, sock);
+    }
+    if (ret == NETWORK_SOCKET_SUCCESS) {
+        ret = network_mysqld_con_get_packet(srv, sock);
+    }
+    while (ret == NETWORK_SOCKET_SUCCESS) {
+        network_packet packet;
+        packet.data = g_queue_pop_tail(sock->recv_queue->chunks);
+        packet.offset = 0;
+        int rc = network_mysqld_proto_skip_network_header(&packet)
+            ? -1 : network_mysqld_proto_get_com_query_result(&packet, result, FALSE);
+        g_string_free(packet.data, TRUE);
+        if (rc != 0) {
+            return rc;
+        }
+        ret = network_mysqld_con_get_packet(srv, sock);
+        if (ret == NETWORK_SOCKET_WAIT_FOR_EVENT && sock->do_compress
+            && network_mysqld_con_get_uncompressed_packet(srv, sock) == NETWORK_SOCKET_SUCCESS) {
+            ret = network_mysqld_con_get_packet(srv, sock);
+        }
+    }
+    return ret == NETWORK_SOCKET_ERROR ? -1 : 0;
+}
+
+static void
+hedge_cancel_free(hedge_cancel_t *hc)
+{
+    network_mysqld_com_query_result_free(hc->loser_result);
+    network_mysqld_com_query_result_free(hc->killer_result);
+    g_free(hc);
+}
+
+static void
+hedge_cancel_handle(int fd, short events, void *arg)
+{
+    hedge_cancel_t *hc = arg;
+    gboolean is_killer = hc->killer && fd == hc->killer->fd;
+    network_socket *sock = is_killer ? hc->killer : hc->loser;
+
+    int rc = -1;
+    if (events & EV_READ) {
+        rc = hedge_cancel_read(hc->srv, sock, is_killer ? hc->killer_result : hc->loser_result);
+    }
+    if (rc == 0) {
+        hedge_cancel_wait(hc, sock);
+        return;
+    }
+
+    if (is_killer) {
+        hedge_cancel_release(hc, sock, rc == 1);
+        hc->killer = NULL;
+        hc->kill_unknown = (rc != 1);
+    } else {
+        hc->loser_over = rc;
+    }
+    if (hc->loser_over == 0 || hc->killer) {
+        return;
+    }
+    g_debug("%s: hedged read cancelled on %s, answer %s", G_STRLOC,
+            hc->loser->dst->name->str, hc->loser_over == 1 ? "drained" : "failed");
+    hedge_cancel_release(hc, hc->loser, hc->loser_over == 1 && !hc->kill_unknown);
+    g_queue_remove(&hedge_cancels, hc);
+    hedge_cancel_free(hc);
+}
+
+/**
+ * stop the read the other one beat
+ * @param poolable FALSE if the connection holds a session state
+ */
+static void
+hedge_cancel(chassis *srv, network_socket *loser, network_backend_t *backend,
+             gboolean poolable, const struct timeval *timeout)
+{
+    if (loser->event.ev_base) {
+        chassis_event_del(&(loser->event), &(loser->timer));
+    }
+    /* only a query fully sent and not read from yet can be drained */
+    if (!poolable || loser->send_queue->chunks->length > 0 || loser->resp_len > 0
+        || loser->recv_queue_raw->len > 0 || loser->recv_queue->chunks->length > 0
+        || !loser->challenge || !loser->response) {
+        backend->connected_clients--;
+        network_socket_free(loser);
+        return;
+    }
+
+    hedge_cancel_t *hc = g_new0(hedge_cancel_t, 1);
+    hc->srv = srv;
+    hc->backend = backend;
+    hc->loser = loser;
+    hc->loser_result = network_mysqld_com_query_result_new();
+    hc->timeout = *timeout;
+    g_queue_push_tail(&hedge_cancels, hc);
+
+    int is_robbed = 0;
+    network_socket *killer = network_connection_pool_get(backend->pool, loser->response->username, &is_robbed);
+    if (killer && is_robbed) {
+        /* another user can't kill it */
+        network_pool_add_idle_conn(backend->pool, srv, killer);
+        killer = NULL;
+    }
+    if (killer) {
+        backend->connected_clients++;
+        GString *packet = g_string_new(NULL);
+        g_string_append_c(packet, (char)COM_QUERY);
+        g_string_append_printf(packet, "KILL QUERY %u", loser->challenge->thread_id);
+        network_mysqld_queue_reset(killer);
+        network_mysqld_queue_append(killer, killer->send_queue, S(packet));
+        g_string_free(packet, TRUE);
+        killer->resp_len = 0;
+        killer->compressed_packet_id = 0;
+        if (network_mysqld_write(srv, killer) == NETWORK_SOCKET_SUCCESS) {
+            hc->killer = killer;
+            hc->killer_result = network_mysqld_com_query_result_new();
+            hedge_cancel_wait(hc, killer);
+        } else {
+            backend->connected_clients--;
+            network_socket_free(killer);
+        }
+    }
+    hedge_cancel_wait(hc, loser);
+}
+
+/* shutdown, the connections are closed */
+static void
+hedge_cancels_free(void)
+{
+    hedge_cancel_t *hc;
+    while ((hc = g_queue_pop_head(&hedge_cancels))) {
+        network_socket_free(hc->loser);
+        if (hc->killer) {
+            network_socket_free(hc->killer);
+        }
+        hedge_cancel_free(hc);
+    }
+}
+
+#ifdef SIMPLE_PARSER
+/**
+ * hedged reads
+ *
+ * an autocommit SELECT a slave hasn't started to answer within its recent
+ * p95 is sent to a second slave too, the first to answer is read and the
+ * other one cancelled
+ */
+#define HEDGE_WINDOW_US (10 * G_USEC_PER_SEC)
+#define HEDGE_REFRESH_US G_USEC_PER_SEC
+#define HEDGE_MIN_SAMPLES 100
+#define HEDGE_MIN_DELAY_US 1000
+
+typedef struct hedge_window_t {
+    chassis_histogram_t base;   /* backend_time when the window started */
+    gint64 start_us;
+    gint64 refreshed_us;
+    guint64 p95_us;
+} hedge_window_t;
+
+static hedge_window_t *hedge_windows[MAX_SERVER_NUM];
+
+static void
+hedge_windows_free(void)
+{
+    int i;
+    for (i = 0; i < MAX_SERVER_NUM; i++) {
+        g_free(hedge_windows[i]);
+        hedge_windows[i] = NULL;
+    }
+}
+
+/* p95 of the round trips of the last 10 seconds, 0 if not known yet */
+static guint64
+hedge_delay_us(network_mysqld_con *con, int backend_ndx)
+{
+    if (backend_ndx < 0 || backend_ndx >= MAX_SERVER_NUM) {
+        return 0;
+    }
+    const chassis_histogram_t *hist = con->srv->query_stats.backend_time[backend_ndx];
+    if (hist == NULL) {
+        return 0;
+    }
+    hedge_window_t *w = hedge_windows[backend_ndx];
+    if (w == NULL) {
+        w = hedge_windows[backend_ndx] = g_new0(hedge_window_t, 1);
+    }
+
+    gint64 now = g_get_monotonic_time();
+    if (hist->total < w->base.total) {
+        /* the stats were reset */
+        memcpy(&w->base, hist, sizeof(*hist));
+        w->start_us = now;
+    }
+    if (now - w->refreshed_us >= HEDGE_REFRESH_US) {
+        w->refreshed_us = now;
+        if (hist->total - w->base.total >= HEDGE_MIN_SAMPLES) {
+            w->p95_us = chassis_histogram_percentile_since(hist, &w->base, 95);
+        }
+        if (now - w->start_us >= HEDGE_WINDOW_US) {
+            memcpy(&w->base, hist, sizeof(*hist));
+            w->start_us = now;
+        }
+    }
+    return w->p95_us;
+}
+
+/* the read can go to the pooled connection without adjusting it first */
+static gboolean
+is_hedge_session_alike(network_socket *client, network_socket *sock)
+{
+    const char *clt_sql_mode = client->sql_mode ? client->sql_mode->str : "";
+    const char *srv_sql_mode = sock->sql_mode ? sock->sql_mode->str : "";
+
+    if (sock->is_in_sess_context || client->is_multi_stmt_set != sock->is_multi_stmt_set) {
+        return FALSE;
+    }
+    if (strcasecmp(clt_sql_mode, srv_sql_mode) != 0) {
+        return FALSE;
+    }
+    if (!g_string_equal(client->charset, sock->charset)
+        || !g_string_equal(client->charset_client, sock->charset_client)
+        || !g_string_equal(client->charset_connection, sock->charset_connection)
+        || !g_string_equal(client->charset_results, sock->charset_results)) {
+        return FALSE;
+    }
+    return client->default_db->len == 0 || g_string_equal(client->default_db, sock->default_db);
+}
+
+static int
+hedge_backend_ndx(network_mysqld_con *con)
+{
+    proxy_plugin_con_t *st = con->plugin_con_state;
+    network_backends_t *bs = con->srv->priv->backends;
+    int count = network_backends_count(bs);
+    int start = g_random_int_range(0, MAX(count, 1));
+    int i;
+
+    for (i = 0; i < count; i++) {
+        int ndx = (start + i) % count;
+        network_backend_t *backend = network_backends_get(bs, ndx);
+        if (ndx == st->backend_ndx || backend->type != BACKEND_TYPE_RO || backend->state != BACKEND_STATE_UP) {
+            continue;
+        }
+        /* it might not have the last write of the session */
+        if (con->srv->read_your_writes_wait && st->own_gtid && st->own_gtid->len > 0
+            && (ndx >= 64 || !(st->own_gtid_applied & (G_GUINT64_CONSTANT(1) << ndx)))) {
+            continue;
+        }
+        return ndx;
+    }
+    return -1;
+}
+
+static void
+hedge_read(network_mysqld_con *con)
+{
+    proxy_plugin_con_t *st = con->plugin_con_state;
+    int ndx = hedge_backend_ndx(con);
+    if (ndx == -1 || st->injected.queries->length != 1) {
+        return;
+    }
+
+    network_backend_t *backend = network_backends_get(con->srv->priv->backends, ndx);
+    int is_robbed = 0;
+    network_socket *sock = network_connection_pool_get(backend->pool, con->client->response->username, &is_robbed);
+    if (sock == NULL) {
+        return;
+    }
+    if (is_robbed || !is_hedge_session_alike(con->client, sock)) {
+        network_pool_add_idle_conn(backend->pool, con->srv, sock);
+        return;
+    }
+
+    con->hedge = sock;
+    con->hedge_backend = backend;
+    con->hedge_backend_ndx = ndx;
+    sock->breaker_epoch = backend->breaker_epoch;
+    backend->connected_clients++;
+    network_connection_pool_note_in_use(backend->pool, network_backend_borrowed_count(backend));
+
+    injection *inj = g_queue_peek_head(st->injected.queries);
+    network_mysqld_queue_reset(sock);
+    network_mysqld_queue_append(sock, sock->send_queue, S(inj->query));
+    sock->resp_len = 0;
+    sock->compressed_packet_id = 0;
+
+    /* a query too long to go out at once isn't worth it */
+    if (network_mysqld_write(con->srv, sock) != NETWORK_SOCKET_SUCCESS) {
+        drop_hedge(con);
+        return;
+    }
+    con->hedge_send_us = g_get_monotonic_time();
+    con->srv->query_stats.hedged_reads++;
+    g_debug("%s: read hedged to backend ndx:%d for con:%p", G_STRLOC, ndx, con);
+
+    struct timeval timeout = con->read_timeout;
+    WAIT_FOR_EVENT(sock, EV_READ, &timeout);
+}
+
+/* the second slave answered first, it becomes the server of the query */
+static void
+hedge_won(network_mysqld_con *con)
+{
+    proxy_plugin_con_t *st = con->plugin_con_state;
+
+    /* the wait of the slower one counts for its latency too */
+    network_mysqld_con_backend_done(con, st->backend_ndx, con->server);
+    hedge_cancel(con->srv, con->server, st->backend,
+                 con->prepare_stmt_count == 0 && !con->server->is_in_sess_context, &con->read_timeout);
+
+    con->server = con->hedge;
+    st->backend = con->hedge_backend;
+    st->backend_ndx = con->hedge_backend_ndx;
+    con->backend_send_us = con->hedge_send_us;
+    con->hedge = NULL;
+    con->hedge_backend = NULL;
+    con->hedge_backend_ndx = -1;
+    con->srv->query_stats.hedged_read_wins++;
+}
+
+/* how long to wait for the first bytes before hedging, 0 for as usual */
+static guint64
+hedge_timeout_us(network_mysqld_con *con)
+{
+    proxy_plugin_con_t *st = con->plugin_con_state;
+    network_socket *server = con->server;
+
+    if (!con->is_read_hedgeable) {
+        return 0;
+    }
+    /* a timeout armed without it is a real one */
+    guint64 delay = hedge_delay_us(con, st->backend_ndx);
+    if (delay == 0 || con->hedge || server->resp_len > 0 || server->recv_queue_raw->len > 0) {
+        con->is_read_hedgeable = 0;
+        return 0;
+    }
+    gint64 waited = g_get_monotonic_time() - con->backend_send_us;
+    return waited + HEDGE_MIN_DELAY_US < delay ? delay - waited : HEDGE_MIN_DELAY_US;
+}
+#endif
+
 static int
 normal_read_query_result(network_mysqld_con *con, network_mysqld_con_state_t ostate)
 {
@@ -3381,6 +4430,13 @@ normal_read_query_result(network_mysqld_con *con, network_mysqld_con_state_t ost
                 g_debug("%s: send_part_content_to_client", G_STRLOC);
                 send_part_content_to_client(con);
             }
+#ifdef SIMPLE_PARSER
+            guint64 hedge_us = hedge_timeout_us(con);
+            if (hedge_us > 0) {
+                timeout.tv_sec = hedge_us / G_USEC_PER_SEC;
+                timeout.tv_usec = hedge_us % G_USEC_PER_SEC;
+            }
+#endif
             WAIT_FOR_EVENT(con->server, EV_READ, &timeout);
             return DISP_STOP;
         case NETWORK_SOCKET_ERROR_RETRY:
@@ -3420,6 +4476,8 @@ normal_read_query_result(network_mysqld_con *con, network_mysqld_con_state_t ost
         }
     } while (con->state == ST_READ_QUERY_RESULT);
 
+    drop_hedge(con);
+    network_mysqld_con_phase_end(con, QUERY_PHASE_BACKEND);
     return DISP_CONTINUE;
 }
 
@@ -3451,6 +4509,12 @@ read_query_result_for_sharding(network_mysqld_con *con, network_mysqld_con_state
         }
     }
 
+    /* rounds after the query itself are for XA END, PREPARE and COMMIT/ROLLBACK */
+    if (con->dist_tran && con->dist_tran_state > NEXT_ST_XA_QUERY) {
+        network_mysqld_con_phase_end(con, QUERY_PHASE_XA);
+    } else {
+        network_mysqld_con_phase_end(con, QUERY_PHASE_BACKEND);
+    }
     return DISP_CONTINUE;
 }
 
@@ -3475,7 +4539,14 @@ process_read_event(network_mysqld_con *con, int event_fd)
         if (event_fd == con->client->fd) {
             con->client->to_read = b;
             g_debug("%s:client to read:%d for con:%p", G_STRLOC, b, con);
+#ifdef SIMPLE_PARSER
+        } else if (con->hedge && event_fd == con->hedge->fd) {
+            hedge_won(con);
+            con->server->to_read = b;
+            g_debug("%s:hedged server to read:%d for con:%p", G_STRLOC, b, con);
+#endif
         } else if (con->server && event_fd == con->server->fd) {
+            drop_hedge(con);
             con->server->to_read = b;
             g_debug("%s:server to read:%d for con:%p", G_STRLOC, b, con);
         } else {
@@ -3492,7 +4563,17 @@ process_read_event(network_mysqld_con *con, int event_fd)
             g_debug("%s:client needs to be closed for con:%p", G_STRLOC, con);
         } else if (con->server && event_fd == con->server->fd && con->com_quit_seen) {
             con->state = ST_CLOSE_SERVER;
+        } else if (con->hedge && event_fd == con->hedge->fd) {
+            /* the first one may still answer */
+            drop_hedge(con);
         } else {
+            drop_hedge(con);
+#ifdef SIMPLE_PARSER
+            proxy_plugin_con_t *st = con->plugin_con_state;
+            if (st && st->backend && con->server) {
+                network_backend_breaker_record(st->backend, con->server->breaker_epoch, 0, TRUE);
+            }
+#endif
             g_message("%s:server closed prematurely, op: %s", G_STRLOC, network_mysqld_con_st_name(con->state));
 
             network_mysqld_con_send_error_full(con->client, C("server closed prematurely"), ER_CETUS_UNKNOWN, "HY000");
@@ -3508,6 +4589,14 @@ process_read_event(network_mysqld_con *con, int event_fd)
 static void
 process_timeout_event(network_mysqld_con *con)
 {
+#ifdef SIMPLE_PARSER
+    if (con->state == ST_READ_QUERY_RESULT && con->is_read_hedgeable && con->hedge == NULL) {
+        con->is_read_hedgeable = 0;
+        hedge_read(con);
+        return;
+    }
+#endif
+    drop_hedge(con);
     if (con->is_wait_server) {
         g_debug("%s:now get a chance to get server connection", G_STRLOC);
     } else {
@@ -3556,6 +4645,11 @@ network_mysqld_con_handle(int event_fd, short events, void *user_data)
         struct timeval timeout;
 
         ostate = con->state;
+        if (con->stamped_state != con->state) {
+            /* state may also be changed by server sessions, outside of this loop */
+            con->stamped_state = con->state;
+            con->state_since_us = g_get_monotonic_time();
+        }
 #if NETWORK_DEBUG_TRACE_STATE_CHANGES
         /*
          * if you need the state-change information without dtrace,
@@ -3744,7 +4838,9 @@ network_mysqld_con_handle(int event_fd, short events, void *user_data)
 
             break;
         case ST_GET_SERVER_CONNECTION_LIST:
-            switch (plugin_call(srv, con, con->state)) {
+            retval = plugin_call(srv, con, con->state);
+            network_mysqld_con_phase_end(con, QUERY_PHASE_POOL_WAIT);
+            switch (retval) {
             case NETWORK_SOCKET_SUCCESS:
                 con->state = ST_SEND_QUERY;
                 if (con->retry_serv_cnt > 0 && con->is_wait_server) {
@@ -3755,6 +4851,10 @@ network_mysqld_con_handle(int event_fd, short events, void *user_data)
                 con->retry_serv_cnt = 0;
                 break;
             case NETWORK_SOCKET_WAIT_FOR_EVENT:
+                if (con->is_wait_write_gate) {
+                    /* woken up when the gate opens, see shard_migration_wait_gate() */
+                    return;
+                }
                 if (con->retry_serv_cnt < con->max_retry_serv_cnt) {
                     con->master_conn_shortaged = 1;
                     con->retry_serv_cnt++;
@@ -3783,7 +4883,7 @@ network_mysqld_con_handle(int event_fd, short events, void *user_data)
             break;
         case ST_READ_QUERY:
             g_debug("%s:call here.", G_STRLOC);
-            CHECK_PENDING_EVENT(&(con->client->event));
+            CHECK_PENDING_EVENT(&(con->client->event), &(con->client->timer));
 
             /* TODO If config is reloaded, close all current cons */
             g_assert(events == 0 || event_fd == con->client->fd);
@@ -3818,6 +4918,7 @@ network_mysqld_con_handle(int event_fd, short events, void *user_data)
              * send error to the client
              * and close the connections afterwards
              */
+            restore_held_output(con);
             switch (network_mysqld_write(srv, con->client)) {
             case NETWORK_SOCKET_SUCCESS:
                 break;
@@ -3901,11 +5002,12 @@ accept_new_conns(chassis *chas, const gboolean do_accept)
         network_mysqld_con *con = l->data;
         if (do_accept) {
             update_accept_event(con, EV_READ | EV_PERSIST);
-            if (listen(con->server->fd, 128) != 0) {
+            if (listen(con->server->fd, chas->listen_backlog) != 0) {
                 g_warning("listen errno: %d", errno);
             }
         } else {
             update_accept_event(con, 0);
+            network_uring_accept_cancel(con->server->fd);
             if (listen(con->server->fd, 0) != 0) {
                 g_warning("listen errno: %d", errno);
             }
@@ -3927,23 +5029,14 @@ accept_new_conns(chassis *chas, const gboolean do_accept)
  * @param user_data    the listening connection handle
  * 
  */
-void
-network_mysqld_con_accept(int G_GNUC_UNUSED event_fd, short events, void *user_data)
+static void
+network_mysqld_con_accepted(network_mysqld_con *listen_con, network_socket *client)
 {
-    network_mysqld_con *listen_con = user_data;
     network_mysqld_con *client_con;
-    network_socket *client;
 
-    g_assert(events == EV_READ);
-    g_assert(listen_con->server);
-    int reason = 0;
-    client = network_socket_accept(listen_con->server, &reason);
-    if (!client) {
-        if (reason == EMFILE) { /* if reach max fd, stop accepting */
-            g_warning("EMFILE (Too many open files), stop accept");
-            accept_new_conns(listen_con->srv, FALSE);
-        }
-        return;
+    if (network_uring_enabled()) {
+        client->uring_async = 1;
+        client->uring_slot = network_uring_register_fd(client->fd);
     }
 
     /* looks like we open a client connection */
@@ -3964,8 +5057,62 @@ network_mysqld_con_accept(int G_GNUC_UNUSED event_fd, short events, void *user_d
     client_con->config = listen_con->config;
 
     network_mysqld_con_handle(-1, 0, client_con);
+}
 
-    return;
+static void
+network_mysqld_con_uring_accept(int fd, gboolean more, void *user_data)
+{
+    network_mysqld_con *listen_con = user_data;
+
+    if (fd >= 0) {
+        network_socket *client = network_socket_accepted(fd);
+        if (client) {
+            network_mysqld_con_accepted(listen_con, client);
+        }
+    }
+    if (!more) {
+        if (fd == -EMFILE) {
+            g_warning("EMFILE (Too many open files), stop accept");
+            accept_new_conns(listen_con->srv, FALSE);
+        } else {
+            /* back to readiness, the next one restarts the multishot accept */
+            event_add(&(listen_con->server->event), NULL);
+        }
+    }
+}
+
+void
+network_mysqld_con_accept(int G_GNUC_UNUSED event_fd, short events, void *user_data)
+{
+    network_mysqld_con *listen_con = user_data;
+    network_socket *client;
+
+    g_assert(events == EV_READ);
+    g_assert(listen_con->server);
+
+    /* with io_uring, the first readiness hands the listen socket to a multishot accept */
+    if (network_uring_accept(listen_con->server->fd, network_mysqld_con_uring_accept, listen_con)) {
+        chassis_event_del(&(listen_con->server->event), &(listen_con->server->timer));
+        return;
+    }
+
+    /* drain the listen queue, bounded to keep serving established clients */
+    int n;
+    for (n = 0; n < MAX_ACCEPTS_PER_EVENT; n++) {
+        int reason = 0;
+        client = network_socket_accept(listen_con->server, &reason);
+        if (!client) {
+            if (reason == EMFILE) { /* if reach max fd, stop accepting */
+                g_warning("EMFILE (Too many open files), stop accept");
+                accept_new_conns(listen_con->srv, FALSE);
+            } else if (reason == ECONNABORTED || reason == EINTR) {
+                continue;
+            }
+            return;
+        }
+
+        network_mysqld_con_accepted(listen_con, client);
+    }
 }
 
 /**
@@ -4210,8 +5357,23 @@ proxy_self_create_auth(chassis *srv, server_connection_state_t *con)
     auth->client_capabilities = CETUS_DEFAULT_FLAGS;
 
     if (srv->is_back_compressed) {
-        auth->client_capabilities |= CLIENT_COMPRESS;
+        if (srv->zstd_back_level > 0 && (challenge->capabilities & CLIENT_ZSTD_COMPRESSION_ALGORITHM)) {
+            auth->client_capabilities |= CLIENT_ZSTD_COMPRESSION_ALGORITHM;
+            auth->zstd_level = srv->zstd_back_level;
+            send_sock->do_zstd = 1;
+            send_sock->zstd_level = srv->zstd_back_level;
+        } else {
+            auth->client_capabilities |= CLIENT_COMPRESS;
+        }
+    }
+
+#ifdef SIMPLE_PARSER
+    if (srv->read_your_writes_wait > 0 && (challenge->capabilities & CLIENT_SESSION_TRACK)) {
+        /* the GTID of the writes comes in the OK packets */
+        auth->client_capabilities |= CLIENT_SESSION_TRACK;
+        send_sock->is_session_tracked = 1;
     }
+#endif
 
     if (send_sock->default_db->len == 0) {
         auth->client_capabilities &= ~CLIENT_CONNECT_WITH_DB;
@@ -4280,7 +5442,7 @@ network_mysqld_self_con_free(server_connection_state_t *con)
 
 #define ASYNC_WAIT_FOR_EVENT(sock, ev_type, timeout, user_data)         \
 event_set(&(sock->event), sock->fd, ev_type, network_mysqld_self_con_handle, user_data); \
-chassis_event_add_with_timeout(srv, &(sock->event), timeout);
+chassis_event_add_with_timer(srv, &(sock->event), &(sock->timer), timeout);
 
 static int
 process_self_event(server_connection_state_t *con, int events, int event_fd)
@@ -4387,13 +5549,14 @@ process_self_read_auth_result(server_connection_state_t *con)
 
     if (con->state != ST_ASYNC_ERROR) {
         con->backend->connected_clients--;
+        con->backend->connecting--;
         g_debug("%s: connected_clients sub, now:%d for con:%p", G_STRLOC, con->backend->connected_clients, con);
         g_message("%s: backend:%s, new connection:%p", G_STRLOC, con->backend->addr->name->str, con->server);
         network_mysqld_queue_reset(con->server);
         network_queue_clear(con->server->recv_queue);
         con->server->is_multi_stmt_set = con->is_multi_stmt_set;
 #if NETWORK_DEBUG_TRACE_EVENT
-        CHECK_PENDING_EVENT(&(con->server->event));
+        CHECK_PENDING_EVENT(&(con->server->event), &(con->server->timer));
 #endif
         if (con->srv->is_back_compressed) {
             con->server->do_compress = 1;
@@ -4426,6 +5589,7 @@ network_mysqld_self_con_handle(int event_fd, short events, void *user_data)
         case ST_ASYNC_ERROR:
             g_warning("%s: con:%p failed for server:%p", G_STRLOC, con, con->server);
             con->backend->connected_clients--;
+            con->backend->connecting--;
             g_debug("%s: connected_clients sub, now:%d for con:%p", G_STRLOC, con->backend->connected_clients, con);
             network_mysqld_self_con_free(con);
             return;
@@ -4613,6 +5777,7 @@ network_connection_pool_create_conn(network_mysqld_con *con)
             }
 
             scs->backend->connected_clients++;
+            scs->backend->connecting++;
             g_message("%s: connected_clients add, backend ndx:%d, for server:%p, faked con:%p",
                       G_STRLOC, i, scs->server, scs);
 
@@ -4635,6 +5800,7 @@ network_connection_pool_create_conn(network_mysqld_con *con)
                 break;
             default:
                 scs->backend->connected_clients--;
+                scs->backend->connecting--;
                 if (scs->backend->type != BACKEND_TYPE_RW) {
                     backend->state = BACKEND_STATE_DOWN;
                     g_message("%s: set backend ndx:%d down", G_STRLOC, i);
@@ -4649,75 +5815,153 @@ network_connection_pool_create_conn(network_mysqld_con *con)
     }
 }
 
-void
-network_connection_pool_create_conns(chassis *srv)
+static int
+network_backend_open_conn(chassis *srv, network_backend_t *backend, int ndx)
 {
-    int i, j;
     chassis_private *g = srv->priv;
+    server_connection_state_t *scs = network_mysqld_self_con_init(srv);
+    if (srv->disable_dns_cache)
+        network_address_set_address(scs->server->dst, backend->address->str);
+    else
+        network_address_copy(scs->server->dst, backend->addr);
 
-    for (i = 0; i < network_backends_count(g->backends); i++) {
-        network_backend_t *backend = network_backends_get(g->backends, i);
-        if (backend != NULL) {
-            for (j = 0; j < backend->config->mid_conn_pool; j++) {
-                server_connection_state_t *scs = network_mysqld_self_con_init(srv);
-                if (srv->disable_dns_cache)
-                    network_address_set_address(scs->server->dst, backend->address->str);
-                else
-                    network_address_copy(scs->server->dst, backend->addr);
-
-                scs->backend = backend;
-                scs->pool = backend->pool;
-                scs->charset_code = backend->config->charset;
-                g_string_append(scs->server->username, backend->config->default_username->str);
-                cetus_users_get_hashed_server_pwd(g->users, scs->server->username->str, scs->hashed_pwd);
-
-                scs->connect_timeout.tv_sec = 3;
-                scs->connect_timeout.tv_usec = 0;
-
-                if (backend->config->default_db && backend->config->default_db->len > 0) {
-                    g_string_append(scs->server->default_db, backend->config->default_db->str);
-                    g_debug("%s:set server default db:%s for con:%p", G_STRLOC, scs->server->default_db->str, scs);
+    scs->backend = backend;
+    scs->pool = backend->pool;
+    scs->charset_code = backend->config->charset;
+    g_string_append(scs->server->username, backend->config->default_username->str);
+    cetus_users_get_hashed_server_pwd(g->users, scs->server->username->str, scs->hashed_pwd);
 
-                }
+    scs->connect_timeout.tv_sec = 3;
+    scs->connect_timeout.tv_usec = 0;
+
+    if (backend->config->default_db && backend->config->default_db->len > 0) {
+        g_string_append(scs->server->default_db, backend->config->default_db->str);
+        g_debug("%s:set server default db:%s for con:%p", G_STRLOC, scs->server->default_db->str, scs);
 
-                g_message("%s: connected_clients add, backend ndx:%d, for server:%p, faked con:%p",
-                          G_STRLOC, i, scs->server, scs);
+    }
 
-                scs->backend->connected_clients++;
-                switch (network_socket_connect(scs->server)) {
-                case NETWORK_SOCKET_ERROR_RETRY:{
-                    scs->state = ST_ASYNC_CONN;
-                    struct timeval timeout = scs->connect_timeout;
-                    ASYNC_WAIT_FOR_EVENT(scs->server, EV_WRITE, &timeout, scs);
+    g_debug("%s: connected_clients add, backend ndx:%d, for server:%p, faked con:%p",
+            G_STRLOC, ndx, scs->server, scs);
+
+    scs->backend->connected_clients++;
+    scs->backend->connecting++;
+    switch (network_socket_connect(scs->server)) {
+    case NETWORK_SOCKET_ERROR_RETRY:{
+        scs->state = ST_ASYNC_CONN;
+        struct timeval timeout = scs->connect_timeout;
+        ASYNC_WAIT_FOR_EVENT(scs->server, EV_WRITE, &timeout, scs);
+        break;
+    }
+    case NETWORK_SOCKET_SUCCESS:
+        if (backend->state != BACKEND_STATE_UP) {
+            backend->state = BACKEND_STATE_UP;
+            g_message("%s: set backend:%p, ndx:%d up", G_STRLOC, backend, ndx);
+            g_get_current_time(&(backend->state_since));
+        }
+        ASYNC_WAIT_FOR_EVENT(scs->server, EV_READ, 0, scs);
+        scs->state = ST_ASYNC_READ_HANDSHAKE;
+        g_debug("%s: set backend conn:%p read handshake", G_STRLOC, scs);
+        break;
+    default:
+        scs->backend->connected_clients--;
+        scs->backend->connecting--;
+        network_mysqld_self_con_free(scs);
+        if (backend->type != BACKEND_TYPE_RW) {
+            backend->state = BACKEND_STATE_DOWN;
+            g_message("%s: set backend ndx:%d down, connected_clients sub", G_STRLOC, ndx);
+        } else {
+            g_message("%s: error when creating conn for backend ndx:%d", G_STRLOC, ndx);
+        }
+        g_get_current_time(&(backend->state_since));
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Pool controller: every interval, each pool is sized to the demand seen
+ * (see network_connection_pool_target()), new connections are opened at
+ * no more than pool-connect-rate per second in total.
+ */
+#define POOL_CTL_INTERVAL_SEC 1
+
+static double pool_connect_tokens;
+/* where the tokens go first, rotated so the first backends don't always win */
+static int pool_ctl_start;
+
+static void
+pool_ctl_handler(int G_GNUC_UNUSED fd, short G_GNUC_UNUSED events, void *arg)
+{
+    chassis *srv = arg;
+    chassis_private *g = srv->priv;
+    int rate = srv->pool_connect_rate;
+    int count = network_backends_count(g->backends);
+    int k;
+
+    if (rate > 0) {
+        /* at most one second of connects in a burst */
+        pool_connect_tokens = MIN(pool_connect_tokens + rate * POOL_CTL_INTERVAL_SEC, rate);
+    }
+
+    if (count > 0) {
+        pool_ctl_start = (pool_ctl_start + 1) % count;
+    }
+    for (k = 0; k < count; k++) {
+        int i = (pool_ctl_start + k) % count;
+        network_backend_t *backend = network_backends_get(g->backends, i);
+        if (backend == NULL || backend->config == NULL) {
+            continue;
+        }
+        network_connection_pool *pool = backend->pool;
+        network_connection_pool_update_demand(pool, network_backend_borrowed_count(backend));
+        if (backend->state != BACKEND_STATE_UP && backend->state != BACKEND_STATE_UNKNOWN) {
+            continue;
+        }
+
+        int target = network_connection_pool_target(pool, backend->config->max_conn_pool);
+        int total = network_backend_conns_count(backend);
+
+        if (total < target) {
+            int n = target - total;
+            if (rate > 0) {
+                n = MIN(n, (int)pool_connect_tokens);
+            }
+            g_debug("%s: backend ndx:%d open %d conns, total:%d, target:%d", G_STRLOC, i, n, total, target);
+            while (n-- > 0) {
+                if (network_backend_open_conn(srv, backend, i) != 0) {
                     break;
                 }
-                case NETWORK_SOCKET_SUCCESS:
-                    if (backend->state != BACKEND_STATE_UP) {
-                        backend->state = BACKEND_STATE_UP;
-                        g_message("%s: set backend:%p, ndx:%d up", G_STRLOC, backend, i);
-                        g_get_current_time(&(backend->state_since));
-                    }
-                    ASYNC_WAIT_FOR_EVENT(scs->server, EV_READ, 0, scs);
-                    scs->state = ST_ASYNC_READ_HANDSHAKE;
-                    g_message("%s: set backend conn:%p read handshake", G_STRLOC, scs);
-                    break;
-                default:
-                    scs->backend->connected_clients--;
-                    network_mysqld_self_con_free(scs);
-                    if (scs->backend->type != BACKEND_TYPE_RW) {
-                        backend->state = BACKEND_STATE_DOWN;
-                        g_message("%s: set backend ndx:%d down, connected_clients sub", G_STRLOC, i);
-                    } else {
-                        g_message("%s: error when creating conn for backend ndx:%d", G_STRLOC, i);
-                    }
-                    g_get_current_time(&(backend->state_since));
-                    break;
+                if (rate > 0) {
+                    pool_connect_tokens -= 1;
                 }
             }
+        } else if (total > target && srv->is_reduce_conns) {
+            pool->shrink_budget -= network_connection_pool_shrink(pool, backend->connected_clients,
+                                                                  target, pool->shrink_budget);
         }
     }
 }
 
+/**
+ * start the pool controller, it warms the pools up to mid_conn_pool
+ * within the connect rate instead of connecting all at once
+ */
+void
+network_connection_pool_create_conns(chassis *srv)
+{
+    struct timeval interval = { POOL_CTL_INTERVAL_SEC, 0 };
+
+    if (pool_ctl_event.ev_base) {
+        return;
+    }
+    pool_connect_tokens = 0;
+    event_set(&pool_ctl_event, -1, EV_PERSIST, pool_ctl_handler, srv);
+    event_base_set(srv->event_base, &pool_ctl_event);
+    event_add(&pool_ctl_event, &interval);
+
+    pool_ctl_handler(-1, 0, srv);
+}
+
 void
 network_mysqld_con_set_sharding_plan(network_mysqld_con *con, sharding_plan_t *plan)
 {
@@ -341,6 +341,14 @@ struct server_connection_state_t {
     guint8 charset_code;
 };
 
+/* a client command longer than one packet, relayed as it is read */
+typedef enum {
+    LARGE_PACKET_NONE = 0,
+    LARGE_PACKET_PENDING = 1,   /* only the first packet is read */
+    LARGE_PACKET_HEAD = 2,      /* the first packet is queued for the server */
+    LARGE_PACKET_BODY = 3       /* the rest is being relayed */
+} large_packet_relay_t;
+
 typedef enum {
     ST_PROXY_OK = 0,
     ST_PROXY_QUIT = 1
@@ -508,6 +516,7 @@ struct network_mysqld_con {
     mysqld_query_attr_t query_attr;
 
     unsigned int is_wait_server:1;  /* first connect to backend failed, retrying */
+    unsigned int is_wait_write_gate:1;  /* shard-only: dual write held while a partition batch is copied */
     unsigned int is_calc_found_rows:1;
     unsigned int login_failed:1;
     unsigned int is_auto_commit:1;
@@ -542,6 +551,7 @@ struct network_mysqld_con {
     unsigned int buffer_and_send_fake_resp:1;
     unsigned int delay_send_auto_commit:1;
     unsigned int resp_too_long:1;
+    unsigned int global_index_missed:1;
     unsigned int rob_other_conn:1;
     unsigned int master_unavailable:1;
     unsigned int master_conn_shortaged:1;
@@ -557,9 +567,17 @@ struct network_mysqld_con {
     unsigned int query_cache_judged:1;
     unsigned int is_client_compressed:1;
     unsigned int is_client_to_be_closed:1;
+    unsigned int is_flush_deferred:1;   /* partial output written at the end of the loop iteration */
+    unsigned int is_held_output_queued:1;   /* the send queue starts with responses of earlier commands */
+    unsigned int is_read_hedgeable:1;   /* rw-only: the read may go to a second slave too */
     unsigned int last_backend_type:2;
+    unsigned int query_class:3; /* query_class_t */
+    unsigned int large_packet_relay:2;  /* large_packet_relay_t */
+    unsigned int large_packet_last:1;   /* the packet being relayed ends the command */
     unsigned int all_participate_num:8;
 
+    guint32 large_packet_left;  /* bytes of the packet being relayed not read yet */
+
     unsigned long long xa_id;
 
     time_t last_check_conn_supplement_time;
@@ -568,6 +586,15 @@ struct network_mysqld_con {
     struct timeval resp_recv_time;
     struct timeval resp_send_time;
 
+    /* monotonic usec of the current query, for the latency histograms */
+    gint64 query_start_us;
+    gint64 phase_start_us;
+    gint64 backend_send_us;
+    gint64 phase_us[QUERY_PHASE_MAX];
+    guint phases_seen;
+    gint64 state_since_us;      /* when stamped_state was entered */
+    network_mysqld_con_state_t stamped_state;
+
     guint64 resp_cnt;
     guint64 last_insert_id;
 
@@ -639,6 +666,14 @@ struct network_mysqld_con {
     char last_backends_type[MAX_SERVER_NUM];
 
     struct sharding_plan_t *sharding_plan;
+    struct sharding_load_data_t *load_data; /* LOAD DATA LOCAL INFILE being relayed */
+    network_queue *held_output; /* unwritten responses, set aside while pipelined commands go on */
+    struct event drain_event;   /* writes what a deferred flush left while the backend is waited for */
+    chassis_timer_t drain_timer;
+    network_socket *hedge;      /* rw-only: a second slave the read was sent to */
+    network_backend_t *hedge_backend;
+    int hedge_backend_ndx;
+    gint64 hedge_send_us;
     struct query_queue_t *recent_queries;
     void *data;
 };
@@ -680,6 +715,7 @@ typedef struct server_session_t {
     const GString *sql;
     network_mysqld_con *con;
     network_backend_t *backend;
+    int backend_ndx;            /* index of backend in the backend-array */
     network_mysqld_con_dist_tran_state_t dist_tran_state;
     read_write_state state;
     session_attr_flags_t attr_diff;
@@ -699,6 +735,10 @@ typedef struct {
     int trx_read_write;         /* default TF_READ_WRITE */
     int trx_isolation_level;    /* default TF_REPEATABLE_READ */
 
+    GString *own_gtid;          /* rw-only: GTID of the last write of the session */
+    guint64 own_gtid_applied;   /* rw-only: bitmap of the slaves known to have applied own_gtid */
+    unsigned int own_gtid_wait_failed:1;    /* rw-only: read own_gtid from the master */
+
 } proxy_plugin_con_t;
 
 NETWORK_API network_mysqld_con *network_mysqld_con_new(void);
@@ -720,6 +760,23 @@ void network_mysqld_send_xa_start(network_socket *, const char *xid);
 NETWORK_API void network_mysqld_con_reset_command_response_state(network_mysqld_con *con);
 NETWORK_API void network_mysqld_con_reset_query_state(network_mysqld_con *con);
 
+/**
+ * charge the time since the previous phase end to `phase`
+ */
+NETWORK_API void network_mysqld_con_phase_end(network_mysqld_con *con, query_phase_t phase);
+
+NETWORK_API const char *query_phase_name(query_phase_t phase);
+
+/**
+ * append "phase:usec" of the phases seen so far by current query
+ */
+NETWORK_API void network_mysqld_con_append_phases(network_mysqld_con *con, GString *out);
+
+/**
+ * record one round trip to backend `backend_ndx` over `server`, timed from the last send
+ */
+NETWORK_API void network_mysqld_con_backend_done(network_mysqld_con *con, int backend_ndx, network_socket *server);
+
 /**
  * set groups, delete if already exists
  */
@@ -751,6 +808,7 @@ NETWORK_API int network_mysqld_init(chassis *srv);
 NETWORK_API void network_mysqld_add_connection(chassis *srv, network_mysqld_con *con, gboolean listen);
 NETWORK_API void network_mysqld_con_handle(int event_fd, short events, void *user_data);
 NETWORK_API int network_mysqld_queue_append(network_socket *sock, network_queue *queue, const char *data, size_t len);
+NETWORK_API int network_mysqld_queue_append_head(network_socket *sock, network_queue *queue, const char *data);
 NETWORK_API int network_mysqld_queue_append_raw(network_socket *sock, network_queue *queue, GString *data);
 NETWORK_API int network_mysqld_queue_reset(network_socket *sock);
 
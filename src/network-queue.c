@@ -61,12 +61,49 @@ network_queue_clear(network_queue *queue)
     if (!queue)
         return;
     GString *packet;
+    if (queue->pinned > 0) {
+        /* what an async write is reading has to go out, as if written already */
+        while (queue->chunks->length > queue->pinned) {
+            packet = g_queue_pop_tail(queue->chunks);
+            queue->len -= packet->len;
+            g_string_free(packet, TRUE);
+        }
+        return;
+    }
     while ((packet = g_queue_pop_head(queue->chunks)) != NULL) {
         g_string_free(packet, TRUE);
     }
     queue->len = queue->offset = 0;
 }
 
+/**
+ * the first @n chunks are read by an async write until network_queue_unpin(),
+ * network_queue_clear() leaves them in the queue
+ */
+void
+network_queue_pin(network_queue *queue, guint n)
+{
+    g_assert(n <= queue->chunks->length);
+    queue->pinned = n;
+}
+
+void
+network_queue_unpin(network_queue *queue)
+{
+    queue->pinned = 0;
+}
+
+/* unlink the pinned chunks without freeing them, the async write owns them now */
+void
+network_queue_drop_pinned(network_queue *queue)
+{
+    for (; queue->pinned > 0; queue->pinned--) {
+        GString *packet = g_queue_pop_head(queue->chunks);
+        queue->len -= packet->len - queue->offset;
+        queue->offset = 0;
+    }
+}
+
 int
 network_queue_append(network_queue *queue, GString *s)
 {
@@ -31,6 +31,7 @@ typedef struct {
 
     size_t len;                 /* len in all chunks (w/o the offset) */
     size_t offset;              /* offset in the first chunk */
+    guint pinned;               /* chunks at the head read by an async write */
 } network_queue;
 
 NETWORK_API network_queue *network_queue_new(void);
@@ -39,5 +40,8 @@ void network_queue_clear(network_queue *queue);
 NETWORK_API int network_queue_append(network_queue *queue, GString *chunk);
 NETWORK_API GString *network_queue_pop_str(network_queue *queue, gsize steal_len, GString *dest);
 NETWORK_API GString *network_queue_peek_str(network_queue *queue, gsize peek_len, GString *dest);
+void network_queue_pin(network_queue *queue, guint n);
+void network_queue_unpin(network_queue *queue);
+void network_queue_drop_pinned(network_queue *queue);
 
 #endif
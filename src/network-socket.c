@@ -78,6 +78,9 @@
 #include "network-mysqld-packet.h"
 #include "cetus-util.h"
 #include "network-compress.h"
+#include "network-compress-pool.h"
+#include "network-uring.h"
+#include "chassis-event.h"
 #include "glib-ext.h"
 
 network_socket *
@@ -101,6 +104,7 @@ network_socket_new()
     s->sql_mode = g_string_new(NULL);
 
     s->fd = -1;
+    s->uring_slot = -1;
     s->socket_type = SOCK_STREAM;   /* let's default to TCP */
     s->packet_id_is_reset = TRUE;
 
@@ -123,6 +127,18 @@ network_socket_free(network_socket *s)
         g_string_free(s->last_compressed_packet, TRUE);
         s->last_compressed_packet = NULL;
     }
+    if (s->compress_job) {
+        /* the context is still in use, the job frees it */
+        network_compress_job_cancel(s->compress_job);
+    } else {
+        cetus_compress_ctx_free(s->compress_ctx);
+    }
+    if (s->uring_send) {
+        /* the kernel may still read the chunks, they go with the completion */
+        network_queue_drop_pinned(s->send_queue);
+        network_uring_send_cancel(s->uring_send);
+        s->uring_send = NULL;
+    }
     network_queue_free(s->send_queue);
     network_queue_free(s->recv_queue);
     network_queue_free(s->recv_queue_raw);
@@ -138,7 +154,11 @@ network_socket_free(network_socket *s)
 
     if (s->event.ev_base) {     /* if .ev_base isn't set, the event never got added */
         g_debug("%s:event del, ev:%p", G_STRLOC, &(s->event));
-        event_del(&(s->event));
+        chassis_event_del(&(s->event), &(s->timer));
+    }
+
+    if (s->uring_slot != -1) {
+        network_uring_unregister_fd(s->uring_slot);
     }
 
     if (s->fd != -1) {
@@ -186,6 +206,40 @@ network_socket_set_send_buffer_size(network_socket *sock, int size)
     return NETWORK_SOCKET_SUCCESS;
 }
 
+compress_ctx_t *
+network_socket_compress_ctx(network_socket *sock)
+{
+    if (!sock->compress_ctx) {
+        if (sock->do_zstd) {
+            sock->compress_ctx = cetus_compress_ctx_new(COMPRESS_ALGO_ZSTD, sock->zstd_level);
+        } else {
+            sock->compress_ctx = cetus_compress_ctx_new(COMPRESS_ALGO_ZLIB, Z_DEFAULT_COMPRESSION);
+        }
+    }
+    return sock->compress_ctx;
+}
+
+static network_socket *
+network_socket_accept_finish(network_socket *client)
+{
+    if (network_address_refresh_name(client->src)) {
+        network_socket_free(client);
+        return NULL;
+    }
+
+    /* 
+     * the listening side may be INADDR_ANY, 
+     * let's get which address the client really connected to
+     */
+    if (-1 == getsockname(client->fd, &client->dst->addr.common, &(client->dst->len))) {
+        network_address_reset(client->dst);
+    } else if (network_address_refresh_name(client->dst)) {
+        network_address_reset(client->dst);
+    }
+
+    return client;
+}
+
 /**
  * accept a connection
  *
@@ -199,43 +253,48 @@ network_socket_accept(network_socket *srv, int *reason)
 {
     network_socket *client;
 
+    int fd;
+    struct sockaddr_storage addr;
+    socklen_t addr_len = sizeof(addr);
+
     g_return_val_if_fail(srv, NULL);
     /* accept() only works on stream sockets */
     g_return_val_if_fail(srv->socket_type == SOCK_STREAM, NULL);
 
-    client = network_socket_new();
+    /* the socket is only built for a real client, accept loops end with EAGAIN */
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 28)
-    g_debug("%s: call accept4", G_STRLOC);
-    if (-1 == (client->fd = accept4(srv->fd, &client->src->addr.common, &(client->src->len), SOCK_NONBLOCK))) {
-        *reason = errno;
-        network_socket_free(client);
-        return NULL;
-    }
+    fd = accept4(srv->fd, (struct sockaddr *)&addr, &addr_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
 #else
-    if (-1 == (client->fd = accept(srv->fd, &client->src->addr.common, &(client->src->len)))) {
+    fd = accept(srv->fd, (struct sockaddr *)&addr, &addr_len);
+#endif
+    if (-1 == fd) {
         *reason = errno;
-        network_socket_free(client);
         return NULL;
     }
+
+    client = network_socket_new();
+    client->fd = fd;
+    client->src->len = MIN(addr_len, sizeof(client->src->addr));
+    memcpy(&client->src->addr, &addr, client->src->len);
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 28)
     network_socket_set_non_blocking(client);
 #endif
 
-    if (network_address_refresh_name(client->src)) {
+    return network_socket_accept_finish(client);
+}
+
+network_socket *
+network_socket_accepted(int fd)
+{
+    network_socket *client = network_socket_new();
+    client->fd = fd;
+    client->src->len = sizeof(client->src->addr);
+    if (-1 == getpeername(fd, &client->src->addr.common, &(client->src->len))) {
         network_socket_free(client);
         return NULL;
     }
 
-    /* 
-     * the listening side may be INADDR_ANY, 
-     * let's get which address the client really connected to
-     */
-    if (-1 == getsockname(client->fd, &client->dst->addr.common, &(client->dst->len))) {
-        network_address_reset(client->dst);
-    } else if (network_address_refresh_name(client->dst)) {
-        network_address_reset(client->dst);
-    }
-
-    return client;
+    return network_socket_accept_finish(client);
 }
 
 static network_socket_retval_t
@@ -377,7 +436,7 @@ network_socket_connect(network_socket *sock)
  * @see network_address_set_address()
  */
 network_socket_retval_t
-network_socket_bind(network_socket *con)
+network_socket_bind(network_socket *con, int backlog)
 {
     /* 
      * HPUX:       int setsockopt(int s, int level, int optname, 
@@ -508,8 +567,9 @@ network_socket_bind(network_socket *con)
             con->dst->addr.ipv6.sin6_port = a.sin6_port;
         }
 
-        if (-1 == listen(con->fd, 128)) {
-            g_critical("%s: listen(%s, 128) failed: %s (%d)", G_STRLOC, con->dst->name->str, g_strerror(errno), errno);
+        if (-1 == listen(con->fd, backlog)) {
+            g_critical("%s: listen(%s, %d) failed: %s (%d)",
+                       G_STRLOC, con->dst->name->str, backlog, g_strerror(errno), errno);
             return NETWORK_SOCKET_ERROR;
         }
     } else {
@@ -584,12 +644,96 @@ network_socket_read(network_socket *sock)
     return NETWORK_SOCKET_SUCCESS;
 }
 
+gboolean
+network_socket_write_pending(network_socket *sock)
+{
+    return sock->compress_job != NULL || sock->uring_send != NULL;
+}
+
+/* wake up the connection waiting for a write done off the event loop */
+static void
+network_socket_write_done(network_socket *sock)
+{
+    if (sock->write_wait) {
+        /* the wait may have no timeout, the event is not pending then */
+        sock->write_wait = 0;
+        chassis_event_del(&(sock->event), &(sock->timer));
+        event_active(&(sock->event), EV_WRITE, 1);
+    }
+}
+
+static void
+network_socket_compress_done(compress_job_t *job, GString *frame, void *user_data)
+{
+    network_socket *sock = user_data;
+
+    sock->compress_job = NULL;
+    if (frame) {
+        sock->last_compressed_packet = frame;
+        sock->compressed_unsend_offset = 0;
+    } else {
+        sock->compress_failed = 1;
+    }
+
+    network_socket_write_done(sock);
+}
+
+/**
+ * hand the whole packets at the head of the send queue to the compress pool
+ *
+ * @return TRUE if a batch was taken
+ */
+static gboolean
+network_socket_compress_offload(network_socket *con, gint chunk_count)
+{
+    GList *chunk;
+    gint n = 0;
+    gsize total = 0;
+
+    if (!con->compress_async || con->send_queue->offset != 0) {
+        return FALSE;
+    }
+
+    /* a batch is one compressed packet, larger ones are split inline */
+    for (chunk = con->send_queue->chunks->head; chunk && n < chunk_count; chunk = chunk->next, n++) {
+        GString *s = chunk->data;
+        if (total + s->len > PACKET_LEN_MAX) {
+            break;
+        }
+        total += s->len;
+    }
+
+    if (n == 0 || !network_compress_pool_accepts(total)) {
+        return FALSE;
+    }
+
+    GPtrArray *chunks = g_ptr_array_sized_new(n);
+    while (n-- > 0) {
+        g_ptr_array_add(chunks, g_queue_pop_head(con->send_queue->chunks));
+    }
+
+    con->do_strict_compress = 1;
+    con->total_output += total;
+    con->compress_job = network_compress_job_submit(network_socket_compress_ctx(con), chunks,
+                                                    con->compressed_packet_id, network_socket_compress_done, con);
+    con->compressed_packet_id++;
+    g_debug("%s: %d bytes to compress pool for sock:%p", G_STRLOC, (int)total, con);
+    return TRUE;
+}
+
 static network_socket_retval_t
 network_socket_compressed_write(network_socket *con, int send_chunks)
 {
     gssize len;
     int os_errno;
 
+    if (con->compress_job) {
+        return NETWORK_SOCKET_WAIT_FOR_EVENT;
+    }
+    if (con->compress_failed) {
+        return NETWORK_SOCKET_ERROR;
+    }
+
     if (con->last_compressed_packet) {
         char *str = con->last_compressed_packet->str + con->compressed_unsend_offset;
         int unsend_len = con->last_compressed_packet->len - con->compressed_unsend_offset;
@@ -643,8 +787,15 @@ network_socket_compressed_write(network_socket *con, int send_chunks)
 
     g_assert_cmpint(chunk_count, >, 0); /* make sure it is never negative */
 
-    z_stream strm;
-    cetus_compress_init(&strm);
+    if (network_socket_compress_offload(con, chunk_count)) {
+        return NETWORK_SOCKET_WAIT_FOR_EVENT;
+    }
+
+    compress_ctx_t *ctx = network_socket_compress_ctx(con);
+    if (cetus_compress_begin(ctx) != Z_OK) {
+        g_warning("%s:compression can't start for socket:%p", G_STRLOC, con);
+        return NETWORK_SOCKET_ERROR;
+    }
 
     GString *compress_packet = g_string_sized_new(16384);
 
@@ -696,24 +847,20 @@ network_socket_compressed_write(network_socket *con, int send_chunks)
                 uncompressed_len -= str_len;
                 str_len = PACKET_LEN_MAX - uncompressed_len;
                 if (str_len == 0) {
-                    cetus_compress(&strm, compress_packet, NULL, 0, 1);
+                    cetus_compress(ctx, compress_packet, NULL, 0, 1);
                     con->send_queue->offset = 0;
                 } else {
                     uncompressed_len = PACKET_LEN_MAX;
-                    cetus_compress(&strm, compress_packet, str, str_len, 1);
+                    cetus_compress(ctx, compress_packet, str, str_len, 1);
                     con->send_queue->offset += str_len;
                 }
                 is_too_large = 1;
             } else {
-                cetus_compress(&strm, compress_packet, str, str_len, end);
+                cetus_compress(ctx, compress_packet, str, str_len, end);
                 con->send_queue->offset = 0;
             }
         }
 
-        if (end || is_too_large) {
-            cetus_compress_end(&strm);
-        }
-
         con->total_output += str_len;
 
         if (is_too_large) {
@@ -805,6 +952,115 @@ network_socket_compressed_write(network_socket *con, int send_chunks)
     return NETWORK_SOCKET_SUCCESS;
 }
 
+/**
+ * drop the chunks written out from the send queue
+ *
+ * @param len bytes written from the head of the queue
+ */
+static network_socket_retval_t
+network_socket_sent(network_socket *con, gssize len)
+{
+    GList *chunk;
+
+    con->send_queue->offset += len;
+    con->send_queue->len -= len;
+
+    /* check all the chunks which we have sent out */
+    for (chunk = con->send_queue->chunks->head; chunk;) {
+        GString *s = chunk->data;
+
+        if (s->len == 0) {
+            g_warning("%s: s->len is zero", G_STRLOC);
+        }
+
+        if (con->send_queue->offset >= s->len) {
+            con->send_queue->offset -= s->len;
+#if NETWORK_DEBUG_TRACE_IO
+            g_debug("%s:output for sock:%p", G_STRLOC, con);
+            /* to trace the data we sent to the socket, enable this */
+            g_debug_hexdump(G_STRLOC, S(s));
+#endif
+            if (!con->do_query_cache) {
+                g_string_free(s, TRUE);
+            } else {
+                size_t len = con->cache_queue->len + s->len;
+                if (len > MAX_QUERY_CACHE_SIZE) {
+                    if (!con->query_cache_too_long) {
+                        g_message("%s:too long for cache queue:%p, len:%d", G_STRLOC, con, (int)len);
+                        con->query_cache_too_long = 1;
+                    }
+                    g_string_free(s, TRUE);
+                } else {
+                    g_debug("%s:append packet to cache queue:%p, len:%d, total:%d",
+                            G_STRLOC, con, (int)s->len, (int)len);
+                    network_queue_append(con->cache_queue, s);
+                }
+            }
+
+            g_queue_delete_link(con->send_queue->chunks, chunk);
+
+            chunk = con->send_queue->chunks->head;
+        } else {
+            g_debug("%s:wait for event", G_STRLOC);
+            return NETWORK_SOCKET_WAIT_FOR_EVENT;
+        }
+    }
+
+    return NETWORK_SOCKET_SUCCESS;
+}
+
+static void
+network_socket_uring_sent(uring_send_t *send, GPtrArray *chunks, gssize res, void *user_data)
+{
+    network_socket *sock = user_data;
+
+    sock->uring_send = NULL;
+
+    /* the chunks never left the queue, the unsent part goes with the next write */
+    network_queue_unpin(sock->send_queue);
+    g_ptr_array_free(chunks, TRUE);
+
+    if (res <= 0) {
+        if (res < 0 && res != -EPIPE && res != -E_NET_CONNRESET) {
+            g_message("%s: io_uring writev(%s, ...) failed: %s", G_STRLOC, sock->dst->name->str,
+                      g_strerror(-res));
+        }
+        sock->uring_failed = 1;
+    } else {
+        network_socket_sent(sock, res);
+    }
+
+    network_socket_write_done(sock);
+}
+
+/**
+ * hand the chunks at the head of the send queue to io_uring,
+ * they are submitted with the other writes of this loop iteration
+ *
+ * @return TRUE if the chunks were taken
+ */
+static gboolean
+network_socket_uring_offload(network_socket *con, gint chunk_count)
+{
+    GPtrArray *chunks = g_ptr_array_sized_new(chunk_count);
+    GList *chunk;
+
+    for (chunk = con->send_queue->chunks->head; chunk && (gint)chunks->len < chunk_count; chunk = chunk->next) {
+        g_ptr_array_add(chunks, chunk->data);
+    }
+
+    con->uring_send = network_uring_send_submit(con->fd, con->uring_slot, chunks, con->send_queue->offset,
+                                                network_socket_uring_sent, con);
+    if (!con->uring_send) {
+        g_ptr_array_free(chunks, TRUE);
+        return FALSE;
+    }
+
+    /* they stay queued and counted until written */
+    network_queue_pin(con->send_queue, chunks->len);
+    return TRUE;
+}
+
 /**
  * write data to the socket
  *
@@ -821,6 +1077,13 @@ network_socket_write_writev(network_socket *con, int send_chunks)
     int os_errno;
     gint max_chunk_count;
 
+    if (con->uring_send) {
+        return NETWORK_SOCKET_WAIT_FOR_EVENT;
+    }
+    if (con->uring_failed) {
+        return NETWORK_SOCKET_ERROR;
+    }
+
     if (send_chunks == 0)
         return NETWORK_SOCKET_SUCCESS;
 
@@ -835,6 +1098,10 @@ network_socket_write_writev(network_socket *con, int send_chunks)
 
     g_assert_cmpint(chunk_count, >, 0); /* make sure it is never negative */
 
+    if (con->uring_async && network_socket_uring_offload(con, chunk_count)) {
+        return NETWORK_SOCKET_WAIT_FOR_EVENT;
+    }
+
     iov = g_new0(struct iovec, chunk_count);
 
     for (chunk = con->send_queue->chunks->head, chunk_id = 0;
@@ -859,7 +1126,15 @@ network_socket_write_writev(network_socket *con, int send_chunks)
     g_debug("%s: network socket:%p, send (src:%s, dst:%s) fd:%d",
             G_STRLOC, con, con->src->name->str, con->dst->name->str, con->fd);
 
-    len = writev(con->fd, iov, chunk_count);
+    if (con->more_data) {
+        /* let the kernel fill whole segments, the next write without it pushes */
+        struct msghdr msg = { 0 };
+        msg.msg_iov = iov;
+        msg.msg_iovlen = chunk_count;
+        len = sendmsg(con->fd, &msg, MSG_MORE | MSG_NOSIGNAL);
+    } else {
+        len = writev(con->fd, iov, chunk_count);
+    }
     g_debug("%s: tcp write:%d, chunk count:%d", G_STRLOC, (int)len, (int)chunk_count);
     os_errno = errno;
 
@@ -883,51 +1158,7 @@ network_socket_write_writev(network_socket *con, int send_chunks)
         return NETWORK_SOCKET_ERROR;
     }
 
-    con->send_queue->offset += len;
-    con->send_queue->len -= len;
-
-    /* check all the chunks which we have sent out */
-    for (chunk = con->send_queue->chunks->head; chunk;) {
-        GString *s = chunk->data;
-
-        if (s->len == 0) {
-            g_warning("%s: s->len is zero", G_STRLOC);
-        }
-
-        if (con->send_queue->offset >= s->len) {
-            con->send_queue->offset -= s->len;
-#if NETWORK_DEBUG_TRACE_IO
-            g_debug("%s:output for sock:%p", G_STRLOC, con);
-            /* to trace the data we sent to the socket, enable this */
-            g_debug_hexdump(G_STRLOC, S(s));
-#endif
-            if (!con->do_query_cache) {
-                g_string_free(s, TRUE);
-            } else {
-                size_t len = con->cache_queue->len + s->len;
-                if (len > MAX_QUERY_CACHE_SIZE) {
-                    if (!con->query_cache_too_long) {
-                        g_message("%s:too long for cache queue:%p, len:%d", G_STRLOC, con, (int)len);
-                        con->query_cache_too_long = 1;
-                    }
-                    g_string_free(s, TRUE);
-                } else {
-                    g_debug("%s:append packet to cache queue:%p, len:%d, total:%d",
-                            G_STRLOC, con, (int)s->len, (int)len);
-                    network_queue_append(con->cache_queue, s);
-                }
-            }
-
-            g_queue_delete_link(con->send_queue->chunks, chunk);
-
-            chunk = con->send_queue->chunks->head;
-        } else {
-            g_debug("%s:wait for event", G_STRLOC);
-            return NETWORK_SOCKET_WAIT_FOR_EVENT;
-        }
-    }
-
-    return NETWORK_SOCKET_SUCCESS;
+    return network_socket_sent(con, len);
 }
 
 /**
@@ -51,6 +51,7 @@
 #include <event.h>
 
 #include "network-address.h"
+#include "chassis-event.h"
 
 typedef enum {
     NETWORK_SOCKET_SUCCESS,
@@ -101,6 +102,7 @@ typedef struct {
     int fd;             /**< socket-fd */
     guint32 create_or_update_time;
     struct event event; /**< events for this fd */
+    chassis_timer_t timer; /**< timeout of event */
 
     network_address *src; /**< getsockname() */
     network_address *dst; /**< getpeername() */
@@ -121,10 +123,15 @@ typedef struct {
     network_queue *cache_queue;
     GString *last_compressed_packet;
     int compressed_unsend_offset;
+    struct compress_ctx_t *compress_ctx;    /* see network_socket_compress_ctx() */
+    struct compress_job_t *compress_job;    /* batch being compressed by the pool */
+    struct uring_send_t *uring_send;        /* chunks being written by io_uring */
+    int uring_slot;                         /* registered file of fd, -1 if none */
 
     off_t to_read;
     off_t resp_len;
     int total_output;
+    guint32 breaker_epoch;      /* of the backend when the last query was sent */
 
     /**
      * data extracted from the handshake  
@@ -151,10 +158,20 @@ typedef struct {
     unsigned int query_cache_too_long:1;
     unsigned int max_header_size_reached:1;
     unsigned int do_compress:1;
+    unsigned int do_zstd:1;             /* zstd instead of zlib when do_compress */
     unsigned int do_strict_compress:1;
+    unsigned int compress_async:1;      /* large batches may go to the compress pool */
+    unsigned int write_wait:1;          /* write event waits for network_socket_write_pending() */
+    unsigned int compress_failed:1;
+    unsigned int uring_async:1;         /* writes go through io_uring */
+    unsigned int uring_failed:1;
+    unsigned int more_data:1;           /* more output follows, send with MSG_MORE */
     unsigned int do_query_cache:1;
+    unsigned int is_session_tracked:1;  /* CLIENT_SESSION_TRACK agreed with the server */
+    unsigned int is_gtid_tracked:1;     /* session_track_gtids is set on the server */
 
     guint8 charset_code;
+    int zstd_level;
 
     /**
      * store the default-db of the socket
@@ -185,8 +202,17 @@ NETWORK_API network_socket_retval_t network_socket_to_read(network_socket *sock)
 NETWORK_API network_socket_retval_t network_socket_set_non_blocking(network_socket *sock);
 NETWORK_API network_socket_retval_t network_socket_connect(network_socket *con);
 NETWORK_API network_socket_retval_t network_socket_connect_finish(network_socket *sock);
-NETWORK_API network_socket_retval_t network_socket_bind(network_socket *con);
+/* @param backlog for listen(), capped by net.core.somaxconn */
+NETWORK_API network_socket_retval_t network_socket_bind(network_socket *con, int backlog);
 NETWORK_API network_socket *network_socket_accept(network_socket *srv, int *reason);
+/* for a client accepted elsewhere, e.g. by io_uring */
+NETWORK_API network_socket *network_socket_accepted(int fd);
 NETWORK_API network_socket_retval_t network_socket_set_send_buffer_size(network_socket *sock, int size);
 
+/* compression state of a socket with do_compress set, created on first use */
+NETWORK_API struct compress_ctx_t *network_socket_compress_ctx(network_socket *sock);
+
+/* a write is done off the event loop, the fd is not to be polled for it */
+NETWORK_API gboolean network_socket_write_pending(network_socket *sock);
+
 #endif
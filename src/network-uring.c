@@ -0,0 +1,452 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+
+#include "network-uring.h"
+
+#ifdef HAVE_LIBURING
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <event.h>
+#include <liburing.h>
+
+#define URING_ENTRIES 4096
+/* sockets beyond it are passed by fd */
+#define URING_FILES 16384
+/* like MAX_ACCEPTS_PER_EVENT, the rest waits for the next loop iteration */
+#define URING_ACCEPTS_PER_LOOP 64
+
+typedef enum {
+    URING_OP_SEND,
+    URING_OP_ACCEPT,
+} uring_op_type_t;
+
+struct uring_send_t {
+    uring_op_type_t type;
+    GPtrArray *chunks;
+    struct iovec *iov;
+    uring_send_done_fn done;
+    void *user_data;
+    gboolean cancelled;
+};
+
+typedef struct {
+    uring_op_type_t type;
+    int fd;
+    uring_accept_fn cb;
+    void *user_data;
+    gboolean cancelled;
+} uring_accept_t;
+
+typedef struct {
+    struct io_uring ring;
+    int efd;
+    struct event cqe_event;
+    struct event flush_event;
+    gboolean flush_scheduled;
+    gboolean no_accept;         /* multishot accept not supported by the kernel */
+    GArray *free_slots;         /* of the registered file table, empty if not registered */
+    GHashTable *accepts;        /* <fd, uring_accept_t *> */
+} uring_t;
+
+static uring_t *uring = NULL;
+
+static void
+uring_send_free(uring_send_t *op)
+{
+    /* only a cancelled op owns the strings */
+    if (op->chunks) {
+        int i;
+        for (i = 0; i < op->chunks->len; i++) {
+            g_string_free(g_ptr_array_index(op->chunks, i), TRUE);
+        }
+        g_ptr_array_free(op->chunks, TRUE);
+    }
+    g_free(op->iov);
+    g_free(op);
+}
+
+/* the SQEs prepared so far go out once the ready callbacks have run */
+static void
+uring_flush_handler(int G_GNUC_UNUSED fd, short G_GNUC_UNUSED events, void G_GNUC_UNUSED *arg)
+{
+    uring->flush_scheduled = FALSE;
+    int ret = io_uring_submit(&uring->ring);
+    if (ret < 0) {
+        g_critical("%s:io_uring_submit failed: %s", G_STRLOC, g_strerror(-ret));
+    }
+}
+
+static struct io_uring_sqe *
+uring_get_sqe(void)
+{
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&uring->ring);
+    if (!sqe) {
+        io_uring_submit(&uring->ring);
+        sqe = io_uring_get_sqe(&uring->ring);
+    }
+    if (sqe && !uring->flush_scheduled) {
+        uring->flush_scheduled = TRUE;
+        event_active(&uring->flush_event, EV_TIMEOUT, 1);
+    }
+    return sqe;
+}
+
+static void
+uring_complete(void *data, int res, unsigned int flags)
+{
+    switch (*(uring_op_type_t *)data) {
+    case URING_OP_SEND:{
+        uring_send_t *op = data;
+        if (!op->cancelled) {
+            GPtrArray *chunks = op->chunks;
+            op->chunks = NULL;
+            op->done(op, chunks, res, op->user_data);
+        }
+        uring_send_free(op);
+        break;
+    }
+    case URING_OP_ACCEPT:{
+        uring_accept_t *op = data;
+        gboolean more = (flags & IORING_CQE_F_MORE) != 0;
+        if (!more) {
+            if (res == -EINVAL) {
+                g_message("%s:multishot accept not supported, use accept()", G_STRLOC);
+                uring->no_accept = TRUE;
+            }
+            if (g_hash_table_lookup(uring->accepts, GINT_TO_POINTER(op->fd)) == op) {
+                g_hash_table_steal(uring->accepts, GINT_TO_POINTER(op->fd));
+            }
+        }
+        if (!op->cancelled || (res >= 0 && more)) {
+            op->cb(res, more, op->user_data);
+        } else if (res >= 0) {
+            close(res);
+        }
+        if (!more) {
+            g_free(op);
+        }
+        break;
+    }
+    }
+}
+
+static void
+uring_cqe_handler(int fd, short G_GNUC_UNUSED events, void G_GNUC_UNUSED *arg)
+{
+    uint64_t n;
+    if (read(fd, &n, sizeof(n)) != sizeof(n) && errno != EAGAIN) {
+        g_critical("%s:read eventfd failed: %s", G_STRLOC, g_strerror(errno));
+    }
+
+    struct io_uring_cqe *cqe;
+    int accepts = 0;
+    while (io_uring_peek_cqe(&uring->ring, &cqe) == 0) {
+        void *data = io_uring_cqe_get_data(cqe);
+        int res = cqe->res;
+        unsigned int flags = cqe->flags;
+        io_uring_cqe_seen(&uring->ring, cqe);
+        if (!data) {            /* a cancel request */
+            continue;
+        }
+        if (*(uring_op_type_t *)data == URING_OP_ACCEPT && res >= 0) {
+            accepts++;
+        }
+        uring_complete(data, res, flags);
+        if (accepts >= URING_ACCEPTS_PER_LOOP) {
+            /* keep serving established clients, the eventfd counter is read already */
+            event_active(&uring->cqe_event, EV_READ, 1);
+            break;
+        }
+    }
+}
+
+int
+network_uring_start(chassis *chas)
+{
+    if (uring || !chas->enable_io_uring) {
+        return 0;
+    }
+
+    struct io_uring ring;
+    int ret = io_uring_queue_init(URING_ENTRIES, &ring, 0);
+    if (ret < 0) {
+        g_warning("%s:io_uring_queue_init failed: %s, use libevent only", G_STRLOC, g_strerror(-ret));
+        return 0;
+    }
+
+    int efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (efd == -1 || io_uring_register_eventfd(&ring, efd) < 0) {
+        g_critical("%s:eventfd for io_uring failed: %s", G_STRLOC, g_strerror(errno));
+        if (efd != -1) {
+            close(efd);
+        }
+        io_uring_queue_exit(&ring);
+        return -1;
+    }
+
+    uring = g_new0(uring_t, 1);
+    uring->ring = ring;
+    uring->efd = efd;
+    uring->accepts = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+    uring->free_slots = g_array_new(FALSE, FALSE, sizeof(int));
+
+    ret = io_uring_register_files_sparse(&uring->ring, URING_FILES);
+    if (ret < 0) {
+        g_message("%s:no registered files for io_uring: %s", G_STRLOC, g_strerror(-ret));
+    } else {
+        int slot;
+        for (slot = URING_FILES - 1; slot >= 0; slot--) {
+            g_array_append_val(uring->free_slots, slot);
+        }
+    }
+
+    event_set(&uring->cqe_event, efd, EV_READ | EV_PERSIST, uring_cqe_handler, NULL);
+    event_base_set(chas->event_base, &uring->cqe_event);
+    event_add(&uring->cqe_event, NULL);
+
+    event_set(&uring->flush_event, -1, 0, uring_flush_handler, NULL);
+    event_base_set(chas->event_base, &uring->flush_event);
+
+    g_message("%s:io_uring enabled, %d entries", G_STRLOC, URING_ENTRIES);
+    return 0;
+}
+
+void
+network_uring_stop(void)
+{
+    if (!uring) {
+        return;
+    }
+
+    /* completions still queued belong to sockets gone by now */
+    struct io_uring_cqe *cqe;
+    while (io_uring_peek_cqe(&uring->ring, &cqe) == 0) {
+        void *data = io_uring_cqe_get_data(cqe);
+        io_uring_cqe_seen(&uring->ring, cqe);
+        if (data && *(uring_op_type_t *)data == URING_OP_SEND) {
+            uring_send_free(data);
+        }
+    }
+
+    event_del(&uring->cqe_event);
+    event_del(&uring->flush_event);
+    io_uring_queue_exit(&uring->ring);
+    close(uring->efd);
+    g_hash_table_destroy(uring->accepts);
+    g_array_free(uring->free_slots, TRUE);
+    g_free(uring);
+    uring = NULL;
+}
+
+gboolean
+network_uring_enabled(void)
+{
+    return uring != NULL;
+}
+
+int
+network_uring_register_fd(int fd)
+{
+    if (!uring || uring->free_slots->len == 0) {
+        return -1;
+    }
+
+    int slot = g_array_index(uring->free_slots, int, uring->free_slots->len - 1);
+    if (io_uring_register_files_update(&uring->ring, slot, &fd, 1) < 0) {
+        return -1;
+    }
+    g_array_set_size(uring->free_slots, uring->free_slots->len - 1);
+    return slot;
+}
+
+void
+network_uring_unregister_fd(int slot)
+{
+    int fd = -1;
+    if (uring && slot >= 0 && io_uring_register_files_update(&uring->ring, slot, &fd, 1) >= 0) {
+        g_array_append_val(uring->free_slots, slot);
+    }
+}
+
+uring_send_t *
+network_uring_send_submit(int fd, int slot, GPtrArray *chunks, gsize offset,
+                          uring_send_done_fn done, void *user_data)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe();
+    if (!sqe) {
+        return NULL;
+    }
+
+    uring_send_t *op = g_new0(uring_send_t, 1);
+    op->type = URING_OP_SEND;
+    op->chunks = chunks;
+    op->done = done;
+    op->user_data = user_data;
+
+    /* read by the kernel until completion */
+    op->iov = g_new(struct iovec, chunks->len);
+    int i;
+    for (i = 0; i < chunks->len; i++) {
+        GString *s = g_ptr_array_index(chunks, i);
+        op->iov[i].iov_base = s->str + (i == 0 ? offset : 0);
+        op->iov[i].iov_len = s->len - (i == 0 ? offset : 0);
+    }
+
+    if (slot >= 0) {
+        io_uring_prep_writev(sqe, slot, op->iov, chunks->len, 0);
+        sqe->flags |= IOSQE_FIXED_FILE;
+    } else {
+        io_uring_prep_writev(sqe, fd, op->iov, chunks->len, 0);
+    }
+    io_uring_sqe_set_data(sqe, op);
+    return op;
+}
+
+void
+network_uring_send_cancel(uring_send_t *op)
+{
+    op->cancelled = TRUE;
+    /* resolve the fd before the owner closes it and the number is reused */
+    if (io_uring_sq_ready(&uring->ring) > 0) {
+        io_uring_submit(&uring->ring);
+    }
+}
+
+gboolean
+network_uring_accept(int fd, uring_accept_fn cb, void *user_data)
+{
+    if (!uring || uring->no_accept) {
+        return FALSE;
+    }
+    if (g_hash_table_contains(uring->accepts, GINT_TO_POINTER(fd))) {
+        return TRUE;
+    }
+
+    struct io_uring_sqe *sqe = uring_get_sqe();
+    if (!sqe) {
+        return FALSE;
+    }
+
+    uring_accept_t *op = g_new0(uring_accept_t, 1);
+    op->type = URING_OP_ACCEPT;
+    op->fd = fd;
+    op->cb = cb;
+    op->user_data = user_data;
+
+    io_uring_prep_multishot_accept(sqe, fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    io_uring_sqe_set_data(sqe, op);
+    g_hash_table_insert(uring->accepts, GINT_TO_POINTER(fd), op);
+    return TRUE;
+}
+
+void
+network_uring_accept_cancel(int fd)
+{
+    if (!uring) {
+        return;
+    }
+    uring_accept_t *op = g_hash_table_lookup(uring->accepts, GINT_TO_POINTER(fd));
+    if (!op) {
+        return;
+    }
+
+    /* freed with its last completion, a new accept of @fd may start before */
+    g_hash_table_steal(uring->accepts, GINT_TO_POINTER(fd));
+    op->cancelled = TRUE;
+
+    struct io_uring_sqe *sqe = uring_get_sqe();
+    if (!sqe) {
+        g_critical("%s:no sqe to cancel the accept of fd:%d", G_STRLOC, fd);
+        return;
+    }
+    io_uring_prep_cancel(sqe, op, 0);
+    io_uring_sqe_set_data(sqe, NULL);
+}
+
+#else /* HAVE_LIBURING */
+
+int
+network_uring_start(chassis *chas)
+{
+    if (chas->enable_io_uring) {
+        g_warning("%s:io_uring not built in, use libevent only", G_STRLOC);
+    }
+    return 0;
+}
+
+void
+network_uring_stop(void)
+{
+}
+
+gboolean
+network_uring_enabled(void)
+{
+    return FALSE;
+}
+
+int
+network_uring_register_fd(int G_GNUC_UNUSED fd)
+{
+    return -1;
+}
+
+void
+network_uring_unregister_fd(int G_GNUC_UNUSED slot)
+{
+}
+
+uring_send_t *
+network_uring_send_submit(int G_GNUC_UNUSED fd, int G_GNUC_UNUSED slot, GPtrArray G_GNUC_UNUSED *chunks,
+                          gsize G_GNUC_UNUSED offset, uring_send_done_fn G_GNUC_UNUSED done,
+                          void G_GNUC_UNUSED *user_data)
+{
+    return NULL;
+}
+
+void
+network_uring_send_cancel(uring_send_t G_GNUC_UNUSED *op)
+{
+}
+
+gboolean
+network_uring_accept(int G_GNUC_UNUSED fd, uring_accept_fn G_GNUC_UNUSED cb, void G_GNUC_UNUSED *user_data)
+{
+    return FALSE;
+}
+
+void
+network_uring_accept_cancel(int G_GNUC_UNUSED fd)
+{
+}
+
+#endif /* HAVE_LIBURING */
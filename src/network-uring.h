@@ -0,0 +1,75 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#ifndef _NETWORK_URING_H_
+#define _NETWORK_URING_H_
+
+#include <glib.h>
+
+#include "chassis-mainloop.h"
+#include "network-exports.h"
+
+/**
+ * Optional io_uring submission of client writes and accepts.
+ *
+ * Readiness and reads stay with libevent. Writes queued during one loop
+ * iteration are submitted with a single io_uring_enter(), their completions
+ * come back to the event loop through an eventfd.
+ */
+typedef struct uring_send_t uring_send_t;
+
+/**
+ * @param chunks the array given to network_uring_send_submit(), the GStrings stay with the caller
+ * @param res    bytes written or -errno
+ */
+typedef void (*uring_send_done_fn) (uring_send_t *, GPtrArray *chunks, gssize res, void *user_data);
+
+/**
+ * @param fd   the accepted client or -errno
+ * @param more FALSE if the multishot accept ended
+ */
+typedef void (*uring_accept_fn) (int fd, gboolean more, void *user_data);
+
+NETWORK_API int network_uring_start(chassis *);
+NETWORK_API void network_uring_stop(void);
+NETWORK_API gboolean network_uring_enabled(void);
+
+/* @return slot in the registered file table, -1 if full */
+NETWORK_API int network_uring_register_fd(int fd);
+NETWORK_API void network_uring_unregister_fd(int slot);
+
+/**
+ * @param slot   registered file of @fd or -1
+ * @param offset already sent bytes of the first chunk
+ * @return NULL if the submission queue is full
+ */
+NETWORK_API uring_send_t *network_uring_send_submit(int fd, int slot, GPtrArray *chunks, gsize offset,
+                                                    uring_send_done_fn done, void *user_data);
+
+/* the owner is gone, the chunks are handed over and freed on completion */
+NETWORK_API void network_uring_send_cancel(uring_send_t *);
+
+/* @return TRUE if @fd is accepted by a multishot accept from now on */
+NETWORK_API gboolean network_uring_accept(int fd, uring_accept_fn cb, void *user_data);
+
+/* stop the multishot accept of @fd, @cb sees the clients accepted meanwhile but not the end */
+NETWORK_API void network_uring_accept_cancel(int fd);
+
+#endif
@@ -65,6 +65,7 @@ typedef int socklen_t;
 #include "cetus-users.h"
 #include "chassis-options.h"
 #include "plugin-common.h"
+#include "network-compress.h"
 
 #define MAX_CACHED_ITEMS 65536
 
@@ -110,9 +111,18 @@ do_read_auth(network_mysqld_con *con, GHashTable *allow_ip_table, GHashTable *de
                                         C("\xff\xd7\x07" "4.0 protocol is not supported"));
             network_mysqld_auth_response_free(auth);
             return NETWORK_SOCKET_ERROR;
-        } else if (auth->client_capabilities & CLIENT_COMPRESS) {
+        } else if (auth->client_capabilities & (CLIENT_COMPRESS | CLIENT_ZSTD_COMPRESSION_ALGORITHM)) {
             con->is_client_compressed = 1;
-            g_message("%s: client compressed for con:%p", G_STRLOC, con);
+            /* zstd is only offered when configured, and is preferred by the client */
+            if (auth->client_capabilities & CLIENT_ZSTD_COMPRESSION_ALGORITHM) {
+                int level = con->srv->zstd_client_level;
+                if (auth->zstd_level > 0 && auth->zstd_level < level) {
+                    level = auth->zstd_level;
+                }
+                con->client->do_zstd = 1;
+                con->client->zstd_level = level;
+            }
+            g_message("%s: client compressed(%s) for con:%p", G_STRLOC, con->client->do_zstd ? "zstd" : "zlib", con);
         } else if (auth->client_capabilities & CLIENT_MULTI_STATEMENTS) {
             con->client->is_multi_stmt_set = 1;
         }
@@ -185,6 +195,10 @@ do_read_auth(network_mysqld_con *con, GHashTable *allow_ip_table, GHashTable *de
     network_mysqld_auth_response *response = con->client->response;
     if (cetus_users_authenticate_client(users, challenge, response)) {
         con->state = ST_SEND_AUTH_RESULT;
+        if (cetus_users_is_fast_auth(response)) {
+            /* AuthMoreData: fast_auth_success, then the OK */
+            network_mysqld_queue_append(recv_sock, recv_sock->send_queue, C("\x01\x03"));
+        }
         network_mysqld_con_send_ok(recv_sock);
     } else {
         char msg[256] = { 0 };
@@ -353,6 +367,15 @@ do_connect_cetus(network_mysqld_con *con, network_backend_t **backend, int *back
         return NETWORK_SOCKET_SUCCESS;
     }
 
+    g_assert(con->client->challenge == NULL);
+
+    /* zstd on the client side does not depend on what the backend offers */
+    challenge = network_mysqld_auth_challenge_copy(challenge);
+    challenge->capabilities &= ~CLIENT_ZSTD_COMPRESSION_ALGORITHM;
+    if (con->srv->compress_support && con->srv->zstd_client_level > 0) {
+        challenge->capabilities |= CLIENT_ZSTD_COMPRESSION_ALGORITHM;
+    }
+
     GString *auth_packet = g_string_new(NULL);
     network_mysqld_proto_append_auth_challenge(auth_packet, challenge);
 
@@ -360,9 +383,7 @@ do_connect_cetus(network_mysqld_con *con, network_backend_t **backend, int *back
 
     g_string_free(auth_packet, TRUE);
 
-    g_assert(con->client->challenge == NULL);
-
-    con->client->challenge = network_mysqld_auth_challenge_copy(challenge);
+    con->client->challenge = challenge;
 
     con->state = ST_SEND_HANDSHAKE;
 
@@ -533,13 +554,13 @@ proxy_put_shard_conn_to_pool(network_mysqld_con *con)
 
             is_reduced = 0;
             if (con->srv->is_reduce_conns && is_put_to_pool_allowed) {
-                if (network_conn_pool_do_reduce_conns_verdict(pool, ss->backend->connected_clients)) {
+                if (network_conn_pool_do_reduce_conns_verdict(pool, network_backend_borrowed_count(ss->backend))) {
                     is_reduced = 1;
                     is_put_to_pool_allowed = 0;
                 }
             }
 
-            CHECK_PENDING_EVENT(&(server->event));
+            CHECK_PENDING_EVENT(&(server->event), &(server->timer));
 
             if (is_put_to_pool_allowed) {
                 g_debug("%s: is_put_to_pool_allowed true here, server:%p, con:%p, num:%d",
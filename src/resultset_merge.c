@@ -39,6 +39,7 @@
 #include "server-session.h"
 #include "chassis-event.h"
 #include "sharding-query-plan.h"
+#include "character-set.h"
 
 const char EPOCH[] = "1970-01-01 00:00:00";
 const char *type_name[] = {
@@ -73,6 +74,8 @@ const char *type_name[] = {
 
 #define MAX_PACK_LEN 2048
 #define MAX_COL_VALUE_LEN 512
+#define DECIMAL_MAX_SCALE 30
+#define AVG_SCALE_INCREMENT 4   /* div_precision_increment of MySQL */
 
 #define PRIOR_TO 1
 #define NOR_REL 0
@@ -1023,6 +1026,7 @@ merge_aggr_value(int fun_type, int type, char *merged_value,
     }
 
     switch (fun_type) {
+    case FT_AVG:               /* shards return SUM() for AVG(), @see SF_REWRITE_AVG */
     case FT_SUM:
         if (!str_add(type, merged_value, str1, len1, str2, len2, merge_failed)) {
             return 0;
@@ -1151,6 +1155,241 @@ modify_record(GList *cand1, group_aggr_t * aggr,
     return 1;
 }
 
+/**
+ * exact decimal division of a decimal string by a positive integer,
+ * rounded half up to 'scale' fractional digits like MySQL AVG() does
+ */
+static gboolean
+str_decimal_div(char *quotient, int size, const char *dividend, guint64 divisor, int scale)
+{
+    char digits[MAX_COL_VALUE_LEN + DECIMAL_MAX_SCALE + 2];
+    int ndigits = 0, frac = 0, seen_point = 0, negative = 0;
+    const char *p = dividend;
+
+    if (divisor == 0 || divisor > G_MAXUINT64 / 10) {
+        return FALSE;
+    }
+    if (*p == '-' || *p == '+') {
+        negative = (*p == '-');
+        p++;
+    }
+    for (; *p; p++) {
+        if (*p == '.' && !seen_point) {
+            seen_point = 1;
+            continue;
+        }
+        if (*p < '0' || *p > '9' || ndigits >= MAX_COL_VALUE_LEN) {
+            return FALSE;       /* exponent notation etc. */
+        }
+        digits[ndigits++] = *p;
+        frac += seen_point;
+    }
+    /* one more fractional digit for rounding */
+    if (frac > scale + 1) {
+        ndigits -= frac - (scale + 1);
+        frac = scale + 1;
+    }
+    while (frac < scale + 1) {
+        digits[ndigits++] = '0';
+        frac++;
+    }
+
+    char q[sizeof(digits) + 1];
+    guint64 rem = 0;
+    int i;
+    for (i = 0; i < ndigits; i++) {
+        rem = rem * 10 + (digits[i] - '0');
+        q[i + 1] = '0' + rem / divisor;
+        rem %= divisor;
+    }
+    q[0] = '0';                 /* room for carry */
+    int nq = ndigits;           /* q[1..nq-1] kept, q[nq] is the rounding digit */
+    int carry = q[nq] >= '5';
+    for (i = nq - 1; carry && i >= 0; i--) {
+        if (q[i] == '9') {
+            q[i] = '0';
+        } else {
+            q[i]++;
+            carry = 0;
+        }
+    }
+
+    int int_end = nq - scale;   /* q[0..int_end) is the integer part */
+    int start = 0;
+    while (start < int_end - 1 && q[start] == '0') {
+        start++;
+    }
+    int nonzero = 0;
+    for (i = start; i < nq; i++) {
+        nonzero |= (q[i] != '0');
+    }
+    if (int_end - start + scale + 3 > size) {
+        return FALSE;
+    }
+
+    char *out = quotient;
+    if (negative && nonzero) {
+        *out++ = '-';
+    }
+    memcpy(out, q + start, int_end - start);
+    out += int_end - start;
+    if (scale > 0) {
+        *out++ = '.';
+        memcpy(out, q + int_end, scale);
+        out += scale;
+    }
+    *out = '\0';
+    return TRUE;
+}
+
+static gboolean
+avg_merge_compute(avg_column_t *col, const char *sum, const char *count, char *avg, int size)
+{
+    guint64 n = g_ascii_strtoull(count, NULL, 10);
+    if (n == 0) {
+        return FALSE;
+    }
+    switch (col->type) {
+    case FIELD_TYPE_NEWDECIMAL:
+    case FIELD_TYPE_DECIMAL:
+        return str_decimal_div(avg, size, sum, n, col->scale);
+    default:
+        g_ascii_formatd(avg, size, "%.15g", g_ascii_strtod(sum, NULL) / n);
+        return TRUE;
+    }
+}
+
+/**
+ * replace the SUM() of AVG columns with SUM()/COUNT() and cut off the hidden COUNT() columns
+ * @return the new row packet, or NULL on malformed row
+ */
+static GString *
+avg_merge_finalize_record(GString *pkt, avg_merge_t *avg)
+{
+    int field_count = avg->visible_field_count + avg->num;
+    guint *offsets = g_new0(guint, field_count + 1);
+    network_packet packet = { pkt, NET_HEADER_SIZE };
+    int i, j;
+
+    for (i = 0; i < field_count; i++) {
+        offsets[i] = packet.offset;
+        if (skip_field(&packet, 1) != 0) {
+            g_free(offsets);
+            return NULL;
+        }
+    }
+    offsets[field_count] = packet.offset;
+
+    GString *row = g_string_sized_new(pkt->len);
+    g_string_append_len(row, pkt->str, NET_HEADER_SIZE);
+    for (i = 0; i < avg->visible_field_count; i++) {
+        avg_column_t *col = NULL;
+        for (j = 0; j < avg->num; j++) {
+            if (avg->columns[j].sum_pos == i) {
+                col = &(avg->columns[j]);
+                break;
+            }
+        }
+        if (col == NULL) {
+            g_string_append_len(row, pkt->str + offsets[i], offsets[i + 1] - offsets[i]);
+            continue;
+        }
+
+        char sum[MAX_COL_VALUE_LEN] = { 0 };
+        char count[MAX_COL_VALUE_LEN] = { 0 };
+        char value[MAX_COL_VALUE_LEN] = { 0 };
+        gboolean is_null = (guchar)pkt->str[offsets[col->sum_pos]] == MYSQLD_PACKET_NULL;
+        if (!is_null) {
+            packet.offset = offsets[col->sum_pos];
+            network_mysqld_proto_get_column(&packet, sum, MAX_COL_VALUE_LEN);
+            packet.offset = offsets[col->count_pos];
+            network_mysqld_proto_get_column(&packet, count, MAX_COL_VALUE_LEN);
+            is_null = !avg_merge_compute(col, sum, count, value, MAX_COL_VALUE_LEN);
+        }
+        if (is_null) {
+            g_string_append_c(row, (char)MYSQLD_PACKET_NULL);
+        } else {
+            network_mysqld_proto_append_lenenc_str(row, value);
+        }
+    }
+    network_mysqld_proto_set_packet_len(row, row->len - NET_HEADER_SIZE);
+    g_free(offsets);
+    return row;
+}
+
+/* fields count, field defs & EOF seen by client don't contain the hidden COUNT() columns */
+static void
+avg_merge_strip_header(GQueue *chunks, avg_merge_t *avg)
+{
+    int i;
+    GString *packet = g_queue_peek_head(chunks);
+    g_string_truncate(packet, NET_HEADER_SIZE);
+    network_mysqld_proto_append_lenenc_int(packet, avg->visible_field_count);
+    network_mysqld_proto_set_packet_len(packet, packet->len - NET_HEADER_SIZE);
+
+    for (i = 0; i < avg->num; i++) {
+        GString *hidden = g_queue_pop_nth(chunks, avg->visible_field_count + 1);
+        g_string_free(hidden, TRUE);
+    }
+
+    /* result of AVG(DECIMAL) has 4 more fractional digits than its SUM */
+    for (i = 0; i < avg->num; i++) {
+        avg_column_t *col = &(avg->columns[i]);
+        if (col->type == FIELD_TYPE_NEWDECIMAL || col->type == FIELD_TYPE_DECIMAL) {
+            GString *fdef = g_queue_peek_nth(chunks, col->sum_pos + 1);
+            /* ... type(1) flags(2) decimals(1) filler(2) */
+            fdef->str[fdef->len - 3] = (char)col->scale;
+        }
+    }
+
+    GString *eof = g_queue_peek_nth(chunks, avg->visible_field_count + 1);
+    network_mysqld_proto_set_packet_id(eof, avg->visible_field_count + 2);
+}
+
+/**
+ * locate AVG columns and their hidden COUNT() columns, @see sql_rewrite_avg_columns()
+ * the hidden COUNT() columns are merged as ordinary aggregates
+ */
+static gboolean
+avg_merge_prepare(sql_select_t *select, cetus_result_t *res_merge,
+                  group_aggr_t *aggr_array, int *aggr_num, avg_merge_t *avg)
+{
+    int i;
+    for (i = 0; i < select->columns->len; ++i) {
+        sql_expr_t *expr = g_ptr_array_index(select->columns, i);
+        if (expr->op == TK_FUNCTION && sql_func_type(expr->token_text) == FT_AVG) {
+            if (avg->num >= MAX_AGGR_FUNS) {
+                return FALSE;
+            }
+            avg->columns[avg->num].sum_pos = i;
+            avg->num++;
+        }
+    }
+    avg->visible_field_count = res_merge->field_count - avg->num;
+    if (avg->num == 0 || avg->visible_field_count <= 0 || *aggr_num + avg->num > MAX_AGGR_FUNS) {
+        return FALSE;
+    }
+
+    for (i = 0; i < avg->num; ++i) {
+        avg_column_t *col = &(avg->columns[i]);
+        col->count_pos = avg->visible_field_count + i;
+        if (col->sum_pos >= avg->visible_field_count) {
+            return FALSE;
+        }
+        network_mysqld_proto_fielddef_t *fdef = g_ptr_array_index(res_merge->fielddefs, col->sum_pos);
+        col->type = fdef->type;
+        col->scale = MIN(fdef->decimals + AVG_SCALE_INCREMENT, DECIMAL_MAX_SCALE);
+
+        fdef = g_ptr_array_index(res_merge->fielddefs, col->count_pos);
+        group_aggr_t *count = &(aggr_array[*aggr_num]);
+        count->pos = col->count_pos;
+        count->fun_type = FT_COUNT;
+        count->type = fdef->type;
+        (*aggr_num)++;
+    }
+    return TRUE;
+}
+
 static gint
 combine_aggr_record(GList *cand1, GList *cand2, aggr_by_group_para_t *para, int *merge_failed)
 {
@@ -1798,6 +2037,17 @@ aggr_by_group(aggr_by_group_para_t *para, GList **candidates, guint *pkt_count,
             candidate = candidate->next;
             continue;
         } else {
+            if (para->avg) {
+                GString *row = avg_merge_finalize_record(candidate->data, para->avg);
+                if (row == NULL) {
+                    g_warning("%s: malformed row for AVG merge", G_STRLOC);
+                    merged_result->status = RM_FAIL;
+                    return 0;
+                }
+                g_string_free(candidate->data, TRUE);
+                candidate->data = row;
+            }
+
             char aggr_value[MAX_COL_VALUE_LEN] = { 0 };
             retrieve_aggr_value(candidate->data, para->aggr_array, aggr_value);
 
@@ -1925,8 +2175,8 @@ check_server_sess_wait_for_event(network_mysqld_con *con, int ss_index, short ev
             g_debug("%s: ss %d is not read finished, read pending:%d, fd:%d, ss index:%d",
                     G_STRLOC, (int)i, con->num_read_pending, ss->server->fd, ss->index);
             event_set(&(ss->server->event), ss->server->fd, ev_type, server_session_con_handler, ss);
-            chassis_event_add_with_timeout(con->srv, &(ss->server->event), timeout);
-            g_debug("%s: call chassis_event_add_with_timeout", G_STRLOC);
+            chassis_event_add_with_timer(con->srv, &(ss->server->event), &(ss->server->timer), timeout);
+            g_debug("%s: call chassis_event_add_with_timer", G_STRLOC);
             ss->server->is_waiting = 1;
         } else {
             g_debug("%s: ss %d is read finished", G_STRLOC, (int)i);
@@ -2813,6 +3063,720 @@ merge_for_show_warnings(network_queue *send_queue, GPtrArray *recv_queues,
     return 1;
 }
 
+#define HLL_PRECISION 14
+#define HLL_REGISTERS (1 << HLL_PRECISION)
+
+#define DISTINCT_KEYS_MAX_BYTES (64 << 20)
+#define DISTINCT_ENTRY_OVERHEAD 64      /* GString and hash node of a key */
+
+/**
+ * counts distinct keys of SF_COUNT_DISTINCT queries
+ *   exact with a hash set, switches to HyperLogLog (~0.8% standard error)
+ *   once the set outgrows approx_threshold, if approx_threshold > 0;
+ *   the set is kept within DISTINCT_KEYS_MAX_BYTES
+ */
+typedef struct distinct_counter_t {
+    GHashTable *keys;
+    gsize bytes;
+    guint8 *registers;
+    guint approx_threshold;
+} distinct_counter_t;
+
+static guint64
+distinct_key_hash64(const GString *key)
+{
+    guint64 h = G_GUINT64_CONSTANT(14695981039346656037);   /* FNV-1a */
+    gsize i;
+    for (i = 0; i < key->len; i++) {
+        h ^= (guchar)key->str[i];
+        h *= G_GUINT64_CONSTANT(1099511628211);
+    }
+    /* finalizer of splitmix64, spreads the bits for register indexing */
+    h ^= h >> 30;
+    h *= G_GUINT64_CONSTANT(0xbf58476d1ce4e5b9);
+    h ^= h >> 27;
+    h *= G_GUINT64_CONSTANT(0x94d049bb133111eb);
+    h ^= h >> 31;
+    return h;
+}
+
+static void
+hll_add(guint8 *registers, const GString *key)
+{
+    guint64 h = distinct_key_hash64(key);
+    guint index = h >> (64 - HLL_PRECISION);
+    guint64 w = (h << HLL_PRECISION) | (G_GUINT64_CONSTANT(1) << (HLL_PRECISION - 1));
+    guint8 rank = 1;
+    while (!(w & G_GUINT64_CONSTANT(0x8000000000000000))) {
+        rank++;
+        w <<= 1;
+    }
+    if (rank > registers[index]) {
+        registers[index] = rank;
+    }
+}
+
+static guint64
+hll_estimate(const guint8 *registers)
+{
+    double m = HLL_REGISTERS;
+    double sum = 0;
+    int zeros = 0;
+    int i;
+    for (i = 0; i < HLL_REGISTERS; i++) {
+        sum += 1.0 / (double)(G_GUINT64_CONSTANT(1) << registers[i]);
+        zeros += (registers[i] == 0);
+    }
+    double estimate = (0.7213 / (1 + 1.079 / m)) * m * m / sum;
+    if (estimate <= 2.5 * m && zeros > 0) {
+        estimate = m * log(m / zeros); /* linear counting for small range */
+    }
+    return (guint64)(estimate + 0.5);
+}
+
+static void
+distinct_counter_init(distinct_counter_t *counter, guint approx_threshold)
+{
+    counter->keys = g_hash_table_new_full(g_hash_table_string_hash, g_hash_table_string_equal,
+                                          g_hash_table_string_free, NULL);
+    counter->bytes = 0;
+    counter->registers = NULL;
+    counter->approx_threshold = approx_threshold;
+}
+
+static void
+distinct_counter_approx(distinct_counter_t *counter)
+{
+    GHashTableIter iter;
+    GString *k;
+    counter->registers = g_new0(guint8, HLL_REGISTERS);
+    g_hash_table_iter_init(&iter, counter->keys);
+    while (g_hash_table_iter_next(&iter, (gpointer *)&k, NULL)) {
+        hll_add(counter->registers, k);
+    }
+    g_hash_table_remove_all(counter->keys);
+    counter->bytes = 0;
+}
+
+/* FALSE if the exact count doesn't fit DISTINCT_KEYS_MAX_BYTES and can't be approximated */
+static gboolean
+distinct_counter_add(distinct_counter_t *counter, GString *key)
+{
+    if (counter->registers) {
+        hll_add(counter->registers, key);
+        g_string_free(key, TRUE);
+        return TRUE;
+    }
+    guint size = g_hash_table_size(counter->keys);
+    gsize key_bytes = key->allocated_len + DISTINCT_ENTRY_OVERHEAD;
+    g_hash_table_insert(counter->keys, key, GINT_TO_POINTER(1));   /* dup key is freed */
+    if (g_hash_table_size(counter->keys) > size) {
+        counter->bytes += key_bytes;
+    }
+    if (counter->approx_threshold > 0 && g_hash_table_size(counter->keys) > counter->approx_threshold) {
+        distinct_counter_approx(counter);
+        g_message("%s: COUNT(DISTINCT) over %u keys, switch to approximate counting",
+                  G_STRLOC, counter->approx_threshold);
+    } else if (counter->bytes > DISTINCT_KEYS_MAX_BYTES) {
+        if (counter->approx_threshold == 0) {
+            return FALSE;
+        }
+        distinct_counter_approx(counter);
+        g_message("%s: COUNT(DISTINCT) keys over %d bytes, switch to approximate counting",
+                  G_STRLOC, DISTINCT_KEYS_MAX_BYTES);
+    }
+    return TRUE;
+}
+
+static guint64
+distinct_counter_result(distinct_counter_t *counter)
+{
+    if (counter->registers) {
+        return hll_estimate(counter->registers);
+    }
+    return g_hash_table_size(counter->keys);
+}
+
+static void
+distinct_counter_destroy(distinct_counter_t *counter)
+{
+    g_hash_table_destroy(counter->keys);
+    g_free(counter->registers);
+}
+
+/**
+ * distinct key of a row, NULL if any column is NULL (COUNT ignores it)
+ *   the row has nkeys values, then the COLLATION() of each, @see sql_modify_count_distinct;
+ *   values from different shards are folded by that collation to compare them
+ */
+static GString *
+distinct_key_from_row(GString *row, network_mysqld_proto_fielddefs_t *fielddefs, guint nkeys)
+{
+    network_packet packet = { row, NET_HEADER_SIZE };
+    network_packet collations = packet;
+    if (skip_field(&collations, nkeys) == -1) {
+        return NULL;
+    }
+    GString *key = g_string_sized_new(row->len);
+    guint i;
+    for (i = 0; i < nkeys; i++) {
+        guint8 first = 0;
+        if (network_mysqld_proto_peek_int8(&packet, &first) == -1 || first == MYSQLD_PACKET_NULL) {
+            g_string_free(key, TRUE);
+            return NULL;
+        }
+        gchar *value = NULL;
+        guint64 len = 0;
+        gchar *collation = NULL;
+        if (network_mysqld_proto_get_lenenc_str(&packet, &value, &len) == -1
+            || network_mysqld_proto_get_lenenc_str(&collations, &collation, NULL) == -1) {
+            g_free(value);
+            g_string_free(key, TRUE);
+            return NULL;
+        }
+        network_mysqld_proto_fielddef_t *fdef = g_ptr_array_index(fielddefs, i);
+        GString *folded = g_string_sized_new(len);
+        collation_fold(collation, fdef->charsetnr, value ? value : "", len, folded);
+        network_mysqld_proto_append_lenenc_str_len(key, S(folded));
+        g_string_free(folded, TRUE);
+        g_free(collation);
+        g_free(value);
+    }
+    return key;
+}
+
+static void
+append_count_distinct_resultset(network_queue *send_queue, sql_expr_t *column, guint64 count, gboolean with_row)
+{
+    guint8 seq = 1;
+    GString *pkt = g_string_new_len("\x01\x00\x00\x01\x01", 5);
+    network_queue_append(send_queue, pkt);
+
+    pkt = g_string_new_len("\x00\x00\x00\x00", NET_HEADER_SIZE);
+    network_mysqld_proto_append_lenenc_str(pkt, "def");
+    network_mysqld_proto_append_lenenc_str(pkt, "");    /* db */
+    network_mysqld_proto_append_lenenc_str(pkt, "");    /* table */
+    network_mysqld_proto_append_lenenc_str(pkt, "");    /* org_table */
+    if (column->alias) {
+        network_mysqld_proto_append_lenenc_str(pkt, column->alias);
+    } else {
+        network_mysqld_proto_append_lenenc_str_len(pkt, column->start, column->end - column->start);
+    }
+    network_mysqld_proto_append_lenenc_str(pkt, "");    /* org_name */
+    g_string_append_c(pkt, '\x0c');
+    network_mysqld_proto_append_int16(pkt, 63); /* binary charset */
+    network_mysqld_proto_append_int32(pkt, 21);
+    network_mysqld_proto_append_int8(pkt, FIELD_TYPE_LONGLONG);
+    network_mysqld_proto_append_int16(pkt, NOT_NULL_FLAG | BINARY_FLAG);
+    network_mysqld_proto_append_int8(pkt, 0);   /* decimals */
+    network_mysqld_proto_append_int16(pkt, 0);  /* filler */
+    network_mysqld_proto_set_packet_len(pkt, pkt->len - NET_HEADER_SIZE);
+    network_mysqld_proto_set_packet_id(pkt, ++seq);
+    network_queue_append(send_queue, pkt);
+
+    pkt = g_string_new_len("\x05\x00\x00\x07\xfe\x00\x00\x02\x00", 9);
+    network_mysqld_proto_set_packet_id(pkt, ++seq);
+    network_queue_append(send_queue, pkt);
+
+    if (with_row) {
+        char value[32];
+        snprintf(value, sizeof(value), "%" G_GUINT64_FORMAT, count);
+        pkt = g_string_new_len("\x00\x00\x00\x00", NET_HEADER_SIZE);
+        network_mysqld_proto_append_lenenc_str(pkt, value);
+        network_mysqld_proto_set_packet_len(pkt, pkt->len - NET_HEADER_SIZE);
+        network_mysqld_proto_set_packet_id(pkt, ++seq);
+        network_queue_append(send_queue, pkt);
+    }
+
+    pkt = g_string_new_len("\x05\x00\x00\x07\xfe\x00\x00\x02\x00", 9);
+    network_mysqld_proto_set_packet_id(pkt, ++seq);
+    network_queue_append(send_queue, pkt);
+}
+
+/* shards return DISTINCT key streams, @see SF_COUNT_DISTINCT */
+static int
+merge_for_count_distinct(sql_select_t *select, network_queue *send_queue, GPtrArray *recv_queues,
+                         network_mysqld_con *con, cetus_result_t *res_merge, result_merge_t *merged_result)
+{
+    network_queue *first_queue = g_ptr_array_index(recv_queues, 0);
+    if (!cetus_result_parse_fielddefs(res_merge, first_queue->chunks)) {
+        g_warning("%s:parse_fielddefs failed:%s", G_STRLOC, con->orig_sql->str);
+        merged_result->status = RM_FAIL;
+        return 0;
+    }
+
+    guint nkeys = res_merge->field_count / 2;   /* values, then their collations */
+    if (nkeys == 0 || res_merge->field_count % 2) {
+        g_warning("%s:COUNT(DISTINCT) got %d columns:%s", G_STRLOC, res_merge->field_count, con->orig_sql->str);
+        merged_result->status = RM_FAIL;
+        return 0;
+    }
+
+    distinct_counter_t counter;
+    distinct_counter_init(&counter, con->srv->count_distinct_approx_threshold);
+
+    /* field-count-packet + field-defs + eof-packet */
+    guint header_count = res_merge->field_count + 2;
+    int i;
+    for (i = 0; i < recv_queues->len; i++) {
+        network_queue *recv_q = g_ptr_array_index(recv_queues, i);
+        GList *link = g_queue_peek_nth_link(recv_q->chunks, header_count);
+        if (link == NULL) {
+            g_warning("%s:rows start null, enlarge max_header_size, pkt cnt:%d", G_STRLOC, header_count);
+            distinct_counter_destroy(&counter);
+            merged_result->status = RM_FAIL;
+            return 0;
+        }
+        for (; link; link = link->next) {
+            GString *row = link->data;
+            guchar pkt_type = get_pkt_type(row);
+            if (pkt_type == MYSQLD_PACKET_EOF) {
+                break;
+            }
+            if (pkt_type == MYSQLD_PACKET_ERR) {
+                network_queue_append(send_queue, row);
+                g_queue_delete_link(recv_q->chunks, link);
+                distinct_counter_destroy(&counter);
+                merged_result->status = con->num_pending_servers ? RM_FAIL : RM_SUCCESS;
+                return 0;
+            }
+            GString *key = distinct_key_from_row(row, res_merge->fielddefs, nkeys);
+            if (key && !distinct_counter_add(&counter, key)) {
+                g_warning("%s:COUNT(DISTINCT) keys over %d bytes, set count-distinct-approx-threshold:%s",
+                          G_STRLOC, DISTINCT_KEYS_MAX_BYTES, con->orig_sql->str);
+                merged_result->detail = g_string_new("(cetus) COUNT(DISTINCT) has too many keys");
+                distinct_counter_destroy(&counter);
+                merged_result->status = RM_FAIL;
+                return 0;
+            }
+        }
+    }
+
+    gint64 row_count = G_MAXINT32;
+    gint64 offset = 0;
+    sql_expr_get_int(select->limit, &row_count);
+    sql_expr_get_int(select->offset, &offset);
+
+    append_count_distinct_resultset(send_queue, g_ptr_array_index(select->columns, 0),
+                                    distinct_counter_result(&counter), row_count > 0 && offset == 0);
+    distinct_counter_destroy(&counter);
+    return 1;
+}
+
+#define JOIN_SIDES 2
+#define JOIN_HEAD_COLS 4        /* side, join key of table 0, join key of table 1, its collation */
+#define JOIN_COLLATION_COL 3
+#define JOIN_ENTRY_OVERHEAD 64  /* hash node and match list of a distinct key */
+
+typedef struct join_output_t {
+    network_queue *send_queue;
+    const GByteArray *sides;
+    gint64 skip;                /* OFFSET rows not sent yet */
+    gint64 remain;              /* LIMIT rows still to send */
+    guint8 seq;
+} join_output_t;
+
+/* where the columns of a row start, offs[ncols] is where the row ends */
+static gboolean
+row_column_offsets(GString *row, guint ncols, guint *offs)
+{
+    network_packet packet = { row, NET_HEADER_SIZE };
+    guint i;
+    for (i = 0; i < ncols; i++) {
+        offs[i] = packet.offset;
+        if (skip_field(&packet, 1) == -1) {
+            return FALSE;
+        }
+    }
+    offs[ncols] = packet.offset;
+    return TRUE;
+}
+
+/* how join keys are compared, MySQL compares mixed numbers as doubles */
+enum join_key_kind {
+    JOIN_KEY_RAW,               /* temporal and other values, as sent */
+    JOIN_KEY_STRING,            /* folded by the collation both keys have, or binary */
+    JOIN_KEY_EXACT,             /* integers and decimals */
+    JOIN_KEY_APPROX,            /* floating point */
+};
+
+static int
+join_key_field_kind(network_mysqld_proto_fielddef_t *fdef)
+{
+    switch (fdef->type) {
+    case FIELD_TYPE_TINY:
+    case FIELD_TYPE_SHORT:
+    case FIELD_TYPE_LONG:
+    case FIELD_TYPE_LONGLONG:
+    case FIELD_TYPE_INT24:
+    case FIELD_TYPE_YEAR:
+    case FIELD_TYPE_DECIMAL:
+    case FIELD_TYPE_NEWDECIMAL:
+        return JOIN_KEY_EXACT;
+    case FIELD_TYPE_FLOAT:
+    case FIELD_TYPE_DOUBLE:
+        return JOIN_KEY_APPROX;
+    case FIELD_TYPE_VAR_STRING:
+    case FIELD_TYPE_STRING:
+    case FIELD_TYPE_VARCHAR:
+    case FIELD_TYPE_TINY_BLOB:
+    case FIELD_TYPE_MEDIUM_BLOB:
+    case FIELD_TYPE_LONG_BLOB:
+    case FIELD_TYPE_BLOB:
+    case FIELD_TYPE_ENUM:
+    case FIELD_TYPE_SET:
+        return JOIN_KEY_STRING;
+    default:
+        return JOIN_KEY_RAW;
+    }
+}
+
+/**
+ * how the keys of both tables are compared, -1 if their text can't be matched
+ *   the way the backend would: a number against a string, a binary string
+ *   against a text, or other values of different types
+ */
+static int
+join_key_kind(network_mysqld_proto_fielddef_t *def0, network_mysqld_proto_fielddef_t *def1)
+{
+    int kind0 = join_key_field_kind(def0);
+    int kind1 = join_key_field_kind(def1);
+    if ((kind0 == JOIN_KEY_EXACT || kind0 == JOIN_KEY_APPROX)
+        && (kind1 == JOIN_KEY_EXACT || kind1 == JOIN_KEY_APPROX)) {
+        return MAX(kind0, kind1);
+    }
+    if (kind0 != kind1) {
+        return -1;
+    }
+    if (kind0 == JOIN_KEY_STRING && (def0->flags & BINARY_FLAG) != (def1->flags & BINARY_FLAG)) {
+        return -1;
+    }
+    if (kind0 == JOIN_KEY_RAW && def0->type != def1->type) {
+        return -1;
+    }
+    return kind0;
+}
+
+/* [-]int[.frac] without leading and trailing zeros, so that 1, 01 and 1.00 are equal */
+static void
+join_key_exact(GString *key)
+{
+    const gchar *p = key->str;
+    gboolean neg = (*p == '-');
+    if (*p == '-' || *p == '+') {
+        p++;
+    }
+    while (*p == '0') {
+        p++;
+    }
+    const gchar *point = strchr(p, '.');
+    gsize int_len = point ? point - p : strlen(p);
+    gsize frac_len = point ? strlen(point + 1) : 0;
+    while (frac_len > 0 && point[frac_len] == '0') {
+        frac_len--;
+    }
+
+    GString *out = g_string_sized_new(key->len);
+    if (neg && (int_len > 0 || frac_len > 0)) {
+        g_string_append_c(out, '-');
+    }
+    if (int_len > 0) {
+        g_string_append_len(out, p, int_len);
+    } else {
+        g_string_append_c(out, '0');
+    }
+    if (frac_len > 0) {
+        g_string_append_len(out, point, frac_len + 1);
+    }
+    g_string_assign(key, out->str);
+    g_string_free(out, TRUE);
+}
+
+static void
+join_key_approx(GString *key)
+{
+    gdouble d = g_ascii_strtod(key->str, NULL);
+    gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+    g_ascii_formatd(buf, sizeof(buf), "%.17g", d == 0 ? 0 : d);    /* -0 is 0 */
+    g_string_assign(key, buf);
+}
+
+/* the COLLATION() of the join key of a row, NULL if it can't be read */
+static gchar *
+join_key_collation(GString *row, guint ncols, guint *offs)
+{
+    gchar *collation = NULL;
+    if (row_column_offsets(row, ncols, offs)) {
+        network_packet packet = { row, offs[JOIN_COLLATION_COL] };
+        network_mysqld_proto_get_lenenc_str(&packet, &collation, NULL);
+    }
+    return collation;
+}
+
+/**
+ * join key of a row, NULL if it is NULL and matches nothing
+ *   strings are folded by collation, the one of both tables' keys, or NULL
+ *   if they differ and are compared byte by byte
+ */
+static GString *
+join_key_from_row(GString *row, const guint *offs, int col, network_mysqld_proto_fielddef_t *fdef, int kind,
+                  const char *collation)
+{
+    network_packet packet = { row, offs[col] };
+    guint8 first = 0;
+    if (network_mysqld_proto_peek_int8(&packet, &first) == -1 || first == MYSQLD_PACKET_NULL) {
+        return NULL;
+    }
+    gchar *value = NULL;
+    guint64 len = 0;
+    if (network_mysqld_proto_get_lenenc_str(&packet, &value, &len) == -1) {
+        return NULL;
+    }
+    GString *key = g_string_sized_new(len);
+    if (kind == JOIN_KEY_STRING) {
+        collation_fold(collation, fdef->charsetnr, value ? value : "", len, key);
+    } else {
+        g_string_append_len(key, value ? value : "", len);
+    }
+    g_free(value);
+    if (kind == JOIN_KEY_EXACT) {
+        join_key_exact(key);
+    } else if (kind == JOIN_KEY_APPROX) {
+        join_key_approx(key);
+    }
+    return key;
+}
+
+static void
+join_matches_free(gpointer p)
+{
+    g_ptr_array_free(p, TRUE);
+}
+
+/* field count, field defs and EOF of the output columns, taken from the first group */
+static void
+append_join_header(join_output_t *out, GQueue *first_chunks, guint field_count)
+{
+    GString *pkt = g_string_new_len("\x00\x00\x00\x00", NET_HEADER_SIZE);
+    network_mysqld_proto_append_lenenc_int(pkt, field_count - JOIN_HEAD_COLS);
+    network_mysqld_proto_set_packet_len(pkt, pkt->len - NET_HEADER_SIZE);
+    network_mysqld_proto_set_packet_id(pkt, ++out->seq);
+    network_queue_append(out->send_queue, pkt);
+
+    guint i;
+    for (i = JOIN_HEAD_COLS; i <= field_count; i++) {   /* field defs, then EOF */
+        GString *orig = g_queue_peek_nth(first_chunks, i + 1);
+        pkt = g_string_new_len(S(orig));
+        network_mysqld_proto_set_packet_id(pkt, ++out->seq);
+        network_queue_append(out->send_queue, pkt);
+    }
+}
+
+/* each column is taken from the row of its table, rows[1] is NULL for an unmatched left row */
+static void
+append_joined_row(join_output_t *out, GString **rows, guint **offs)
+{
+    if (out->skip > 0) {
+        out->skip--;
+        return;
+    }
+    GString *pkt = g_string_sized_new(rows[0]->len + (rows[1] ? rows[1]->len : 0));
+    g_string_append_len(pkt, "\x00\x00\x00\x00", NET_HEADER_SIZE);
+    guint i;
+    for (i = 0; i < out->sides->len; i++) {
+        int side = rows[1] ? out->sides->data[i] : 0;
+        guint col = i + JOIN_HEAD_COLS;
+        g_string_append_len(pkt, rows[side]->str + offs[side][col], offs[side][col + 1] - offs[side][col]);
+    }
+    network_mysqld_proto_set_packet_len(pkt, pkt->len - NET_HEADER_SIZE);
+    network_mysqld_proto_set_packet_id(pkt, ++out->seq);
+    network_queue_append(out->send_queue, pkt);
+    out->remain--;
+}
+
+/* account a row of a JOIN across shards as it is read, it starts with the tag "0" or "1" */
+void
+hash_join_read_row(network_mysqld_con *con, GString *packet)
+{
+    sharding_plan_t *plan = con->sharding_plan;
+    if (plan && plan->join_sides && packet->len > NET_HEADER_SIZE + 1 && packet->str[NET_HEADER_SIZE] == 1) {
+        char tag = packet->str[NET_HEADER_SIZE + 1];
+        if (tag == '0' || tag == '1') {
+            plan->join_read[tag - '0'] += packet->len;
+        }
+    }
+}
+
+/**
+ * TRUE once the table to be hashed can't fit join_buffer_size, whichever one
+ * it turns out to be, so that reading stops before the rest is buffered
+ */
+gboolean
+hash_join_over_buffer(network_mysqld_con *con)
+{
+    sharding_plan_t *plan = con->sharding_plan;
+    if (!plan || !plan->join_sides) {
+        return FALSE;
+    }
+    gsize build = plan->join_keep_left ? plan->join_read[1] : MIN(plan->join_read[0], plan->join_read[1]);
+    return build > con->srv->join_buffer_size;
+}
+
+/**
+ * groups return the tagged rows of both tables, @see routing_hash_join
+ *   the smaller table (the right one of LEFT JOIN) is hashed on its join key,
+ *   within join_buffer_size, then rows of the other table look up their matches
+ */
+static int
+merge_for_hash_join(sql_select_t *select, network_queue *send_queue, GPtrArray *recv_queues,
+                    network_mysqld_con *con, cetus_result_t *res_merge, result_merge_t *merged_result)
+{
+    sharding_plan_t *plan = con->sharding_plan;
+    network_queue *first_queue = g_ptr_array_index(recv_queues, 0);
+    if (res_merge->field_count != plan->join_sides->len + JOIN_HEAD_COLS
+        || !cetus_result_parse_fielddefs(res_merge, first_queue->chunks)) {
+        g_warning("%s:parse_fielddefs failed:%s", G_STRLOC, con->orig_sql->str);
+        merged_result->status = RM_FAIL;
+        return 0;
+    }
+
+    GPtrArray *rows[JOIN_SIDES] = { g_ptr_array_new(), g_ptr_array_new() };
+    /* field-count-packet + field-defs + eof-packet */
+    guint header_count = res_merge->field_count + 2;
+    int i;
+    for (i = 0; i < recv_queues->len; i++) {
+        network_queue *recv_q = g_ptr_array_index(recv_queues, i);
+        GList *link = g_queue_peek_nth_link(recv_q->chunks, header_count);
+        if (link == NULL) {
+            g_warning("%s:rows start null, enlarge max_header_size, pkt cnt:%d", G_STRLOC, header_count);
+            g_ptr_array_free(rows[0], TRUE);
+            g_ptr_array_free(rows[1], TRUE);
+            merged_result->status = RM_FAIL;
+            return 0;
+        }
+        for (; link; link = link->next) {
+            GString *row = link->data;
+            guchar pkt_type = get_pkt_type(row);
+            if (pkt_type == MYSQLD_PACKET_EOF) {
+                break;
+            }
+            if (pkt_type == MYSQLD_PACKET_ERR) {
+                network_queue_append(send_queue, row);
+                g_queue_delete_link(recv_q->chunks, link);
+                g_ptr_array_free(rows[0], TRUE);
+                g_ptr_array_free(rows[1], TRUE);
+                merged_result->status = con->num_pending_servers ? RM_FAIL : RM_SUCCESS;
+                return 0;
+            }
+            int side = row->str[NET_HEADER_SIZE + 1] == '1' ? 1 : 0;  /* tag is "0" or "1" */
+            g_ptr_array_add(rows[side], row);
+        }
+    }
+
+    int build = (plan->join_keep_left || rows[1]->len <= rows[0]->len) ? 1 : 0;
+    int probe = 1 - build;
+    guint ncols = res_merge->field_count;
+    guint *offs[JOIN_SIDES] = { g_new(guint, ncols + 1), g_new(guint, ncols + 1) };
+    GHashTable *table = g_hash_table_new_full(g_hash_table_string_hash, g_hash_table_string_equal,
+                                              g_hash_table_string_free, join_matches_free);
+    network_mysqld_proto_fielddef_t *build_key_def = g_ptr_array_index(res_merge->fielddefs, 1 + build);
+    network_mysqld_proto_fielddef_t *probe_key_def = g_ptr_array_index(res_merge->fielddefs, 1 + probe);
+    int kind = join_key_kind(build_key_def, probe_key_def);
+    gchar *collation = NULL;
+    if (kind == JOIN_KEY_STRING && rows[0]->len > 0 && rows[1]->len > 0) {
+        collation = join_key_collation(g_ptr_array_index(rows[0], 0), ncols, offs[0]);
+        gchar *collation1 = join_key_collation(g_ptr_array_index(rows[1], 0), ncols, offs[1]);
+        if (!collation || !collation1 || g_ascii_strcasecmp(collation, collation1) != 0) {
+            g_free(collation);
+            collation = NULL;
+        }
+        g_free(collation1);
+    }
+    gsize used = 0;
+    gboolean ok = TRUE;
+    if (kind == -1) {
+        g_message("%s: JOIN keys of type %d and %d can't be matched:%s", G_STRLOC,
+                  build_key_def->type, probe_key_def->type, con->orig_sql->str);
+        merged_result->detail = g_string_new("(cetus) JOIN across shards needs join keys of the same type");
+        ok = FALSE;
+    }
+    for (i = 0; i < rows[build]->len && ok; i++) {
+        GString *row = g_ptr_array_index(rows[build], i);
+        if (!row_column_offsets(row, ncols, offs[build])) {
+            ok = FALSE;
+            break;
+        }
+        GString *key = join_key_from_row(row, offs[build], 1 + build, build_key_def, kind, collation);
+        if (!key) {
+            continue;
+        }
+        GPtrArray *matches = g_hash_table_lookup(table, key);
+        if (matches) {
+            g_string_free(key, TRUE);
+        } else {
+            used += key->len + JOIN_ENTRY_OVERHEAD;
+            matches = g_ptr_array_new();
+            g_hash_table_insert(table, key, matches);
+        }
+        g_ptr_array_add(matches, row);
+        used += row->len + sizeof(gpointer);
+        if (used > con->srv->join_buffer_size) {
+            g_message("%s: JOIN build side over %d bytes:%s", G_STRLOC, con->srv->join_buffer_size,
+                      con->orig_sql->str);
+            merged_result->detail = g_string_new("(cetus) JOIN across shards exceeds join-buffer-size");
+            ok = FALSE;
+        }
+    }
+
+    if (ok) {
+        join_output_t out = { send_queue, plan->join_sides, 0, G_MAXINT32, 0 };
+        sql_expr_get_int(select->limit, &out.remain);
+        sql_expr_get_int(select->offset, &out.skip);
+        append_join_header(&out, first_queue->chunks, ncols);
+
+        GString *pair[JOIN_SIDES];
+        for (i = 0; i < rows[probe]->len && out.remain > 0 && ok; i++) {
+            GString *row = g_ptr_array_index(rows[probe], i);
+            if (!row_column_offsets(row, ncols, offs[probe])) {
+                ok = FALSE;
+                break;
+            }
+            GString *key = join_key_from_row(row, offs[probe], 1 + probe, probe_key_def, kind, collation);
+            GPtrArray *matches = key ? g_hash_table_lookup(table, key) : NULL;
+            if (key) {
+                g_string_free(key, TRUE);
+            }
+            pair[probe] = row;
+            if (matches) {
+                int j;
+                for (j = 0; j < matches->len && out.remain > 0; j++) {
+                    pair[build] = g_ptr_array_index(matches, j);
+                    row_column_offsets(pair[build], ncols, offs[build]);
+                    append_joined_row(&out, pair, offs);
+                }
+            } else if (plan->join_keep_left) {  /* probe is the left table */
+                pair[1] = NULL;
+                append_joined_row(&out, pair, offs);
+            }
+        }
+
+        GString *eof_pkt = g_string_new_len("\x05\x00\x00\x07\xfe\x00\x00\x02\x00", 9);
+        network_mysqld_proto_set_packet_id(eof_pkt, ++out.seq);
+        network_queue_append(send_queue, eof_pkt);
+    }
+    if (!ok) {
+        merged_result->status = RM_FAIL;
+    }
+
+    g_hash_table_destroy(table);
+    g_free(collation);
+    g_free(offs[0]);
+    g_free(offs[1]);
+    g_ptr_array_free(rows[0], TRUE);
+    g_ptr_array_free(rows[1], TRUE);
+    return ok;
+}
+
 static int
 merge_for_select(sql_context_t *context, network_queue *send_queue, GPtrArray *recv_queues,
                  network_mysqld_con *con, cetus_result_t *res_merge, result_merge_t *merged_result)
@@ -2825,6 +3789,14 @@ merge_for_select(sql_context_t *context, network_queue *send_queue, GPtrArray *r
     }
     res_merge->field_count = field_count;
 
+    if (con->sharding_plan && con->sharding_plan->join_sides) {
+        return merge_for_hash_join(select, send_queue, recv_queues, con, res_merge, merged_result);
+    }
+
+    if (select->flags & SF_COUNT_DISTINCT) {
+        return merge_for_count_distinct(select, send_queue, recv_queues, con, res_merge, merged_result);
+    }
+
     group_aggr_t aggr_array[MAX_AGGR_FUNS] = { {0}
     };
     int aggr_num = sql_expr_list_find_aggregates(select->columns, aggr_array);
@@ -2884,9 +3856,24 @@ merge_for_select(sql_context_t *context, network_queue *send_queue, GPtrArray *r
         index++;
     }
 
+    avg_merge_t avg = { 0 };
+    int visible_field_count = res_merge->field_count;
+    if (select->flags & SF_REWRITE_AVG) {
+        if (!avg_merge_prepare(select, res_merge, aggr_array, &aggr_num, &avg)) {
+            g_warning("%s:avg_merge_prepare failed:%s", G_STRLOC, con->orig_sql->str);
+            merged_result->status = RM_FAIL;
+            return 0;
+        }
+        for (i = 0; i < recv_queues->len; i++) {
+            network_queue *recv_q = g_ptr_array_index(recv_queues, i);
+            avg_merge_strip_header(recv_q->chunks, &avg);
+        }
+        visible_field_count = avg.visible_field_count;
+    }
+
     GList **candidates = g_new0(GList *, recv_queues->len);
     /* field-count-packet + eof-packet */
-    guint pkt_count = res_merge->field_count + 2;
+    guint pkt_count = visible_field_count + 2;
 
     if (!prepare_for_row_process(candidates, recv_queues, send_queue, pkt_count, merged_result)) {
         g_warning("%s:prepare_for_row_process failed", G_STRLOC);
@@ -2917,6 +3904,7 @@ merge_for_select(sql_context_t *context, network_queue *send_queue, GPtrArray *r
         para.group_array = group_array;
         para.aggr_array = aggr_array;
         para.hav_condi = hav_condi;
+        para.avg = avg.num > 0 ? &avg : NULL;
         para.group_array_size = group_array_size;
         para.aggr_num = aggr_num;
 
@@ -75,6 +75,19 @@ typedef struct {
     unsigned int is_err:1;
 } heap_type;
 
+typedef struct avg_column_t {
+    int sum_pos;                /* the AVG column, SUM() on shards */
+    int count_pos;              /* hidden COUNT() column appended to the shard sql */
+    int scale;                  /* fractional digits of the DECIMAL result */
+    uint8_t type;
+} avg_column_t;
+
+typedef struct avg_merge_t {
+    avg_column_t columns[MAX_AGGR_FUNS];
+    int num;
+    int visible_field_count;    /* field count the client expects */
+} avg_merge_t;
+
 typedef struct aggr_by_group_para_s {
     network_queue *send_queue;
     GPtrArray *recv_queues;
@@ -82,6 +95,7 @@ typedef struct aggr_by_group_para_s {
     group_by_t *group_array;
     group_aggr_t *aggr_array;
     having_condition_t *hav_condi;
+    avg_merge_t *avg;
     short aggr_num;
     short group_array_size;
 } aggr_by_group_para_t;
@@ -89,6 +103,9 @@ typedef struct aggr_by_group_para_s {
 NETWORK_API int callback_merge(network_mysqld_con *, merge_parameters_t *, int);
 NETWORK_API void resultset_merge(network_queue *, GPtrArray *, network_mysqld_con *, uint64_t *, result_merge_t *);
 
+NETWORK_API void hash_join_read_row(network_mysqld_con *, GString *);
+NETWORK_API gboolean hash_join_over_buffer(network_mysqld_con *);
+
 NETWORK_API gint check_dist_tran_resultset(network_queue *recv_queue, network_mysqld_con *);
 
 #endif
@@ -31,6 +31,7 @@
 #include "network-mysqld-proto.h"
 #include "resultset_merge.h"
 #include "plugin-common.h"
+#include "sharding-load-data.h"
 
 void
 server_session_free(server_session_t *ss)
@@ -50,7 +51,7 @@ void
 server_sess_wait_for_event(server_session_t *ss, short ev_type, struct timeval *timeout)
 {
     event_set(&(ss->server->event), ss->server->fd, ev_type, server_session_con_handler, ss);
-    chassis_event_add_with_timeout(ss->con->srv, &(ss->server->event), timeout);
+    chassis_event_add_with_timer(ss->con->srv, &(ss->server->event), &(ss->server->timer), timeout);
     ss->server->is_waiting = 1;
 }
 
@@ -63,7 +64,7 @@ remove_server_wait_event(network_mysqld_con *con)
         network_socket *server = ss->server;
         if (server->is_waiting) {
             g_message("%s: still wait server resp here", G_STRLOC);
-            CHECK_PENDING_EVENT(&(server->event));
+            CHECK_PENDING_EVENT(&(server->event), &(server->timer));
             result = 1;
         }
     }
@@ -71,6 +72,17 @@ remove_server_wait_event(network_mysqld_con *con)
     return result;
 }
 
+static void
+send_resp_too_long_error(network_mysqld_con *con)
+{
+    if (hash_join_over_buffer(con)) {
+        network_mysqld_con_send_error_full(con->client, C("(cetus) JOIN across shards exceeds join-buffer-size"),
+                                           ER_CETUS_LONG_RESP, "HY000");
+    } else {
+        network_mysqld_con_send_error_full(con->client, C("response too long for proxy"), ER_CETUS_LONG_RESP, "HY000");
+    }
+}
+
 static void
 do_tcp_stream_after_recv_resp(network_mysqld_con *con, server_session_t *ss)
 {
@@ -97,16 +109,21 @@ do_tcp_stream_after_recv_resp(network_mysqld_con *con, server_session_t *ss)
     }
 
     if (!con->resp_too_long) {
+        network_mysqld_con_phase_end(con, QUERY_PHASE_BACKEND);
         if (con->num_pending_servers == 0) {
             g_debug("%s: merge over", G_STRLOC);
-            if (callback_merge(con, con->data, 1) == RM_FAIL) {
+            int merge_ret = callback_merge(con, con->data, 1);
+            network_mysqld_con_phase_end(con, QUERY_PHASE_MERGE);
+            if (merge_ret == RM_FAIL) {
                 network_queue_clear(con->client->send_queue);
                 network_mysqld_con_send_error_full(con->client, C("merge failed"), ER_CETUS_RESULT_MERGE, "HY000");
             }
             con->state = ST_SEND_QUERY_RESULT;
             network_mysqld_con_handle(-1, 0, con);
         } else {
-            if (callback_merge(con, con->data, 0) == RM_FAIL) {
+            int merge_ret = callback_merge(con, con->data, 0);
+            network_mysqld_con_phase_end(con, QUERY_PHASE_MERGE);
+            if (merge_ret == RM_FAIL) {
                 if (remove_server_wait_event(con)) {
                     g_critical("%s: remove read pending event:%p", G_STRLOC, con);
                 }
@@ -120,7 +137,7 @@ do_tcp_stream_after_recv_resp(network_mysqld_con *con, server_session_t *ss)
         remove_server_wait_event(con);
         g_message("%s: resp too long:%p, src port:%s, sql:%s",
                   G_STRLOC, con, con->client->src->name->str, con->orig_sql->str);
-        network_mysqld_con_send_error_full(con->client, C("response too long for proxy"), ER_CETUS_LONG_RESP, "HY000");
+        send_resp_too_long_error(con);
         GList *err = con->client->send_queue->chunks->tail;
         GString *err_packet = err->data;
         merge_parameters_t *data = con->data;
@@ -262,6 +279,14 @@ process_write_event(network_mysqld_con *con, server_session_t *ss)
     default:
     {
         char *msg = "write error";
+        if (con->load_data && sharding_load_data_is_streaming(con->load_data)) {
+            sharding_load_data_write_failed(con, ss);
+            con->num_write_pending--;
+            if (con->num_write_pending == 0) {
+                network_mysqld_con_handle(-1, 0, con);
+            }
+            break;
+        }
         con->state = ST_SEND_QUERY_RESULT;
         con->server_to_be_closed = 1;
         g_warning("%s:write error for con:%p", G_STRLOC, con);
@@ -321,7 +346,7 @@ process_read_server(network_mysqld_con *con, server_session_t *ss)
         }
         break;
     case NETWORK_SOCKET_WAIT_FOR_EVENT:
-        if (sock->resp_len > con->srv->max_resp_len) {
+        if (sock->resp_len > con->srv->max_resp_len || hash_join_over_buffer(con)) {
             ss->state = NET_RW_STATE_FINISHED;
             con->server_to_be_closed = 1;
             con->resp_too_long = 1;
@@ -329,8 +354,7 @@ process_read_server(network_mysqld_con *con, server_session_t *ss)
             if (!con->candidate_tcp_streamed || con->servers->len == 1) {
                 g_message("%s: resp too long:%p, src port:%s, sql:%s",
                           G_STRLOC, con, con->client->src->name->str, con->orig_sql->str);
-                network_mysqld_con_send_error_full(con->client,
-                                                   C("response too long for proxy"), ER_CETUS_LONG_RESP, "HY000");
+                send_resp_too_long_error(con);
                 con->state = ST_SEND_QUERY_RESULT;
                 con->resultset_is_finished = TRUE;
                 network_mysqld_con_handle(-1, 0, con);
@@ -36,6 +36,7 @@ typedef struct {
     struct sql_context_t *sql_context;
     int trx_read_write;         /* default TF_READ_WRITE */
     int trx_isolation_level;    /* default TF_REPEATABLE_READ */
+    int is_dual_writer;         /* writing to a partition being moved, see sharding-migration.h */
 
 } shard_plugin_con_t;
 
@@ -27,13 +27,23 @@
 #include "cJSON.h"
 #include "chassis-timings.h"
 
-static GList *shard_conf_vdbs = NULL;
-
-static GList *shard_conf_tables = NULL;
+/*
+ * A loaded configuration is never modified. Reloading swaps in a new one,
+ * the old one is freed when the last query planned with it is done.
+ */
+struct sharding_conf_t {
+    GList *vdbs;
+    GList *tables;
+    GHashTable *vdb_map;
+    GList *single_tables;
+    guint64 version;
+    int refcount;               /* only used by the event loop thread */
+};
 
-static GHashTable *shard_conf_vdb_map = NULL;
+/* the configuration for new queries, holds a reference */
+static sharding_conf_t *shard_conf = NULL;
 
-static GList *shard_conf_single_tables = NULL;
+static guint64 shard_conf_last_version = 0;
 
 struct sharding_database_t {
     char *name;
@@ -94,6 +104,11 @@ sharding_table_free(gpointer q)
         g_string_free(info->name, TRUE);
     if (NULL != info->pkey)
         g_string_free(info->pkey, TRUE);
+    if (NULL != info->index_column) {
+        g_string_free(info->index_column, TRUE);
+        g_string_free(info->index_group, TRUE);
+        g_string_free(info->index_table, TRUE);
+    }
     g_free(info);
 }
 
@@ -106,6 +121,43 @@ sharding_partition_contain_hash(sharding_partition_t *partition, int val)
     return TestBit(partition->hash_set, val);
 }
 
+void
+sharding_partition_describe(sharding_partition_t *partition, GString *out)
+{
+    const sharding_vdb_t *vdb = partition->vdb;
+    if (vdb->method == SHARD_METHOD_HASH) {
+        int i;
+        g_string_append_c(out, '[');
+        for (i = 0; i < vdb->logic_shard_num; ++i) {
+            if (TestBit(partition->hash_set, i)) {
+                if (out->str[out->len - 1] != '[') {
+                    g_string_append(out, ", ");
+                }
+                g_string_append_printf(out, "%d", i);
+            }
+        }
+        g_string_append_c(out, ']');
+    } else if (vdb->key_type == SHARD_DATA_TYPE_STR) {
+        const char *low = partition->low_value;
+        const char *high = partition->value;
+        g_string_append_printf(out, "(%s, %s]", low ? low : "-inf", high ? high : "+inf");
+    } else {
+        int64_t low = (int64_t) partition->low_value;
+        int64_t high = (int64_t) partition->value;
+        g_string_append_c(out, '(');
+        if (low == INT_MIN) {
+            g_string_append(out, "-inf");
+        } else {
+            g_string_append_printf(out, "%" G_GINT64_FORMAT, low);
+        }
+        if (high == INT_MAX) {
+            g_string_append(out, ", +inf]");
+        } else {
+            g_string_append_printf(out, ", %" G_GINT64_FORMAT "]", high);
+        }
+    }
+}
+
 static sharding_vdb_t *
 sharding_vdb_new()
 {
@@ -138,6 +190,9 @@ sharding_vdb_free(sharding_vdb_t *vdb)
         if (item->group_name) {
             g_string_free(item->group_name, TRUE);
         }
+        if (item->migrate_to) {
+            g_string_free(item->migrate_to, TRUE);
+        }
         g_free(item);
     }
     g_ptr_array_free(vdb->partitions, TRUE);
@@ -147,13 +202,14 @@ sharding_vdb_free(sharding_vdb_t *vdb)
 }
 
 static gboolean
-sharding_vdb_is_valid(sharding_vdb_t *vdb, int num_groups)
+sharding_vdb_is_valid(sharding_vdb_t *vdb, int num_groups, int num_index_groups)
 {
     if (vdb->method == SHARD_METHOD_HASH) {
         if (vdb->logic_shard_num <= 0 || vdb->logic_shard_num > MAX_HASH_VALUE_COUNT) {
             return FALSE;
         }
-        if (vdb->partitions->len != num_groups) {
+        /* groups only holding global indexes may have no partition */
+        if (vdb->partitions->len != num_groups && vdb->partitions->len != num_groups - num_index_groups) {
             g_critical("vdb partition count not equal to number of groups");
             return FALSE;
         }
@@ -180,6 +236,25 @@ sharding_vdb_is_valid(sharding_vdb_t *vdb, int num_groups)
     return TRUE;
 }
 
+static gboolean
+sharding_table_index_is_valid(sharding_table_t *table, sharding_vdb_t *vdb)
+{
+    if (strcasecmp(table->index_column->str, table->pkey->str) == 0) {
+        g_critical(G_STRLOC " table %s: global index on the sharding key", table->name->str);
+        return FALSE;
+    }
+    int i;
+    for (i = 0; i < vdb->partitions->len; ++i) {
+        sharding_partition_t *part = g_ptr_array_index(vdb->partitions, i);
+        if (g_string_equal(part->group_name, table->index_group)) {
+            g_critical(G_STRLOC " table %s: global index group %s holds a partition",
+                       table->name->str, table->index_group->str);
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
 static struct sharding_database_t *
 sharding_vdb_get_database(sharding_vdb_t *vdb, const char *db_name)
 {
@@ -201,6 +276,12 @@ sharding_vdb_add_database(sharding_vdb_t *vdb, const char *name)
     return db;
 }
 
+static sharding_vdb_t *
+shard_conf_get_vdb(const char *db)
+{
+    return shard_conf ? g_hash_table_lookup(shard_conf->vdb_map, db) : NULL;
+}
+
 GPtrArray *
 shard_conf_get_all_groups(GPtrArray *visited_groups, const char *db)
 {
@@ -208,7 +289,7 @@ shard_conf_get_all_groups(GPtrArray *visited_groups, const char *db)
         g_warning(G_STRLOC " db name is NULL");
         return visited_groups;
     }
-    sharding_vdb_t *vdb = g_hash_table_lookup(shard_conf_vdb_map, db);
+    sharding_vdb_t *vdb = shard_conf_get_vdb(db);
     if (vdb) {
         int i = 0;
         for (i = 0; i < vdb->partitions->len; ++i) {
@@ -229,7 +310,7 @@ shard_conf_find_groups(GPtrArray *groups, const char *match, const char *db)
         shard_conf_get_all_groups(groups, db);
         return;
     }
-    sharding_vdb_t *vdb = g_hash_table_lookup(shard_conf_vdb_map, db);
+    sharding_vdb_t *vdb = shard_conf_get_vdb(db);
     if (vdb) {
         int i = 0;
         for (i = 0; i < vdb->partitions->len; ++i) {
@@ -250,7 +331,7 @@ shard_conf_get_any_group(GPtrArray *visited_groups, char *db, char *UNUSED_PARAM
         g_warning(G_STRLOC " db name is NULL");
         return NULL;
     }
-    sharding_vdb_t *vdb = g_hash_table_lookup(shard_conf_vdb_map, db);
+    sharding_vdb_t *vdb = shard_conf_get_vdb(db);
     if (vdb == NULL) {
         return NULL;
     }
@@ -272,7 +353,7 @@ shard_conf_get_table_groups(GPtrArray *visited_groups, char *db, char *UNUSED_PA
         return NULL;
     }
 
-    sharding_vdb_t *vdb = g_hash_table_lookup(shard_conf_vdb_map, db);
+    sharding_vdb_t *vdb = shard_conf_get_vdb(db);
     if (vdb == NULL) {
         return NULL;
     }
@@ -308,7 +389,7 @@ shard_conf_table_partitions(GPtrArray *partitions, const char *db, const char *U
         return NULL;
     }
 
-    sharding_vdb_t *vdb = g_hash_table_lookup(shard_conf_vdb_map, db);
+    sharding_vdb_t *vdb = shard_conf_get_vdb(db);
     if (!vdb) {
         return NULL;
     }
@@ -326,7 +407,7 @@ shard_conf_get_info(const char *db_name, const char *table)
 {
     if (!db_name)
         return NULL;
-    sharding_vdb_t *vdb = g_hash_table_lookup(shard_conf_vdb_map, db_name);
+    sharding_vdb_t *vdb = shard_conf_get_vdb(db_name);
     if (!vdb) {
         return NULL;
     }
@@ -350,7 +431,7 @@ shard_conf_get_fixed_group(GPtrArray *groups, const char *db, guint32 fixture)
         g_warning(G_STRLOC " db name is NULL");
         return groups;
     }
-    sharding_vdb_t *vdb = g_hash_table_lookup(shard_conf_vdb_map, db);
+    sharding_vdb_t *vdb = shard_conf_get_vdb(db);
     if (vdb) {
         int base = vdb->partitions->len;
         if (base == 0) {
@@ -381,33 +462,176 @@ single_table_free(struct single_table_t *t)
 }
 
 static void
-shard_conf_set_vdb_list(GList *vdbs)
+sharding_conf_free(sharding_conf_t *conf)
 {
-    g_list_free_full(shard_conf_vdbs, (GDestroyNotify) sharding_vdb_free);
-    shard_conf_vdbs = vdbs;
+    g_debug("%s: free sharding config version %llu", G_STRLOC, (unsigned long long)conf->version);
+    g_list_free_full(conf->vdbs, (GDestroyNotify) sharding_vdb_free);
+    g_list_free_full(conf->tables, (GDestroyNotify) sharding_table_free);
+    if (conf->vdb_map) {
+        g_hash_table_destroy(conf->vdb_map);
+    }
+    g_list_free_full(conf->single_tables, (GDestroyNotify) single_table_free);
+    g_free(conf);
 }
 
-static void
-shard_conf_set_table_list(GList *tables)
+sharding_conf_t *
+shard_conf_acquire(void)
 {
-    g_list_free_full(shard_conf_tables, (GDestroyNotify) sharding_table_free);
-    shard_conf_tables = tables;
+    if (shard_conf) {
+        shard_conf->refcount++;
+    }
+    return shard_conf;
 }
 
-static void
-shard_conf_set_vdb_map(GHashTable *vdbmap)
+void
+shard_conf_release(sharding_conf_t *conf)
 {
-    if (shard_conf_vdb_map) {
-        g_hash_table_destroy(shard_conf_vdb_map);
+    if (conf && --conf->refcount == 0) {
+        sharding_conf_free(conf);
     }
-    shard_conf_vdb_map = vdbmap;
 }
 
 static void
-shard_conf_set_single_tables(GList *tables)
+shard_conf_publish(GList *vdbs, GList *tables, GHashTable *vdbmap, GList *single_tables)
+{
+    sharding_conf_t *conf = g_new0(sharding_conf_t, 1);
+    conf->vdbs = vdbs;
+    conf->tables = tables;
+    conf->vdb_map = vdbmap;
+    conf->single_tables = single_tables;
+    conf->version = ++shard_conf_last_version;
+    conf->refcount = 1;
+
+    sharding_conf_t *old = shard_conf;
+    shard_conf = conf;
+    if (old) {
+        g_message("%s: sharding config version %llu replaces %llu, still used by %d queries", G_STRLOC,
+                  (unsigned long long)conf->version, (unsigned long long)old->version, old->refcount - 1);
+        shard_conf_release(old);
+    }
+}
+
+GList *
+shard_conf_get_vdbs(void)
+{
+    return shard_conf ? shard_conf->vdbs : NULL;
+}
+
+GList *
+shard_conf_get_tables(void)
 {
-    g_list_free_full(shard_conf_single_tables, (GDestroyNotify) single_table_free);
-    shard_conf_single_tables = tables;
+    return shard_conf ? shard_conf->tables : NULL;
+}
+
+sharding_partition_t *
+shard_conf_get_partition(sharding_conf_t *conf, int vdb_id, int index)
+{
+    sharding_vdb_t *vdb = conf ? shard_vdbs_get_by_id(conf->vdbs, vdb_id) : NULL;
+    if (!vdb || index < 0 || index >= vdb->partitions->len) {
+        return NULL;
+    }
+    return g_ptr_array_index(vdb->partitions, index);
+}
+
+static sharding_vdb_t *
+sharding_vdb_copy(const sharding_vdb_t *vdb)
+{
+    sharding_vdb_t *copy = sharding_vdb_new();
+    copy->id = vdb->id;
+    copy->method = vdb->method;
+    copy->key_type = vdb->key_type;
+    copy->logic_shard_num = vdb->logic_shard_num;
+
+    int i;
+    for (i = 0; i < vdb->partitions->len; i++) {
+        sharding_partition_t *part = g_ptr_array_index(vdb->partitions, i);
+        sharding_partition_t *item = g_new0(sharding_partition_t, 1);
+        item->vdb = copy;
+        item->group_name = g_string_new_len(S(part->group_name));
+        if (part->migrate_to) {
+            item->migrate_to = g_string_new_len(S(part->migrate_to));
+        }
+        memcpy(item->hash_set, part->hash_set, sizeof(item->hash_set));
+        if (vdb->method == SHARD_METHOD_RANGE && vdb->key_type == SHARD_DATA_TYPE_STR) {
+            item->value = g_strdup(part->value);
+            item->low_value = g_strdup(part->low_value);
+        } else {
+            item->value = part->value;
+            item->low_value = part->low_value;
+        }
+        g_ptr_array_add(copy->partitions, item);
+    }
+    return copy;
+}
+
+static sharding_table_t *
+sharding_table_copy(const sharding_table_t *table)
+{
+    sharding_table_t *copy = g_new0(sharding_table_t, 1);
+    copy->db = g_string_new_len(S(table->db));
+    copy->name = g_string_new_len(S(table->name));
+    copy->pkey = g_string_new_len(S(table->pkey));
+    copy->vdb_id = table->vdb_id;
+    if (table->index_column) {
+        copy->index_column = g_string_new_len(S(table->index_column));
+        copy->index_group = g_string_new_len(S(table->index_group));
+        copy->index_table = g_string_new_len(S(table->index_table));
+    }
+    return copy;
+}
+
+static struct single_table_t *
+single_table_copy(const struct single_table_t *t)
+{
+    struct single_table_t *copy = g_new0(struct single_table_t, 1);
+    copy->name = g_string_new_len(S(t->name));
+    copy->db = g_string_new_len(S(t->db));
+    copy->group = g_string_new_len(S(t->group));
+    return copy;
+}
+
+static GHashTable *shard_conf_link(GList *vdbs, GList *tables);
+
+gboolean
+shard_conf_update_partition(int vdb_id, int index, const char *group, const char *migrate_to)
+{
+    if (!shard_conf_get_partition(shard_conf, vdb_id, index)) {
+        return FALSE;
+    }
+
+    GList *vdbs = NULL, *tables = NULL, *single_tables = NULL;
+    GList *l;
+    for (l = shard_conf->vdbs; l; l = l->next) {
+        vdbs = g_list_prepend(vdbs, sharding_vdb_copy(l->data));
+    }
+    for (l = shard_conf->tables; l; l = l->next) {
+        tables = g_list_prepend(tables, sharding_table_copy(l->data));
+    }
+    for (l = shard_conf->single_tables; l; l = l->next) {
+        single_tables = g_list_prepend(single_tables, single_table_copy(l->data));
+    }
+    vdbs = g_list_reverse(vdbs);
+    tables = g_list_reverse(tables);
+    single_tables = g_list_reverse(single_tables);
+
+    sharding_vdb_t *vdb = shard_vdbs_get_by_id(vdbs, vdb_id);
+    sharding_partition_t *part = g_ptr_array_index(vdb->partitions, index);
+    if (group) {
+        g_string_assign(part->group_name, group);
+    }
+    if (part->migrate_to) {
+        g_string_free(part->migrate_to, TRUE);
+        part->migrate_to = NULL;
+    }
+    if (migrate_to) {
+        part->migrate_to = g_string_new(migrate_to);
+    }
+
+    /* the copy was valid already */
+    GHashTable *vdbmap = shard_conf_link(vdbs, tables);
+    g_assert(vdbmap);
+    shard_conf_publish(vdbs, tables, vdbmap, single_tables);
+    return TRUE;
 }
 
 /**
@@ -420,17 +644,38 @@ shard_conf_try_setup(GList *vdbs, GList *tables, GList *single_tables, int num_g
         g_critical("empty vdb/table list");
         return FALSE;
     }
-    GList *l = vdbs;
+    GHashTable *index_groups = g_hash_table_new(g_str_hash, g_str_equal);
+    GList *l = tables;
     for (; l != NULL; l = l->next) {
+        sharding_table_t *table = l->data;
+        if (table->index_group) {
+            g_hash_table_insert(index_groups, table->index_group->str, NULL);
+        }
+    }
+    int num_index_groups = g_hash_table_size(index_groups);
+    g_hash_table_destroy(index_groups);
+
+    for (l = vdbs; l != NULL; l = l->next) {
         sharding_vdb_t *vdb = l->data;
-        if (!sharding_vdb_is_valid(vdb, num_groups)) {
+        if (!sharding_vdb_is_valid(vdb, num_groups, num_index_groups)) {
             g_warning("invalid vdb config");
             return FALSE;
         }
     }
-    GHashTable *vdbmap = g_hash_table_new(g_str_hash, g_str_equal);
+    GHashTable *vdbmap = shard_conf_link(vdbs, tables);
+    if (!vdbmap) {
+        return FALSE;
+    }
+    shard_conf_publish(vdbs, tables, vdbmap, single_tables);
+    return TRUE;
+}
 
-    l = tables;
+/* fill the tables with their vdb data and map the databases to the vdbs */
+static GHashTable *
+shard_conf_link(GList *vdbs, GList *tables)
+{
+    GHashTable *vdbmap = g_hash_table_new(g_str_hash, g_str_equal);
+    GList *l = tables;
     for (; l != NULL; l = l->next) {
         sharding_table_t *table = l->data;
         sharding_vdb_t *vdb = shard_vdbs_get_by_id(vdbs, table->vdb_id);
@@ -439,7 +684,7 @@ shard_conf_try_setup(GList *vdbs, GList *tables, GList *single_tables, int num_g
         if (!vdb) {
             g_critical(G_STRLOC " table:%s VDB ID cannot be found: %d", table->name->str, table->vdb_id);
             g_hash_table_destroy(vdbmap);
-            return FALSE;
+            return NULL;
         } else {
             table->shard_key_type = vdb->key_type;
             table->logic_shard_num = vdb->logic_shard_num;
@@ -447,6 +692,12 @@ shard_conf_try_setup(GList *vdbs, GList *tables, GList *single_tables, int num_g
             table->partitions = vdb->partitions;
         }
 
+        /* a group gets one statement, the index pairs can't share it with the rows */
+        if (table->index_column && !sharding_table_index_is_valid(table, vdb)) {
+            g_hash_table_destroy(vdbmap);
+            return NULL;
+        }
+
         /* collect database into vdb */
         struct sharding_database_t *database = sharding_vdb_get_database(vdb, table->db->str);
         if (!database) {
@@ -457,7 +708,7 @@ shard_conf_try_setup(GList *vdbs, GList *tables, GList *single_tables, int num_g
         if (sharding_database_get_table(database, table->name->str)) {
             g_hash_table_destroy(vdbmap);
             g_critical(G_STRLOC " same table name inside same db: %s", table->name->str);
-            return FALSE;
+            return NULL;
         }
         sharding_database_add_table(database, table);
 
@@ -466,28 +717,19 @@ shard_conf_try_setup(GList *vdbs, GList *tables, GList *single_tables, int num_g
         if (vdb_res && vdb_res != vdb) {
             g_hash_table_destroy(vdbmap);
             g_critical(G_STRLOC " same db inside different vdb: %s", database->name);
-            return FALSE;
+            return NULL;
         } else {
             g_hash_table_insert(vdbmap, database->name, vdb);
         }
     }
-    shard_conf_set_vdb_list(vdbs);
-    shard_conf_set_table_list(tables);
-    shard_conf_set_vdb_map(vdbmap);
-    shard_conf_set_single_tables(single_tables);
-    return TRUE;
+    return vdbmap;
 }
 
 void
 shard_conf_destroy(void)
 {
-    if (shard_conf_vdbs) {
-        g_list_free_full(shard_conf_vdbs, (GDestroyNotify) sharding_vdb_free);
-    }
-    g_list_free_full(shard_conf_tables, (GDestroyNotify) sharding_table_free);
-    if (shard_conf_vdb_map) {
-        g_hash_table_destroy(shard_conf_vdb_map);
-    }
+    shard_conf_release(shard_conf);
+    shard_conf = NULL;
 }
 
 static GHashTable *load_shard_from_json(gchar *json_str);
@@ -514,7 +756,10 @@ shard_conf_load(char *json_str, int num_groups)
 static struct single_table_t *
 shard_conf_get_single_table(const char *db, const char *name)
 {
-    GList *l = shard_conf_single_tables;
+    if (!shard_conf) {
+        return NULL;
+    }
+    GList *l = shard_conf->single_tables;
     for (; l; l = l->next) {
         struct single_table_t *t = l->data;
         if (strcasecmp(t->name->str, name) == 0 && strcasecmp(t->db->str, db) == 0) {
@@ -803,6 +1048,26 @@ parse_tables(cJSON *root)
             table->name = g_string_new(table_root->valuestring);
             table->pkey = g_string_new(pkey->valuestring);
 
+            cJSON *index = cJSON_GetObjectItem(p, "global_index");
+            if (index) {
+                cJSON *column = cJSON_GetObjectItem(index, "column");
+                cJSON *group = cJSON_GetObjectItem(index, "group");
+                cJSON *index_table = cJSON_GetObjectItem(index, "table");
+                if (column && group) {
+                    table->index_column = g_string_new(column->valuestring);
+                    table->index_group = g_string_new(group->valuestring);
+                    if (index_table) {
+                        table->index_table = g_string_new(index_table->valuestring);
+                    } else {
+                        table->index_table = g_string_new(NULL);
+                        g_string_printf(table->index_table, "%s_%s_gidx", table_root->valuestring,
+                                        column->valuestring);
+                    }
+                } else {
+                    g_critical("global_index of table %s needs column and group", table_root->valuestring);
+                }
+            }
+
             tables = g_list_append(tables, table);
         } else {
             g_critical("parse_tables error");
@@ -54,9 +54,14 @@ typedef struct sharding_partition_t {
 
     GString *group_name;
     const sharding_vdb_t *vdb;  /* references the vdb it belongs to */
+
+    GString *migrate_to;        /* while moving to this group, writes go to both */
 } sharding_partition_t;
 
 gboolean sharding_partition_contain_hash(sharding_partition_t *, int);
+
+/* human readable range or hash values, e.g. "(100, 200]" */
+void sharding_partition_describe(sharding_partition_t *, GString *out);
 //gboolean sharding_partition_cover_range(sharding_partition_t *, );
 
 struct sharding_vdb_t {
@@ -79,6 +84,11 @@ struct sharding_table_t {
 
     int vdb_id;
     struct sharding_vdb_t *vdb;
+
+    /* optional global index on a unique column, see sharding-global-index.h */
+    GString *index_column;
+    GString *index_group;       /* holds no partition of the table */
+    GString *index_table;
 };
 
 GPtrArray *shard_conf_get_table_groups(GPtrArray *groups, char *db, char *table);
@@ -112,6 +122,32 @@ void shard_conf_find_groups(GPtrArray *groups, const char *match, const char *db
 
 gboolean shard_conf_load(char *, int);
 
+typedef struct sharding_conf_t sharding_conf_t;
+
+/**
+ * keep the current configuration alive, e.g. for the group names in a plan,
+ * a reload doesn't free it until released
+ */
+sharding_conf_t *shard_conf_acquire(void);
+void shard_conf_release(sharding_conf_t *);
+
+/* GList<sharding_vdb_t *> of the current configuration */
+GList *shard_conf_get_vdbs(void);
+
+/* GList<sharding_table_t *> of the current configuration */
+GList *shard_conf_get_tables(void);
+
+/* partition index of vdb_id in conf, NULL if none */
+sharding_partition_t *shard_conf_get_partition(sharding_conf_t *, int vdb_id, int index);
+
+/**
+ * swap in a copy of the current configuration where partition index of
+ * vdb_id is on group (unchanged if NULL) and also written to migrate_to
+ * (none if NULL), plans made before keep the configuration they used
+ * @return FALSE if there is no such partition
+ */
+gboolean shard_conf_update_partition(int vdb_id, int index, const char *group, const char *migrate_to);
+
 void shard_conf_destroy(void);
 
 #endif /* __SHARDING_CONFIG_H__ */
@@ -0,0 +1,330 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#include "sharding-global-index.h"
+
+#include <string.h>
+
+#include "cetus-util.h"
+#include "network-backend.h"
+#include "network-mysqld.h"
+#include "sharding-config.h"
+
+#define GLOBAL_INDEX_BATCH 10000
+#define GLOBAL_INDEX_RESCAN 1000    /* pairs before the last one read again, they may commit late */
+#define GLOBAL_INDEX_RETRY_INTERVAL 1000    /* ms */
+
+struct global_index_t {
+    chassis *chas;
+    char *db;
+    char *table;
+    char *column;
+    char *key;                  /* sharding key of the table */
+    char *group;
+    char *index_table;
+    volatile gint enabled;      /* cleared for good when removed from the configuration */
+    gboolean configured;        /* only used while reloading */
+
+    GHashTable *entries;        /* <column value, sharding key>, at most global_index_cache_size,
+                                   only used by the event loop thread */
+
+    /* only used by the monitor thread */
+    gint64 last_seq;
+    GHashTable *recent_seqs;    /* <gint64 *, NULL> read within the rescan window */
+
+    GPtrArray *volatile pending;    /* value, key, value, key... read but not copied yet */
+    struct event notify_event;  /* monitor thread -> event loop */
+};
+
+/* every index configured since start, they are only freed on shutdown */
+static GPtrArray *indexes = NULL;
+
+/* copy of indexes for the monitor thread, replaced ones are kept as it may still read them */
+static GPtrArray *volatile published = NULL;
+static GList *retired = NULL;
+
+static void
+global_index_free(global_index_t *index)
+{
+    if (index->notify_event.ev_base) {
+        evtimer_del(&index->notify_event);
+    }
+    g_free(index->db);
+    g_free(index->table);
+    g_free(index->column);
+    g_free(index->key);
+    g_free(index->group);
+    g_free(index->index_table);
+    g_hash_table_destroy(index->entries);
+    g_hash_table_destroy(index->recent_seqs);
+    if (index->pending) {
+        g_ptr_array_free(index->pending, TRUE);
+    }
+    g_free(index);
+}
+
+static global_index_t *
+global_index_find(const char *db, const char *table)
+{
+    int i;
+    for (i = 0; indexes && i < indexes->len; ++i) {
+        global_index_t *index = g_ptr_array_index(indexes, i);
+        if (index->enabled && strcmp(index->table, table) == 0 && strcmp(index->db, db) == 0) {
+            return index;
+        }
+    }
+    return NULL;
+}
+
+static gboolean
+global_index_same(global_index_t *index, sharding_table_t *t)
+{
+    return strcmp(index->column, t->index_column->str) == 0 && strcmp(index->key, t->pkey->str) == 0
+        && strcmp(index->group, t->index_group->str) == 0 && strcmp(index->index_table, t->index_table->str) == 0;
+}
+
+void
+global_index_conf_reloaded(chassis *chas)
+{
+    if (!indexes) {
+        indexes = g_ptr_array_new();
+    }
+    int i;
+    for (i = 0; i < indexes->len; ++i) {
+        global_index_t *index = g_ptr_array_index(indexes, i);
+        index->configured = FALSE;
+    }
+
+    gboolean added = FALSE;
+    GList *l;
+    for (l = shard_conf_get_tables(); l; l = l->next) {
+        sharding_table_t *t = l->data;
+        if (!t->index_column) {
+            continue;
+        }
+        global_index_t *index = global_index_find(t->db->str, t->name->str);
+        if (index && global_index_same(index, t)) {
+            index->configured = TRUE;
+            continue;
+        }
+        /* a new or changed index starts over, the old pairs may be stale */
+        index = g_new0(global_index_t, 1);
+        index->chas = chas;
+        index->db = g_strdup(t->db->str);
+        index->table = g_strdup(t->name->str);
+        index->column = g_strdup(t->index_column->str);
+        index->key = g_strdup(t->pkey->str);
+        index->group = g_strdup(t->index_group->str);
+        index->index_table = g_strdup(t->index_table->str);
+        index->entries = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+        index->recent_seqs = g_hash_table_new_full(g_int64_hash, g_int64_equal, g_free, NULL);
+        index->configured = TRUE;
+        g_ptr_array_add(indexes, index);
+        added = TRUE;
+        g_message("%s: global index of %s.%s on %s, stored in %s.%s of group %s", G_STRLOC,
+                  index->db, index->table, index->column, index->db, index->index_table, index->group);
+    }
+
+    for (i = 0; i < indexes->len; ++i) {
+        global_index_t *index = g_ptr_array_index(indexes, i);
+        if (index->enabled && !index->configured) {
+            g_message("%s: global index of %s.%s on %s removed", G_STRLOC, index->db, index->table, index->column);
+            g_hash_table_remove_all(index->entries);
+        }
+        g_atomic_int_set(&index->enabled, index->configured);
+    }
+
+    if (added) {
+        GPtrArray *copy = g_ptr_array_sized_new(indexes->len);
+        for (i = 0; i < indexes->len; ++i) {
+            g_ptr_array_add(copy, g_ptr_array_index(indexes, i));
+        }
+        if (published) {
+            retired = g_list_prepend(retired, published);
+        }
+        g_atomic_pointer_set(&published, copy);
+    }
+}
+
+const char *
+global_index_lookup(const char *db, const char *table, const char *value)
+{
+    global_index_t *index = global_index_find(db, table);
+    if (!index) {
+        return NULL;
+    }
+    return g_hash_table_lookup(index->entries, value);
+}
+
+void
+global_index_evict(const char *db, const char *table, const char *value)
+{
+    global_index_t *index = global_index_find(db, table);
+    if (index) {
+        g_hash_table_remove(index->entries, value);
+    }
+}
+
+static gboolean
+pair_drop(gpointer key, gpointer value, gpointer data)
+{
+    guint *left = data;
+    if (*left == 0) {
+        return FALSE;
+    }
+    (*left)--;
+    return TRUE;
+}
+
+/* pairs are only hints, a full index drops an arbitrary eighth of them */
+static void
+global_index_make_room(global_index_t *index)
+{
+    guint left = g_hash_table_size(index->entries) / 8 + 1;
+    g_hash_table_foreach_remove(index->entries, pair_drop, &left);
+}
+
+void
+global_index_destroy(void)
+{
+    /* the monitor thread has stopped */
+    if (indexes) {
+        g_ptr_array_foreach(indexes, (GFunc) global_index_free, NULL);
+        g_ptr_array_free(indexes, TRUE);
+        indexes = NULL;
+    }
+    if (published) {
+        g_ptr_array_free(published, TRUE);
+        published = NULL;
+    }
+    g_list_free_full(retired, (GDestroyNotify) g_ptr_array_unref);
+    retired = NULL;
+}
+
+/* event loop thread, a batch of pairs has been read */
+static void
+global_index_notified(int fd, short what, void *arg)
+{
+    global_index_t *index = arg;
+    GPtrArray *pairs = g_atomic_pointer_get(&index->pending);
+    if (!pairs) {
+        return;
+    }
+    if (index->enabled) {
+        int i;
+        for (i = 0; i + 1 < pairs->len; i += 2) {
+            gchar *value = g_ptr_array_index(pairs, i);
+            if (g_hash_table_size(index->entries) >= index->chas->global_index_cache_size
+                && !g_hash_table_contains(index->entries, value)) {
+                global_index_make_room(index);
+            }
+            g_hash_table_replace(index->entries, value, g_ptr_array_index(pairs, i + 1));
+        }
+        g_ptr_array_set_free_func(pairs, NULL);     /* taken by the entries */
+    }
+    g_ptr_array_free(pairs, TRUE);
+    g_atomic_pointer_set(&index->pending, NULL);
+}
+
+GPtrArray *
+global_index_get_all(void)
+{
+    return g_atomic_pointer_get(&published);
+}
+
+const char *
+global_index_master_addr(global_index_t *index)
+{
+    GString *name = g_string_new(index->group);
+    network_group_t *gp = network_backends_get_group(index->chas->priv->backends, name);
+    g_string_free(name, TRUE);
+    if (!gp || !gp->master) {
+        return NULL;
+    }
+    return gp->master->addr->name->str;
+}
+
+static gboolean
+recent_seq_is_old(gpointer key, gpointer value, gpointer data)
+{
+    return *(gint64 *)key <= *(gint64 *)data;
+}
+
+int
+global_index_poll(global_index_t *index, MYSQL *conn)
+{
+    int interval = index->chas->global_index_interval;
+    if (!g_atomic_int_get(&index->enabled) || g_atomic_pointer_get(&index->pending)) {
+        return interval;        /* last batch not copied yet */
+    }
+    if (!conn) {
+        return GLOBAL_INDEX_RETRY_INTERVAL;
+    }
+
+    /* the sequence is taken on insert, but a lower one may commit later */
+    gint64 from = MAX(index->last_seq - GLOBAL_INDEX_RESCAN, 0);
+    g_hash_table_foreach_remove(index->recent_seqs, recent_seq_is_old, &from);
+
+    GString *sql = g_string_new(NULL);
+    g_string_printf(sql, "SELECT `%s`,`%s`,`%s` FROM `%s`.`%s` WHERE `%s` > %" G_GINT64_FORMAT
+                    " ORDER BY `%s` LIMIT %d", GLOBAL_INDEX_SEQ_COLUMN, index->column, index->key,
+                    index->db, index->index_table, GLOBAL_INDEX_SEQ_COLUMN, from,
+                    GLOBAL_INDEX_SEQ_COLUMN, GLOBAL_INDEX_RESCAN + GLOBAL_INDEX_BATCH);
+    MYSQL_RES *res = NULL;
+    if (mysql_real_query(conn, S(sql)) != 0 || !(res = mysql_store_result(conn))) {
+        g_warning("%s: global index query failed: %s, error: %d, %s",
+                  G_STRLOC, sql->str, mysql_errno(conn), mysql_error(conn));
+        g_string_free(sql, TRUE);
+        return GLOBAL_INDEX_RETRY_INTERVAL;
+    }
+    g_string_free(sql, TRUE);
+
+    GPtrArray *pairs = g_ptr_array_new_with_free_func(g_free);
+    int new_seqs = 0;
+    MYSQL_ROW row;
+    while ((row = mysql_fetch_row(res))) {
+        if (!row[0] || !row[1] || !row[2]) {
+            continue;
+        }
+        gint64 seq = g_ascii_strtoll(row[0], NULL, 10);
+        if (g_hash_table_contains(index->recent_seqs, &seq)) {
+            continue;
+        }
+        gint64 *key = g_new(gint64, 1);
+        *key = seq;
+        g_hash_table_insert(index->recent_seqs, key, NULL);
+        index->last_seq = MAX(index->last_seq, seq);
+        g_ptr_array_add(pairs, g_strdup(row[1]));
+        g_ptr_array_add(pairs, g_strdup(row[2]));
+        new_seqs++;
+    }
+    mysql_free_result(res);
+
+    if (pairs->len == 0) {
+        g_ptr_array_free(pairs, TRUE);
+        return interval;
+    }
+    g_atomic_pointer_set(&index->pending, pairs);
+    struct timeval timeout = { 0 };
+    evtimer_set(&index->notify_event, global_index_notified, index);
+    event_base_set(index->chas->event_base, &index->notify_event);
+    evtimer_add(&index->notify_event, &timeout);
+    return new_seqs >= GLOBAL_INDEX_BATCH ? 0 : interval;
+}
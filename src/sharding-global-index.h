@@ -0,0 +1,73 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#ifndef _SHARDING_GLOBAL_INDEX_H_
+#define _SHARDING_GLOBAL_INDEX_H_
+
+#include <glib.h>
+#include <mysql.h>
+
+#include "chassis-mainloop.h"
+
+/**
+ * Global index of a sharding table on a unique column other than the
+ * sharding key.
+ *
+ * Writes of the column also write the (value, sharding key) pair to an index
+ * table on a group holding no partition of the table, in the same distributed
+ * transaction. The monitor thread copies new pairs into memory, so a query on
+ * the column is routed to the one group of the key without an extra round
+ * trip.
+ *
+ * The pairs in memory are only hints: one may be stale after the row is
+ * deleted or updated, and a newer one may not be copied yet. Values without
+ * a pair are routed to all groups as before, and so is a query again when the
+ * group of its hint returns no row.
+ *
+ * Index table: <column> PRIMARY KEY, <sharding key>,
+ *   gidx_seq AUTO_INCREMENT UNIQUE, the order the pairs are copied in
+ */
+#define GLOBAL_INDEX_SEQ_COLUMN "gidx_seq"
+
+typedef struct global_index_t global_index_t;
+
+/* event loop thread */
+void global_index_conf_reloaded(chassis *);
+
+/* sharding key of the row holding the value, NULL if not known */
+const char *global_index_lookup(const char *db, const char *table, const char *value);
+
+/* forget the pair of a value being written or found stale */
+void global_index_evict(const char *db, const char *table, const char *value);
+
+void global_index_destroy(void);
+
+/* monitor thread, NULL if no index was ever configured */
+GPtrArray *global_index_get_all(void);
+
+const char *global_index_master_addr(global_index_t *);
+
+/**
+ * copy one batch of new pairs, the connection is NULL if not available
+ * @return milliseconds until the next poll
+ */
+int global_index_poll(global_index_t *, MYSQL *);
+
+#endif /* _SHARDING_GLOBAL_INDEX_H_ */
@@ -0,0 +1,1056 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#include "sharding-load-data.h"
+
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+
+#include <mysql.h>
+#include <mysqld_error.h>
+
+#include "cetus-error.h"
+#include "glib-ext.h"
+#include "network-mysqld-packet.h"
+#include "network-mysqld-proto.h"
+#include "plugin-common.h"
+
+/* rows kept for a group before they are queued to it */
+#define LOAD_DATA_FLUSH_SIZE (64 * 1024)
+
+enum load_data_phase_t {
+    LOAD_DATA_REQUESTED,        /* statement sent, the groups will ask for the file */
+    LOAD_DATA_STREAMING,        /* relaying the rows */
+    LOAD_DATA_FINISHING,        /* end of file sent, waiting for the results */
+};
+
+/* the rows of one group */
+typedef struct load_data_target_t {
+    server_session_t *ss;
+    GString *rows;
+} load_data_target_t;
+
+struct sharding_load_data_t {
+    enum load_data_phase_t phase;
+
+    GString *file_name;
+    GString *db;
+    GString *table;
+    GString *sql;               /* sent to the groups */
+    GPtrArray *fields;          /* GPtrArray<char *>, column names or @vars, NULL if not listed */
+    GPtrArray *set_columns;     /* GPtrArray<char *>, assigned by SET */
+
+    GString *field_term;
+    GString *line_term;
+    GString *line_start;
+    int enclosed;               /* -1 if none */
+    int escaped;                /* -1 if none */
+    guint64 ignore_lines;
+
+    sharding_table_t *table_info;   /* NULL if rows are not routed by key */
+    sharding_conf_t *conf;      /* keeps table_info alive across a reload */
+    load_data_route_func route;
+    int key_field;
+
+    GString *pending;           /* file data not ending a row yet */
+    gboolean last_packet_full;  /* an empty packet after it is not the end of the file */
+    GPtrArray *targets;         /* GPtrArray<load_data_target_t *> */
+    GHashTable *target_by_group;    /* group name -> load_data_target_t * */
+    GPtrArray *route_groups;
+    GString *key;
+    guint64 rows;
+
+    int errcode;
+    GString *error;             /* first error, the rest of the file is drained */
+};
+
+static const char *unsafe_charsets[] = {
+    "big5", "cp932", "gb18030", "gbk", "sjis", NULL
+};
+
+static inline gboolean
+is_word_char(unsigned char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '$'
+        || c >= 0x80;
+}
+
+/* blanks and comments */
+static const char *
+skip_blank(const char *p, const char *end)
+{
+    while (p < end) {
+        if (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r' || *p == '\f' || *p == '\v') {
+            ++p;
+        } else if (*p == '#' || (*p == '-' && p + 2 < end && p[1] == '-' && p[2] == ' ')) {
+            while (p < end && *p != '\n') {
+                ++p;
+            }
+        } else if (*p == '/' && p + 1 < end && p[1] == '*') {
+            const char *close = g_strstr_len(p + 2, end - p - 2, "*/");
+            p = close ? close + 2 : end;
+        } else {
+            break;
+        }
+    }
+    return p;
+}
+
+static int
+word_len(const char *p, const char *end)
+{
+    const char *s = p;
+    while (p < end && is_word_char(*p)) {
+        ++p;
+    }
+    return p - s;
+}
+
+/* consume the keyword if it comes next */
+static gboolean
+next_word_is(const char **pp, const char *end, const char *word)
+{
+    const char *p = skip_blank(*pp, end);
+    int len = word_len(p, end);
+    if (len == strlen(word) && strncasecmp(p, word, len) == 0) {
+        *pp = p + len;
+        return TRUE;
+    }
+    return FALSE;
+}
+
+static gboolean
+next_char_is(const char **pp, const char *end, char c)
+{
+    const char *p = skip_blank(*pp, end);
+    if (p < end && *p == c) {
+        *pp = p + 1;
+        return TRUE;
+    }
+    return FALSE;
+}
+
+static char
+unescape_char(char c)
+{
+    switch (c) {
+    case '0':
+        return '\0';
+    case 'b':
+        return '\b';
+    case 'n':
+        return '\n';
+    case 'r':
+        return '\r';
+    case 't':
+        return '\t';
+    case 'Z':
+        return '\032';
+    default:
+        return c;
+    }
+}
+
+/* a quoted string literal, unescaped */
+static gboolean
+scan_string(const char **pp, const char *end, GString *out)
+{
+    const char *p = skip_blank(*pp, end);
+    if (p == end || (*p != '\'' && *p != '"')) {
+        return FALSE;
+    }
+    char quote = *p++;
+    g_string_truncate(out, 0);
+    while (p < end) {
+        if (*p == '\\' && p + 1 < end) {
+            g_string_append_c(out, unescape_char(p[1]));
+            p += 2;
+        } else if (*p == quote) {
+            if (p + 1 < end && p[1] == quote) {
+                g_string_append_c(out, quote);
+                p += 2;
+            } else {
+                *pp = p + 1;
+                return TRUE;
+            }
+        } else {
+            g_string_append_c(out, *p++);
+        }
+    }
+    return FALSE;
+}
+
+/* a plain or back quoted identifier */
+static gboolean
+scan_ident(const char **pp, const char *end, GString *out)
+{
+    const char *p = skip_blank(*pp, end);
+    g_string_truncate(out, 0);
+    if (p < end && *p == '`') {
+        for (++p; p < end; ++p) {
+            if (*p == '`') {
+                if (p + 1 < end && p[1] == '`') {
+                    ++p;
+                } else {
+                    *pp = p + 1;
+                    return out->len > 0;
+                }
+            }
+            g_string_append_c(out, *p);
+        }
+        return FALSE;
+    }
+    int len = word_len(p, end);
+    if (len == 0) {
+        return FALSE;
+    }
+    g_string_append_len(out, p, len);
+    *pp = p + len;
+    return TRUE;
+}
+
+/* (col_name_or_user_var, ...) */
+static gboolean
+scan_fields(const char **pp, const char *end, GPtrArray *fields)
+{
+    GString *name = g_string_new(NULL);
+    const char *p = *pp;
+    gboolean ok = FALSE;
+    if (next_char_is(&p, end, ')')) {
+        ok = TRUE;
+    }
+    while (!ok) {
+        gboolean is_var = next_char_is(&p, end, '@');
+        if (is_var) {
+            if (!scan_ident(&p, end, name) && !scan_string(&p, end, name)) {
+                break;
+            }
+            g_string_prepend_c(name, '@');
+        } else if (!scan_ident(&p, end, name)) {
+            break;
+        }
+        g_ptr_array_add(fields, g_strdup(name->str));
+        if (next_char_is(&p, end, ')')) {
+            ok = TRUE;
+        } else if (!next_char_is(&p, end, ',')) {
+            break;
+        }
+    }
+    g_string_free(name, TRUE);
+    *pp = p;
+    return ok;
+}
+
+/* SET col = expr, ... up to the end of the statement, only the columns are kept */
+static gboolean
+scan_set_list(const char **pp, const char *end, GPtrArray *columns)
+{
+    GString *name = g_string_new(NULL);
+    const char *p = *pp;
+    gboolean ok = FALSE;
+    for (;;) {
+        if (!scan_ident(&p, end, name) || !next_char_is(&p, end, '=')) {
+            break;
+        }
+        g_ptr_array_add(columns, g_strdup(name->str));
+        int depth = 0;
+        while (p < end) {
+            if (*p == '\'' || *p == '"' || *p == '`') {
+                char quote = *p++;
+                while (p < end && *p != quote) {
+                    p += (*p == '\\' && quote != '`') ? 2 : 1;
+                }
+                ++p;
+            } else if (*p == '(') {
+                ++depth;
+                ++p;
+            } else if (*p == ')') {
+                --depth;
+                ++p;
+            } else if ((*p == ',' || *p == ';') && depth == 0) {
+                break;
+            } else {
+                ++p;
+            }
+        }
+        if (p >= end || *p == ';') {
+            ok = TRUE;
+            p = MIN(p, end);
+            break;
+        }
+        ++p;                    /* comma */
+    }
+    g_string_free(name, TRUE);
+    *pp = p;
+    return ok;
+}
+
+/* FIELDS TERMINATED BY .. [OPTIONALLY] ENCLOSED BY .. ESCAPED BY .. */
+static gboolean
+scan_fields_options(sharding_load_data_t *ld, const char **pp, const char *end, GString *err)
+{
+    GString *s = g_string_new(NULL);
+    int n = 0;
+    for (;; ++n) {
+        if (next_word_is(pp, end, "TERMINATED")) {
+            if (!next_word_is(pp, end, "BY") || !scan_string(pp, end, ld->field_term)) {
+                break;
+            }
+        } else if (next_word_is(pp, end, "OPTIONALLY") || next_word_is(pp, end, "ENCLOSED")) {
+            next_word_is(pp, end, "ENCLOSED");
+            if (!next_word_is(pp, end, "BY") || !scan_string(pp, end, s) || s->len > 1) {
+                break;
+            }
+            ld->enclosed = s->len ? (unsigned char)s->str[0] : -1;
+        } else if (next_word_is(pp, end, "ESCAPED")) {
+            if (!next_word_is(pp, end, "BY") || !scan_string(pp, end, s) || s->len > 1) {
+                break;
+            }
+            ld->escaped = s->len ? (unsigned char)s->str[0] : -1;
+        } else {
+            g_string_free(s, TRUE);
+            return n > 0;
+        }
+    }
+    g_string_free(s, TRUE);
+    g_string_assign(err, "(proxy) bad FIELDS options of LOAD DATA");
+    return FALSE;
+}
+
+/* LINES STARTING BY .. TERMINATED BY .. */
+static gboolean
+scan_lines_options(sharding_load_data_t *ld, const char **pp, const char *end)
+{
+    int n = 0;
+    for (;; ++n) {
+        if (next_word_is(pp, end, "STARTING")) {
+            if (!next_word_is(pp, end, "BY") || !scan_string(pp, end, ld->line_start)) {
+                return FALSE;
+            }
+        } else if (next_word_is(pp, end, "TERMINATED")) {
+            if (!next_word_is(pp, end, "BY") || !scan_string(pp, end, ld->line_term)) {
+                return FALSE;
+            }
+        } else {
+            return n > 0;
+        }
+    }
+}
+
+static sharding_load_data_t *
+load_data_alloc(void)
+{
+    sharding_load_data_t *ld = g_new0(sharding_load_data_t, 1);
+    ld->file_name = g_string_new(NULL);
+    ld->db = g_string_new(NULL);
+    ld->table = g_string_new(NULL);
+    ld->sql = g_string_new(NULL);
+    ld->set_columns = g_ptr_array_new_with_free_func(g_free);
+    ld->field_term = g_string_new("\t");
+    ld->line_term = g_string_new("\n");
+    ld->line_start = g_string_new(NULL);
+    ld->enclosed = -1;
+    ld->escaped = '\\';
+    ld->key_field = -1;
+    ld->pending = g_string_new(NULL);
+    ld->targets = g_ptr_array_new();
+    ld->target_by_group = g_hash_table_new(g_str_hash, g_str_equal);
+    ld->route_groups = g_ptr_array_new();
+    ld->key = g_string_new(NULL);
+    ld->error = g_string_new(NULL);
+    return ld;
+}
+
+gboolean
+sharding_load_data_is_statement(const GString *sql)
+{
+    const char *p = sql->str;
+    const char *end = sql->str + strnlen(sql->str, sql->len);
+    return next_word_is(&p, end, "LOAD") && next_word_is(&p, end, "DATA");
+}
+
+sharding_load_data_t *
+sharding_load_data_new(const GString *sql, const char *default_db, GString *err)
+{
+    const char *start = sql->str;
+    const char *end = sql->str + strnlen(sql->str, sql->len);
+    const char *p = start;
+    sharding_load_data_t *ld = load_data_alloc();
+
+    if (!next_word_is(&p, end, "LOAD") || !next_word_is(&p, end, "DATA")) {
+        goto syntax_error;
+    }
+    if (!next_word_is(&p, end, "LOW_PRIORITY")) {
+        next_word_is(&p, end, "CONCURRENT");
+    }
+    if (!next_word_is(&p, end, "LOCAL")) {
+        g_string_assign(err, "(proxy) LOAD DATA INFILE is only supported with LOCAL");
+        goto error;
+    }
+    if (!next_word_is(&p, end, "INFILE") || !scan_string(&p, end, ld->file_name)) {
+        goto syntax_error;
+    }
+    if (!next_word_is(&p, end, "REPLACE")) {
+        next_word_is(&p, end, "IGNORE");
+    }
+    if (!next_word_is(&p, end, "INTO") || !next_word_is(&p, end, "TABLE") || !scan_ident(&p, end, ld->table)) {
+        goto syntax_error;
+    }
+    if (next_char_is(&p, end, '.')) {
+        g_string_assign_len(ld->db, S(ld->table));
+        if (!scan_ident(&p, end, ld->table)) {
+            goto syntax_error;
+        }
+    } else {
+        g_string_assign(ld->db, default_db);
+    }
+    if (next_word_is(&p, end, "PARTITION")) {
+        g_string_assign(err, "(proxy) LOAD DATA into a PARTITION is not supported");
+        goto error;
+    }
+    if (next_word_is(&p, end, "CHARSET") || (next_word_is(&p, end, "CHARACTER") && next_word_is(&p, end, "SET"))) {
+        GString *charset = g_string_new(NULL);
+        gboolean ok = scan_ident(&p, end, charset) || scan_string(&p, end, charset);
+        int i;
+        for (i = 0; ok && unsafe_charsets[i]; ++i) {
+            if (strcasecmp(charset->str, unsafe_charsets[i]) == 0) {
+                g_string_printf(err, "(proxy) LOAD DATA in character set %s is not supported", charset->str);
+                g_string_free(charset, TRUE);
+                goto error;
+            }
+        }
+        g_string_free(charset, TRUE);
+        if (!ok) {
+            goto syntax_error;
+        }
+    }
+    if (next_word_is(&p, end, "FIELDS") || next_word_is(&p, end, "COLUMNS")) {
+        if (!scan_fields_options(ld, &p, end, err)) {
+            goto error;
+        }
+    }
+    if (next_word_is(&p, end, "LINES")) {
+        if (!scan_lines_options(ld, &p, end)) {
+            goto syntax_error;
+        }
+    }
+    if (ld->field_term->len == 0 || ld->line_term->len == 0) {
+        g_string_assign(err, "(proxy) LOAD DATA with empty terminators is not supported");
+        goto error;
+    }
+
+    /* the groups get the file without the ignored lines */
+    const char *ignore_start = p;
+    const char *ignore_end = p;
+    if (next_word_is(&p, end, "IGNORE")) {
+        const char *digits = skip_blank(p, end);
+        int len = word_len(digits, end);
+        char *num_end = NULL;
+        ld->ignore_lines = g_ascii_strtoull(digits, &num_end, 10);
+        if (len == 0 || num_end != digits + len) {
+            goto syntax_error;
+        }
+        p = digits + len;
+        if (!next_word_is(&p, end, "LINES") && !next_word_is(&p, end, "ROWS")) {
+            goto syntax_error;
+        }
+        ignore_end = p;
+    }
+    if (next_char_is(&p, end, '(')) {
+        ld->fields = g_ptr_array_new_with_free_func(g_free);
+        if (!scan_fields(&p, end, ld->fields)) {
+            goto syntax_error;
+        }
+    }
+    if (next_word_is(&p, end, "SET")) {
+        if (!scan_set_list(&p, end, ld->set_columns)) {
+            goto syntax_error;
+        }
+    }
+    next_char_is(&p, end, ';');
+    if (skip_blank(p, end) != end) {
+        goto syntax_error;
+    }
+
+    g_string_append_len(ld->sql, start, ignore_start - start);
+    g_string_append_len(ld->sql, ignore_end, end - ignore_end);
+    return ld;
+
+  syntax_error:
+    g_string_assign(err, "(proxy) LOAD DATA syntax not recognized");
+  error:
+    sharding_load_data_free(ld);
+    return NULL;
+}
+
+void
+sharding_load_data_free(sharding_load_data_t *ld)
+{
+    if (!ld)
+        return;
+    g_string_free(ld->file_name, TRUE);
+    g_string_free(ld->db, TRUE);
+    g_string_free(ld->table, TRUE);
+    g_string_free(ld->sql, TRUE);
+    if (ld->fields) {
+        g_ptr_array_free(ld->fields, TRUE);
+    }
+    g_ptr_array_free(ld->set_columns, TRUE);
+    g_string_free(ld->field_term, TRUE);
+    g_string_free(ld->line_term, TRUE);
+    g_string_free(ld->line_start, TRUE);
+    g_string_free(ld->pending, TRUE);
+    int i;
+    for (i = 0; i < ld->targets->len; ++i) {
+        load_data_target_t *t = g_ptr_array_index(ld->targets, i);
+        g_string_free(t->rows, TRUE);
+        g_free(t);
+    }
+    g_ptr_array_free(ld->targets, TRUE);
+    g_hash_table_destroy(ld->target_by_group);
+    g_ptr_array_free(ld->route_groups, TRUE);
+    g_string_free(ld->key, TRUE);
+    g_string_free(ld->error, TRUE);
+    if (ld->conf) {
+        shard_conf_release(ld->conf);
+    }
+    g_free(ld);
+}
+
+const char *
+sharding_load_data_db(sharding_load_data_t *ld)
+{
+    return ld->db->str;
+}
+
+const char *
+sharding_load_data_table(sharding_load_data_t *ld)
+{
+    return ld->table->str;
+}
+
+GString *
+sharding_load_data_sql(sharding_load_data_t *ld)
+{
+    return ld->sql;
+}
+
+gboolean
+sharding_load_data_set_key(sharding_load_data_t *ld, sharding_table_t *info, load_data_route_func route, GString *err)
+{
+    int i;
+    for (i = 0; i < ld->set_columns->len; ++i) {
+        if (strcasecmp(g_ptr_array_index(ld->set_columns, i), info->pkey->str) == 0) {
+            g_string_assign(err, "(proxy) LOAD DATA can't SET the sharding key");
+            return FALSE;
+        }
+    }
+    for (i = 0; ld->fields && i < ld->fields->len; ++i) {
+        if (strcasecmp(g_ptr_array_index(ld->fields, i), info->pkey->str) == 0) {
+            ld->key_field = i;
+            break;
+        }
+    }
+    if (ld->key_field < 0) {
+        g_string_assign(err, "(proxy) LOAD DATA needs the sharding key in its column list");
+        return FALSE;
+    }
+    ld->table_info = info;
+    ld->conf = shard_conf_acquire();
+    ld->route = route;
+    return TRUE;
+}
+
+gboolean
+sharding_load_data_is_streaming(sharding_load_data_t *ld)
+{
+    return ld->phase == LOAD_DATA_STREAMING;
+}
+
+gboolean
+sharding_load_data_is_started(sharding_load_data_t *ld)
+{
+    return ld->phase != LOAD_DATA_REQUESTED;
+}
+
+static void
+load_data_set_error(sharding_load_data_t *ld, int errcode, const char *fmt, ...)
+{
+    if (ld->error->len) {
+        return;
+    }
+    va_list args;
+    va_start(args, fmt);
+    g_string_vprintf(ld->error, fmt, args);
+    va_end(args);
+    ld->errcode = errcode;
+    g_string_truncate(ld->pending, 0);
+}
+
+static inline gboolean
+term_at(const char *p, const char *end, const GString *term)
+{
+    return end - p >= term->len && memcmp(p, term->str, term->len) == 0;
+}
+
+/* the data ends inside the terminator, more is needed to tell */
+static inline gboolean
+term_cut_at(const char *p, const char *end, const GString *term)
+{
+    return end - p < term->len && memcmp(p, term->str, end - p) == 0;
+}
+
+/**
+ * find the end of the row at p, the key field is decoded on the way
+ * @return past the line terminator, NULL if more data is needed
+ */
+static const char *
+scan_row(sharding_load_data_t *ld, const char *p, const char *end, gboolean at_eof,
+         gboolean *key_found, gboolean *key_null)
+{
+    int field;
+    *key_found = FALSE;
+    for (field = 0;; ++field) {
+        gboolean is_key = (field == ld->key_field);
+        gboolean quoted = (ld->enclosed >= 0 && p < end && (unsigned char)*p == ld->enclosed);
+        const char *value = p;
+        if (is_key) {
+            g_string_truncate(ld->key, 0);
+        }
+        if (quoted) {
+            for (++p;; ++p) {
+                if (p == end) {
+                    if (!at_eof) {
+                        return NULL;
+                    }
+                    break;
+                }
+                if ((unsigned char)*p == ld->escaped && p + 1 < end) {
+                    if (is_key) {
+                        g_string_append_c(ld->key, unescape_char(p[1]));
+                    }
+                    ++p;
+                    continue;
+                }
+                if ((unsigned char)*p == ld->escaped && !at_eof) {
+                    return NULL;
+                }
+                if ((unsigned char)*p == ld->enclosed) {
+                    const char *next = p + 1;
+                    if (next < end && (unsigned char)*next == ld->enclosed) {
+                        if (is_key) {
+                            g_string_append_c(ld->key, *p);
+                        }
+                        ++p;
+                        continue;
+                    }
+                    if (next == end && at_eof) {
+                        p = next;
+                        break;
+                    }
+                    if (term_at(next, end, ld->field_term) || term_at(next, end, ld->line_term)) {
+                        p = next;
+                        break;
+                    }
+                    if (!at_eof && (next == end || term_cut_at(next, end, ld->field_term)
+                                    || term_cut_at(next, end, ld->line_term))) {
+                        return NULL;
+                    }
+                }
+                if (is_key) {
+                    g_string_append_c(ld->key, *p);
+                }
+            }
+        } else {
+            for (;; ++p) {
+                if (p == end) {
+                    if (!at_eof) {
+                        return NULL;
+                    }
+                    break;
+                }
+                if ((unsigned char)*p == ld->escaped && p + 1 < end) {
+                    if (is_key) {
+                        g_string_append_c(ld->key, unescape_char(p[1]));
+                    }
+                    ++p;
+                    continue;
+                }
+                if ((unsigned char)*p == ld->escaped && !at_eof) {
+                    return NULL;
+                }
+                if (term_at(p, end, ld->line_term) || term_at(p, end, ld->field_term)) {
+                    break;
+                }
+                if (!at_eof && (term_cut_at(p, end, ld->line_term) || term_cut_at(p, end, ld->field_term))) {
+                    return NULL;
+                }
+                if (is_key) {
+                    g_string_append_c(ld->key, *p);
+                }
+            }
+        }
+        if (is_key) {
+            *key_found = TRUE;
+            /* \N, or the word NULL when fields may be enclosed */
+            *key_null = !quoted && ((p - value == 2 && (unsigned char)value[0] == ld->escaped && value[1] == 'N')
+                                    || (ld->enclosed >= 0 && p - value == 4 && strncmp(value, "NULL", 4) == 0));
+        }
+        if (p == end) {
+            return end;
+        }
+        if (term_at(p, end, ld->line_term)) {
+            return p + ld->line_term->len;
+        }
+        p += ld->field_term->len;
+    }
+}
+
+static void
+load_data_flush(load_data_target_t *t)
+{
+    if (t->rows->len > 0) {
+        network_socket *server = t->ss->server;
+        network_mysqld_queue_append(server, server->send_queue, S(t->rows));
+        g_string_truncate(t->rows, 0);
+    }
+}
+
+static void
+load_data_add_row(sharding_load_data_t *ld, load_data_target_t *t, const char *row, gsize len, gboolean terminated)
+{
+    g_string_append_len(t->rows, row, len);
+    if (!terminated) {
+        g_string_append_len(t->rows, S(ld->line_term));
+    }
+    if (t->rows->len >= LOAD_DATA_FLUSH_SIZE) {
+        load_data_flush(t);
+    }
+}
+
+static void
+load_data_route_row(sharding_load_data_t *ld, const char *row, gsize len, gboolean terminated,
+                    gboolean key_found, gboolean key_null)
+{
+    int i;
+    ld->rows++;
+    if (!ld->route) {
+        for (i = 0; i < ld->targets->len; ++i) {
+            load_data_add_row(ld, g_ptr_array_index(ld->targets, i), row, len, terminated);
+        }
+        return;
+    }
+    if (!key_found || key_null) {
+        load_data_set_error(ld, ER_CETUS_PARSE_SHARDING, "(proxy) no sharding key in line %llu of LOAD DATA",
+                            (unsigned long long)(ld->rows + ld->ignore_lines));
+        return;
+    }
+    g_ptr_array_set_size(ld->route_groups, 0);
+    if (ld->route(ld->table_info, ld->key->str, ld->route_groups) != 0) {
+        load_data_set_error(ld, ER_CETUS_PARSE_SHARDING, "(proxy) no partition for sharding key '%s' of LOAD DATA",
+                            ld->key->str);
+        return;
+    }
+    for (i = 0; i < ld->route_groups->len; ++i) {
+        GString *group = g_ptr_array_index(ld->route_groups, i);
+        load_data_target_t *t = g_hash_table_lookup(ld->target_by_group, group->str);
+        if (!t) {
+            load_data_set_error(ld, ER_CETUS_PARSE_SHARDING, "(proxy) group %s is not ready for LOAD DATA",
+                                group->str);
+            return;
+        }
+        load_data_add_row(ld, t, row, len, terminated);
+    }
+}
+
+/* relay the complete rows of the pending data */
+static void
+load_data_scan(sharding_load_data_t *ld, gboolean at_eof, int max_row_len)
+{
+    const char *p = ld->pending->str;
+    const char *end = ld->pending->str + ld->pending->len;
+    while (p < end && !ld->error->len) {
+        const char *row = p;
+        if (ld->line_start->len > 0) {
+            row = g_strstr_len(p, end - p, ld->line_start->str);
+            if (!row) {
+                /* not a row, but the prefix might be cut */
+                p = at_eof ? end : MAX(p, end - (ld->line_start->len - 1));
+                break;
+            }
+            p = row + ld->line_start->len;
+        }
+        gboolean key_found, key_null;
+        const char *row_end = scan_row(ld, p, end, at_eof, &key_found, &key_null);
+        if (!row_end) {
+            p = row;
+            break;
+        }
+        p = row_end;
+        if (ld->ignore_lines > 0) {
+            ld->ignore_lines--;
+            continue;
+        }
+        gboolean terminated = row_end - row >= ld->line_term->len
+            && memcmp(row_end - ld->line_term->len, ld->line_term->str, ld->line_term->len) == 0;
+        load_data_route_row(ld, row, row_end - row, terminated, key_found, key_null);
+    }
+    if (ld->error->len) {
+        return;
+    }
+    g_string_erase(ld->pending, 0, p - ld->pending->str);
+    if (ld->pending->len > max_row_len) {
+        load_data_set_error(ld, ER_CETUS_NOT_SUPPORTED, "(proxy) line %llu of LOAD DATA is longer than %d bytes",
+                            (unsigned long long)(ld->rows + ld->ignore_lines + 1), max_row_len);
+    }
+}
+
+static void
+load_data_done(network_mysqld_con *con)
+{
+    sharding_load_data_free(con->load_data);
+    con->load_data = NULL;
+    con->client->is_server_conn_reserved = 0;
+    con->resultset_is_finished = TRUE;
+    con->state = ST_SEND_QUERY_RESULT;
+}
+
+/* end of file from the client, end the file of every group */
+static void
+load_data_finish(network_mysqld_con *con)
+{
+    sharding_load_data_t *ld = con->load_data;
+    int i;
+
+    if (ld->error->len) {
+        g_message("%s: LOAD DATA failed after %llu rows: %s, sql:%s",
+                  G_STRLOC, (unsigned long long)ld->rows, ld->error->str, con->orig_sql->str);
+        network_mysqld_con_send_error_full(con->client, S(ld->error), ld->errcode, "HY000");
+        con->server_to_be_closed = 1;   /* the groups are still waiting for the file */
+        load_data_done(con);
+        return;
+    }
+
+    con->resp_expected_num = 0;
+    for (i = 0; i < ld->targets->len; ++i) {
+        load_data_target_t *t = g_ptr_array_index(ld->targets, i);
+        load_data_flush(t);
+        network_mysqld_queue_append(t->ss->server, t->ss->server->send_queue, "", 0);
+        t->ss->server->parse.qs_state = PARSE_COM_QUERY_INIT;
+        con->resp_expected_num++;
+    }
+    ld->phase = LOAD_DATA_FINISHING;
+    con->state = ST_SEND_QUERY;
+}
+
+void
+sharding_load_data_read(network_mysqld_con *con)
+{
+    sharding_load_data_t *ld = con->load_data;
+    GQueue *chunks = con->client->recv_queue->chunks;
+    gboolean eof = FALSE;
+    GString *packet;
+
+    while ((packet = g_queue_pop_head(chunks))) {
+        gsize len = packet->len - NET_HEADER_SIZE;
+        if (len == 0 && !ld->last_packet_full) {
+            eof = TRUE;
+            g_string_free(packet, TRUE);
+            break;
+        }
+        ld->last_packet_full = (len == PACKET_LEN_MAX);
+        if (!ld->error->len) {
+            g_string_append_len(ld->pending, packet->str + NET_HEADER_SIZE, len);
+        }
+        g_string_free(packet, TRUE);
+    }
+
+    if (!ld->error->len) {
+        load_data_scan(ld, eof, con->srv->cetus_max_allowed_packet);
+    }
+    if (eof) {
+        load_data_finish(con);
+        return;
+    }
+
+    int i;
+    con->state = ST_READ_QUERY;
+    for (i = 0; i < ld->targets->len; ++i) {
+        load_data_target_t *t = g_ptr_array_index(ld->targets, i);
+        if (!g_queue_is_empty(t->ss->server->send_queue->chunks)) {
+            con->state = ST_SEND_QUERY;
+            break;
+        }
+    }
+}
+
+/* every group answered the statement, ask the client for the file */
+static void
+load_data_start(network_mysqld_con *con)
+{
+    sharding_load_data_t *ld = con->load_data;
+    GString *err_packet = NULL;
+    int i, asked = 0, participated = 0;
+
+    for (i = 0; i < con->servers->len; ++i) {
+        server_session_t *ss = g_ptr_array_index(con->servers, i);
+        if (!ss->participated) {
+            continue;
+        }
+        participated++;
+        GString *pkt = g_queue_peek_head(ss->server->recv_queue->chunks);
+        if (pkt && pkt->len > NET_HEADER_SIZE && (guchar)pkt->str[NET_HEADER_SIZE] == MYSQLD_PACKET_NULL) {
+            asked++;
+        } else if (pkt && !err_packet) {
+            err_packet = g_queue_pop_head(ss->server->recv_queue->chunks);
+        }
+    }
+
+    if (asked == 0 || asked != participated) {
+        con->client->packet_id_is_reset = FALSE;
+        if (err_packet) {
+            network_mysqld_queue_append_raw(con->client, con->client->send_queue, err_packet);
+        } else {
+            network_mysqld_con_send_error_full(con->client, C("(proxy) LOAD DATA LOCAL INFILE refused by a group"),
+                                               ER_CETUS_NOT_SUPPORTED, "HY000");
+        }
+        if (asked > 0) {
+            con->server_to_be_closed = 1;   /* they are waiting for the file */
+        }
+        remove_mul_server_recv_packets(con);
+        load_data_done(con);
+        return;
+    }
+
+    remove_mul_server_recv_packets(con);
+    for (i = 0; i < con->servers->len; ++i) {
+        server_session_t *ss = g_ptr_array_index(con->servers, i);
+        if (!ss->participated) {
+            continue;
+        }
+        load_data_target_t *t = g_new0(load_data_target_t, 1);
+        t->ss = ss;
+        t->rows = g_string_sized_new(LOAD_DATA_FLUSH_SIZE);
+        g_ptr_array_add(ld->targets, t);
+        g_hash_table_insert(ld->target_by_group, ss->server->group->str, t);
+        /* the file follows the request of the server */
+        ss->server->packet_id_is_reset = FALSE;
+        ss->server->last_packet_id = 1;
+    }
+
+    GString *request = g_string_new(NULL);
+    g_string_append_c(request, (char)MYSQLD_PACKET_NULL);
+    g_string_append_len(request, S(ld->file_name));
+    con->client->packet_id_is_reset = FALSE;
+    con->client->last_packet_id = 0;
+    network_mysqld_queue_append(con->client, con->client->send_queue, S(request));
+    g_string_free(request, TRUE);
+
+    /* the connections are in the middle of a statement until the end of the file */
+    con->client->is_server_conn_reserved = 1;
+    ld->phase = LOAD_DATA_STREAMING;
+    con->resultset_is_finished = TRUE;
+    con->state = ST_SEND_QUERY_RESULT;
+}
+
+/* every group answered the end of the file */
+static void
+load_data_end(network_mysqld_con *con)
+{
+    sharding_load_data_t *ld = con->load_data;
+    GString *err_packet = NULL;
+    guint64 affected_rows = 0;
+    guint32 warnings = 0;
+    int i, ok = 0, participated = 0;
+
+    for (i = 0; i < con->servers->len; ++i) {
+        server_session_t *ss = g_ptr_array_index(con->servers, i);
+        if (!ss->participated) {
+            continue;
+        }
+        participated++;
+        GString *pkt = g_queue_peek_head(ss->server->recv_queue->chunks);
+        if (!pkt || pkt->len <= NET_HEADER_SIZE) {
+            continue;
+        }
+        switch ((guchar)pkt->str[NET_HEADER_SIZE]) {
+        case MYSQLD_PACKET_OK:{
+            network_packet packet = { pkt, 0 };
+            network_mysqld_ok_packet_t one_ok;
+            network_mysqld_proto_skip_network_header(&packet);
+            if (!network_mysqld_proto_get_ok_packet(&packet, &one_ok)) {
+                affected_rows += one_ok.affected_rows;
+                warnings += one_ok.warnings;
+                ok++;
+            }
+            break;
+        }
+        case MYSQLD_PACKET_ERR:
+            if (!err_packet) {
+                err_packet = g_queue_pop_head(ss->server->recv_queue->chunks);
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    if (ok == participated) {
+        if (!ld->route && participated > 0) {
+            affected_rows /= participated;  /* the same rows on every group */
+        }
+        network_mysqld_con_send_ok_full(con->client, affected_rows, 0, SERVER_STATUS_AUTOCOMMIT, warnings);
+    } else {
+        if (ok > 0) {
+            g_warning("%s: LOAD DATA committed on %d of %d groups, sql:%s",
+                      G_STRLOC, ok, participated, con->orig_sql->str);
+        }
+        if (err_packet) {
+            network_mysqld_queue_append_raw(con->client, con->client->send_queue, err_packet);
+        } else {
+            network_mysqld_con_send_error_full(con->client, C("(proxy) LOAD DATA got no result from a group"),
+                                               ER_CETUS_UNKNOWN, "HY000");
+            con->server_to_be_closed = 1;
+        }
+    }
+    remove_mul_server_recv_packets(con);
+    load_data_done(con);
+}
+
+void
+sharding_load_data_dispatch_resp(network_mysqld_con *con)
+{
+    if (con->load_data->phase == LOAD_DATA_REQUESTED) {
+        load_data_start(con);
+    } else {
+        load_data_end(con);
+    }
+}
+
+void
+sharding_load_data_write_failed(network_mysqld_con *con, server_session_t *ss)
+{
+    g_warning("%s: LOAD DATA write error to group %s for con:%p", G_STRLOC, ss->server->group->str, con);
+    network_queue_clear(ss->server->send_queue);
+    load_data_set_error(con->load_data, ER_NET_ERROR_ON_WRITE, "(proxy) write error to group %s",
+                        ss->server->group->str);
+    con->server_to_be_closed = 1;
+}
@@ -0,0 +1,86 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#ifndef _SHARDING_LOAD_DATA_H_
+#define _SHARDING_LOAD_DATA_H_
+
+/**
+ * LOAD DATA LOCAL INFILE on sharded tables
+ *
+ * The statement goes to every group the table lives in. Once all of them
+ * ask for the file, the client is asked for it, and the rows it sends are
+ * split by their sharding key and relayed to the groups as they come.
+ * The client is not read while a group still has data to be written.
+ */
+
+#include <glib.h>
+
+#include "network-mysqld.h"
+#include "sharding-config.h"
+
+typedef struct sharding_load_data_t sharding_load_data_t;
+
+/**
+ * append the write groups of a sharding key given as text
+ * @return 0 on success, -1 if no partition holds the key
+ */
+typedef int (*load_data_route_func) (sharding_table_t *, const char *key, GPtrArray *groups);
+
+/* is it a LOAD DATA statement, LOCAL or not */
+gboolean sharding_load_data_is_statement(const GString *sql);
+
+/**
+ * parse the statement
+ * @return NULL with the reason in err if it can't be relayed
+ */
+sharding_load_data_t *sharding_load_data_new(const GString *sql, const char *default_db, GString *err);
+
+void sharding_load_data_free(sharding_load_data_t *);
+
+const char *sharding_load_data_db(sharding_load_data_t *);
+
+const char *sharding_load_data_table(sharding_load_data_t *);
+
+/* the statement sent to the groups, IGNORE n LINES is applied by the proxy */
+GString *sharding_load_data_sql(sharding_load_data_t *);
+
+/**
+ * rows are routed by the sharding key of the table,
+ * without it (single and global tables) every row goes to every group
+ * @return FALSE with the reason in err if the key can't be found in the rows
+ */
+gboolean sharding_load_data_set_key(sharding_load_data_t *, sharding_table_t *, load_data_route_func, GString *err);
+
+/* the file is being relayed, no response is expected from the groups */
+gboolean sharding_load_data_is_streaming(sharding_load_data_t *);
+
+/* the groups are in the middle of the statement, reading the file */
+gboolean sharding_load_data_is_started(sharding_load_data_t *);
+
+/* relay the file packets read from the client */
+void sharding_load_data_read(network_mysqld_con *);
+
+/* all groups have answered the statement or the end of the file */
+void sharding_load_data_dispatch_resp(network_mysqld_con *);
+
+/* a group can't be written any more, the load fails at the end of the file */
+void sharding_load_data_write_failed(network_mysqld_con *, server_session_t *);
+
+#endif /* _SHARDING_LOAD_DATA_H_ */
@@ -0,0 +1,764 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#include "sharding-migration.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "cetus-util.h"
+#include "network-backend.h"
+#include "network-mysqld.h"
+#include "sharding-config.h"
+
+#define MIGRATION_BATCH_INTERVAL 100    /* ms */
+#define MIGRATION_RETRY_INTERVAL 1000   /* ms */
+#define MIGRATION_IDLE_INTERVAL 1000    /* ms */
+#define MIGRATION_MAX_ERRORS 30
+#define MIGRATION_QUIESCE_WAIT 500  /* ms a batch waits for the dual writes in flight */
+#define MIGRATION_QUIESCE_POLL 5    /* ms */
+#define MIGRATION_BUSY (-2)
+
+enum migration_state_t {
+    MIGRATION_COPYING,          /* dual writes, backfill by the monitor thread */
+    MIGRATION_CUTOVER,          /* copied, waiting for the event loop to switch routing */
+    MIGRATION_CLEANUP,          /* routed to the new group, deleting from the old one */
+    MIGRATION_DONE,
+    MIGRATION_FAILED,
+    MIGRATION_CANCELLED,
+};
+
+static const char *migration_state_names[] = {
+    "copying", "cutover", "cleanup", "done", "failed", "cancelled"
+};
+
+struct migration_table_t {
+    char *db;
+    char *name;
+    char *key;                  /* sharding key, also used to page through the rows */
+    GString *cursor;            /* last key copied, NULL before the first batch */
+};
+
+struct shard_migration_t {
+    chassis *chas;
+    int vdb_id;
+    int index;
+    char *from_group;
+    char *to_group;
+    char *from_addr;
+    char *to_addr;
+
+    /* partition bounds, copied for the monitor thread */
+    int method;
+    int key_type;
+    int logic_shard_num;
+    int64_t low;
+    int64_t high;
+    char *low_str;
+    char *high_str;
+    GString *hash_values;
+
+    /* only used by the monitor thread */
+    GPtrArray *tables;          /* GPtrArray<struct migration_table_t *> */
+    int table_index;
+    int batch_size;
+    int errors;
+    gint64 paused_since;        /* dual writes held since, 0 if not */
+
+    /* only used by the event loop thread */
+    gboolean dual_write;        /* the current configuration has migrate_to set */
+
+    volatile gint state;
+    volatile gint rows_copied;
+    volatile gint rows_deleted;
+};
+
+/* the last move, only used by the event loop thread */
+static shard_migration_t *current = NULL;
+
+/* the move the monitor thread works on, it lets go when the move is over */
+static shard_migration_t *volatile active = NULL;
+
+/* connections writing to both groups, and set while a batch is copied */
+static volatile gint dual_writers = 0;
+static volatile gint copy_gate = 0;
+
+/* the monitor thread wakes up the event loop when the gate opens or the copy is over */
+static int wake_fd = -1;
+static struct event wake_event;
+
+/* connections waiting for the gate to open, event loop thread */
+static GQueue gate_waiters = G_QUEUE_INIT;
+static GQueue *gate_waking = NULL;
+
+static void
+migration_table_free(struct migration_table_t *t)
+{
+    g_free(t->db);
+    g_free(t->name);
+    g_free(t->key);
+    if (t->cursor) {
+        g_string_free(t->cursor, TRUE);
+    }
+    g_free(t);
+}
+
+static void
+migration_free(shard_migration_t *job)
+{
+    g_free(job->from_group);
+    g_free(job->to_group);
+    g_free(job->from_addr);
+    g_free(job->to_addr);
+    g_free(job->low_str);
+    g_free(job->high_str);
+    g_string_free(job->hash_values, TRUE);
+    g_ptr_array_free(job->tables, TRUE);
+    g_free(job);
+}
+
+static gboolean
+migration_is_over(int state)
+{
+    return state == MIGRATION_DONE || state == MIGRATION_FAILED || state == MIGRATION_CANCELLED;
+}
+
+static const char *
+group_master_addr(network_backends_t *bs, const char *group)
+{
+    GString *name = g_string_new(group);
+    network_group_t *gp = network_backends_get_group(bs, name);
+    g_string_free(name, TRUE);
+    if (!gp || !gp->master) {
+        return NULL;
+    }
+    return gp->master->addr->name->str;
+}
+
+/* event loop thread, after the copy is done or failed */
+static void
+migration_route(shard_migration_t *job)
+{
+    int state = g_atomic_int_get(&job->state);
+    if (state == MIGRATION_FAILED && job->dual_write) {
+        shard_conf_update_partition(job->vdb_id, job->index, NULL, NULL);
+        job->dual_write = FALSE;
+        return;
+    }
+    if (state != MIGRATION_CUTOVER) {
+        return;                 /* cancelled in between */
+    }
+    if (!shard_conf_update_partition(job->vdb_id, job->index, job->to_group, NULL)) {
+        g_atomic_int_set(&job->state, MIGRATION_FAILED);
+        g_critical("%s: partition %d of vdb %d is gone, move failed", G_STRLOC, job->index, job->vdb_id);
+        return;
+    }
+    job->dual_write = FALSE;
+    g_atomic_int_set(&job->state, MIGRATION_CLEANUP);
+    g_message("%s: partition %d of vdb %d is now on group %s, update the sharding config to keep it",
+              G_STRLOC, job->index, job->vdb_id, job->to_group);
+}
+
+static void
+migration_wake_handler(int fd, short what, void *arg)
+{
+    uint64_t n;
+    if (read(fd, &n, sizeof(n)) != sizeof(n) && errno != EAGAIN) {
+        g_critical("%s:read eventfd failed: %s", G_STRLOC, g_strerror(errno));
+    }
+
+    if (current) {
+        migration_route(current);
+    }
+
+    /* the ones finding the gate closed again wait for the next wakeup */
+    GQueue waking = gate_waiters;
+    g_queue_init(&gate_waiters);
+    gate_waking = &waking;
+    network_mysqld_con *con;
+    while ((con = g_queue_pop_head(&waking))) {
+        con->is_wait_write_gate = 0;
+        network_mysqld_con_handle(-1, 0, con);
+    }
+    gate_waking = NULL;
+}
+
+static gboolean
+migration_wake_init(chassis *chas)
+{
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd == -1) {
+        g_critical("%s:eventfd failed: %s", G_STRLOC, g_strerror(errno));
+        return FALSE;
+    }
+    event_set(&wake_event, wake_fd, EV_READ | EV_PERSIST, migration_wake_handler, NULL);
+    event_base_set(chas->event_base, &wake_event);
+    event_add(&wake_event, NULL);
+    return TRUE;
+}
+
+/* monitor thread */
+static void
+migration_wake(void)
+{
+    uint64_t one = 1;
+    if (write(wake_fd, &one, sizeof(one)) != sizeof(one)) {
+        g_critical("%s:write eventfd failed: %s", G_STRLOC, g_strerror(errno));
+    }
+}
+
+static void
+migration_resume_writes(shard_migration_t *job)
+{
+    if (job->paused_since) {
+        job->paused_since = 0;
+        g_atomic_int_set(&copy_gate, 0);
+        migration_wake();
+    }
+}
+
+
+/**
+ * hold new dual writes, the rows of the old group are final once the ones
+ * in flight are over, until migration_resume_writes()
+ * @return 0 when they are over, else milliseconds to check again, or
+ * MIGRATION_BUSY if they took too long
+ */
+static int
+migration_pause_writes(shard_migration_t *job)
+{
+    gint64 now = g_get_monotonic_time();
+    if (!job->paused_since) {
+        job->paused_since = now;
+        g_atomic_int_set(&copy_gate, 1);
+    }
+    if (g_atomic_int_get(&dual_writers) == 0) {
+        return 0;
+    }
+    if (now - job->paused_since >= MIGRATION_QUIESCE_WAIT * 1000) {
+        migration_resume_writes(job);
+        return MIGRATION_BUSY;
+    }
+    return MIGRATION_QUIESCE_POLL;
+}
+
+gboolean
+shard_migration_start(chassis *chas, int vdb_id, int index, const char *group, GString *errmsg)
+{
+    if (current && !migration_is_over(g_atomic_int_get(&current->state))) {
+        g_string_printf(errmsg, "partition %d of vdb %d is being moved", current->index, current->vdb_id);
+        return FALSE;
+    }
+    if (g_atomic_pointer_get(&active)) {
+        g_string_assign(errmsg, "last move is still stopping, try later");
+        return FALSE;
+    }
+    if (chas->disable_threads || !chas->default_username) {
+        g_string_assign(errmsg, "moving partitions needs the monitor thread and default-username");
+        return FALSE;
+    }
+
+    sharding_vdb_t *vdb = NULL;
+    GList *l;
+    for (l = shard_conf_get_vdbs(); l; l = l->next) {
+        sharding_vdb_t *v = l->data;
+        if (v->id == vdb_id) {
+            vdb = v;
+            break;
+        }
+    }
+    if (!vdb || index < 0 || index >= vdb->partitions->len) {
+        g_string_printf(errmsg, "no partition %d in vdb %d", index, vdb_id);
+        return FALSE;
+    }
+    if (vdb->method == SHARD_METHOD_HASH && vdb->key_type == SHARD_DATA_TYPE_STR) {
+        g_string_assign(errmsg, "partitions hashed by string can't be moved");
+        return FALSE;
+    }
+    int i;
+    for (i = 0; i < vdb->partitions->len; ++i) {
+        sharding_partition_t *p = g_ptr_array_index(vdb->partitions, i);
+        if (strcmp(p->group_name->str, group) == 0) {
+            g_string_printf(errmsg, "group %s is already used by vdb %d", group, vdb_id);
+            return FALSE;
+        }
+    }
+    for (l = shard_conf_get_tables(); l; l = l->next) {
+        sharding_table_t *table = l->data;
+        if (table->vdb_id == vdb_id && table->index_group && strcmp(table->index_group->str, group) == 0) {
+            g_string_printf(errmsg, "group %s holds the global index of %s", group, table->name->str);
+            return FALSE;
+        }
+    }
+    sharding_partition_t *part = g_ptr_array_index(vdb->partitions, index);
+    network_backends_t *bs = chas->priv->backends;
+    const char *from_addr = group_master_addr(bs, part->group_name->str);
+    const char *to_addr = group_master_addr(bs, group);
+    if (!from_addr || !to_addr) {
+        g_string_printf(errmsg, "no master for group %s", from_addr ? group : part->group_name->str);
+        return FALSE;
+    }
+
+    GPtrArray *tables = g_ptr_array_new_with_free_func((GDestroyNotify) migration_table_free);
+    for (l = shard_conf_get_tables(); l; l = l->next) {
+        sharding_table_t *table = l->data;
+        if (table->vdb_id == vdb_id) {
+            struct migration_table_t *t = g_new0(struct migration_table_t, 1);
+            t->db = g_strdup(table->db->str);
+            t->name = g_strdup(table->name->str);
+            t->key = g_strdup(table->pkey->str);
+            g_ptr_array_add(tables, t);
+        }
+    }
+    if (tables->len == 0) {
+        g_ptr_array_free(tables, TRUE);
+        g_string_printf(errmsg, "no table in vdb %d", vdb_id);
+        return FALSE;
+    }
+
+    shard_migration_t *job = g_new0(shard_migration_t, 1);
+    job->chas = chas;
+    job->vdb_id = vdb_id;
+    job->index = index;
+    job->from_group = g_strdup(part->group_name->str);
+    job->to_group = g_strdup(group);
+    job->from_addr = g_strdup(from_addr);
+    job->to_addr = g_strdup(to_addr);
+    job->method = vdb->method;
+    job->key_type = vdb->key_type;
+    job->logic_shard_num = vdb->logic_shard_num;
+    job->hash_values = g_string_new(NULL);
+    if (vdb->method == SHARD_METHOD_HASH) {
+        for (i = 0; i < vdb->logic_shard_num; ++i) {
+            if (TestBit(part->hash_set, i)) {
+                g_string_append_printf(job->hash_values, "%s%d", job->hash_values->len ? "," : "", i);
+            }
+        }
+    } else if (vdb->key_type == SHARD_DATA_TYPE_STR) {
+        job->low_str = g_strdup(part->low_value);
+        job->high_str = g_strdup(part->value);
+    } else {
+        job->low = (int64_t) part->low_value;
+        job->high = (int64_t) part->value;
+    }
+    job->tables = tables;
+    job->batch_size = chas->reshard_batch_size;
+    job->state = MIGRATION_COPYING;
+
+    if (wake_fd == -1 && !migration_wake_init(chas)) {
+        migration_free(job);
+        g_string_assign(errmsg, "eventfd failed");
+        return FALSE;
+    }
+    if (current) {
+        migration_free(current);
+    }
+    current = job;
+    /* part is gone with the old configuration from here */
+    shard_conf_update_partition(vdb_id, index, NULL, group);
+    job->dual_write = TRUE;
+
+    g_message("%s: move partition %d of vdb %d from group %s to %s, %d tables", G_STRLOC,
+              index, vdb_id, job->from_group, group, tables->len);
+    g_atomic_pointer_set(&active, job);
+    return TRUE;
+}
+
+/* event loop thread */
+static void
+migration_stop(shard_migration_t *job, int state)
+{
+    if (job->dual_write) {
+        shard_conf_update_partition(job->vdb_id, job->index, NULL, NULL);
+        job->dual_write = FALSE;
+    }
+    g_atomic_int_set(&job->state, state);
+}
+
+gboolean
+shard_migration_cancel(GString *errmsg)
+{
+    if (!current || migration_is_over(g_atomic_int_get(&current->state))) {
+        g_string_assign(errmsg, "no partition is being moved");
+        return FALSE;
+    }
+    migration_stop(current, MIGRATION_CANCELLED);
+    g_message("%s: move of partition %d of vdb %d cancelled", G_STRLOC, current->index, current->vdb_id);
+    return TRUE;
+}
+
+void
+shard_migration_conf_reloaded(void)
+{
+    if (current && !migration_is_over(g_atomic_int_get(&current->state))) {
+        current->dual_write = FALSE;    /* the new configuration has no migrate_to */
+        migration_stop(current, MIGRATION_FAILED);
+        g_warning("%s: sharding config reloaded, move of partition %d of vdb %d failed",
+                  G_STRLOC, current->index, current->vdb_id);
+    }
+}
+
+void
+shard_migration_status(GString *out)
+{
+    if (!current) {
+        return;
+    }
+    int state = g_atomic_int_get(&current->state);
+    g_string_printf(out, "partition %d of vdb %d from %s to %s: %s, %d rows copied, %d rows deleted",
+                    current->index, current->vdb_id, current->from_group, current->to_group,
+                    migration_state_names[state], g_atomic_int_get(&current->rows_copied),
+                    g_atomic_int_get(&current->rows_deleted));
+}
+
+void
+shard_migration_destroy(void)
+{
+    /* the monitor thread has stopped, so are the connections */
+    if (current) {
+        migration_free(current);
+        current = NULL;
+    }
+    active = NULL;
+    if (wake_fd != -1) {
+        event_del(&wake_event);
+        close(wake_fd);
+        wake_fd = -1;
+    }
+    g_queue_clear(&gate_waiters);
+}
+
+gboolean
+shard_migration_is_dual_write(sharding_plan_t *plan)
+{
+    if (!current || !plan) {
+        return FALSE;
+    }
+    /* the groups of the plan point into the configuration it was made with */
+    sharding_partition_t *part = shard_conf_get_partition(plan->conf, current->vdb_id, current->index);
+    GString *to = part ? part->migrate_to : NULL;
+    int i;
+    for (i = 0; to && i < plan->groups->len; ++i) {
+        if (g_ptr_array_index(plan->groups, i) == to) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+gboolean
+shard_migration_write_enter(void)
+{
+    g_atomic_int_inc(&dual_writers);
+    if (g_atomic_int_get(&copy_gate)) {
+        g_atomic_int_add(&dual_writers, -1);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+void
+shard_migration_write_leave(void)
+{
+    g_atomic_int_add(&dual_writers, -1);
+}
+
+void
+shard_migration_wait_gate(network_mysqld_con *con)
+{
+    con->is_wait_write_gate = 1;
+    g_queue_push_tail(&gate_waiters, con);
+}
+
+void
+shard_migration_wait_cancel(network_mysqld_con *con)
+{
+    if (!con->is_wait_write_gate) {
+        return;
+    }
+    con->is_wait_write_gate = 0;
+    g_queue_remove(&gate_waiters, con);
+    if (gate_waking) {
+        g_queue_remove(gate_waking, con);
+    }
+}
+
+shard_migration_t *
+shard_migration_get_active(void)
+{
+    shard_migration_t *job = g_atomic_pointer_get(&active);
+    if (job && migration_is_over(g_atomic_int_get(&job->state))) {
+        migration_resume_writes(job);
+        g_atomic_pointer_set(&active, NULL);
+        return NULL;
+    }
+    return job;
+}
+
+const char *
+shard_migration_from_addr(shard_migration_t *job)
+{
+    return job->from_addr;
+}
+
+const char *
+shard_migration_to_addr(shard_migration_t *job)
+{
+    return job->to_addr;
+}
+
+static void
+append_quoted(GString *s, MYSQL *conn, const char *value, unsigned long len)
+{
+    gsize pos = s->len;
+    g_string_set_size(s, pos + 2 * len + 3);
+    s->str[pos] = '\'';
+    unsigned long n = mysql_real_escape_string(conn, s->str + pos + 1, value, len);
+    s->str[pos + 1 + n] = '\'';
+    g_string_truncate(s, pos + 2 + n);
+}
+
+static void
+append_bound(GString *s, int key_type, int64_t value)
+{
+    if (key_type == SHARD_DATA_TYPE_INT) {
+        g_string_append_printf(s, "%" G_GINT64_FORMAT, value);
+    } else {
+        g_string_append_printf(s, "FROM_UNIXTIME(%" G_GINT64_FORMAT ")", value);
+    }
+}
+
+/* the rows of the partition, same bounds as the sharding parser uses */
+static void
+migration_filter(shard_migration_t *job, struct migration_table_t *t, MYSQL *conn, GString *where)
+{
+    g_string_printf(where, "`%s` IS NOT NULL", t->key);
+    if (job->method == SHARD_METHOD_HASH) {
+        g_string_append_printf(where, " AND MOD(`%s`, %d) IN (%s)", t->key, job->logic_shard_num,
+                               job->hash_values->str);
+    } else if (job->key_type == SHARD_DATA_TYPE_STR) {
+        if (job->low_str) {
+            g_string_append_printf(where, " AND `%s` > ", t->key);
+            append_quoted(where, conn, L(job->low_str));
+        }
+        if (job->high_str) {
+            g_string_append_printf(where, " AND `%s` <= ", t->key);
+            append_quoted(where, conn, L(job->high_str));
+        }
+    } else {
+        if (job->low != INT_MIN) {
+            g_string_append_printf(where, " AND `%s` > ", t->key);
+            append_bound(where, job->key_type, job->low);
+        }
+        if (job->high != INT_MAX) {
+            g_string_append_printf(where, " AND `%s` <= ", t->key);
+            append_bound(where, job->key_type, job->high);
+        }
+    }
+}
+
+static gboolean
+migration_query(MYSQL *conn, const char *sql, unsigned long len)
+{
+    if (mysql_real_query(conn, sql, len) != 0) {
+        g_warning("%s: partition move query failed: %.128s, error: %d, %s",
+                  G_STRLOC, sql, mysql_errno(conn), mysql_error(conn));
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/**
+ * Copy the rows of the next batch of keys, in key order.
+ * Dual writes must be paused meanwhile: one waiting for a lock the copy holds
+ * on one group while holding one the copy wants on the other would deadlock,
+ * and one hitting no row on the new group before the copy would be lost.
+ * @return number of rows copied, -1 on error
+ */
+static int
+migration_copy_batch(shard_migration_t *job, struct migration_table_t *t, MYSQL *from, MYSQL *to)
+{
+    GString *where = g_string_new(NULL);
+    migration_filter(job, t, from, where);
+    if (t->cursor) {
+        g_string_append_printf(where, " AND `%s` > ", t->key);
+        append_quoted(where, from, S(t->cursor));
+    }
+    GString *sql = g_string_new(NULL);
+    g_string_printf(sql, "SELECT * FROM `%s`.`%s` WHERE %s AND `%s` <= (SELECT MAX(`%s`) FROM"
+                    " (SELECT `%s` FROM `%s`.`%s` WHERE %s ORDER BY `%s` LIMIT %d) AS batch) ORDER BY `%s`",
+                    t->db, t->name, where->str, t->key, t->key,
+                    t->key, t->db, t->name, where->str, t->key, job->batch_size, t->key);
+    g_string_free(where, TRUE);
+
+    int rows = -1;
+    GString *last_key = NULL;
+    MYSQL_RES *res = NULL;
+    if (!migration_query(from, S(sql)) || !(res = mysql_store_result(from))) {
+        goto out;
+    }
+
+    int nfields = mysql_num_fields(res);
+    MYSQL_FIELD *fields = mysql_fetch_fields(res);
+    int key_index = -1;
+    int i;
+    g_string_printf(sql, "REPLACE INTO `%s`.`%s` (", t->db, t->name);
+    for (i = 0; i < nfields; ++i) {
+        g_string_append_printf(sql, "%s`%s`", i ? "," : "", fields[i].name);
+        if (strcasecmp(fields[i].name, t->key) == 0) {
+            key_index = i;
+        }
+    }
+    if (key_index == -1) {
+        g_warning("%s: no column %s in %s.%s", G_STRLOC, t->key, t->db, t->name);
+        goto out;
+    }
+    g_string_append(sql, ") VALUES ");
+
+    int nrows = 0;
+    MYSQL_ROW row;
+    while ((row = mysql_fetch_row(res))) {
+        unsigned long *lengths = mysql_fetch_lengths(res);
+        g_string_append(sql, nrows ? ",(" : "(");
+        for (i = 0; i < nfields; ++i) {
+            if (i) {
+                g_string_append_c(sql, ',');
+            }
+            if (row[i]) {
+                append_quoted(sql, to, row[i], lengths[i]);
+            } else {
+                g_string_append(sql, "NULL");
+            }
+        }
+        g_string_append_c(sql, ')');
+        if (!last_key) {
+            last_key = g_string_new(NULL);
+        }
+        g_string_assign_len(last_key, row[key_index], lengths[key_index]);
+        nrows++;
+    }
+    if (nrows > 0 && !migration_query(to, S(sql))) {
+        goto out;
+    }
+    rows = nrows;
+    if (last_key) {
+        if (t->cursor) {
+            g_string_free(t->cursor, TRUE);
+        }
+        t->cursor = last_key;
+        last_key = NULL;
+    }
+    g_atomic_int_add(&job->rows_copied, rows);
+
+  out:
+    if (res) {
+        mysql_free_result(res);
+    }
+    if (last_key) {
+        g_string_free(last_key, TRUE);
+    }
+    g_string_free(sql, TRUE);
+    return rows;
+}
+
+/* @return number of rows deleted from the old group, -1 on error */
+static int
+migration_delete_batch(shard_migration_t *job, struct migration_table_t *t, MYSQL *from)
+{
+    GString *where = g_string_new(NULL);
+    migration_filter(job, t, from, where);
+    GString *sql = g_string_new(NULL);
+    g_string_printf(sql, "DELETE FROM `%s`.`%s` WHERE %s LIMIT %d", t->db, t->name, where->str, job->batch_size);
+    g_string_free(where, TRUE);
+
+    int rows = -1;
+    if (migration_query(from, S(sql))) {
+        rows = mysql_affected_rows(from);
+        g_atomic_int_add(&job->rows_deleted, rows);
+    }
+    g_string_free(sql, TRUE);
+    return rows;
+}
+
+int
+shard_migration_step(shard_migration_t *job, MYSQL *from, MYSQL *to)
+{
+    int state = g_atomic_int_get(&job->state);
+    if (state != MIGRATION_COPYING || !from || !to) {
+        migration_resume_writes(job);
+    }
+    if (state != MIGRATION_COPYING && state != MIGRATION_CLEANUP) {
+        return MIGRATION_IDLE_INTERVAL;
+    }
+
+    struct migration_table_t *t = g_ptr_array_index(job->tables, job->table_index);
+    int rows = -1;
+    if (from && to) {
+        if (state == MIGRATION_COPYING) {
+            /* the monitor thread keeps ticking while the writes in flight finish */
+            int wait = migration_pause_writes(job);
+            if (wait == MIGRATION_BUSY) {
+                g_message("%s: dual writes to %s.%s still in flight, copy later", G_STRLOC, t->db, t->name);
+                return MIGRATION_BATCH_INTERVAL;
+            }
+            if (wait > 0) {
+                return wait;
+            }
+            rows = migration_copy_batch(job, t, from, to);
+            migration_resume_writes(job);
+        } else {
+            rows = migration_delete_batch(job, t, from);
+        }
+    }
+    if (rows < 0) {
+        if (++job->errors < MIGRATION_MAX_ERRORS) {
+            return MIGRATION_RETRY_INTERVAL;
+        }
+        if (g_atomic_int_compare_and_exchange(&job->state, state, MIGRATION_FAILED)) {
+            g_critical("%s: move of partition %d of vdb %d failed while %s %s.%s",
+                       G_STRLOC, job->index, job->vdb_id, migration_state_names[state], t->db, t->name);
+            if (state == MIGRATION_COPYING) {
+                migration_wake();       /* stop the dual writes */
+            }
+        }
+        return MIGRATION_IDLE_INTERVAL;
+    }
+    job->errors = 0;
+    if (rows > 0 || ++job->table_index < job->tables->len) {
+        return MIGRATION_BATCH_INTERVAL;
+    }
+
+    job->table_index = 0;
+    if (state == MIGRATION_COPYING) {
+        if (g_atomic_int_compare_and_exchange(&job->state, state, MIGRATION_CUTOVER)) {
+            g_message("%s: partition %d of vdb %d copied, %d rows", G_STRLOC,
+                      job->index, job->vdb_id, g_atomic_int_get(&job->rows_copied));
+            migration_wake();
+        }
+    } else if (g_atomic_int_compare_and_exchange(&job->state, state, MIGRATION_DONE)) {
+        g_message("%s: partition %d of vdb %d moved to group %s, %d rows deleted from %s", G_STRLOC,
+                  job->index, job->vdb_id, job->to_group, g_atomic_int_get(&job->rows_deleted), job->from_group);
+    }
+    return MIGRATION_BATCH_INTERVAL;
+}
@@ -0,0 +1,91 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#ifndef _SHARDING_MIGRATION_H_
+#define _SHARDING_MIGRATION_H_
+
+#include <glib.h>
+#include <mysql.h>
+
+#include "chassis-mainloop.h"
+#include "network-mysqld.h"
+#include "sharding-query-plan.h"
+
+/**
+ * Online move of a sharding partition to another group.
+ *
+ * Once started, writes to the partition go to both groups while the monitor
+ * thread copies the existing rows over in batches. New dual writes wait at a
+ * gate while a batch is copied, and a batch waits for the transactions
+ * already writing to both groups, so the copy never races a write. When the
+ * copy is done the partition is routed to the new group on the event loop
+ * thread, then the rows left on the old group are deleted in batches.
+ *
+ * Routing changes swap in a new sharding configuration, queries planned
+ * before keep the one they were planned with.
+ *
+ * Only one move runs at a time.
+ */
+typedef struct shard_migration_t shard_migration_t;
+
+/* event loop thread */
+gboolean shard_migration_start(chassis *, int vdb_id, int partition, const char *group, GString *errmsg);
+
+gboolean shard_migration_cancel(GString *errmsg);
+
+/* the partitions are gone with the old configuration */
+void shard_migration_conf_reloaded(void);
+
+/* one line state of the last move, empty if none */
+void shard_migration_status(GString *out);
+
+void shard_migration_destroy(void);
+
+/* does the plan write to the partition being moved */
+gboolean shard_migration_is_dual_write(sharding_plan_t *);
+
+/**
+ * a connection starts writing to both groups, until its transaction is over
+ * @return FALSE while a batch is being copied, see shard_migration_wait_gate()
+ */
+gboolean shard_migration_write_enter(void);
+
+void shard_migration_write_leave(void);
+
+/* the connection is handled again once the gate opens */
+void shard_migration_wait_gate(network_mysqld_con *);
+
+/* the connection is closed while waiting */
+void shard_migration_wait_cancel(network_mysqld_con *);
+
+/* monitor thread */
+shard_migration_t *shard_migration_get_active(void);
+
+const char *shard_migration_from_addr(shard_migration_t *);
+
+const char *shard_migration_to_addr(shard_migration_t *);
+
+/**
+ * copy or delete one batch, the connections are NULL if not available
+ * @return milliseconds until the next step
+ */
+int shard_migration_step(shard_migration_t *, MYSQL *from, MYSQL *to);
+
+#endif /* _SHARDING_MIGRATION_H_ */
@@ -22,12 +22,15 @@
 
 #include <string.h>
 
+#include "sharding-config.h"
+
 sharding_plan_t *
 sharding_plan_new(const GString *orig_sql)
 {
     sharding_plan_t *plan = g_new0(sharding_plan_t, 1);
     plan->orig_sql = orig_sql;
     plan->groups = g_ptr_array_new();
+    plan->conf = shard_conf_acquire();
     return plan;
 }
 
@@ -45,6 +48,13 @@ sharding_plan_free(sharding_plan_t *plan)
         }
         g_list_free(plan->mapping);
     }
+    if (plan->join_sides) {
+        g_byte_array_free(plan->join_sides, TRUE);
+    }
+    if (plan->global_index_query) {
+        g_string_free(plan->global_index_query, TRUE);
+    }
+    shard_conf_release(plan->conf);
 
     g_free(plan);
 }
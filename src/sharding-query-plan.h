@@ -40,6 +40,8 @@ enum sharding_table_type_t {
 typedef struct sharding_plan_t {
     GPtrArray *groups;          /* GPtrArray<GString *> */
 
+    struct sharding_conf_t *conf;   /* the configuration the group names belong to */
+
     GList *sql_list;            /* GList<GString *> */
 
     GList *mapping;             /* GList<struct _group_sql_pair *> */
@@ -48,6 +50,16 @@ typedef struct sharding_plan_t {
     const GString *orig_sql;
     const GString *modified_sql;
     enum sharding_table_type_t table_type;
+
+    /* two tables joined by the proxy, every group returns both tagged sides */
+    GByteArray *join_sides;     /* table (0 or 1) each output column comes from */
+    gboolean join_keep_left;    /* LEFT JOIN, unmatched rows of table 0 are kept */
+    gsize join_read[2];         /* bytes of the rows of each table read so far */
+
+    /* global index pairs are hints, see sharding-global-index.h */
+    gboolean global_index_stale;    /* a hint found no row, route without hints */
+    gboolean global_index_hint;     /* routed by a hint */
+    GString *global_index_query;    /* the client packet, to be routed again if the hint finds no row */
 } sharding_plan_t;
 
 sharding_plan_t *sharding_plan_new(const GString *orig_sql);
@@ -0,0 +1,149 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#include <string.h>
+#include <glib.h>
+
+#include "chassis-mainloop.h"
+#include "network-backend.h"
+
+static network_backend_t *
+breaker_backend_new(chassis *chas)
+{
+    memset(chas, 0, sizeof(*chas));
+    chas->circuit_breaker = 1;
+    chas->circuit_breaker_latency = 1000;
+    chas->circuit_breaker_error_rate = 50;
+
+    network_backend_t *b = network_backend_new();
+    b->pool->srv = chas;
+    return b;
+}
+
+static void
+breaker_trip(network_backend_t *b)
+{
+    int i;
+    for (i = 0; i < 20; i++) {
+        network_backend_breaker_record(b, b->breaker_epoch, 0, TRUE);
+    }
+    g_assert_cmpint(b->breaker_state, ==, BREAKER_OPEN);
+}
+
+static void
+test_opens_on_errors(void)
+{
+    chassis chas;
+    network_backend_t *b = breaker_backend_new(&chas);
+
+    g_assert(network_backend_breaker_check(b));
+    breaker_trip(b);
+    g_assert(!network_backend_breaker_check(b));
+
+    network_backend_free(b);
+}
+
+/* checking is free of side effects, only claiming lets a probe through */
+static void
+test_check_and_claim(void)
+{
+    chassis chas;
+    network_backend_t *b = breaker_backend_new(&chas);
+
+    breaker_trip(b);
+    b->breaker_since_us -= 10 * G_USEC_PER_SEC;
+    guint32 epoch = b->breaker_epoch;
+    g_assert(network_backend_breaker_check(b));
+    g_assert(network_backend_breaker_check(b));
+    g_assert_cmpint(b->breaker_state, ==, BREAKER_OPEN);
+    g_assert_cmpuint(b->breaker_epoch, ==, epoch);
+
+    network_backend_breaker_claim(b);
+    g_assert_cmpint(b->breaker_state, ==, BREAKER_HALF_OPEN);
+    g_assert_cmpuint(b->breaker_epoch, !=, epoch);
+    g_assert(!network_backend_breaker_check(b));    /* one probe at a time */
+
+    network_backend_free(b);
+}
+
+/* answers to queries sent before the breaker opened are not probes */
+static void
+test_late_answer_ignored(void)
+{
+    chassis chas;
+    network_backend_t *b = breaker_backend_new(&chas);
+
+    guint32 before = b->breaker_epoch;
+    breaker_trip(b);
+    b->breaker_since_us -= 10 * G_USEC_PER_SEC;
+    network_backend_breaker_claim(b);
+
+    int i;
+    for (i = 0; i < 10; i++) {
+        network_backend_breaker_record(b, before, 0, FALSE);
+    }
+    g_assert_cmpint(b->breaker_state, ==, BREAKER_HALF_OPEN);
+    g_assert_cmpint(b->breaker_probes_ok, ==, 0);
+
+    for (i = 0; i < 5; i++) {
+        b->breaker_probe_us -= G_USEC_PER_SEC;
+        g_assert(network_backend_breaker_check(b));
+        network_backend_breaker_claim(b);
+        network_backend_breaker_record(b, b->breaker_epoch, 0, FALSE);
+    }
+    g_assert_cmpint(b->breaker_state, ==, BREAKER_CLOSED);
+    g_assert(network_backend_breaker_check(b));
+
+    network_backend_free(b);
+}
+
+static void
+test_failed_probe_reopens(void)
+{
+    chassis chas;
+    network_backend_t *b = breaker_backend_new(&chas);
+
+    breaker_trip(b);
+    b->breaker_since_us -= 10 * G_USEC_PER_SEC;
+    network_backend_breaker_claim(b);
+    guint32 probe = b->breaker_epoch;
+    network_backend_breaker_record(b, probe, 2000 * 1000, FALSE);  /* over the latency limit */
+    g_assert_cmpint(b->breaker_state, ==, BREAKER_OPEN);
+
+    /* nor does a second answer from the failed round */
+    b->breaker_since_us -= 10 * G_USEC_PER_SEC;
+    network_backend_breaker_claim(b);
+    network_backend_breaker_record(b, probe, 0, FALSE);
+    g_assert_cmpint(b->breaker_probes_ok, ==, 0);
+
+    network_backend_free(b);
+}
+
+int
+main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    /* the breaker warns when it opens */
+    g_log_set_always_fatal(G_LOG_FATAL_MASK | G_LOG_LEVEL_CRITICAL);
+    g_test_add_func("/breaker/opens_on_errors", test_opens_on_errors);
+    g_test_add_func("/breaker/check_and_claim", test_check_and_claim);
+    g_test_add_func("/breaker/late_answer_ignored", test_late_answer_ignored);
+    g_test_add_func("/breaker/failed_probe_reopens", test_failed_probe_reopens);
+    return g_test_run();
+}
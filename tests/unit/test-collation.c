@@ -0,0 +1,103 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+
+#include <string.h>
+#include <glib.h>
+
+#include "character-set.h"
+
+#define UTF8MB4_RESULTS 45      /* character_set_results utf8mb4 */
+#define LATIN1_RESULTS 8
+
+/* TRUE if a and b give the same key under the collation */
+static gboolean
+same_key(const char *collation, int result_charsetnr, const char *a, const char *b)
+{
+    GString *ka = g_string_new(NULL);
+    GString *kb = g_string_new(NULL);
+    collation_fold(collation, result_charsetnr, a, strlen(a), ka);
+    collation_fold(collation, result_charsetnr, b, strlen(b), kb);
+    gboolean same = g_string_equal(ka, kb);
+    g_string_free(ka, TRUE);
+    g_string_free(kb, TRUE);
+    return same;
+}
+
+static void
+test_case_insensitive(void)
+{
+    g_assert(same_key("utf8mb4_general_ci", UTF8MB4_RESULTS, "abc", "ABC"));
+    g_assert(!same_key("utf8_general_ci", UTF8MB4_RESULTS, "Straße", "STRASSE"));
+    g_assert(same_key("ascii_general_ci", UTF8MB4_RESULTS, "Key", "kEY"));
+    g_assert(!same_key("utf8mb4_bin", UTF8MB4_RESULTS, "abc", "ABC"));
+    g_assert(!same_key("binary", UTF8MB4_RESULTS, "abc", "ABC"));
+}
+
+static void
+test_accent_insensitive(void)
+{
+    g_assert(same_key("utf8mb4_general_ci", UTF8MB4_RESULTS, "é", "E"));
+    g_assert(same_key("utf8mb4_general_ci", UTF8MB4_RESULTS, "Ångström", "angstrom"));
+    g_assert(same_key("utf8mb4_general_ci", UTF8MB4_RESULTS, "ß", "s"));
+    g_assert(!same_key("utf8mb4_general_ci", UTF8MB4_RESULTS, "æ", "ae"));
+    g_assert(!same_key("utf8mb4_bin", UTF8MB4_RESULTS, "é", "e"));
+}
+
+static void
+test_pad_space(void)
+{
+    g_assert(same_key("utf8mb4_general_ci", UTF8MB4_RESULTS, "a  ", "A"));
+    g_assert(same_key("utf8mb4_bin", UTF8MB4_RESULTS, "a  ", "a"));
+    g_assert(!same_key("binary", UTF8MB4_RESULTS, "a  ", "a"));
+    g_assert(!same_key("utf8mb4_0900_bin", UTF8MB4_RESULTS, "a  ", "a"));
+}
+
+/* other collations and characters keep the value as it is */
+static void
+test_binary_fallback(void)
+{
+    GString *key = g_string_new(NULL);
+    g_assert(!collation_fold("utf8mb4_0900_ai_ci", UTF8MB4_RESULTS, "Abc", 3, key));
+    g_assert_cmpstr(key->str, ==, "Abc");
+
+    g_string_truncate(key, 0);
+    g_assert(!collation_fold("utf8mb4_general_ci", UTF8MB4_RESULTS, "Ā", strlen("Ā"), key));
+    g_assert_cmpstr(key->str, ==, "Ā");
+
+    g_string_truncate(key, 0);     /* not sent as UTF-8 */
+    g_assert(!collation_fold("latin1_swedish_ci", LATIN1_RESULTS, "\xe9", 1, key));
+    g_assert(!collation_fold("utf8mb4_general_ci", LATIN1_RESULTS, "\xc3\xa9", 2, key));
+    g_string_free(key, TRUE);
+
+    g_assert(!same_key(NULL, UTF8MB4_RESULTS, "a", "A"));
+    g_assert(same_key("utf8mb4_general_ci", UTF8MB4_RESULTS, "\xf0\x9f\x98\x80", "\xf0\x9f\x98\x81"));
+}
+
+int
+main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/collation/case_insensitive", test_case_insensitive);
+    g_test_add_func("/collation/accent_insensitive", test_accent_insensitive);
+    g_test_add_func("/collation/pad_space", test_pad_space);
+    g_test_add_func("/collation/binary_fallback", test_binary_fallback);
+    return g_test_run();
+}
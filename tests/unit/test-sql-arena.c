@@ -0,0 +1,107 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+
+#include <string.h>
+#include <glib.h>
+
+#include "sql-arena.h"
+#include "sql-context.h"
+#include "sql-expression.h"
+
+#define PARSES_PER_THREAD 2000
+
+static void
+test_node_owner(void)
+{
+    sql_arena_t *arena = sql_arena_new();
+    sql_arena_t *prev = sql_arena_activate(arena);
+    char *in_arena = sql_node_alloc0(16);
+    sql_arena_activate(prev);
+    char *on_heap = sql_node_alloc0(16);
+
+    g_assert(sql_node_in_arena(in_arena));
+    g_assert(!sql_node_in_arena(on_heap));
+    sql_node_free(in_arena);    /* no-op, even with no arena active */
+    sql_node_free(on_heap);
+    sql_arena_free(arena);
+}
+
+/* a tree of the arena freed after the arena is deactivated isn't walked nor freed */
+static void
+test_tree_free(void)
+{
+    sql_arena_t *arena = sql_arena_new();
+    sql_arena_t *prev = sql_arena_activate(arena);
+    sql_token_t name = { "a", 1 };
+    sql_select_t *select = sql_select_new();
+    int i;
+    for (i = 0; i < 1000; i++) {
+        select->columns = sql_expr_list_append(select->columns, sql_expr_new(TK_ID, &name));
+    }
+    sql_arena_activate(prev);
+
+    g_assert(sql_node_in_arena(select));
+    sql_select_free(select);
+    sql_arena_reset(arena);
+    sql_arena_free(arena);
+}
+
+static gpointer
+parse_loop(gpointer data)
+{
+    const char *sql = data;
+    sql_context_t context;
+    sql_context_init(&context);
+    int i;
+    for (i = 0; i < PARSES_PER_THREAD; i++) {
+        GString *s = g_string_new(sql);
+        g_string_append_c(s, '\0');     /* 2 more NULL for lexer EOB */
+        g_string_append_c(s, '\0');
+        sql_context_parse_len(&context, s);
+        g_string_free(s, TRUE);
+        if (context.rc != PARSE_OK || context.stmt_type != STMT_SELECT) {
+            sql_context_destroy(&context);
+            return GINT_TO_POINTER(FALSE);
+        }
+    }
+    sql_context_destroy(&context);
+    return GINT_TO_POINTER(TRUE);
+}
+
+/* each thread builds into the arena of its own context */
+static void
+test_parse_in_threads(void)
+{
+    GThread *t1 = g_thread_new("parse1", parse_loop, "SELECT a, b FROM t1 WHERE id IN (1, 2, 3)");
+    GThread *t2 = g_thread_new("parse2", parse_loop, "SELECT x, COUNT(*) FROM t2 GROUP BY x ORDER BY x LIMIT 10");
+    g_assert(GPOINTER_TO_INT(g_thread_join(t1)));
+    g_assert(GPOINTER_TO_INT(g_thread_join(t2)));
+}
+
+int
+main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/sql-arena/node_owner", test_node_owner);
+    g_test_add_func("/sql-arena/tree_free", test_tree_free);
+    g_test_add_func("/sql-arena/parse_in_threads", test_parse_in_threads);
+    return g_test_run();
+}
@@ -0,0 +1,94 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+
+#include <string.h>
+#include <glib.h>
+
+#include "sql-context.h"
+#include "sql-classify.h"
+
+/* as the proxy does: the fast path first, the parser when it is not sure */
+static gboolean
+classify_or_parse(sql_context_t *context, const char *sql)
+{
+    GString *s = g_string_new(sql);
+    g_string_append_c(s, '\0');     /* 2 more NULL for lexer EOB */
+    g_string_append_c(s, '\0');
+    gboolean fast = sql_context_classify_len(context, s);
+    if (!fast) {
+        sql_context_parse_len(context, s);
+    }
+    g_string_free(s, TRUE);
+    return fast;
+}
+
+static void
+test_plain_select(void)
+{
+    sql_context_t context;
+    sql_context_init(&context);
+    g_assert(classify_or_parse(&context, "SELECT a FROM t WHERE b = 'for update'"));
+    g_assert_cmpint(context.stmt_type, ==, STMT_SELECT);
+    g_assert(context.rw_flag & CF_READ);
+    g_assert(!(context.rw_flag & CF_WRITE));
+    sql_context_destroy(&context);
+}
+
+static void
+test_locking_select(void)
+{
+    static const char *sqls[] = {
+        "SELECT a FROM t WHERE id = 1 FOR UPDATE",
+        "select a from t where id = 1 lock in share mode;",
+    };
+    int i;
+    for (i = 0; i < G_N_ELEMENTS(sqls); i++) {
+        sql_context_t context;
+        sql_context_init(&context);
+        g_assert(!classify_or_parse(&context, sqls[i]));
+        g_assert_cmpint(context.rc, ==, PARSE_OK);
+        g_assert(context.rw_flag & CF_WRITE);
+        sql_select_t *select = context.sql_statement;
+        g_assert(select != NULL);
+        g_assert(select->lock_read);
+        g_assert(!sql_context_is_cacheable(&context));
+        sql_context_destroy(&context);
+    }
+}
+
+static void
+test_select_into(void)
+{
+    sql_context_t context;
+    sql_context_init(&context);
+    g_assert(!classify_or_parse(&context, "SELECT a INTO @v FROM t"));
+    sql_context_destroy(&context);
+}
+
+int
+main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/sql-classify/plain_select", test_plain_select);
+    g_test_add_func("/sql-classify/locking_select", test_locking_select);
+    g_test_add_func("/sql-classify/select_into", test_select_into);
+    return g_test_run();
+}
@@ -0,0 +1,211 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <glib.h>
+#include <event.h>
+
+#include "chassis-event.h"
+
+typedef struct {
+    struct event_base *base;
+    short events;               /* of the last callback, 0 if none */
+} fired_t;
+
+static void
+on_event(int G_GNUC_UNUSED fd, short events, void *arg)
+{
+    fired_t *fired = arg;
+    fired->events = events;
+    event_base_loopbreak(fired->base);
+}
+
+static void
+on_guard(int G_GNUC_UNUSED fd, short G_GNUC_UNUSED events, void *arg)
+{
+    event_base_loopbreak(arg);
+}
+
+/* runs the loop until an event fired or sec passed */
+static void
+wait_fired(fired_t *fired, int sec)
+{
+    struct event guard;
+    struct timeval limit = { sec, 0 };
+
+    evtimer_set(&guard, on_guard, fired->base);
+    event_base_set(fired->base, &guard);
+    event_add(&guard, &limit);
+    event_base_dispatch(fired->base);
+    event_del(&guard);
+}
+
+/* event_base_dispatch() returns 1 once nothing, not even the tick, is pending */
+static gboolean
+loop_is_idle(struct event_base *base)
+{
+    return event_base_dispatch(base) == 1;
+}
+
+static void
+test_timeout_fires(void)
+{
+    int fds[2];
+    struct event ev;
+    chassis_timer_t timer;
+    chassis chas;
+    struct timeval tv = { 1, 0 };
+
+    g_assert_cmpint(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), ==, 0);
+    memset(&chas, 0, sizeof(chas));
+    memset(&timer, 0, sizeof(timer));
+    chas.event_base = chassis_event_loop_new();
+    fired_t fired = { chas.event_base, 0 };
+
+    event_set(&ev, fds[0], EV_READ, on_event, &fired);
+    chassis_event_add_with_timer(&chas, &ev, &timer, &tv);
+    g_assert(timer.wheel != NULL);
+    g_assert(!event_pending(&ev, EV_TIMEOUT, NULL));  /* libevent only watches the fd */
+
+    gint64 start = g_get_monotonic_time();
+    wait_fired(&fired, 3);
+    g_assert_cmpint(fired.events, ==, EV_TIMEOUT);
+    g_assert_cmpint(g_get_monotonic_time() - start, >=, 900000);
+    g_assert(timer.wheel == NULL);
+    g_assert(loop_is_idle(chas.event_base));
+
+    chassis_event_loop_free(chas.event_base);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+static void
+test_del_disarms(void)
+{
+    int fds[2];
+    struct event ev;
+    chassis_timer_t timer;
+    chassis chas;
+    struct timeval tv = { 5, 0 };
+
+    g_assert_cmpint(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), ==, 0);
+    memset(&chas, 0, sizeof(chas));
+    memset(&timer, 0, sizeof(timer));
+    chas.event_base = chassis_event_loop_new();
+    fired_t fired = { chas.event_base, 0 };
+
+    event_set(&ev, fds[0], EV_READ, on_event, &fired);
+    chassis_event_add_with_timer(&chas, &ev, &timer, &tv);
+    g_assert(timer.wheel != NULL);
+    chassis_event_del(&ev, &timer);
+    g_assert(timer.wheel == NULL);
+    g_assert(loop_is_idle(chas.event_base));
+    g_assert_cmpint(fired.events, ==, 0);
+
+    chassis_event_loop_free(chas.event_base);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+/* re-arming moves the entry, a short timeout takes it back to libevent */
+static void
+test_rearm(void)
+{
+    int fds[2];
+    struct event ev;
+    chassis_timer_t timer;
+    chassis chas;
+    struct timeval longer = { 60, 0 };
+    struct timeval shorter = { 0, 200000 };
+
+    g_assert_cmpint(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), ==, 0);
+    memset(&chas, 0, sizeof(chas));
+    memset(&timer, 0, sizeof(timer));
+    chas.event_base = chassis_event_loop_new();
+    fired_t fired = { chas.event_base, 0 };
+
+    event_set(&ev, fds[0], EV_READ, on_event, &fired);
+    chassis_event_add_with_timer(&chas, &ev, &timer, &longer);
+    guint64 expires = timer.expires;
+    event_del(&ev);
+    event_set(&ev, fds[0], EV_READ, on_event, &fired);
+    chassis_event_add_with_timer(&chas, &ev, &timer, &longer);
+    g_assert(timer.wheel != NULL);
+    g_assert(timer.expires >= expires);
+
+    event_del(&ev);
+    event_set(&ev, fds[0], EV_READ, on_event, &fired);
+    chassis_event_add_with_timer(&chas, &ev, &timer, &shorter);
+    g_assert(timer.wheel == NULL);
+    g_assert(event_pending(&ev, EV_TIMEOUT, NULL));
+
+    wait_fired(&fired, 3);
+    g_assert_cmpint(fired.events, ==, EV_TIMEOUT);
+    g_assert(loop_is_idle(chas.event_base));
+
+    chassis_event_loop_free(chas.event_base);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+/* an event that fired on its fd leaves an entry behind, its expiry does nothing */
+static void
+test_fired_before_timeout(void)
+{
+    int fds[2];
+    struct event ev;
+    chassis_timer_t timer;
+    chassis chas;
+    struct timeval tv = { 1, 0 };
+
+    g_assert_cmpint(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), ==, 0);
+    memset(&chas, 0, sizeof(chas));
+    memset(&timer, 0, sizeof(timer));
+    chas.event_base = chassis_event_loop_new();
+    fired_t fired = { chas.event_base, 0 };
+
+    event_set(&ev, fds[0], EV_READ, on_event, &fired);
+    chassis_event_add_with_timer(&chas, &ev, &timer, &tv);
+    g_assert_cmpint(write(fds[1], "x", 1), ==, 1);
+    wait_fired(&fired, 3);
+    g_assert_cmpint(fired.events, ==, EV_READ);
+
+    fired.events = 0;
+    g_assert(timer.wheel != NULL);
+    g_assert(loop_is_idle(chas.event_base));
+    g_assert(timer.wheel == NULL);
+    g_assert_cmpint(fired.events, ==, 0);
+
+    chassis_event_loop_free(chas.event_base);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+int
+main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/timer-wheel/timeout_fires", test_timeout_fires);
+    g_test_add_func("/timer-wheel/del_disarms", test_del_disarms);
+    g_test_add_func("/timer-wheel/rearm", test_rearm);
+    g_test_add_func("/timer-wheel/fired_before_timeout", test_fired_before_timeout);
+    return g_test_run();
+}